@@ -88,8 +88,21 @@
 
 #include "curses/chstr.c"
 #include "curses/window.c"
+#include "curses/vterm.c"
+#include "curses/screen.c"
+#include "curses/server.c"
+#include "curses/workers.c"
+#include "curses/queue.c"
+#include "curses/vpad.c"
+#include "curses/fileview.c"
+#include "curses/logview.c"
+#include "curses/listview.c"
+#include "curses/layout.c"
+#include "curses/panel.c"
+#include "curses/compositor.c"
+#include "curses/mirror.c"
+#include "curses/record.c"
 
-static const char *STDSCR_REGISTRY	= "curses:stdscr";
 static const char *RIPOFF_TABLE		= "curses:ripoffline";
 
 
@@ -107,23 +120,50 @@ Pnew_chstr(lua_State *L) {
 }
 
 #define CCR(n, v)				\
-	lua_pushstring(L, n);			\
 	lua_pushinteger(L, v);			\
-	lua_settable(L, lua_upvalueindex(1))
+	lua_setfield(L, -2, n)
 
 #define CC(s)	   CCR(#s, s)
 #define CF(i)	   CCR(LCURSES_STR(LCURSES_SPLICE(KEY_F, i)), KEY_F(i))
 
 /*
-** these values may be fixed only after initialization, so this is
-** called from Pinitscr, after the curses driver is initialized
-**
-** curses table is kept at upvalue position 1, in case the global
-** name is changed by the user or even in the registration phase by
-** the developer
-**
-** some of these values are not constant so need to register
-** them directly instead of using a table
+** the alternate character set depends on the terminal of the current
+** screen, so ACS_ values are looked up by the __index metamethod of the
+** curses table each time they are used; see acs_index
+*/
+#define ACS_NAMES(X)						\
+	X(BLOCK)	X(BOARD)	X(BTEE)		X(TTEE)		\
+	X(LTEE)		X(RTEE)		X(LLCORNER)	X(LRCORNER)	\
+	X(URCORNER)	X(ULCORNER)	X(LARROW)	X(RARROW)	\
+	X(UARROW)	X(DARROW)	X(HLINE)	X(VLINE)	\
+	X(BULLET)	X(CKBOARD)	X(LANTERN)	X(DEGREE)	\
+	X(DIAMOND)	X(PLMINUS)	X(PLUS)		X(S1)		\
+	X(S9)
+
+static int
+acs_index(lua_State *L)
+{
+	const char *k = lua_tostring(L, 2);
+
+	/* nothing to map before a terminal is set up */
+	if (k == NULL || strncmp(k, "ACS_", 4) != 0 || stdscr == NULL)
+		return 0;
+	k += 4;
+#define ACS_CASE(n)				\
+	if (strcmp(k, #n) == 0)			\
+	{					\
+		lua_pushinteger(L, ACS_##n);	\
+		return 1;			\
+	}
+	ACS_NAMES(ACS_CASE)
+#undef ACS_CASE
+	return 0;
+}
+
+/*
+** all the other values are fixed when lcurses is compiled, so they are
+** set once, from luaopen_curses_c, in the curses table on top; screens
+** created and ended later cost nothing here
 */
 
 static void
@@ -134,25 +174,6 @@ register_curses_constants(lua_State *L)
 	CC(COLOR_YELLOW);	CC(COLOR_BLUE);		CC(COLOR_MAGENTA);
 	CC(COLOR_CYAN);		CC(COLOR_WHITE);
 
-	/* alternate character set */
-	CC(ACS_BLOCK);		CC(ACS_BOARD);
-
-	CC(ACS_BTEE);		CC(ACS_TTEE);
-	CC(ACS_LTEE);		CC(ACS_RTEE);
-	CC(ACS_LLCORNER);	CC(ACS_LRCORNER);
-	CC(ACS_URCORNER);	CC(ACS_ULCORNER);
-
-	CC(ACS_LARROW);		CC(ACS_RARROW);
-	CC(ACS_UARROW);		CC(ACS_DARROW);
-
-	CC(ACS_HLINE);		CC(ACS_VLINE);
-
-	CC(ACS_BULLET);		CC(ACS_CKBOARD);	CC(ACS_LANTERN);
-	CC(ACS_DEGREE);		CC(ACS_DIAMOND);
-
-	CC(ACS_PLMINUS);	CC(ACS_PLUS);
-	CC(ACS_S1);		CC(ACS_S9);
-
 	/* attributes */
 	CC(A_NORMAL);		CC(A_STANDOUT);		CC(A_UNDERLINE);
 	CC(A_REVERSE);		CC(A_BLINK);		CC(A_DIM);
@@ -249,6 +270,7 @@ Pinitscr(lua_State *L)
 	/* failed to initialize */
 	if (w == NULL)
 		return 0;
+	initscr_std = w;
 
 	/* return stdscr - main window */
 	lc_newwin(L, w);
@@ -258,9 +280,6 @@ Pinitscr(lua_State *L)
 	lua_pushvalue(L, -2);
 	lua_rawset(L, LUA_REGISTRYINDEX);
 
-	/* setup curses constants - curses.xxx numbers */
-	register_curses_constants(L);
-
 	/* install cleanup handler to help in debugging and screen trashing */
 	atexit(cleanup);
 
@@ -268,6 +287,76 @@ Pinitscr(lua_State *L)
 }
 
 
+/***
+Initialise a new terminal, besides or instead of @{initscr}.
+The new screen becomes the current screen, as with
+@{curses.screen:set_term}.  The descriptors are duplicated, so the
+caller remains responsible for closing *outfd* and *infd*.
+@function newterm
+@string[opt] termtype terminal type, `$TERM` if `nil`
+@int outfd file descriptor to write to
+@int[opt=outfd] infd file descriptor to read from
+@bool[opt=false] threaded write the output of the screen from a
+  separate thread; see @{curses.screen:present}.  The terminal stays in
+  raw mode until the screen is closed
+@treturn screen a new screen, or `nil` plus an error message
+@see newterm(3x)
+@see curses.screen
+@usage
+  local fd = posix.open ("/dev/pts/3", posix.O_RDWR)
+  local screen = curses.newterm ("xterm-256color", fd)
+*/
+static int
+Pnewterm(lua_State *L)
+{
+	const char *termtype = optstring(L, 1, NULL);
+	int outfd = checkint(L, 2);
+	int infd = optint(L, 3, outfd);
+	lc_flusher *flush = NULL;
+	FILE *ofp = NULL, *ifp = NULL;
+	SCREEN *sp;
+	int fd;
+
+	if (lua_toboolean(L, 4))
+	{
+		if (!(flush = flusher_open(outfd, infd)))
+			return pusherror(L, "threaded screen");
+		outfd = infd = flush->slave;
+	}
+
+	if ((fd = dup(outfd)) >= 0 && !(ofp = fdopen(fd, "w")))
+		close(fd);
+	if (ofp && (fd = dup(infd)) >= 0 && !(ifp = fdopen(fd, "r")))
+		close(fd);
+	if (!ifp)
+	{
+		int e = errno;
+		if (ofp)
+			fclose(ofp);
+		if (flush)
+			flusher_close(flush);
+		errno = e;
+		return pusherror(L, "newterm");
+	}
+
+	sp = newterm(termtype, ofp, ifp);
+	if (sp == NULL)
+	{
+		fclose(ofp);
+		fclose(ifp);
+		if (flush)
+			flusher_close(flush);
+		lua_pushnil(L);
+		lua_pushfstring(L, "cannot initialize terminal type '%s'",
+			termtype ? termtype : getenv("TERM"));
+		return 2;
+	}
+	lc_newscreen(L, sp, ofp, ifp, flush);
+	setscreen(L, lua_gettop(L));
+	return 1;
+}
+
+
 /***
 Clean up terminal prior to exiting or escaping curses.
 @function endwin
@@ -792,7 +881,152 @@ Refresh the visible terminal screen.
 static int
 Pdoupdate(lua_State *L)
 {
-	return pushokresult(doupdate());
+	int r = doupdate();
+	mr_sync_all();
+	return pushokresult(r);
+}
+
+
+#define FRAME_MAGIC	"LCF1"
+#define FRAME_VERSION	1
+
+/***
+Save the contents of @{stdscr}, to show them again at the next start.
+The cells of stdscr are dumped as they are, after a header with a
+format version, the size of a cell, the size of stdscr and the
+terminal type, which @{restore_frame} checks; the file is replaced
+only once it was written completely.  Windows drawn over stdscr, such
+as panels, are not included.
+@function persist_frame
+@string path file to write
+@treturn[1] bool `true`, if successful
+@return[2] nil
+@treturn[2] string error message
+@see restore_frame
+@usage
+  curses.persist_frame (os.getenv "HOME" .. "/.cache/app.frame")
+  curses.endwin ()
+*/
+static int
+Ppersist_frame(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	WINDOW *w = stdscr;
+	const char *term;
+	uint32_t h[7];
+	FILE *fp;
+	int y, e;
+
+	/* the same window as restore_frame writes to and checks against */
+	luaL_argcheck(L, w != NULL, 1, "curses is not initialised");
+	term = termname();
+	h[0] = FRAME_VERSION;
+	h[1] = sizeof(cchar_t);
+	h[2] = getmaxy(w);
+	h[3] = getmaxx(w);
+	h[4] = getcury(w);
+	h[5] = getcurx(w);
+	h[6] = strlen(term);
+
+	lua_pushfstring(L, "%s.tmp", path);
+	if (!(fp = fopen(lua_tostring(L, -1), "wb")))
+		return pusherror(L, lua_tostring(L, -1));
+	fwrite(FRAME_MAGIC, 1, 4, fp);
+	fwrite(h, sizeof h, 1, fp);
+	fwrite(term, 1, h[6], fp);
+	for (y = 0; y < (int) h[2]; y++)
+		fwrite(w->_line[y].text, sizeof(cchar_t), h[3], fp);
+	e = ferror(fp);
+	if (fclose(fp) != 0 || e || rename(lua_tostring(L, -1), path) != 0)
+	{
+		e = errno;
+		remove(lua_tostring(L, -1));
+		errno = e;
+		return pusherror(L, path);
+	}
+	return pushboolresult(1);
+}
+
+
+/***
+Put the cells saved by @{persist_frame} in @{stdscr}.
+Right after @{initscr}, this shows the last frame of the previous run
+with the next refresh, while the real contents are being prepared.
+Nothing is changed if the file was written by another version, for
+another terminal type, or for a stdscr of another size.  Color pairs
+are saved by number, so they should be initialised first.
+@function restore_frame
+@string path file written by @{persist_frame}
+@treturn[1] bool `true`, if successful
+@return[2] nil
+@treturn[2] string why the frame was not restored
+@see persist_frame
+@usage
+  local stdscr = curses.initscr ()
+  if curses.restore_frame (cache) then stdscr:refresh () end
+*/
+static int
+Prestore_frame(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	WINDOW *w = stdscr;
+	const char *term;
+	char magic[4], name[256];
+	uint32_t h[7];
+	cchar_t *cells;
+	size_t n;
+	FILE *fp;
+	int y, ok;
+
+	luaL_argcheck(L, w != NULL, 1, "curses is not initialised");
+	term = termname();
+	if (!(fp = fopen(path, "rb")))
+		return pusherror(L, path);
+	if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, FRAME_MAGIC, 4) != 0
+		|| fread(h, sizeof h, 1, fp) != 1
+		|| h[0] != FRAME_VERSION || h[1] != sizeof(cchar_t)
+		|| h[6] >= sizeof name || fread(name, 1, h[6], fp) != h[6])
+	{
+		fclose(fp);
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: not a frame of this version", path);
+		return 2;
+	}
+	name[h[6]] = '\0';
+	if (strcmp(name, term) != 0
+		|| (int) h[2] != getmaxy(w) || (int) h[3] != getmaxx(w))
+	{
+		fclose(fp);
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: saved for a %dx%d %s screen", path,
+			(int) h[2], (int) h[3], name);
+		return 2;
+	}
+
+	n = (size_t) h[2] * h[3];
+	if (!(cells = malloc(n * sizeof *cells)))
+	{
+		fclose(fp);
+		return luaL_error(L, "malloc failed");
+	}
+	ok = fread(cells, sizeof *cells, n, fp) == n;
+	fclose(fp);
+	if (ok)
+	{
+		for (y = 0; y < (int) h[2]; y++)
+			memcpy(w->_line[y].text, cells + (size_t) y * h[3],
+				h[3] * sizeof *cells);
+		touchwin(w);
+		wmove(w, h[4] < h[2] ? h[4] : 0, h[5] < h[3] ? h[5] : 0);
+	}
+	free(cells);
+	if (!ok)
+	{
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: truncated frame", path);
+		return 2;
+	}
+	return pushboolresult(1);
 }
 
 
@@ -1119,6 +1353,67 @@ Pkeyname(lua_State *L)
 }
 
 
+/***
+Number of terminal columns a string takes.
+Wide and fullwidth characters count as two columns, combining marks as
+none, and so do control characters and bytes which are not UTF-8.
+@function width
+@string str utf8 string
+@treturn int display width of *str*
+@usage
+  print (curses.width ("this is a test, 中文.")) --> 21
+*/
+static int
+Pwidth(lua_State *L)
+{
+	size_t len;
+	const char *s = luaL_checklstring(L, 1, &len);
+	return pushintresult(width_utf8(s, s + len, -1, NULL));
+}
+
+
+/***
+Cut a string to a number of terminal columns.
+A wide character which does not fit is left out whole.  If the string
+is cut, *ellipsis* is appended, within *ncols* too.
+@function truncate
+@string str utf8 string
+@int ncols number of columns available
+@string[opt=""] ellipsis appended to a cut string
+@treturn string *str*, or the part of it that fits
+@treturn int display width of the result
+@usage
+  label = curses.truncate (name, 20, "…")
+*/
+static int
+Ptruncate(lua_State *L)
+{
+	size_t len, elen;
+	const char *s = luaL_checklstring(L, 1, &len);
+	int ncols = checkint(L, 2);
+	const char *ellipsis = luaL_optlstring(L, 3, "", &elen);
+	const char *stop, *estop;
+	size_t w, ew;
+
+	luaL_argcheck(L, ncols >= 0, 2, "ncols should >= 0");
+	w = width_utf8(s, s + len, ncols, &stop);
+	if (stop == s + len)
+	{
+		lua_pushvalue(L, 1);
+		lua_pushinteger(L, w);
+		return 2;
+	}
+	/* make room for the ellipsis */
+	ew = width_utf8(ellipsis, ellipsis + elen, ncols, &estop);
+	w = width_utf8(s, s + len, ncols - ew, &stop);
+	lua_pushlstring(L, s, stop - s);
+	lua_pushlstring(L, ellipsis, estop - ellipsis);
+	lua_concat(L, 2);
+	lua_pushinteger(L, w + ew);
+	return 2;
+}
+
+
 /***
 Insert padding characters to force a short delay.
 @function delay_output
@@ -1308,6 +1603,7 @@ static const luaL_Reg curseslib[] =
 	LCURSES_FUNC( Phas_ic		),
 	LCURSES_FUNC( Phas_il		),
 	LCURSES_FUNC( Pinit_pair	),
+	LCURSES_FUNC( Pinitscr		),
 	LCURSES_FUNC( Pisendwin		),
 	LCURSES_FUNC( Pkeyname		),
 	LCURSES_FUNC( Pkillchar		),
@@ -1316,11 +1612,14 @@ static const luaL_Reg curseslib[] =
 	LCURSES_FUNC( Pnapms		),
 	LCURSES_FUNC( Pnew_chstr	),
 	LCURSES_FUNC( Pnewpad		),
+	LCURSES_FUNC( Pnewterm		),
 	LCURSES_FUNC( Pnewwin		),
 	LCURSES_FUNC( Pnl		),
 	LCURSES_FUNC( Ppair_content	),
+	LCURSES_FUNC( Ppersist_frame	),
 	LCURSES_FUNC( Praw		),
 	LCURSES_FUNC( Presizeterm	),
+	LCURSES_FUNC( Prestore_frame	),
 	LCURSES_FUNC( Pripoffline	),
 	LCURSES_FUNC( Pslk_attroff	),
 	LCURSES_FUNC( Pslk_attron	),
@@ -1340,9 +1639,11 @@ static const luaL_Reg curseslib[] =
 	LCURSES_FUNC( Ptigetflag	),
 	LCURSES_FUNC( Ptigetnum		),
 	LCURSES_FUNC( Ptigetstr		),
+	LCURSES_FUNC( Ptruncate		),
 	LCURSES_FUNC( Punctrl		),
 	LCURSES_FUNC( Pungetch		),
 	LCURSES_FUNC( Puse_default_colors),
+	LCURSES_FUNC( Pwidth		),
 	{NULL, NULL}
 };
 
@@ -1358,8 +1659,10 @@ see @{example.lua}. Many of the `KEY_` constants cannot be generated by
 modern keyboards and are mostly for historical compatibility with ancient
 terminal hardware keyboards.
 
-Note that almost all of these constants remain undefined (`nil`) until
-after @{curses.initscr} has returned successfully.
+Note that the `ACS_` constants remain undefined (`nil`) until after
+@{curses.initscr} or @{curses.newterm} has returned successfully; they
+are then looked up for the current screen, as they depend on its
+terminal.
 @table curses
 @int ACS_BLOCK alternate character set solid block
 @int ACS_BOARD alternate character set board of squares
@@ -1585,13 +1888,45 @@ luaopen_curses_c(lua_State *L)
 	luaL_requiref(L, "curses.window", luaopen_curses_window, 0);
 	lua_setfield(L, -2, "window");
 
+	luaL_requiref(L, "curses.vterm", luaopen_curses_vterm, 0);
+	lua_setfield(L, -2, "vterm");
+
+	luaL_requiref(L, "curses.screen", luaopen_curses_screen, 0);
+	lua_setfield(L, -2, "screen");
+
+	luaL_requiref(L, "curses.server", luaopen_curses_server, 0);
+	lua_setfield(L, -2, "server");
+	luaL_requiref(L, "curses.workers", luaopen_curses_workers, 0);
+	lua_setfield(L, -2, "workers");
+	luaL_requiref(L, "curses.queue", luaopen_curses_queue, 0);
+	lua_setfield(L, -2, "queue");
+	luaL_requiref(L, "curses.vpad", luaopen_curses_vpad, 0);
+	lua_setfield(L, -2, "vpad");
+	luaL_requiref(L, "curses.fileview", luaopen_curses_fileview, 0);
+	lua_setfield(L, -2, "fileview");
+	luaL_requiref(L, "curses.logview", luaopen_curses_logview, 0);
+	lua_setfield(L, -2, "logview");
+	luaL_requiref(L, "curses.listview", luaopen_curses_listview, 0);
+	lua_setfield(L, -2, "listview");
+	luaL_requiref(L, "curses.layout", luaopen_curses_layout, 0);
+	lua_setfield(L, -2, "layout");
+	luaL_requiref(L, "curses.panel", luaopen_curses_panel, 0);
+	lua_setfield(L, -2, "panel");
+	luaL_requiref(L, "curses.compositor", luaopen_curses_compositor, 0);
+	lua_setfield(L, -2, "compositor");
+	luaL_requiref(L, "curses.mirror", luaopen_curses_mirror, 0);
+	lua_setfield(L, -2, "mirror");
+	luaL_requiref(L, "curses.record", luaopen_curses_record, 0);
+	lua_setfield(L, -2, "record");
+
 	lua_pushfstring(L, VERSION_INFO, curses_version());
 	lua_setfield(L, -2, "version");
 
-	lua_pushstring(L, "initscr");
-	lua_pushvalue(L, -2);
-	lua_pushcclosure(L, Pinitscr, 1);
-	lua_settable(L, -3);
+	register_curses_constants(L);
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, acs_index);
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
 
 	return 1;
 }
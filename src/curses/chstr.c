@@ -17,6 +17,8 @@ and attributes in `chstr` buffers are not defined until **after**
 #define LCURSES_CHSTR_C 1
 
 #include "_helpers.c"
+#include "_ansi.c"
+#include "_width.c"
 
 
 static const char *CHSTR_META = "curses:chstr";
@@ -24,10 +26,11 @@ static const char *CHSTR_META = "curses:chstr";
 typedef struct chstr {
   unsigned int len; // element num
   unsigned int size; // buffer size
+  unsigned int *cols; // column of each element, built when first needed
   cchar_t str[1];
 } chstr;
 
-#define CHSTR_SIZE(len) (sizeof(chstr) + len * sizeof(cchar_t))
+#define CHSTR_SIZE(len) (sizeof(chstr) + (len) * sizeof(cchar_t))
 
 
 static chstr *
@@ -37,11 +40,9 @@ chstr_new_by_size(size_t len) {
   if (!cs) return NULL;
   cs->size = len;
   cs->len = len;
-  for (unsigned int i = 0; i < len; i++) {
-    cs->str[i].attr = A_NORMAL;
-    cs->str[i].chars[0] = ' ';
-    cs->str[i].chars[1] = '\0';
-  }
+  cs->cols = NULL;
+  for (unsigned int i = 0; i < len; i++)
+    setcchar_(&cs->str[i], ' ', A_NORMAL, 0);
   return cs;
 }
 
@@ -53,6 +54,7 @@ chstr_new(const char * str, size_t len, int attr) {
   if (!cs) return NULL;
 
   cs->size = len;
+  cs->cols = NULL;
 
   int i = 0;
 
@@ -63,9 +65,7 @@ chstr_new(const char * str, size_t len, int attr) {
     // str is not valid utf-8 byte sequence
     if (str == NULL) return free(cs), NULL;
 
-    cs->str[i].attr     = attr;
-    cs->str[i].chars[0] = code;
-    cs->str[i].chars[1] = '\0';
+    setcchar_(&cs->str[i], code, attr, 0);
   }
 
   cs->len = i;
@@ -75,9 +75,17 @@ chstr_new(const char * str, size_t len, int attr) {
 
 static void
 delete_chwstr(chstr * cs) {
+  free(cs->cols);
   free(cs);
 }
 
+/* drop the column index, after the contents changed */
+static void
+chstr_touch(chstr * cs) {
+  free(cs->cols);
+  cs->cols = NULL;
+}
+
 /* get chstr from lua (convert if needed) */
 static chstr **
 checkchstr(lua_State *L, int narg) {
@@ -145,6 +153,7 @@ Cset_str(lua_State *L) {
   }
 
   chstr * cs = *pcs;
+  chstr_touch(cs);
 
   if (new_size > cs->len) {
     cs->len = new_size;
@@ -152,12 +161,8 @@ Cset_str(lua_State *L) {
 
   cchar_t * p = &cs->str[offset];
   for (int i = 0; i < rep; i++) {
-    for (int li = 0; li < utf8_str_len; li++) {
-      p->attr     = attr;
-      p->chars[0] = code_array[li];
-      p->chars[1] = '\0';
-      ++p;
-    }
+    for (int li = 0; li < utf8_str_len; li++)
+      setcchar_(p++, code_array[li], attr, 0);
   }
   free(code_array);
 
@@ -193,12 +198,15 @@ Cset_ch(lua_State *L)
   luaL_argcheck(L, 0 < rep && rep <= (int)cs->len - offset + 1, 5, "bad rep");
 
   --offset;
+  chstr_touch(cs);
 
   while (rep--) {
-    if (set_attr) cs->str[offset].attr = attr;
-    cs->str[offset].chars[0] = ch;
-    cs->str[offset].chars[1] = '\0';
-
+    if (set_attr) {
+      setcchar_(&cs->str[offset], ch, attr, 0);
+    } else {
+      cs->str[offset].chars[0] = ch;
+      cs->str[offset].chars[1] = '\0';
+    }
     ++offset;
   }
 
@@ -271,6 +279,130 @@ Csize(lua_State *L)
 }
 
 
+/* display width of a chstr cell, control characters taking none */
+static int
+chstr_cellwidth(const cchar_t *cc) {
+  int w = lc_wcwidth(cc->chars[0]);
+  return w < 0 ? 0 : w;
+}
+
+/*
+** The column where each element starts, with the width of the whole
+** chstr at [len]; NULL if out of memory.  Built on first use and kept
+** until the contents change.
+*/
+static const unsigned int *
+chstr_cols(chstr *cs) {
+  if (!cs->cols) {
+    unsigned int *cols = malloc((cs->len + 1) * sizeof *cols);
+    if (!cols) return NULL;
+    cols[0] = 0;
+    for (unsigned int i = 0; i < cs->len; i++)
+      cols[i + 1] = cols[i] + chstr_cellwidth(&cs->str[i]);
+    cs->cols = cols;
+  }
+  return cs->cols;
+}
+
+/* the element covering column col, from 0, or len if col is past the end */
+static unsigned int
+chstr_col_index(const chstr *cs, const unsigned int *cols, unsigned int col) {
+  unsigned int lo = 0, hi = cs->len;
+
+  // first element ending after col; zero width elements never do
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (cols[mid + 1] > col)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+static const unsigned int *
+checkchstrcols(lua_State *L, chstr *cs) {
+  const unsigned int *cols = chstr_cols(cs);
+  if (!cols) luaL_error(L, "malloc failed");
+  return cols;
+}
+
+/***
+Number of terminal columns the chstr takes.
+Wide characters count as two columns, combining marks as none.
+@function width
+@tparam chstr cs buffer to act on
+@treturn int display width of *cs*
+@usage
+  cs = curses.chstr ('hi,世界')
+  print (cs:width ()) --> 7
+*/
+static int
+Cwidth(lua_State *L)
+{
+  chstr *cs = *checkchstr(L, 1);
+  lua_Integer w = 0;
+
+  if (cs->cols)
+    w = cs->cols[cs->len];
+  else
+    for (unsigned int i = 0; i < cs->len; i++)
+      w += chstr_cellwidth(&cs->str[i]);
+  return pushintresult(w);
+}
+
+
+/***
+Find the element shown at a column.
+The first call after the chstr changed indexes the columns of all
+elements; later calls take a binary search.
+@function col_to_index
+@int col column, from 0 for the first element
+@treturn int index of the element covering *col*, or `nil` if *col* is
+  past the end
+@treturn int column where that element starts, less than *col* in the
+  right half of a wide character
+@usage
+  cs = curses.chstr ('hi,世界')
+  print (cs:col_to_index (4)) --> 4 3
+*/
+static int
+Ccol_to_index(lua_State *L)
+{
+  chstr *cs = *checkchstr(L, 1);
+  int col = checkint(L, 2);
+  luaL_argcheck(L, col >= 0, 2, "col should >= 0");
+
+  const unsigned int *cols = checkchstrcols(L, cs);
+  unsigned int i = chstr_col_index(cs, cols, col);
+  if (i == cs->len) return 0;
+
+  lua_pushinteger(L, i + 1);
+  lua_pushinteger(L, cols[i]);
+  return 2;
+}
+
+
+/***
+Find the column of an element.
+@function index_to_col
+@int i index of an element, or `cs:len () + 1` for the end
+@treturn int column where element *i* starts, from 0
+@usage
+  cs = curses.chstr ('hi,世界')
+  print (cs:index_to_col (5)) --> 5
+*/
+static int
+Cindex_to_col(lua_State *L)
+{
+  chstr *cs = *checkchstr(L, 1);
+  int i = checkint(L, 2);
+  luaL_argcheck(L, i > 0 && i <= (int)cs->len + 1, 2, "index range: [1 .. cs:len()+1]");
+
+  return pushintresult(checkchstrcols(L, cs)[i - 1]);
+}
+
+
 /***
 Duplicate chstr.
 @function dup
@@ -292,6 +424,7 @@ Cdup(lua_State *L)
 
   memcpy(*ncs, cs, CHSTR_SIZE(rlen));
   (*ncs)->size = rlen;
+  (*ncs)->cols = NULL;
 
   luaL_setmetatable(L, CHSTR_META);
   return 1;
@@ -333,6 +466,148 @@ create_chstr(lua_State *L, int narg) {
   return 1;
 }
 
+/* grow a chstr so it can hold at least size elements */
+static int
+chstr_reserve(chstr **pcs, size_t size) {
+  chstr *cs = *pcs;
+  if (size <= cs->size) return 1;
+  if (size < cs->size * 2) size = cs->size * 2;
+
+  cs = realloc(cs, CHSTR_SIZE(size));
+  if (!cs) return 0;
+
+  cs->size = size;
+  *pcs = cs;
+  return 1;
+}
+
+/* state of a from_ansi conversion, passed to the parser callbacks */
+typedef struct chstr_ansi {
+  chstr *cs;
+  unsigned int col;
+  lc_pen pen;
+  lc_pencache cache;
+  attr_t attrs;
+  int pair;
+  int nomem;
+} chstr_ansi;
+
+static void
+chstr_ansi_put(chstr_ansi *a, int ch) {
+  if (a->nomem || !chstr_reserve(&a->cs, a->cs->len + 1)) {
+    a->nomem = 1;
+    return;
+  }
+  setcchar_(&a->cs->str[a->cs->len++], ch, a->attrs, a->pair);
+}
+
+static void
+chstr_ansi_print(void *ud, const int *cps, size_t n) {
+  chstr_ansi *a = ud;
+
+  for (size_t i = 0; i < n; i++) {
+    int w = lc_wcwidth(cps[i]);
+    if (w < 0) continue;
+
+    if (w == 0) {
+      // combining character, attach it to the previous cell
+      if (a->cs->len > 0) {
+        cchar_t *cc = &a->cs->str[a->cs->len - 1];
+        int k = 1;
+        while (k < CCHARW_MAX && cc->chars[k]) k++;
+        if (k < CCHARW_MAX) {
+          cc->chars[k] = cps[i];
+          if (k + 1 < CCHARW_MAX) cc->chars[k + 1] = '\0';
+        }
+      }
+      continue;
+    }
+
+    chstr_ansi_put(a, cps[i]);
+    a->col += w;
+  }
+}
+
+static void
+chstr_ansi_execute(void *ud, int c) {
+  chstr_ansi *a = ud;
+
+  // a chstr is a single line, so tabs are the only control that survives
+  if (c == '\t') {
+    do {
+      chstr_ansi_put(a, ' ');
+    } while (++a->col % 8);
+  }
+}
+
+static void
+chstr_ansi_esc(void *ud, const lc_vtparser *p, int final) {
+  (void) ud; (void) p; (void) final;
+}
+
+static void
+chstr_ansi_csi(void *ud, const lc_vtparser *p, int final) {
+  chstr_ansi *a = ud;
+
+  if (final == 'm' && !p->priv && !p->ninter) {
+    sgr_apply(&a->pen, p);
+    a->attrs = pen_render(&a->pen, &a->cache, &a->pair);
+  }
+}
+
+static const lc_vtops chstr_ansi_ops = {
+  chstr_ansi_print, chstr_ansi_execute, chstr_ansi_esc, chstr_ansi_csi, NULL
+};
+
+/***
+Create a chstr from text containing ANSI escape sequences.
+SGR sequences set attributes and colors of the following characters,
+including 256 color and 24-bit color forms, which are mapped onto the
+closest colors the terminal supports.  Color pairs are allocated as
+needed, so colors are only kept after `curses.start_color ()`.  Tabs
+are expanded, other control characters and escape sequences are dropped.
+@function from_ansi
+@string str utf8 string with embedded escape sequences
+@int[opt=A_NORMAL] attr attributes at the start of *str*
+@treturn chstr a new chstr
+@usage
+  cs = curses.chstr.from_ansi ("\27[1;31merror:\27[0m bad thing")
+*/
+static int
+Cfrom_ansi(lua_State *L)
+{
+  size_t len;
+  const char *str = luaL_checklstring(L, 1, &len);
+  int attr = optint(L, 2, A_NORMAL);
+  chstr_ansi a;
+  lc_vtparser p;
+
+  memset(&a, 0, sizeof a);
+  a.cs = malloc(CHSTR_SIZE(len + 1));
+  if (!a.cs) return luaL_error(L, "malloc failed");
+  a.cs->len = 0;
+  a.cs->size = len + 1;
+  a.cs->cols = NULL;
+
+  pen_from_attr(&a.pen, attr, PAIR_NUMBER(attr));
+  a.cache.fg = a.pen.fg;
+  a.cache.bg = a.pen.bg;
+  a.cache.pair = PAIR_NUMBER(attr);
+  a.attrs = pen_render(&a.pen, &a.cache, &a.pair);
+
+  vt_init(&p, &chstr_ansi_ops, &a);
+  vt_feed(&p, str, len);
+
+  if (a.nomem) {
+    free(a.cs);
+    return luaL_error(L, "realloc failed");
+  }
+
+  *(chstr **)lua_newuserdata(L, sizeof(chstr *)) = a.cs;
+  luaL_setmetatable(L, CHSTR_META);
+  return 1;
+}
+
 /***
 Initialise a new chstr.
 @function __call
@@ -353,10 +628,14 @@ static const luaL_Reg curses_chstr_fns[] =
 {
 	LCURSES_FUNC( Clen		),
 	LCURSES_FUNC( Csize		),
+	LCURSES_FUNC( Cwidth		),
+	LCURSES_FUNC( Ccol_to_index	),
+	LCURSES_FUNC( Cindex_to_col	),
 	LCURSES_FUNC( Cset_ch		),
 	LCURSES_FUNC( Cset_str		),
 	LCURSES_FUNC( Cget		),
 	LCURSES_FUNC( Cdup		),
+	LCURSES_FUNC( Cfrom_ansi	),
 	{ NULL, NULL }
 };
 
@@ -0,0 +1,575 @@
+/* */
+
+/***
+ Window compositing.
+
+ A compositor knows the rectangle and stacking order of a set of
+ windows, and refreshes them so that the terminal shows each cell of
+ the topmost one.  Unlike @{curses.panel}, it works from the changes:
+ when a window moves, is hidden or removed, only the cells it uncovers
+ are touched in the windows below; a change drawn into a window is
+ copied again from the windows above where they cover it; and a window
+ covered entirely by others is not refreshed at all.  So moving a popup
+ over a big dashboard costs in proportion to the popup, not the screen:
+
+     local comp = curses.compositor ()
+     comp:add (curses.stdscr (), 0)  -- the background covers the screen
+     comp:add (popup, 10)
+     comp:move (popup, y, x + 1)
+     comp:present ()                 -- wnoutrefresh and one doupdate
+
+ What no window of the compositor covers is not drawn, so the first
+ window is usually one the size of the screen.  A window closed while
+ in a compositor is dropped from it.
+
+@classmod curses.compositor
+*/
+
+#ifndef LCURSES_COMPOSITOR_C
+#define LCURSES_COMPOSITOR_C 1
+
+#include "_helpers.c"
+#include "_dirty.c"
+
+
+static const char *COMPOSITOR_META = "curses:compositor";
+
+#define COMPOSITOR_MAXDAMAGE	64	/* rectangles kept before merging */
+
+/* screen rectangle, bottom and right excluded */
+typedef struct cp_rect {
+	int y0, x0, y1, x1;
+} cp_rect;
+
+typedef struct cp_item {
+	WINDOW *w;
+	WINDOW **ref;		/* the userdata, NULL once the window is closed */
+	cp_rect rect;		/* where it was last seen */
+	int z;
+	unsigned long seq;	/* windows of equal z stack in order added */
+	int hidden;
+	int covered;		/* in the last present */
+} cp_item;
+
+typedef struct lc_compositor {
+	cp_item *items;		/* from the bottom up */
+	int n, cap;
+	unsigned long seq;
+	cp_rect damage[COMPOSITOR_MAXDAMAGE];	/* uncovered screen parts */
+	int ndamage;
+	cp_rect *above;		/* scratch for present */
+	int closed;
+} lc_compositor;
+
+
+static lc_compositor *
+checkcompositor(lua_State *L, int narg)
+{
+	lc_compositor *c = (lc_compositor *) luaL_checkudata(L, narg, COMPOSITOR_META);
+	if (c->closed)
+		luaL_argerror(L, narg, "attempt to use closed compositor");
+	return c;
+}
+
+static cp_rect
+cp_winrect(WINDOW *w)
+{
+	cp_rect r;
+
+	getbegyx(w, r.y0, r.x0);
+	r.y1 = r.y0 + getmaxy(w);
+	r.x1 = r.x0 + getmaxx(w);
+	return r;
+}
+
+static int
+cp_clip(cp_rect *r, const cp_rect *by)
+{
+	if (r->y0 < by->y0) r->y0 = by->y0;
+	if (r->x0 < by->x0) r->x0 = by->x0;
+	if (r->y1 > by->y1) r->y1 = by->y1;
+	if (r->x1 > by->x1) r->x1 = by->x1;
+	return r->y0 < r->y1 && r->x0 < r->x1;
+}
+
+/* whether r is covered by the union of rects[0..n) */
+static int
+cp_covered(cp_rect r, const cp_rect *rects, int n)
+{
+	cp_rect a, part;
+
+	for (; n > 0; rects++, n--)
+	{
+		a = r;
+		if (cp_clip(&a, rects))
+			break;
+	}
+	if (n == 0)
+		return 0;
+	/* what of r lies outside a: above, below, left and right of it */
+	part = r, part.y1 = a.y0;
+	if (part.y0 < part.y1 && !cp_covered(part, rects + 1, n - 1))
+		return 0;
+	part = r, part.y0 = a.y1;
+	if (part.y0 < part.y1 && !cp_covered(part, rects + 1, n - 1))
+		return 0;
+	part = a, part.x0 = r.x0, part.x1 = a.x0;
+	if (part.x0 < part.x1 && !cp_covered(part, rects + 1, n - 1))
+		return 0;
+	part = a, part.x0 = a.x1, part.x1 = r.x1;
+	if (part.x0 < part.x1 && !cp_covered(part, rects + 1, n - 1))
+		return 0;
+	return 1;
+}
+
+/* record that the screen under r must be drawn again */
+static void
+cp_damage(lc_compositor *c, cp_rect r)
+{
+	if (r.y0 >= r.y1 || r.x0 >= r.x1)
+		return;
+	if (c->ndamage == COMPOSITOR_MAXDAMAGE)
+	{
+		/* too many: keep their bounding box */
+		cp_rect *b = &c->damage[0];
+		int i;
+		for (i = 1; i < c->ndamage; i++)
+		{
+			cp_rect *d = &c->damage[i];
+			if (d->y0 < b->y0) b->y0 = d->y0;
+			if (d->x0 < b->x0) b->x0 = d->x0;
+			if (d->y1 > b->y1) b->y1 = d->y1;
+			if (d->x1 > b->x1) b->x1 = d->x1;
+		}
+		c->ndamage = 1;
+	}
+	c->damage[c->ndamage++] = r;
+}
+
+/* touch the part of w under the screen rectangle r */
+static void
+cp_touch(WINDOW *w, cp_rect r)
+{
+	cp_rect wr = cp_winrect(w);
+	int y;
+
+	if (!cp_clip(&r, &wr))
+		return;
+	for (y = r.y0; y < r.y1; y++)
+		dirty_touch(w, y - wr.y0, r.x0 - wr.x0, r.x1 - 1 - wr.x0);
+}
+
+static int
+cp_order(const void *a, const void *b)
+{
+	const cp_item *i = a, *j = b;
+	if (i->z != j->z)
+		return i->z < j->z ? -1 : 1;
+	return i->seq < j->seq ? -1 : i->seq > j->seq;
+}
+
+/*
+** Drop the windows closed since the last call, uncovering what they
+** covered; the compositor is at index 1.
+*/
+static void
+cp_sweep(lua_State *L, lc_compositor *c)
+{
+	int i, n = 0;
+
+	for (i = 0; i < c->n; i++)
+		if (*c->items[i].ref == NULL)
+		{
+			if (!c->items[i].hidden)
+				cp_damage(c, c->items[i].rect);
+		}
+		else
+			c->items[n++] = c->items[i];
+	if (n == c->n)
+		return;
+	c->n = n;
+
+	/* and stop keeping them */
+	lua_getuservalue(L, 1);
+	for (lua_pushnil(L); lua_next(L, -2) != 0;)
+	{
+		WINDOW **w = lua_touserdata(L, -2);
+		lua_pop(L, 1);
+		if (*w == NULL)
+		{
+			lua_pushvalue(L, -1);
+			lua_pushnil(L);
+			lua_rawset(L, -4);
+		}
+	}
+	lua_pop(L, 1);
+}
+
+static int
+cp_find(lc_compositor *c, WINDOW *w)
+{
+	int i;
+
+	for (i = 0; i < c->n; i++)
+		if (c->items[i].w == w)
+			return i;
+	return -1;
+}
+
+/* the item of the window at narg */
+static cp_item *
+cp_checkitem(lua_State *L, lc_compositor *c, int narg)
+{
+	int i;
+
+	cp_sweep(L, c);
+	if ((i = cp_find(c, checkwin(L, narg))) < 0)
+		luaL_argerror(L, narg, "window not in the compositor");
+	return &c->items[i];
+}
+
+static int
+cp_top(lc_compositor *c)
+{
+	return c->n ? c->items[c->n - 1].z : 0;
+}
+
+/* keep (or drop, if v is nil) the window at narg in the uservalue */
+static void
+cp_keep(lua_State *L, int narg, int v)
+{
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, narg);
+	lua_pushvalue(L, v);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+
+/***
+Create a compositor.
+@function __call
+@treturn compositor a compositor without windows
+@usage
+  comp = curses.compositor ()
+*/
+static int
+D__call(lua_State *L)
+{
+	lc_compositor *c = lua_newuserdata(L, sizeof *c);
+
+	memset(c, 0, sizeof *c);
+	luaL_setmetatable(L, COMPOSITOR_META);
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+
+/***
+Add a window, or change its stacking order.
+@function add
+@tparam curses.window win the window
+@int[opt] z its place in the stack, bottom first; above all other
+  windows by default
+*/
+static int
+Dadd(lua_State *L)
+{
+	lc_compositor *c = checkcompositor(L, 1);
+	WINDOW *w = checkwin(L, 2);
+	int i, z;
+
+	cp_sweep(L, c);
+	i = cp_find(c, w);
+	z = optint(L, 3, i < 0 && c->n == 0 ? 0 : cp_top(c) + 1);
+
+	if (i < 0)
+	{
+		if (c->n == c->cap)
+		{
+			int cap = c->cap ? c->cap * 2 : 8;
+			cp_item *items = realloc(c->items, cap * sizeof *items);
+			cp_rect *above = realloc(c->above, cap * sizeof *above);
+			if (items)
+				c->items = items;
+			if (above)
+				c->above = above;
+			if (!items || !above)
+				return luaL_error(L, "malloc failed");
+			c->cap = cap;
+		}
+		i = c->n++;
+		memset(&c->items[i], 0, sizeof c->items[i]);
+		c->items[i].w = w;
+		c->items[i].ref = lua_touserdata(L, 2);
+		c->items[i].rect = cp_winrect(w);
+		lua_pushboolean(L, 1);
+		cp_keep(L, 2, lua_gettop(L));
+	}
+	c->items[i].z = z;
+	c->items[i].seq = ++c->seq;
+	qsort(c->items, c->n, sizeof *c->items, cp_order);
+	touchwin(w);
+	return 0;
+}
+
+
+/***
+Remove a window.
+What it covered is drawn again by the next @{present}.
+@function remove
+@tparam curses.window win the window
+*/
+static int
+Dremove(lua_State *L)
+{
+	lc_compositor *c = checkcompositor(L, 1);
+	cp_item *it = cp_checkitem(L, c, 2);
+
+	if (!it->hidden)
+		cp_damage(c, cp_winrect(it->w));
+	memmove(it, it + 1, (c->items + --c->n - it) * sizeof *it);
+	lua_pushnil(L);
+	cp_keep(L, 2, lua_gettop(L));
+	return 0;
+}
+
+
+/***
+Move a window on the screen.
+Only the window, and what it uncovers, are drawn again.
+@function move
+@tparam curses.window win the window
+@int y new top line
+@int x new left column
+@treturn bool `true`, if successful
+@see mvwin(3x)
+*/
+static int
+Dmove(lua_State *L)
+{
+	lc_compositor *c = checkcompositor(L, 1);
+	cp_item *it = cp_checkitem(L, c, 2);
+	int y = checkint(L, 3);
+	int x = checkint(L, 4);
+	cp_rect old = cp_winrect(it->w);
+
+	if (mvwin(it->w, y, x) == ERR)
+		return pushboolresult(0);
+	if (!it->hidden)
+		cp_damage(c, old);
+	it->rect = cp_winrect(it->w);
+	touchwin(it->w);
+	return pushboolresult(1);
+}
+
+
+/***
+Put a window on top of the others.
+@function raise
+@tparam curses.window win the window
+*/
+static int
+Draise(lua_State *L)
+{
+	lc_compositor *c = checkcompositor(L, 1);
+	cp_item *it = cp_checkitem(L, c, 2);
+
+	if (it != &c->items[c->n - 1])
+	{
+		it->z = cp_top(c) + 1;
+		it->seq = ++c->seq;
+		qsort(c->items, c->n, sizeof *c->items, cp_order);
+		touchwin(checkwin(L, 2));
+	}
+	return 0;
+}
+
+
+/***
+Hide or show a window.
+@function hide
+@tparam curses.window win the window
+@bool[opt=true] hide `false` to show it again
+*/
+static int
+Dhide(lua_State *L)
+{
+	lc_compositor *c = checkcompositor(L, 1);
+	cp_item *it = cp_checkitem(L, c, 2);
+	int hide = lua_isnoneornil(L, 3) || lua_toboolean(L, 3);
+
+	if (hide && !it->hidden)
+		cp_damage(c, cp_winrect(it->w));
+	else if (!hide && it->hidden)
+		touchwin(it->w);
+	it->hidden = hide;
+	return 0;
+}
+
+
+/***
+Refresh the windows.
+Windows are copied to the virtual screen from the bottom up, each only
+where it changed or was uncovered, and the terminal is updated.
+@function present
+@bool[opt=true] update `false` to leave the @{curses.doupdate} to the caller
+@treturn int number of windows refreshed; covered ones are skipped
+*/
+static int
+Dpresent(lua_State *L)
+{
+	lc_compositor *c = checkcompositor(L, 1);
+	int update = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+	int i, j, d, y, nabove = 0, n = 0;
+
+	cp_sweep(L, c);
+	/* from the top down, which windows are covered by those above */
+	for (i = c->n - 1; i >= 0; i--)
+	{
+		cp_item *it = &c->items[i];
+		cp_rect r;
+		if (it->hidden)
+			continue;
+		r = it->rect = cp_winrect(it->w);
+		it->covered = cp_covered(r, c->above, nabove);
+		c->above[nabove++] = r;
+	}
+
+	/* what was uncovered is drawn by the windows that are there */
+	for (d = 0; d < c->ndamage; d++)
+		for (i = 0; i < c->n; i++)
+			if (!c->items[i].hidden && !c->items[i].covered)
+				cp_touch(c->items[i].w, c->damage[d]);
+	c->ndamage = 0;
+
+	/* a change under a window above is copied over again by it */
+	for (i = 0; i < c->n; i++)
+	{
+		cp_item *it = &c->items[i];
+		cp_rect r;
+		if (it->hidden || it->covered)
+			continue;
+		r = cp_winrect(it->w);
+		for (j = i + 1; j < c->n; j++)
+		{
+			cp_item *up = &c->items[j];
+			cp_rect ur = cp_winrect(up->w), o = r;
+			if (up->hidden || up->covered || !cp_clip(&o, &ur))
+				continue;
+			for (y = o.y0; y < o.y1; y++)
+			{
+				int first, last;
+				cp_rect t;
+				if (!dirty_get(it->w, y - r.y0, &first, &last))
+					continue;
+				t.y0 = y, t.y1 = y + 1;
+				t.x0 = r.x0 + first, t.x1 = r.x0 + last + 1;
+				if (cp_clip(&t, &o))
+					cp_touch(up->w, t);
+			}
+		}
+	}
+
+	for (i = 0; i < c->n; i++)
+		if (!c->items[i].hidden && !c->items[i].covered)
+		{
+			wnoutrefresh(c->items[i].w);
+			n++;
+		}
+	if (update)
+	{
+		doupdate();
+		mr_sync_all();
+	}
+	return pushintresult(n);
+}
+
+
+/***
+Number of windows.
+@function windows
+@treturn int number of windows, hidden ones included
+*/
+static int
+Dwindows(lua_State *L)
+{
+	return pushintresult(checkcompositor(L, 1)->n);
+}
+
+
+/***
+Forget all windows.
+@function close
+*/
+static int
+Dclose(lua_State *L)
+{
+	lc_compositor *c = (lc_compositor *) luaL_checkudata(L, 1, COMPOSITOR_META);
+
+	if (!c->closed)
+	{
+		free(c->items);
+		free(c->above);
+		c->items = NULL;
+		c->above = NULL;
+		c->n = c->cap = 0;
+		c->closed = 1;
+		lua_newtable(L);
+		lua_setuservalue(L, 1);
+	}
+	return 0;
+}
+
+
+static const luaL_Reg curses_compositor_fns[] =
+{
+	LCURSES_FUNC( Dadd		),
+	LCURSES_FUNC( Dclose		),
+	LCURSES_FUNC( Dhide		),
+	LCURSES_FUNC( Dmove		),
+	LCURSES_FUNC( Dpresent		),
+	LCURSES_FUNC( Draise		),
+	LCURSES_FUNC( Dremove		),
+	LCURSES_FUNC( Dwindows		),
+	{"__gc",     Dclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_compositor(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_compositor_fns);
+	t = lua_gettop(L);
+
+	lua_createtable(L, 0, 1);		/* u = {} */
+	lua_pushcfunction(L, D__call);
+	lua_setfield(L, -2, "__call");		/* u.__call = D__call */
+	lua_setmetatable(L, -2);		/* setmetatable (t, u) */
+
+	luaL_newmetatable(L, COMPOSITOR_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesCompositor");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesCompositor" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.compositor..." */
+	lua_pushliteral(L, "curses.compositor for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_COMPOSITOR_C*/
@@ -0,0 +1,785 @@
+/* */
+
+/***
+ Memory mapped file viewing.
+
+ A fileview maps a file into memory and indexes its lines on a
+ background thread, so that a pager can show any part of a file of
+ many gigabytes at once, without reading it into Lua strings:
+
+     local fv = assert (curses.fileview.open ("/var/log/huge.log"))
+     fv:render (win, 0)              -- first page, while indexing
+     fv:render (win, 1000000)        -- jump to a line
+     fv:follow (true)                -- like tail -f
+     fv:tail (win)                   -- the last page
+
+ Lines are drawn straight from the mapping as UTF-8.  Tabs are
+ expanded to multiples of 8 columns, and other control characters are
+ shown in caret notation, as `^A`.  Only lines indexed so far can be
+ shown; @{lines} tells how far the index got.
+
+@classmod curses.fileview
+*/
+
+#ifndef LCURSES_FILEVIEW_C
+#define LCURSES_FILEVIEW_C 1
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "_helpers.c"
+#include "_width.c"
+
+
+static const char *FILEVIEW_META = "curses:fileview";
+
+#define FV_STEP		64		/* lines between two index marks */
+#define FV_CHUNK	(4 << 20)	/* bytes indexed at a time */
+#define FV_POLL_MS	200		/* file size checks in follow mode */
+
+typedef struct lc_fileview {
+	int fd;
+	const char *map;
+	size_t maplen;
+	uint64_t size;		/* bytes of the file seen so far */
+	uint64_t indexed;	/* bytes scanned for newlines */
+	uint64_t nl;		/* newlines in the indexed bytes */
+	uint64_t last;		/* offset after the last newline */
+	uint64_t *marks;	/* start of every FV_STEP-th line */
+	size_t nmarks, capmarks;
+	int follow, quit;
+	int nomem;		/* indexing stopped, out of memory */
+	unsigned gen;		/* bumped when the index starts over */
+	pthread_t thread;
+	int started;
+	pthread_mutex_t mu;	/* everything above, and remapping */
+	pthread_cond_t cond;
+	cchar_t *buf;
+	int bufsize;
+} lc_fileview;
+
+
+/* ========= *
+ * Indexing. *
+ * ========= */
+
+static int
+fv_addmark(lc_fileview *f, uint64_t off)
+{
+	if (f->nmarks == f->capmarks)
+	{
+		size_t cap = f->capmarks ? f->capmarks * 2 : 1024;
+		uint64_t *m = realloc(f->marks, cap * sizeof *m);
+		if (!m)
+			return -1;
+		f->marks = m;
+		f->capmarks = cap;
+	}
+	f->marks[f->nmarks++] = off;
+	return 0;
+}
+
+/* start over, after the file was truncated; mu is held */
+static void
+fv_reset(lc_fileview *f)
+{
+	f->indexed = f->nl = f->last = 0;
+	f->nmarks = 0;
+	f->gen++;
+	if (fv_addmark(f, 0) != 0)
+		f->nomem = 1;
+}
+
+/*
+** Map size bytes of the file, with room to grow in follow mode; mu is
+** held.  Pages past the end of the file are never touched.
+*/
+static int
+fv_map(lc_fileview *f, uint64_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t len = size + size / 2 + page;
+	void *p;
+
+	len -= len % page;
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, f->fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	if (f->map)
+		munmap((void *) f->map, f->maplen);
+	f->map = p;
+	f->maplen = len;
+	return 0;
+}
+
+/*
+** Reading a mapped page past the end of the file raises SIGBUS, and
+** the file can be truncated at any time, so its size is checked
+** before each read of the mapping.  If it shrank, or was truncated and
+** written again past its old size, so that the last indexed line no
+** longer ends in a newline, the index starts over.  mu is held;
+** returns the size of the file.
+*/
+static uint64_t
+fv_check(lc_fileview *f)
+{
+	struct stat st;
+	uint64_t size;
+
+	if (fstat(f->fd, &st) != 0)
+		return f->size;
+	size = st.st_size;
+	if (size >= f->size && (f->last == 0 || f->map[f->last - 1] == '\n'))
+		return size;
+	fv_reset(f);
+	if (size < f->size)
+		f->size = size;
+	pthread_cond_broadcast(&f->cond);
+	return size;
+}
+
+/*
+** Follow mode: pick up a change of the file size.  Called with mu
+** held, and only by the indexing thread, which thus knows that the
+** mapping does not move under it.
+*/
+static void
+fv_poll(lc_fileview *f)
+{
+	uint64_t size = fv_check(f);
+
+	if (size <= f->size)
+		return;
+	if (size > f->maplen && fv_map(f, size) != 0)
+		return;
+	f->size = size;
+}
+
+static void *
+fv_indexer(void *arg)
+{
+	lc_fileview *f = arg;
+	uint64_t found[256];
+
+	pthread_mutex_lock(&f->mu);
+	while (!f->quit && !f->nomem)
+	{
+		if (f->indexed < f->size)
+		{
+			/* only this thread remaps, so the mapping stays put */
+			uint64_t from, to, nl;
+			const char *p, *end, *last = NULL;
+			unsigned gen;
+			int n = 0;
+
+			fv_check(f);
+			from = f->indexed, to = f->size, nl = f->nl, gen = f->gen;
+			if (from >= to)
+				continue;
+			if (to - from > FV_CHUNK)
+				to = from + FV_CHUNK;
+			pthread_mutex_unlock(&f->mu);
+
+			p = f->map + from;
+			end = f->map + to;
+			while (p < end && (p = memchr(p, '\n', end - p)) != NULL)
+			{
+				last = ++p;
+				if (++nl % FV_STEP == 0)
+				{
+					found[n++] = p - f->map;
+					if (n == 256)
+					{
+						end = p;	/* take the marks in */
+						break;
+					}
+				}
+			}
+
+			pthread_mutex_lock(&f->mu);
+			/* the file was found truncated meanwhile */
+			if (f->gen != gen)
+				continue;
+			for (int i = 0; i < n; i++)
+				if (fv_addmark(f, found[i]) != 0)
+				{
+					/* keep the index as it was, up to from */
+					f->nmarks -= i;
+					f->nomem = 1;
+					break;
+				}
+			if (f->nomem)
+			{
+				pthread_cond_broadcast(&f->cond);
+				break;
+			}
+			if (last)
+				f->last = last - f->map;
+			f->nl = nl;
+			f->indexed = end - f->map;
+			pthread_cond_broadcast(&f->cond);
+		}
+		else if (f->follow)
+		{
+			struct timespec ts;
+
+			fv_poll(f);
+			if (f->indexed < f->size)
+				continue;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += FV_POLL_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L)
+			{
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&f->cond, &f->mu, &ts);
+		}
+		else
+			pthread_cond_wait(&f->cond, &f->mu);
+	}
+	pthread_mutex_unlock(&f->mu);
+	return NULL;
+}
+
+/* number of lines indexed, a partial last line included; mu is held */
+static uint64_t
+fv_nlines(lc_fileview *f)
+{
+	return f->nl + (f->indexed > f->last);
+}
+
+/* offset of line n, which must be indexed; mu is held */
+static uint64_t
+fv_start(lc_fileview *f, uint64_t n)
+{
+	uint64_t off = f->marks[n / FV_STEP];
+	uint64_t k;
+
+	for (k = n % FV_STEP; k > 0 && off < f->indexed; k--)
+	{
+		const char *p = memchr(f->map + off, '\n', f->indexed - off);
+		if (p == NULL)
+			return f->indexed;
+		off = p - f->map + 1;
+	}
+	return off;
+}
+
+/* end of the line starting at off, its newline excluded; mu is held */
+static uint64_t
+fv_end(lc_fileview *f, uint64_t off)
+{
+	const char *p;
+
+	if (off >= f->indexed)
+		return f->indexed;
+	p = memchr(f->map + off, '\n', f->indexed - off);
+	return p ? (uint64_t) (p - f->map) : f->indexed;
+}
+
+
+/* ========== *
+ * Rendering. *
+ * ========== */
+
+/* decode one character of s..end, never reading past end */
+static const char *
+fv_decode(const char *s, const char *end, int *ch)
+{
+	const char *next;
+
+	if (end - s < 4)
+	{
+		char tmp[5] = { 0 };
+		memcpy(tmp, s, end - s);
+		next = utf8_decode(tmp, ch);
+		if (next && next - tmp <= end - s)
+			return s + (next - tmp);
+	}
+	else if ((next = utf8_decode(s, ch)) != NULL)
+		return next;
+	*ch = 0xfffd;
+	return s + 1;
+}
+
+/* a line being laid out by fv_drawline */
+typedef struct fv_line {
+	cchar_t *buf;		/* room for width cells */
+	int n, x;		/* cells in buf, and columns laid out */
+	int col, width;		/* the columns shown */
+	attr_t attrs;
+} fv_line;
+
+/* add a glyph at column x, if it shows between col and col + width */
+static int
+fv_put(fv_line *l, int ch, int cw)
+{
+	if (l->x + cw > l->col + l->width)
+		return 0;
+	if (l->x >= l->col)
+		setcchar_(&l->buf[l->n++], ch, l->attrs, 0);
+	else
+		/* a wide character cut by the left edge */
+		for (int i = l->col; i < l->x + cw; i++)
+			setcchar_(&l->buf[l->n++], ' ', l->attrs, 0);
+	l->x += cw;
+	return 1;
+}
+
+/*
+** Draw the UTF-8 bytes s..end on line wy of w, from column col of the
+** text on, clearing the rest of the line.  buf holds a line of w.
+*/
+static void
+fv_drawline(cchar_t *buf, WINDOW *w, int wy, const char *s,
+	const char *end, int col, attr_t attrs)
+{
+	fv_line l = { buf, 0, 0, col, getmaxx(w), attrs };
+	int more = 1;
+
+	/* CRLF line ends */
+	if (end > s && end[-1] == '\r')
+		end--;
+	while (more && s < end)
+	{
+		int ch, cw;
+
+		s = fv_decode(s, end, &ch);
+		if (ch == '\t')
+		{
+			int to = (l.x / 8 + 1) * 8;
+			while (more && l.x < to)
+				more = fv_put(&l, ' ', 1);
+		}
+		else if (ch < 0x20 || ch == 0x7f)
+			more = fv_put(&l, '^', 1)
+				&& fv_put(&l, ch == 0x7f ? '?' : ch + '@', 1);
+		else if ((cw = lc_wcwidth(ch)) == 0)
+		{
+			/* combining character, kept with the one before */
+			if (l.n > 0 && l.x > col)
+			{
+				wchar_t *c = buf[l.n - 1].chars;
+				for (int i = 1; i < CCHARW_MAX; i++)
+					if (c[i] == L'\0')
+					{
+						c[i] = ch;
+						if (i + 1 < CCHARW_MAX)
+							c[i + 1] = L'\0';
+						break;
+					}
+			}
+		}
+		else if (cw < 0)
+			more = fv_put(&l, 0xfffd, 1);
+		else
+			more = fv_put(&l, ch, cw);
+	}
+	wmove(w, wy, 0);
+	if (l.n > 0)
+		wadd_wchnstr(w, buf, l.n);
+	if (l.x - col < l.width)
+	{
+		wmove(w, wy, l.x > col ? l.x - col : 0);
+		wclrtoeol(w);
+	}
+}
+
+/* draw the lines from first on into w; mu is held */
+static int
+fv_render(lc_fileview *f, WINDOW *w, uint64_t first, int col)
+{
+	int wlines = getmaxy(w), y, drawn = 0;
+	uint64_t n = fv_nlines(f), off = 0;
+
+	for (y = 0; y < wlines; y++)
+	{
+		uint64_t line = first + y, end;
+		if (line >= n)
+		{
+			wmove(w, y, 0);
+			wclrtoeol(w);
+			continue;
+		}
+		if (y == 0)
+			off = fv_start(f, line);
+		end = fv_end(f, off);
+		fv_drawline(f->buf, w, y, f->map + off, f->map + end, col, A_NORMAL);
+		off = end + 1;
+		drawn++;
+	}
+	return drawn;
+}
+
+
+static lc_fileview *
+checkfileview(lua_State *L, int narg)
+{
+	lc_fileview *f = (lc_fileview *) luaL_checkudata(L, narg, FILEVIEW_META);
+	if (f->fd < 0)
+		luaL_argerror(L, narg, "attempt to use closed fileview");
+	return f;
+}
+
+/* make room for a line of the window at narg */
+static WINDOW *
+checkfvwin(lua_State *L, lc_fileview *f, int narg)
+{
+	WINDOW *w = checkwin(L, narg);
+	int width = getmaxx(w);
+
+	if (width > f->bufsize)
+	{
+		cchar_t *buf = realloc(f->buf, width * sizeof *buf);
+		if (!buf)
+			luaL_error(L, "malloc failed");
+		f->buf = buf;
+		f->bufsize = width;
+	}
+	return w;
+}
+
+
+/***
+Open a file for viewing.
+Indexing starts at once, on a thread of its own.
+@function open
+@string path file to open
+@treturn fileview a new fileview, or `nil`, an error message and errno
+*/
+static int
+Fopen(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	lc_fileview *f;
+	struct stat st;
+	sigset_t set, old;
+	int e;
+
+	f = lua_newuserdata(L, sizeof *f);
+	memset(f, 0, sizeof *f);
+	f->fd = -1;
+	luaL_setmetatable(L, FILEVIEW_META);
+
+	if ((f->fd = open(path, O_RDONLY)) < 0)
+		return pusherror(L, path);
+	if (fstat(f->fd, &st) != 0 || fv_map(f, st.st_size) != 0)
+	{
+		e = errno;
+		close(f->fd);
+		f->fd = -1;
+		errno = e;
+		return pusherror(L, path);
+	}
+	f->size = st.st_size;
+	pthread_mutex_init(&f->mu, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	fv_reset(f);
+	if (f->nomem)
+		return luaL_error(L, "malloc failed");
+
+	/* signals are for the Lua thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old);
+	e = pthread_create(&f->thread, NULL, fv_indexer, f);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (e != 0)
+		return luaL_error(L, "cannot start indexing thread");
+	f->started = 1;
+	return 1;
+}
+
+
+/***
+Number of lines indexed so far.
+A last line without a newline is counted.
+@function lines
+@treturn int number of lines
+@treturn bool whether the whole file, as far as it was seen, is indexed
+*/
+static int
+Flines(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+
+	pthread_mutex_lock(&f->mu);
+	lua_pushinteger(L, fv_nlines(f));
+	lua_pushboolean(L, f->indexed == f->size);
+	pthread_mutex_unlock(&f->mu);
+	return 2;
+}
+
+
+/***
+Size of the file, as far as it was seen.
+@function size
+@treturn int number of bytes
+*/
+static int
+Fsize(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+	lua_Integer size;
+
+	pthread_mutex_lock(&f->mu);
+	size = f->size;
+	pthread_mutex_unlock(&f->mu);
+	return pushintresult(size);
+}
+
+
+/***
+Wait until the file is indexed.
+If the index ran out of memory, an error is raised; the lines indexed
+until then can still be shown.
+@function wait
+@number[opt] timeout seconds to wait at most, forever if `nil`
+@treturn bool whether the file is indexed
+*/
+static int
+Fwait(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+	int forever = lua_isnoneornil(L, 2);
+	double timeout = forever ? 0 : luaL_checknumber(L, 2);
+	struct timespec ts;
+	int done, nomem;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += (time_t) timeout;
+	ts.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+	if (ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&f->mu);
+	while (f->indexed < f->size && !f->nomem)
+		if (forever)
+			pthread_cond_wait(&f->cond, &f->mu);
+		else if (pthread_cond_timedwait(&f->cond, &f->mu, &ts) != 0)
+			break;
+	done = f->indexed == f->size;
+	nomem = f->nomem;
+	pthread_mutex_unlock(&f->mu);
+	if (!done && nomem)
+		return luaL_error(L, "malloc failed");
+	return pushboolresult(done);
+}
+
+
+/***
+Draw lines of the file into a window.
+The window is filled from its top line; lines past the end of the
+index are cleared.
+@function render
+@tparam curses.window win target window
+@int first first line to show, from 0
+@int[opt=0] col first column to show
+@treturn int number of lines drawn
+*/
+static int
+Frender(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+	WINDOW *w = checkfvwin(L, f, 2);
+	lua_Integer first = luaL_checkinteger(L, 3);
+	int col = optint(L, 4, 0);
+	int n;
+
+	luaL_argcheck(L, first >= 0, 3, "line should >= 0");
+	luaL_argcheck(L, col >= 0, 4, "column should >= 0");
+	pthread_mutex_lock(&f->mu);
+	fv_check(f);
+	n = fv_render(f, w, first, col);
+	pthread_mutex_unlock(&f->mu);
+	return pushintresult(n);
+}
+
+
+/***
+Draw the last lines of the file into a window.
+Combined with @{follow}, calling this every frame gives `tail -f`.
+@function tail
+@tparam curses.window win target window
+@int[opt=0] col first column to show
+@treturn int the first line shown
+*/
+static int
+Ftail(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+	WINDOW *w = checkfvwin(L, f, 2);
+	int col = optint(L, 3, 0);
+	uint64_t n, first;
+
+	luaL_argcheck(L, col >= 0, 3, "column should >= 0");
+	pthread_mutex_lock(&f->mu);
+	fv_check(f);
+	n = fv_nlines(f);
+	first = n > (uint64_t) getmaxy(w) ? n - getmaxy(w) : 0;
+	fv_render(f, w, first, col);
+	pthread_mutex_unlock(&f->mu);
+	return pushintresult(first);
+}
+
+
+/***
+Copy one line of the file into a Lua string.
+@function line
+@int n line number, from 0
+@treturn string the line without its newline, or `nil` if it is not
+  indexed
+*/
+static int
+Fline(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	uint64_t off, end;
+
+	pthread_mutex_lock(&f->mu);
+	fv_check(f);
+	if (n < 0 || (uint64_t) n >= fv_nlines(f))
+	{
+		pthread_mutex_unlock(&f->mu);
+		lua_pushnil(L);
+		return 1;
+	}
+	off = fv_start(f, n);
+	end = fv_end(f, off);
+	lua_pushlstring(L, f->map + off, end - off);
+	pthread_mutex_unlock(&f->mu);
+	return 1;
+}
+
+
+/***
+Byte offset of a line.
+@function offset
+@int n line number, from 0
+@treturn int offset in the file, or `nil` if the line is not indexed
+*/
+static int
+Foffset(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+
+	pthread_mutex_lock(&f->mu);
+	fv_check(f);
+	if (n < 0 || (uint64_t) n >= fv_nlines(f))
+		lua_pushnil(L);
+	else
+		lua_pushinteger(L, fv_start(f, n));
+	pthread_mutex_unlock(&f->mu);
+	return 1;
+}
+
+
+/***
+Turn follow mode on or off.
+In follow mode the file size is checked a few times per second, and
+whatever was appended gets indexed.  A file which shrinks, as when it
+is rotated by truncating it, is indexed again from the start, and so
+is one truncated and written past its old size between two checks.
+@function follow
+@bool on whether to follow the file
+*/
+static int
+Ffollow(lua_State *L)
+{
+	lc_fileview *f = checkfileview(L, 1);
+
+	pthread_mutex_lock(&f->mu);
+	f->follow = lua_toboolean(L, 2);
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->mu);
+	return 0;
+}
+
+
+/***
+Stop indexing and unmap the file.
+@function close
+*/
+static int
+Fclose(lua_State *L)
+{
+	lc_fileview *f = (lc_fileview *) luaL_checkudata(L, 1, FILEVIEW_META);
+
+	if (f->fd < 0)
+		return 0;
+	if (f->started)
+	{
+		pthread_mutex_lock(&f->mu);
+		f->quit = 1;
+		pthread_cond_broadcast(&f->cond);
+		pthread_mutex_unlock(&f->mu);
+		pthread_join(f->thread, NULL);
+	}
+	pthread_cond_destroy(&f->cond);
+	pthread_mutex_destroy(&f->mu);
+	munmap((void *) f->map, f->maplen);
+	close(f->fd);
+	f->fd = -1;
+	free(f->marks);
+	f->marks = NULL;
+	free(f->buf);
+	f->buf = NULL;
+	return 0;
+}
+
+
+static const luaL_Reg curses_fileview_fns[] =
+{
+	LCURSES_FUNC( Fclose		),
+	LCURSES_FUNC( Ffollow		),
+	LCURSES_FUNC( Fline		),
+	LCURSES_FUNC( Flines		),
+	LCURSES_FUNC( Foffset		),
+	LCURSES_FUNC( Fopen		),
+	LCURSES_FUNC( Frender		),
+	LCURSES_FUNC( Fsize		),
+	LCURSES_FUNC( Ftail		),
+	LCURSES_FUNC( Fwait		),
+	{"__gc",     Fclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_fileview(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_fileview_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, FILEVIEW_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, mt, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesFileview");
+	lua_setfield(L, mt, "_type");		/* mt._type = "CursesFileview" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.fileview..." */
+	lua_pushliteral(L, "curses.fileview for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_FILEVIEW_C*/
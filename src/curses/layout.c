@@ -0,0 +1,1131 @@
+/* */
+
+/***
+ Text layout.
+
+ @{wrap} breaks a UTF-8 text into lines of at most a number of columns,
+ measured with the display width table of @{curses.width}, and keeps
+ the result as a list of byte ranges into the text; nothing is copied.
+ Hard newlines end paragraphs.  Lines break at spaces, and on either
+ side of a wide character; a word wider than a line is cut.  Lines are
+ drawn as by @{curses.fileview}, with tabs expanded and control
+ characters in caret notation.
+
+     local doc = curses.layout.wrap (help, curses.cols ())
+     doc:draw (win, top)             -- lines top .. of the text
+     print (doc:lines ())
+
+ Layouts are cached by text, width and mode, so wrapping the same text
+ again after a resize back to an earlier width is free.  The cache keeps
+ up to 16 layouts of 64 MB of text in all, and none of a bigger text.
+
+ A big text is laid out on a thread pool, in parts cut at newlines, and
+ the part to be shown first is laid out first: @{view} draws it while the
+ rest is still being done.
+
+@classmod curses.layout
+*/
+
+#ifndef LCURSES_LAYOUT_C
+#define LCURSES_LAYOUT_C 1
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include "_helpers.c"
+#include "_pool.c"
+#include "_width.c"
+#include "chstr.c"
+#include "fileview.c"
+
+
+static const char *LAYOUT_META = "curses:layout";
+static const char *LAYOUT_CACHE = "curses:layoutcache";
+
+#define LAYOUT_GREEDY	0
+#define LAYOUT_BALANCED	1
+#define LAYOUT_NCACHE	16	/* layouts kept by the cache */
+#define LAYOUT_CACHEBYTES	(64 << 20)	/* and their text bytes, at most */
+#define LAYOUT_CHUNK	(1 << 20)	/* bytes laid out by one job */
+
+/* a word, and the spaces after it */
+typedef struct ly_box {
+	uint32_t start, end;	/* bytes of the word */
+	int w, g;		/* columns of the word and of the spaces */
+} ly_box;
+
+typedef struct ly_lines {
+	uint32_t *start, *end;	/* bytes of each line, trailing spaces excluded */
+	size_t n, cap;
+	int nomem;
+} ly_lines;
+
+/* scratch space of a layout run */
+typedef struct ly_work {
+	ly_box *boxes;
+	size_t nboxes, cap;
+	uint64_t *cost;
+	uint32_t *prev;
+	size_t ndp;
+	int nomem;
+} ly_work;
+
+/* paragraphs laid out by one job of a threaded layout */
+typedef struct ly_chunk {
+	uint32_t from, to;
+	ly_lines out;
+	int done;
+} ly_chunk;
+
+/*
+** A layout being done on a thread pool.  A driver thread runs the pool,
+** so that wrap can return as soon as the chunk of the viewport is done;
+** the chunks are joined into one list of lines once all are.
+*/
+typedef struct ly_par {
+	const char *s;
+	int width, mode;
+	ly_chunk *chunks;
+	int nchunks;
+	int *order;		/* the viewport first */
+	lc_pool pool;
+	pthread_t driver;
+	pthread_mutex_t mu;	/* done, ndone and quit */
+	pthread_cond_t cond;
+	int ndone, quit;
+} ly_par;
+
+typedef struct lc_layout {
+	ly_lines breaks;
+	ly_par *par;		/* until all chunks are joined */
+	const char *s;		/* the text, kept in the uservalue */
+	size_t len;
+	int width, mode;
+} lc_layout;
+
+typedef struct ly_cache {
+	lc_layout *ly[LAYOUT_NCACHE];	/* kept in the uservalue too */
+	unsigned long used[LAYOUT_NCACHE];
+	unsigned long clock;
+	size_t bytes;		/* text of the layouts kept */
+} ly_cache;
+
+
+/* =========== *
+ * The engine. *
+ * =========== */
+
+static void
+ly_push(ly_lines *l, uint32_t start, uint32_t end)
+{
+	if (l->n == l->cap)
+	{
+		size_t cap = l->cap ? l->cap * 2 : 64;
+		uint32_t *s = realloc(l->start, cap * sizeof *s);
+		uint32_t *e = s ? realloc(l->end, cap * sizeof *e) : NULL;
+		if (s)
+			l->start = s;
+		if (!s || !e)
+		{
+			l->nomem = 1;
+			return;
+		}
+		l->end = e;
+		l->cap = cap;
+	}
+	l->start[l->n] = start;
+	l->end[l->n] = end;
+	l->n++;
+}
+
+static void
+ly_freelines(ly_lines *l)
+{
+	free(l->start);
+	free(l->end);
+	memset(l, 0, sizeof *l);
+}
+
+static void
+ly_freework(ly_work *k)
+{
+	free(k->boxes);
+	free(k->cost);
+	free(k->prev);
+	memset(k, 0, sizeof *k);
+}
+
+static ly_box *
+ly_newbox(ly_work *k, uint32_t start)
+{
+	ly_box *b;
+
+	if (k->nboxes == k->cap)
+	{
+		size_t cap = k->cap ? k->cap * 2 : 256;
+		ly_box *p = realloc(k->boxes, cap * sizeof *p);
+		if (!p)
+		{
+			k->nomem = 1;
+			return NULL;
+		}
+		k->boxes = p;
+		k->cap = cap;
+	}
+	b = &k->boxes[k->nboxes++];
+	b->start = b->end = start;
+	b->w = b->g = 0;
+	return b;
+}
+
+/*
+** Split the paragraph s[from, to) into boxes.  Spaces at the start of
+** the paragraph stay with the first word, as indentation; words wider
+** than width are cut into pieces that fit.  Characters are measured as
+** fv_drawline shows them: control characters as `^A`, and what has no
+** width as U+FFFD.  A tab in the indentation goes to the next multiple
+** of 8 columns; after a word, where its column is not known yet, it
+** counts for 8, so that a line is never drawn wider than laid out.
+*/
+static void
+ly_boxes(ly_work *k, const char *s, uint32_t from, uint32_t to, int width)
+{
+	ly_box *b = NULL;	/* the open word */
+	uint32_t i = from;
+	int lead = 1;		/* in the indentation */
+
+	k->nboxes = 0;
+	while (i < to && !k->nomem)
+	{
+		const char *next;
+		int c = (unsigned char) s[i], w, wide = 0;
+
+		if (c < 0x80)
+			next = s + i + 1, w = c >= 0x20 && c < 0x7f ? 1 : 2;
+		else if ((next = utf8_decode(s + i, &c)) == NULL || next > s + to)
+			next = s + i + 1, c = 0xfffd, w = 1;
+		else if ((w = lc_wcwidth(c)) < 0)
+			w = 1;
+		else
+			wide = w == 2;
+
+		if (c == '\t')
+			w = lead ? 8 - (b ? b->w : 0) % 8 : 8;
+		if (c != ' ' && c != '\t')
+			lead = 0;
+		if ((c == ' ' || c == '\t') && !lead)
+		{
+			/* spaces after a word */
+			k->boxes[k->nboxes - 1].g += w;
+			b = NULL;
+		}
+		else if (wide || (b && b->w > 0 && b->w + w > width))
+		{
+			/* a wide character, or a word cut in pieces */
+			if ((b = ly_newbox(k, i)) == NULL)
+				break;
+			b->w = w;
+			b->end = next - s;
+			if (wide)
+				b = NULL;
+		}
+		else if (w == 0 && b == NULL && k->nboxes > 0
+			&& k->boxes[k->nboxes - 1].g == 0 && k->boxes[k->nboxes - 1].end == i)
+			/* a combining character after a wide one */
+			k->boxes[k->nboxes - 1].end = next - s;
+		else
+		{
+			if (b == NULL && (b = ly_newbox(k, i)) == NULL)
+				break;
+			b->w += w;
+			b->end = next - s;
+		}
+		i = next - s;
+	}
+}
+
+static void
+ly_greedy(ly_work *k, ly_lines *out, int width)
+{
+	size_t i = 0, j;
+
+	while (i < k->nboxes)
+	{
+		int lw = k->boxes[i].w;
+		for (j = i + 1; j < k->nboxes; j++)
+		{
+			int add = k->boxes[j - 1].g + k->boxes[j].w;
+			if (lw + add > width)
+				break;
+			lw += add;
+		}
+		ly_push(out, k->boxes[i].start, k->boxes[j - 1].end);
+		i = j;
+	}
+}
+
+/*
+** Minimum raggedness: the breaks which minimize the sum of the squares
+** of the room left on each line but the last, by dynamic programming
+** over the break points; each line only looks back as far as a line
+** can reach, so this is linear in the number of words.
+*/
+static void
+ly_balanced(ly_work *k, ly_lines *out, int width)
+{
+	size_t n = k->nboxes, i, j, first = out->n;
+	uint64_t *cost;
+	uint32_t *prev;
+
+	if (n + 1 > k->ndp)
+	{
+		uint64_t *c = realloc(k->cost, (n + 1) * sizeof *c);
+		uint32_t *p = c ? realloc(k->prev, (n + 1) * sizeof *p) : NULL;
+		if (c)
+			k->cost = c;
+		if (!c || !p)
+		{
+			k->nomem = 1;
+			return;
+		}
+		k->prev = p;
+		k->ndp = n + 1;
+	}
+	cost = k->cost;
+	prev = k->prev;
+	cost[0] = 0;
+	for (j = 1; j <= n; j++)
+		cost[j] = UINT64_MAX;
+	for (i = 0; i < n; i++)
+	{
+		long lw = 0;
+		for (j = i; j < n; j++)
+		{
+			uint64_t c;
+			lw += (j > i ? k->boxes[j - 1].g : 0) + k->boxes[j].w;
+			if (lw > width && j > i)
+				break;
+			c = j == n - 1 || lw >= width ? 0 : (uint64_t) (width - lw) * (width - lw);
+			if (cost[i] + c < cost[j + 1])
+			{
+				cost[j + 1] = cost[i] + c;
+				prev[j + 1] = i;
+			}
+		}
+	}
+	/* the lines come out backwards */
+	for (j = n; j > 0; j = prev[j])
+		ly_push(out, k->boxes[prev[j]].start, k->boxes[j - 1].end);
+	if (out->nomem)
+		return;
+	for (i = first, j = out->n - 1; i < j; i++, j--)
+	{
+		uint32_t t = out->start[i];
+		out->start[i] = out->start[j];
+		out->start[j] = t;
+		t = out->end[i];
+		out->end[i] = out->end[j];
+		out->end[j] = t;
+	}
+}
+
+/* lay out the text s[from, to), which starts a paragraph */
+static void
+ly_run(ly_work *k, ly_lines *out, const char *s, uint32_t from, uint32_t to,
+	int width, int mode)
+{
+	for (;;)
+	{
+		const char *nl = memchr(s + from, '\n', to - from);
+		uint32_t end = nl ? (uint32_t) (nl - s) : to;
+		uint32_t pend = end > from && s[end - 1] == '\r' ? end - 1 : end;
+
+		ly_boxes(k, s, from, pend, width);
+		if (k->nboxes == 0)
+			ly_push(out, from, from);
+		else if (mode == LAYOUT_BALANCED)
+			ly_balanced(k, out, width);
+		else
+			ly_greedy(k, out, width);
+		if (k->nomem)
+			out->nomem = 1;
+		if (!nl || out->nomem)
+			break;
+		/* a final newline ends the last line, it starts none */
+		if ((from = end + 1) == to)
+			break;
+	}
+}
+
+
+/* ======== *
+ * Threads. *
+ * ======== */
+
+static void
+ly_chunkjob(void *ctx, int i)
+{
+	ly_par *p = ctx;
+	ly_chunk *c = &p->chunks[p->order[i]];
+	ly_work k;
+	int quit;
+
+	pthread_mutex_lock(&p->mu);
+	quit = p->quit;
+	pthread_mutex_unlock(&p->mu);
+	memset(&k, 0, sizeof k);
+	if (!quit)
+		ly_run(&k, &c->out, p->s, c->from, c->to, p->width, p->mode);
+	ly_freework(&k);
+	pthread_mutex_lock(&p->mu);
+	c->done = 1;
+	p->ndone++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mu);
+}
+
+static void *
+ly_driver(void *arg)
+{
+	ly_par *p = arg;
+	pool_run(&p->pool, ly_chunkjob, p, p->nchunks);
+	return NULL;
+}
+
+static void
+ly_waitchunk(ly_par *p, int c)
+{
+	pthread_mutex_lock(&p->mu);
+	while (!p->chunks[c].done)
+		pthread_cond_wait(&p->cond, &p->mu);
+	pthread_mutex_unlock(&p->mu);
+}
+
+/* stop the threads of a layout, and free what they made */
+static void
+ly_stop(lc_layout *ly)
+{
+	ly_par *p = ly->par;
+	int i;
+
+	if (!p)
+		return;
+	pthread_mutex_lock(&p->mu);
+	p->quit = 1;
+	pthread_mutex_unlock(&p->mu);
+	pthread_join(p->driver, NULL);
+	pool_free(&p->pool);
+	for (i = 0; i < p->nchunks; i++)
+		ly_freelines(&p->chunks[i].out);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mu);
+	free(p->chunks);
+	free(p->order);
+	free(p);
+	ly->par = NULL;
+}
+
+/* wait for all chunks, and join their lines; returns 0 if out of memory */
+static int
+ly_finish(lc_layout *ly)
+{
+	ly_par *p = ly->par;
+	int i, ok = 1;
+
+	if (!p)
+		return !ly->breaks.nomem;
+	for (i = 0; i < p->nchunks; i++)
+		ly_waitchunk(p, i);
+	for (i = 0; i < p->nchunks && ok; i++)
+	{
+		ly_lines *out = &p->chunks[i].out;
+		size_t j;
+		if (out->nomem)
+			ok = 0;
+		for (j = 0; j < out->n && ok; j++)
+			ly_push(&ly->breaks, out->start[j], out->end[j]);
+		ok = ok && !ly->breaks.nomem;
+	}
+	ly_stop(ly);
+	if (!ok)
+		ly->breaks.nomem = 1;
+	return ok;
+}
+
+/*
+** Start laying out ly on nthreads threads, in chunks of paragraphs; the
+** chunk holding byte at is taken first.  Returns the number of chunks,
+** 0 if the text makes only one, or -1 if out of resources.
+*/
+static int
+ly_start(lc_layout *ly, int nthreads, size_t at)
+{
+	ly_par *p;
+	uint32_t from = 0;
+	int n = 0, cap = 0, i, first = 0;
+	sigset_t set, old;
+
+	if (ly->len <= LAYOUT_CHUNK || nthreads < 1)
+		return 0;
+	if (!(p = calloc(1, sizeof *p)))
+		return -1;
+	while (from < ly->len)
+	{
+		/* a chunk ends with a paragraph */
+		const char *nl = ly->len - from > LAYOUT_CHUNK
+			? memchr(ly->s + from + LAYOUT_CHUNK, '\n', ly->len - from - LAYOUT_CHUNK) : NULL;
+		uint32_t to = nl ? (uint32_t) (nl - ly->s) + 1 : ly->len;
+
+		if (n == cap)
+		{
+			void *c = realloc(p->chunks, (cap = cap ? cap * 2 : 16) * sizeof *p->chunks);
+			if (!c)
+				goto nomem;
+			p->chunks = c;
+		}
+		memset(&p->chunks[n], 0, sizeof *p->chunks);
+		p->chunks[n].from = from;
+		p->chunks[n].to = to;
+		if (at >= from && at < to)
+			first = n;
+		n++;
+		from = to;
+	}
+	if (n < 2)
+	{
+		free(p->chunks);
+		free(p);
+		return 0;
+	}
+	if (!(p->order = malloc(n * sizeof *p->order)))
+		goto nomem;
+	p->order[0] = first;
+	for (i = 0; i < n; i++)
+		if (i != first)
+			p->order[i < first ? i + 1 : i] = i;
+	p->nchunks = n;
+	p->s = ly->s;
+	p->width = ly->width;
+	p->mode = ly->mode;
+	pthread_mutex_init(&p->mu, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	/* signals are for the Lua thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old);
+	if (pool_init(&p->pool, nthreads) == 0)
+	{
+		if (pthread_create(&p->driver, NULL, ly_driver, p) == 0)
+		{
+			pthread_sigmask(SIG_SETMASK, &old, NULL);
+			ly->par = p;
+			return n;
+		}
+		pool_free(&p->pool);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mu);
+nomem:
+	free(p->chunks);
+	free(p->order);
+	free(p);
+	return -1;
+}
+
+/* the lines of part c of ly, once they are done; NULL past the end */
+static ly_lines *
+ly_part(lc_layout *ly, int c)
+{
+	if (!ly->par)
+		return c == 0 ? &ly->breaks : NULL;
+	if (c >= ly->par->nchunks)
+		return NULL;
+	ly_waitchunk(ly->par, c);
+	return &ly->par->chunks[c].out;
+}
+
+/* the part of ly holding byte b */
+static int
+ly_partof(lc_layout *ly, uint32_t b)
+{
+	int lo = 0, hi;
+
+	if (!ly->par)
+		return 0;
+	hi = ly->par->nchunks - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (ly->par->chunks[mid].from <= b)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* the last line of l starting at or before byte b */
+static size_t
+ly_find(ly_lines *l, uint32_t b)
+{
+	size_t lo = 0, hi = l->n ? l->n - 1 : 0;
+
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi + 1) / 2;
+		if (l->start[mid] <= b)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+
+/* ========== *
+ * The cache. *
+ * ========== */
+
+/* push the cache of this Lua state, creating it if needed */
+static ly_cache *
+ly_getcache(lua_State *L)
+{
+	ly_cache *c;
+
+	lua_pushstring(L, LAYOUT_CACHE);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if ((c = lua_touserdata(L, -1)) != NULL)
+		return c;
+	lua_pop(L, 1);
+	c = lua_newuserdata(L, sizeof *c);
+	memset(c, 0, sizeof *c);
+	lua_createtable(L, LAYOUT_NCACHE, 0);
+	lua_setuservalue(L, -2);
+	lua_pushstring(L, LAYOUT_CACHE);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+	return c;
+}
+
+/* push the cached layout of str, or return 0 */
+static int
+ly_lookup(lua_State *L, int str, int width, int mode)
+{
+	size_t len;
+	const char *s = lua_tolstring(L, str, &len);
+	ly_cache *c = ly_getcache(L);
+	int i;
+
+	for (i = 0; i < LAYOUT_NCACHE; i++)
+	{
+		lc_layout *ly = c->ly[i];
+		if (ly && ly->len == len && ly->width == width && ly->mode == mode
+			&& (ly->s == s || memcmp(ly->s, s, len) == 0))
+		{
+			c->used[i] = ++c->clock;
+			lua_getuservalue(L, -1);
+			lua_rawgeti(L, -1, i + 1);
+			lua_replace(L, -3);
+			lua_pop(L, 1);
+			return 1;
+		}
+	}
+	lua_pop(L, 1);
+	return 0;
+}
+
+/*
+** Keep the layout at narg, dropping the least recently used ones until
+** there is a free slot and the text of all fits in LAYOUT_CACHEBYTES.
+*/
+static void
+ly_remember(lua_State *L, int narg)
+{
+	lc_layout *ly = lua_touserdata(L, narg);
+	ly_cache *c;
+	int i, slot, lru;
+
+	if (ly->len > LAYOUT_CACHEBYTES)
+		return;
+	c = ly_getcache(L);
+	lua_getuservalue(L, -1);
+	for (;;)
+	{
+		for (i = 0, slot = lru = -1; i < LAYOUT_NCACHE; i++)
+			if (c->ly[i] == NULL)
+				slot = i;
+			else if (lru < 0 || c->used[i] < c->used[lru])
+				lru = i;
+		if (slot >= 0 && c->bytes + ly->len <= LAYOUT_CACHEBYTES)
+			break;
+		c->bytes -= c->ly[lru]->len;
+		c->ly[lru] = NULL;
+		lua_pushnil(L);
+		lua_rawseti(L, -2, lru + 1);
+	}
+	c->ly[slot] = ly;
+	c->used[slot] = ++c->clock;
+	c->bytes += ly->len;
+	lua_pushvalue(L, narg);
+	lua_rawseti(L, -2, slot + 1);
+	lua_pop(L, 2);
+}
+
+
+/* =========== *
+ * Lua access. *
+ * =========== */
+
+static lc_layout *
+checklayout(lua_State *L, int narg)
+{
+	return (lc_layout *) luaL_checkudata(L, narg, LAYOUT_META);
+}
+
+/* the layout at narg, with all its lines */
+static lc_layout *
+checkdone(lua_State *L, int narg)
+{
+	lc_layout *ly = checklayout(L, narg);
+	if (!ly_finish(ly))
+		luaL_error(L, "malloc failed");
+	return ly;
+}
+
+static int
+checkmode(lua_State *L, int narg)
+{
+	const char *mode = "greedy";
+
+	if (!lua_isnoneornil(L, narg))
+	{
+		luaL_checktype(L, narg, LUA_TTABLE);
+		mode = optstringfield(L, narg, "mode", mode);
+	}
+	if (strcmp(mode, "greedy") == 0)
+		return LAYOUT_GREEDY;
+	if (strcmp(mode, "balanced") == 0)
+		return LAYOUT_BALANCED;
+	return luaL_argerror(L, narg, "mode should be \"greedy\" or \"balanced\"");
+}
+
+/* create the layout of the string at str, and leave it on the stack */
+static lc_layout *
+ly_new(lua_State *L, int str, int width, int mode)
+{
+	lc_layout *ly = lua_newuserdata(L, sizeof *ly);
+
+	memset(ly, 0, sizeof *ly);
+	ly->s = lua_tolstring(L, str, &ly->len);
+	ly->width = width;
+	ly->mode = mode;
+	luaL_setmetatable(L, LAYOUT_META);
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, str);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+	return ly;
+}
+
+
+/***
+Break a text into lines.
+@function wrap
+@string str utf8 text
+@int width number of columns of a line
+@tparam[opt] table opts options:
+
+ - `mode`: `"greedy"` (the default) fills each line as far as it goes;
+   `"balanced"` evens out the lines of each paragraph, minimizing the
+   sum of the squares of the room left at their ends
+ - `threads`: threads to lay out a big text on, by default one per
+   processor; the text is cut into parts at newlines, which are laid
+   out in parallel
+ - `at`: byte of the text that will be shown first, 1 by default; its
+   part is laid out first, and wrap returns as soon as it is done, so
+   that @{view} can draw it while the rest is still being laid out
+@treturn layout the lines of *str*
+@usage
+  doc = curses.layout.wrap (text, 60, {mode = "balanced"})
+  doc = curses.layout.wrap (book, cols, {at = bookmark})
+  doc:view (win, bookmark)
+*/
+static int
+Ywrap(lua_State *L)
+{
+	size_t len;
+	int width = checkint(L, 2);
+	int mode = checkmode(L, 3);
+	int nthreads = pool_ncpus();
+	lua_Integer at = 1;
+	lc_layout *ly;
+	ly_work k;
+
+	luaL_checklstring(L, 1, &len);
+	luaL_argcheck(L, width > 0, 2, "width should > 0");
+	luaL_argcheck(L, len < UINT32_MAX, 1, "text too long");
+	if (lua_istable(L, 3))
+	{
+		nthreads = optintfield(L, 3, "threads", nthreads);
+		at = optintfield(L, 3, "at", 1);
+		luaL_argcheck(L, nthreads > 0, 3, "threads should > 0");
+	}
+	if (ly_lookup(L, 1, width, mode))
+		return 1;
+
+	ly = ly_new(L, 1, width, mode);
+	if (nthreads > 1)
+	{
+		int n = ly_start(ly, nthreads, at > 0 ? (size_t) at - 1 : 0);
+		if (n < 0)
+			return luaL_error(L, "malloc failed");
+		if (n > 0)
+		{
+			/* the rest is laid out while the caller shows this part */
+			ly_waitchunk(ly->par, ly->par->order[0]);
+			ly_remember(L, lua_gettop(L));
+			return 1;
+		}
+	}
+	memset(&k, 0, sizeof k);
+	ly_run(&k, &ly->breaks, ly->s, 0, ly->len, width, mode);
+	ly_freework(&k);
+	if (ly->breaks.nomem)
+		return luaL_error(L, "malloc failed");
+	ly_remember(L, lua_gettop(L));
+	return 1;
+}
+
+
+/***
+Number of lines.
+@function lines
+@treturn int number of lines
+*/
+static int
+Ylines(lua_State *L)
+{
+	lc_layout *ly = checkdone(L, 1);
+	return pushintresult(ly->breaks.n);
+}
+
+
+/***
+Width the text was wrapped to.
+@function width
+@treturn int number of columns
+*/
+static int
+Ywidth(lua_State *L)
+{
+	lc_layout *ly = checklayout(L, 1);
+	return pushintresult(ly->width);
+}
+
+
+/***
+Where a line is in the text.
+@function line
+@int i line number, from 1
+@treturn int first byte of the line, for `string.sub`
+@treturn int last byte of the line, without trailing spaces and newline
+@treturn int display width of the line
+@usage
+  print (text:sub (doc:line (i)))
+*/
+static int
+Yline(lua_State *L)
+{
+	lc_layout *ly = checkdone(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+	uint32_t start, end;
+
+	if (i < 1 || (size_t) i > ly->breaks.n)
+		return 0;
+	start = ly->breaks.start[i - 1];
+	end = ly->breaks.end[i - 1];
+	lua_pushinteger(L, start + 1);
+	lua_pushinteger(L, end);
+	lua_pushinteger(L, width_utf8(ly->s + start, ly->s + end, -1, NULL));
+	return 3;
+}
+
+
+/***
+All break offsets.
+@function offsets
+@treturn table first byte of each line
+@treturn table last byte of each line
+*/
+static int
+Yoffsets(lua_State *L)
+{
+	lc_layout *ly = checkdone(L, 1);
+	size_t i;
+
+	lua_createtable(L, ly->breaks.n, 0);
+	lua_createtable(L, ly->breaks.n, 0);
+	for (i = 0; i < ly->breaks.n; i++)
+	{
+		lua_pushinteger(L, ly->breaks.start[i] + 1);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushinteger(L, ly->breaks.end[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+
+
+/***
+Whether all lines are laid out.
+Methods other than @{view} and @{ready} wait for them.
+@function ready
+@treturn bool true when the layout is complete
+*/
+static int
+Yready(lua_State *L)
+{
+	lc_layout *ly = checklayout(L, 1);
+	int ready = 1;
+
+	if (ly->par)
+	{
+		pthread_mutex_lock(&ly->par->mu);
+		ready = ly->par->ndone == ly->par->nchunks;
+		pthread_mutex_unlock(&ly->par->mu);
+	}
+	return pushboolresult(ready);
+}
+
+
+/***
+The line holding a byte of the text.
+@function line_at
+@int b byte offset, from 1
+@treturn int line number
+*/
+static int
+Yline_at(lua_State *L)
+{
+	lc_layout *ly = checkdone(L, 1);
+	lua_Integer b = luaL_checkinteger(L, 2);
+
+	luaL_argcheck(L, b >= 1, 2, "byte should > 0");
+	if (ly->breaks.n == 0)
+		return 0;
+	return pushintresult(ly_find(&ly->breaks,
+		b - 1 < (lua_Integer) ly->len ? (uint32_t) (b - 1) : (uint32_t) ly->len) + 1);
+}
+
+/***
+Draw lines into a window.
+The window is filled from its top line, so a window region is drawn
+into through a @{curses.window:derive}d window; lines past the end of
+the text are cleared.  The window is not refreshed.
+@function draw
+@tparam curses.window win target window
+@int[opt=1] first first line to show
+@int[opt=A_NORMAL] attrs attributes of the text
+@treturn int number of lines drawn
+*/
+static int
+Ydraw(lua_State *L)
+{
+	lc_layout *ly = checkdone(L, 1);
+	WINDOW *w = checkwin(L, 2);
+	lua_Integer first = luaL_optinteger(L, 3, 1) - 1;
+	attr_t attrs = (attr_t) optint(L, 4, A_NORMAL);
+	int nlines = getmaxy(w), ncols = getmaxx(w), y, n = 0;
+	cchar_t *buf;
+
+	luaL_argcheck(L, first >= 0, 3, "first should > 0");
+	if (!(buf = malloc((ncols > 0 ? ncols : 1) * sizeof *buf)))
+		return luaL_error(L, "malloc failed");
+	for (y = 0; y < nlines; y++)
+	{
+		size_t i = first + y;
+		if (i < ly->breaks.n)
+		{
+			fv_drawline(buf, w, y, ly->s + ly->breaks.start[i],
+				ly->s + ly->breaks.end[i], 0, attrs);
+			n++;
+		}
+		else
+		{
+			wmove(w, y, 0);
+			wclrtoeol(w);
+		}
+	}
+	free(buf);
+	return pushintresult(n);
+}
+
+
+/***
+Draw the text from a byte on.
+Like @{draw}, but the window starts with the line holding byte *b*, and
+waits only for the parts of the layout it shows, so it can be called
+right after @{wrap} on a big text.
+@function view
+@tparam curses.window win target window
+@int b byte offset, from 1
+@int[opt=A_NORMAL] attrs attributes of the text
+@treturn int first byte of the top line
+@treturn int number of lines drawn
+*/
+static int
+Yview(lua_State *L)
+{
+	lc_layout *ly = checklayout(L, 1);
+	WINDOW *w = checkwin(L, 2);
+	lua_Integer b = luaL_checkinteger(L, 3) - 1;
+	attr_t attrs = (attr_t) optint(L, 4, A_NORMAL);
+	int nlines = getmaxy(w), ncols = getmaxx(w), y, n = 0, c;
+	uint32_t top = 0;
+	ly_lines *l;
+	size_t i;
+	cchar_t *buf;
+
+	luaL_argcheck(L, b >= 0, 3, "byte should > 0");
+	if (b > (lua_Integer) ly->len)
+		b = ly->len;
+	c = ly_partof(ly, (uint32_t) b);
+	l = ly_part(ly, c);
+	if (l->nomem)
+		return luaL_error(L, "malloc failed");
+	i = ly_find(l, (uint32_t) b);
+	if (!(buf = malloc((ncols > 0 ? ncols : 1) * sizeof *buf)))
+		return luaL_error(L, "malloc failed");
+	for (y = 0; y < nlines; y++)
+	{
+		while (l && i >= l->n)
+		{
+			if ((l = ly_part(ly, ++c)) != NULL && l->nomem)
+			{
+				free(buf);
+				return luaL_error(L, "malloc failed");
+			}
+			i = 0;
+		}
+		if (l)
+		{
+			if (n++ == 0)
+				top = l->start[i];
+			fv_drawline(buf, w, y, ly->s + l->start[i], ly->s + l->end[i], 0, attrs);
+			i++;
+		}
+		else
+		{
+			wmove(w, y, 0);
+			wclrtoeol(w);
+		}
+	}
+	free(buf);
+	lua_pushinteger(L, top + 1);
+	lua_pushinteger(L, n);
+	return 2;
+}
+
+
+/***
+Copy lines into chstrs.
+@function chstrs
+@int[opt=1] first first line to copy
+@int[opt] n number of lines, up to the last line by default
+@int[opt=A_NORMAL] attrs attributes of the text
+@treturn table a @{curses.chstr} for each line
+*/
+static int
+Ychstrs(lua_State *L)
+{
+	lc_layout *ly = checkdone(L, 1);
+	lua_Integer first = luaL_optinteger(L, 2, 1) - 1;
+	lua_Integer n = luaL_optinteger(L, 3, (lua_Integer) ly->breaks.n - first);
+	int attr = optint(L, 4, A_NORMAL);
+	lua_Integer i;
+
+	luaL_argcheck(L, first >= 0, 2, "first should > 0");
+	if (first + n > (lua_Integer) ly->breaks.n)
+		n = ly->breaks.n - first;
+	lua_createtable(L, n > 0 ? n : 0, 0);
+	for (i = 0; i < n; i++)
+	{
+		uint32_t start = ly->breaks.start[first + i];
+		uint32_t end = ly->breaks.end[first + i];
+		chstr *cs = end > start ? chstr_new(ly->s + start, end - start, attr) : NULL;
+
+		if (!cs && (cs = chstr_new_by_size(1)) != NULL)
+			cs->len = 0;	/* an empty line, or not UTF-8 */
+		if (!cs)
+			return luaL_error(L, "malloc failed");
+		*(chstr **)lua_newuserdata(L, sizeof(chstr *)) = cs;
+		luaL_setmetatable(L, CHSTR_META);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+
+/***
+Free the lines.
+@function __gc
+*/
+static int
+Y__gc(lua_State *L)
+{
+	lc_layout *ly = checklayout(L, 1);
+	ly_stop(ly);
+	ly_freelines(&ly->breaks);
+	return 0;
+}
+
+
+static const luaL_Reg curses_layout_fns[] =
+{
+	LCURSES_FUNC( Ychstrs		),
+	LCURSES_FUNC( Ydraw		),
+	LCURSES_FUNC( Yline		),
+	LCURSES_FUNC( Yline_at		),
+	LCURSES_FUNC( Ylines		),
+	LCURSES_FUNC( Yoffsets		),
+	LCURSES_FUNC( Yready		),
+	LCURSES_FUNC( Yview		),
+	LCURSES_FUNC( Ywidth		),
+	LCURSES_FUNC( Ywrap		),
+	LCURSES_FUNC( Y__gc		),
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_layout(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_layout_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, LAYOUT_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesLayout");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesLayout" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.layout..." */
+	lua_pushliteral(L, "curses.layout for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_LAYOUT_C*/
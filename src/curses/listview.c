@@ -0,0 +1,529 @@
+/* */
+
+/***
+ Virtual list views.
+
+ A listview shows a window's worth of a list of any length, with one
+ selected item.  Items are numbered from 1.  The text of an item is
+ asked from the provider only when the item scrolls into view or is
+ invalidated, and moving the selection by one line past the edge
+ scrolls the window with @{curses.window:scrl} and draws one new row:
+
+     local lv = curses.listview (win, #procs, function (i)
+       local p = procs[i]
+       return ("%6d %s"):format (p.pid, p.name), p.zombie and curses.A_DIM
+     end)
+     lv:move (1)                     -- down arrow
+     win:refresh ()
+
+ The provider returns the item as a UTF-8 string and, optionally, its
+ attributes; instead of a function, the provider can be a table of
+ strings.  The selected item is shown in reverse video.
+
+@classmod curses.listview
+*/
+
+#ifndef LCURSES_LISTVIEW_C
+#define LCURSES_LISTVIEW_C 1
+
+#include "_helpers.c"
+#include "fileview.c"
+
+
+static const char *LISTVIEW_META = "curses:listview";
+
+/* a visible item; item n is kept in slot n % vlines */
+typedef struct lw_row {
+	long item;		/* -1 if not fetched */
+	char *s;
+	size_t len;
+	attr_t attrs;
+} lw_row;
+
+typedef struct lc_listview {
+	long count, top, sel;	/* from 0 */
+	lw_row *rows;
+	int vlines, vcols;	/* size of the window when drawn */
+	int busy;		/* calling the provider */
+	unsigned long fetched;	/* items asked from the provider */
+	cchar_t *buf;
+} lc_listview;
+
+
+static lc_listview *
+checklistview(lua_State *L, int narg)
+{
+	lc_listview *v = (lc_listview *) luaL_checkudata(L, narg, LISTVIEW_META);
+	if (v->buf == NULL)
+		luaL_argerror(L, narg, "attempt to use closed listview");
+	if (v->busy)
+		luaL_argerror(L, narg, "attempt to use listview from its provider");
+	return v;
+}
+
+/* the window of the listview at narg */
+static WINDOW *
+lw_window(lua_State *L, int narg)
+{
+	WINDOW *w;
+
+	lua_getuservalue(L, narg);
+	lua_rawgeti(L, -1, 1);
+	w = checkwin(L, -1);
+	lua_pop(L, 2);
+	return w;
+}
+
+static void
+lw_forget(lc_listview *v)
+{
+	int i;
+	if (v->rows)
+		for (i = 0; i < v->vlines; i++)
+		{
+			free(v->rows[i].s);
+			v->rows[i].s = NULL;
+			v->rows[i].item = -1;
+		}
+}
+
+/* ask the provider of the listview at narg for item n */
+static void
+lw_fetch(lua_State *L, int narg, lc_listview *v, lw_row *r, long n)
+{
+	const char *s = "";
+	size_t len = 0;
+	char *copy;
+	int top = lua_gettop(L);
+
+	r->item = -1;
+	lua_getuservalue(L, narg);
+	lua_rawgeti(L, -1, 2);
+	if (lua_type(L, -1) == LUA_TFUNCTION)
+	{
+		lua_pushinteger(L, n + 1);
+		v->busy = 1;
+		if (lua_pcall(L, 1, 2, 0) != 0)
+		{
+			v->busy = 0;
+			lua_error(L);
+		}
+		v->busy = 0;
+	}
+	else
+	{
+		lua_rawgeti(L, -1, n + 1);
+		lua_pushnil(L);
+	}
+	if (lua_isstring(L, -2))
+		s = lua_tolstring(L, -2, &len);
+	else if (!lua_isnil(L, -2))
+		luaL_error(L, "listview provider returned a %s", luaL_typename(L, -2));
+	if (!(copy = malloc(len + 1)))
+		luaL_error(L, "malloc failed");
+	memcpy(copy, s, len);
+	free(r->s);
+	r->s = copy;
+	r->len = len;
+	r->attrs = (attr_t) lua_tointeger(L, -1);
+	r->item = n;
+	v->fetched++;
+	lua_settop(L, top);
+}
+
+/* draw line y of the window, fetching its item if needed */
+static void
+lw_drawrow(lua_State *L, int narg, lc_listview *v, WINDOW *w, int y)
+{
+	long n = v->top + y;
+	lw_row *r;
+
+	if (n >= v->count)
+	{
+		wmove(w, y, 0);
+		wclrtoeol(w);
+		return;
+	}
+	r = &v->rows[n % v->vlines];
+	if (r->item != n)
+		lw_fetch(L, narg, v, r, n);
+	fv_drawline(v->buf, w, y, r->s, r->s + r->len, 0,
+		n == v->sel ? r->attrs | A_REVERSE : r->attrs);
+}
+
+/*
+** Show the items from top on, with the selection moved from oldsel.  A
+** move by less than a screenful scrolls the window, and only the rows
+** scrolled in and the rows of the old and new selection are drawn.
+*/
+static void
+lw_show(lua_State *L, int narg, lc_listview *v, WINDOW *w, long top, long oldsel)
+{
+	int nlines = getmaxy(w), ncols = getmaxx(w), y;
+	long d = top - v->top;
+
+	if (nlines != v->vlines || ncols != v->vcols)
+	{
+		lw_row *rows;
+		cchar_t *buf;
+
+		lw_forget(v);
+		if (!(rows = realloc(v->rows, nlines * sizeof *rows)))
+			luaL_error(L, "malloc failed");
+		v->rows = rows;
+		for (y = 0; y < nlines; y++)
+		{
+			rows[y].item = -1;
+			rows[y].s = NULL;
+		}
+		if (!(buf = realloc(v->buf, (ncols > 0 ? ncols : 1) * sizeof *buf)))
+			luaL_error(L, "malloc failed");
+		v->buf = buf;
+		v->vlines = nlines;
+		v->vcols = ncols;
+		wsetscrreg(w, 0, nlines - 1);
+		d = nlines;		/* redraw everything */
+	}
+
+	if (d >= v->vlines || -d >= v->vlines)
+	{
+		v->top = top;
+		for (y = 0; y < v->vlines; y++)
+			lw_drawrow(L, narg, v, w, y);
+		return;
+	}
+	if (d != 0)
+		wscrl(w, d);
+	v->top = top;
+	for (y = d > 0 ? v->vlines - d : 0; y < (d > 0 ? v->vlines : -d); y++)
+		lw_drawrow(L, narg, v, w, y);
+	/* the selection, unless just drawn */
+	if (oldsel != v->sel)
+	{
+		long lo = d > 0 ? top + v->vlines - d : top;
+		long hi = d > 0 ? top + v->vlines : top - d;
+		if (oldsel >= top && oldsel < top + v->vlines && (oldsel < lo || oldsel >= hi))
+			lw_drawrow(L, narg, v, w, oldsel - top);
+		if (v->sel >= top && v->sel < top + v->vlines && (v->sel < lo || v->sel >= hi))
+			lw_drawrow(L, narg, v, w, v->sel - top);
+	}
+}
+
+/* select item sel, scrolling as little as needed to show it */
+static void
+lw_select(lua_State *L, int narg, lc_listview *v, long sel)
+{
+	WINDOW *w = lw_window(L, narg);
+	long oldsel = v->sel, top = v->top, h = getmaxy(w);
+
+	if (sel >= v->count)
+		sel = v->count - 1;
+	if (sel < 0)
+		sel = 0;
+	v->sel = sel;
+	if (sel < top)
+		top = sel;
+	else if (sel >= top + h)
+		top = sel - h + 1;
+	/* no blank rows below the list while it fills the window */
+	if (top > v->count - h)
+		top = v->count - h;
+	if (top < 0)
+		top = 0;
+	lw_show(L, narg, v, w, top, oldsel);
+	if (v->count > 0)
+		wmove(w, v->sel - v->top, 0);
+}
+
+static long
+checkcount(lua_State *L, int narg)
+{
+	lua_Integer count = luaL_checkinteger(L, narg);
+	luaL_argcheck(L, count >= 0, narg, "count should >= 0");
+	return (long) count;
+}
+
+
+static int
+create_listview(lua_State *L, int narg)
+{
+	WINDOW *w = checkwin(L, narg);
+	long count = checkcount(L, narg + 1);
+	int t = lua_type(L, narg + 2);
+	lc_listview *v;
+
+	luaL_argcheck(L, t == LUA_TFUNCTION || t == LUA_TTABLE, narg + 2,
+		"function or table expected");
+	v = lua_newuserdata(L, sizeof *v);
+	memset(v, 0, sizeof *v);
+	v->vlines = -1;
+	v->count = count;
+	luaL_setmetatable(L, LISTVIEW_META);
+	if (!(v->buf = malloc(sizeof *v->buf)))
+		return luaL_error(L, "malloc failed");
+
+	lua_createtable(L, 2, 0);
+	lua_pushvalue(L, narg);
+	lua_rawseti(L, -2, 1);
+	lua_pushvalue(L, narg + 2);
+	lua_rawseti(L, -2, 2);
+	lua_setuservalue(L, -2);
+
+	scrollok(w, TRUE);
+	idlok(w, TRUE);
+	lw_select(L, lua_gettop(L), v, 0);
+	return 1;
+}
+
+
+/***
+Create a listview in a window.
+The first item is selected.
+@function __call
+@tparam curses.window win window to show the list in
+@int count number of items
+@tparam function|table provider called with an item number, returns the
+  item and optionally its attributes; or a table of items
+@treturn listview a new listview
+@usage
+  lv = curses.listview (win, #results, results)
+*/
+static int
+I__call(lua_State *L)
+{
+	return create_listview(L, 2);
+}
+
+
+/***
+Move the selection.
+The view scrolls to keep the selection shown.  The window is updated,
+but not refreshed.
+@function move
+@int n number of items to move down, or up if negative
+@treturn int the selected item, or `nil` if the list is empty
+*/
+static int
+Imove(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+
+	lw_select(L, 1, v, v->sel + (long) n);
+	if (v->count == 0)
+		return 0;
+	return pushintresult(v->sel + 1);
+}
+
+
+/***
+Select an item.
+@function select
+@int i item to select, clamped to the list
+@treturn int the selected item, or `nil` if the list is empty
+*/
+static int
+Iselect(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+
+	lw_select(L, 1, v, (long) i - 1);
+	if (v->count == 0)
+		return 0;
+	return pushintresult(v->sel + 1);
+}
+
+
+/***
+The selected item.
+@function selected
+@treturn int the selected item, or `nil` if the list is empty
+*/
+static int
+Iselected(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+
+	if (v->count == 0)
+		return 0;
+	return pushintresult(v->sel + 1);
+}
+
+
+/***
+The first item shown.
+@function top
+@treturn int item on the first line of the window
+*/
+static int
+Itop(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	return pushintresult(v->top + 1);
+}
+
+
+/***
+Change the number of items.
+Only rows of items added or removed are drawn again.
+@function set_count
+@int count new number of items
+*/
+static int
+Iset_count(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	long count = checkcount(L, 2);
+	WINDOW *w = lw_window(L, 1);
+	long from = count < v->count ? count : v->count;
+	long to = count < v->count ? v->count : count;
+	long y;
+
+	v->count = count;
+	for (y = from - v->top; y < to - v->top && y < v->vlines; y++)
+		if (y >= 0)
+		{
+			v->rows[(v->top + y) % v->vlines].item = -1;
+			lw_drawrow(L, 1, v, w, (int) y);
+		}
+	lw_select(L, 1, v, v->sel);
+	return 0;
+}
+
+
+/***
+Fetch items again.
+@function invalidate
+@int[opt] i the item which changed, all items if `nil`
+*/
+static int
+Iinvalidate(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	WINDOW *w = lw_window(L, 1);
+
+	if (lua_isnoneornil(L, 2))
+	{
+		lw_forget(v);
+		v->vlines = -1;
+		lw_show(L, 1, v, w, v->top, v->sel);
+	}
+	else
+	{
+		lua_Integer i = luaL_checkinteger(L, 2) - 1;
+		if (i >= v->top && i < v->top + v->vlines && i < v->count)
+		{
+			v->rows[i % v->vlines].item = -1;
+			lw_drawrow(L, 1, v, w, (int) (i - v->top));
+		}
+	}
+	return 0;
+}
+
+
+/***
+Redraw the whole view.
+Needed after the window was cleared or resized behind the listview's
+back; items are not fetched again.
+@function redraw
+*/
+static int
+Iredraw(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	WINDOW *w = lw_window(L, 1);
+	int y;
+
+	if (getmaxy(w) != v->vlines || getmaxx(w) != v->vcols)
+		lw_select(L, 1, v, v->sel);
+	else
+		for (y = 0; y < v->vlines; y++)
+			lw_drawrow(L, 1, v, w, y);
+	return 0;
+}
+
+
+/***
+Number of items asked from the provider so far.
+@function fetched
+@treturn int number of provider calls
+*/
+static int
+Ifetched(lua_State *L)
+{
+	lc_listview *v = checklistview(L, 1);
+	return pushintresult(v->fetched);
+}
+
+
+/***
+Free the items shown.
+The window is left as it is.
+@function close
+*/
+static int
+Iclose(lua_State *L)
+{
+	lc_listview *v = (lc_listview *) luaL_checkudata(L, 1, LISTVIEW_META);
+
+	lw_forget(v);
+	free(v->rows);
+	v->rows = NULL;
+	free(v->buf);
+	v->buf = NULL;
+	return 0;
+}
+
+
+static const luaL_Reg curses_listview_fns[] =
+{
+	LCURSES_FUNC( Iclose		),
+	LCURSES_FUNC( Ifetched		),
+	LCURSES_FUNC( Iinvalidate	),
+	LCURSES_FUNC( Imove		),
+	LCURSES_FUNC( Iredraw		),
+	LCURSES_FUNC( Iselect		),
+	LCURSES_FUNC( Iselected		),
+	LCURSES_FUNC( Iset_count	),
+	LCURSES_FUNC( Itop		),
+	{"__gc",     Iclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_listview(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_listview_fns);
+	t = lua_gettop(L);
+
+	lua_createtable(L, 0, 1);		/* u = {} */
+	lua_pushcfunction(L, I__call);
+	lua_setfield(L, -2, "__call");		/* u.__call = I__call */
+	lua_setmetatable(L, -2);		/* setmetatable (t, u) */
+
+	luaL_newmetatable(L, LISTVIEW_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesListview");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesListview" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.listview..." */
+	lua_pushliteral(L, "curses.listview for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_LISTVIEW_C*/
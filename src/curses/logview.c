@@ -0,0 +1,475 @@
+/* */
+
+/***
+ Scrollback log views.
+
+ A logview keeps the last lines appended to it in a ring of fixed
+ capacity, and shows them in a window.  While the view is at the bottom,
+ appending scrolls the window and draws only the new lines; the window
+ is set up with @{curses.window:scrollok}, @{curses.window:idlok} and a
+ scrolling region, so that refreshing it sends the terminal a scroll
+ and the new lines, not a repaint of the whole pane:
+
+     local log = curses.logview (win, 10000)
+     log:append ("started\n")
+     log:append (line, curses.A_BOLD)
+     win:refresh ()
+
+ Each line takes one row of the window; what does not fit is cut off.
+ Tabs and control characters are shown as by @{curses.fileview}.
+
+@classmod curses.logview
+*/
+
+#ifndef LCURSES_LOGVIEW_C
+#define LCURSES_LOGVIEW_C 1
+
+#include "_helpers.c"
+#include "fileview.c"
+
+
+static const char *LOGVIEW_META = "curses:logview";
+
+typedef struct lv_entry {
+	char *s;
+	size_t len;
+	attr_t attrs;
+} lv_entry;
+
+/*
+** Lines are numbered by the order they were appended in, so that
+** dropping the oldest ones does not renumber what is shown.
+*/
+typedef struct lc_logview {
+	lv_entry *ring;
+	int capacity, head, count;	/* head is the oldest line */
+	unsigned long total;		/* lines ever appended */
+	unsigned long top;		/* line shown on the first row */
+	unsigned long end;		/* line after the last one drawn */
+	int pinned;			/* follow appends */
+	int vlines, vcols;		/* size of the window when drawn */
+	cchar_t *buf;
+} lc_logview;
+
+
+static lc_logview *
+checklogview(lua_State *L, int narg)
+{
+	lc_logview *v = (lc_logview *) luaL_checkudata(L, narg, LOGVIEW_META);
+	if (v->ring == NULL)
+		luaL_argerror(L, narg, "attempt to use closed logview");
+	return v;
+}
+
+/* the window of the logview at narg */
+static WINDOW *
+lv_window(lua_State *L, int narg)
+{
+	WINDOW *w;
+
+	lua_getuservalue(L, narg);
+	lua_rawgeti(L, -1, 1);
+	w = checkwin(L, -1);
+	lua_pop(L, 2);
+	return w;
+}
+
+static unsigned long
+lv_oldest(lc_logview *v)
+{
+	return v->total - v->count;
+}
+
+/* the top line when the view is at the bottom */
+static unsigned long
+lv_bottom(lc_logview *v)
+{
+	unsigned long oldest = lv_oldest(v);
+	return v->total - oldest > (unsigned long) v->vlines
+		? v->total - v->vlines : oldest;
+}
+
+static void
+lv_drawrow(lc_logview *v, WINDOW *w, int y)
+{
+	unsigned long n = v->top + y;
+
+	if (n < v->total)
+	{
+		lv_entry *e = &v->ring[(v->head + (n - lv_oldest(v))) % v->capacity];
+		fv_drawline(v->buf, w, y, e->s, e->s + e->len, 0, e->attrs);
+	}
+	else
+	{
+		wmove(w, y, 0);
+		wclrtoeol(w);
+	}
+}
+
+/*
+** Show the lines from top on.  A move by less than a screenful scrolls
+** the window; then only the rows scrolled in, and rows of lines which
+** were not there when last drawn, are drawn.
+*/
+static int
+lv_show(lua_State *L, lc_logview *v, WINDOW *w, unsigned long top)
+{
+	long d = (long) (top - v->top);
+	int nlines = getmaxy(w), ncols = getmaxx(w), y;
+
+	if (nlines != v->vlines || ncols != v->vcols)
+	{
+		cchar_t *buf = realloc(v->buf, (ncols > 0 ? ncols : 1) * sizeof *buf);
+		if (!buf)
+			return luaL_error(L, "malloc failed");
+		v->buf = buf;
+		v->vlines = nlines;
+		v->vcols = ncols;
+		wsetscrreg(w, 0, v->vlines - 1);
+		if (v->pinned)
+			top = lv_bottom(v);
+		d = v->vlines;		/* redraw everything */
+	}
+
+	if (d >= v->vlines || -d >= v->vlines)
+	{
+		v->top = top;
+		for (y = 0; y < v->vlines; y++)
+			lv_drawrow(v, w, y);
+	}
+	else
+	{
+		unsigned long from, to;
+
+		if (d != 0)
+			wscrl(w, d);
+		v->top = top;
+		for (y = 0; y < -d; y++)
+			lv_drawrow(v, w, y);
+		/* lines not drawn before */
+		from = v->end > top ? v->end : top;
+		to = v->total < top + v->vlines ? v->total : top + v->vlines;
+		for (; from < to; from++)
+			lv_drawrow(v, w, from - top);
+	}
+	v->end = v->total < top + v->vlines ? v->total : top + v->vlines;
+	wmove(w, v->end > top ? v->end - top - 1 : 0, 0);
+	return 0;
+}
+
+static void
+lv_clear(lc_logview *v)
+{
+	for (int i = 0; i < v->count; i++)
+		free(v->ring[(v->head + i) % v->capacity].s);
+	v->head = v->count = 0;
+}
+
+
+static int
+create_logview(lua_State *L, int narg)
+{
+	WINDOW *w = checkwin(L, narg);
+	int capacity = checkint(L, narg + 1);
+	lc_logview *v;
+
+	luaL_argcheck(L, capacity > 0, narg + 1, "capacity should > 0");
+	v = lua_newuserdata(L, sizeof *v);
+	memset(v, 0, sizeof *v);
+	luaL_setmetatable(L, LOGVIEW_META);
+	if (!(v->ring = calloc(capacity, sizeof *v->ring)))
+		return luaL_error(L, "malloc failed");
+	v->capacity = capacity;
+	v->pinned = 1;
+	v->vlines = -1;
+
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, narg);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+
+	scrollok(w, TRUE);
+	idlok(w, TRUE);
+	lv_show(L, v, w, 0);
+	return 1;
+}
+
+
+/***
+Create a logview in a window.
+The window is cleared.
+@function __call
+@tparam curses.window win window to show the log in
+@int capacity number of lines to keep
+@treturn logview a new logview, at the bottom
+@usage
+  log = curses.logview (curses.newwin (10, 80, 14, 0), 5000)
+*/
+static int
+L__call(lua_State *L)
+{
+	return create_logview(L, 2);
+}
+
+
+/***
+Append text to the log.
+Each line of *str* becomes a line of the log; a final newline is
+optional.  The oldest lines are dropped once the log is full.  The
+window is updated, but not refreshed.
+@function append
+@string str text to add
+@int[opt=A_NORMAL] attrs attributes for the new lines
+@treturn int number of lines added
+*/
+static int
+Lappend(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	size_t len;
+	const char *s = luaL_checklstring(L, 2, &len);
+	attr_t attrs = (attr_t) optint(L, 3, A_NORMAL);
+	WINDOW *w = lv_window(L, 1);
+	const char *end = s + len;
+	unsigned long top;
+	int n = 0;
+
+	do
+	{
+		const char *nl = memchr(s, '\n', end - s);
+		const char *e = nl ? nl : end;
+		lv_entry *slot;
+		char *copy = malloc(e - s + 1);
+
+		if (!copy)
+			return luaL_error(L, "malloc failed");
+		memcpy(copy, s, e - s);
+		if (v->count == v->capacity)
+		{
+			slot = &v->ring[v->head];
+			free(slot->s);
+			v->head = (v->head + 1) % v->capacity;
+		}
+		else
+			slot = &v->ring[(v->head + v->count++) % v->capacity];
+		slot->s = copy;
+		slot->len = e - s;
+		slot->attrs = attrs;
+		v->total++;
+		n++;
+		s = nl ? nl + 1 : end;
+	} while (s < end);
+
+	top = v->top;
+	if (v->pinned)
+		top = lv_bottom(v);
+	else if (top < lv_oldest(v))
+		top = lv_oldest(v);
+	lv_show(L, v, w, top);
+	return pushintresult(n);
+}
+
+
+/***
+Scroll through the log.
+@function scroll
+@int n number of lines to go back, or forward if negative
+@treturn int number of lines below the view, 0 when at the bottom
+*/
+static int
+Lscroll(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	WINDOW *w = lv_window(L, 1);
+	unsigned long bottom = lv_bottom(v), oldest = lv_oldest(v);
+	lua_Integer top = (lua_Integer) v->top - n;
+
+	if (top < (lua_Integer) oldest)
+		top = oldest;
+	if (top > (lua_Integer) bottom)
+		top = bottom;
+	v->pinned = (unsigned long) top == bottom;
+	lv_show(L, v, w, top);
+	return pushintresult(bottom - top);
+}
+
+
+/***
+Go to the bottom of the log, and stay there as lines are appended.
+@function bottom
+*/
+static int
+Lbottom(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	WINDOW *w = lv_window(L, 1);
+
+	v->pinned = 1;
+	lv_show(L, v, w, lv_bottom(v));
+	return 0;
+}
+
+
+/***
+Number of lines below the view.
+@function offset
+@treturn int 0 when the view is at the bottom
+*/
+static int
+Loffset(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	return pushintresult(lv_bottom(v) - v->top);
+}
+
+
+/***
+Number of lines in the log.
+@function lines
+@treturn int lines kept
+@treturn int capacity
+*/
+static int
+Llines(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	lua_pushinteger(L, v->count);
+	lua_pushinteger(L, v->capacity);
+	return 2;
+}
+
+
+/***
+Copy a line of the log.
+@function line
+@int n line number, 1 for the oldest line kept, or negative to count
+  from the newest, as -1
+@treturn string the line, or `nil`
+*/
+static int
+Lline(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	lv_entry *e;
+
+	if (n < 0)
+		n += v->count + 1;
+	if (n < 1 || n > v->count)
+		return 0;
+	e = &v->ring[(v->head + n - 1) % v->capacity];
+	lua_pushlstring(L, e->s, e->len);
+	return 1;
+}
+
+
+/***
+Redraw the whole view.
+Needed after the window was cleared or resized behind the logview's
+back.
+@function redraw
+*/
+static int
+Lredraw(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	WINDOW *w = lv_window(L, 1);
+
+	v->vlines = -1;
+	lv_show(L, v, w, v->top);
+	return 0;
+}
+
+
+/***
+Drop all lines.
+@function clear
+*/
+static int
+Lclear(lua_State *L)
+{
+	lc_logview *v = checklogview(L, 1);
+	WINDOW *w = lv_window(L, 1);
+
+	lv_clear(v);
+	v->pinned = 1;
+	v->vlines = -1;
+	lv_show(L, v, w, v->total);
+	return 0;
+}
+
+
+/***
+Free the lines of the log.
+The window is left as it is.
+@function close
+*/
+static int
+Lclose(lua_State *L)
+{
+	lc_logview *v = (lc_logview *) luaL_checkudata(L, 1, LOGVIEW_META);
+
+	if (v->ring)
+	{
+		lv_clear(v);
+		free(v->ring);
+		v->ring = NULL;
+	}
+	free(v->buf);
+	v->buf = NULL;
+	return 0;
+}
+
+
+static const luaL_Reg curses_logview_fns[] =
+{
+	LCURSES_FUNC( Lappend		),
+	LCURSES_FUNC( Lbottom		),
+	LCURSES_FUNC( Lclear		),
+	LCURSES_FUNC( Lclose		),
+	LCURSES_FUNC( Lline		),
+	LCURSES_FUNC( Llines		),
+	LCURSES_FUNC( Loffset		),
+	LCURSES_FUNC( Lredraw		),
+	LCURSES_FUNC( Lscroll		),
+	{"__gc",     Lclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_logview(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_logview_fns);
+	t = lua_gettop(L);
+
+	lua_createtable(L, 0, 1);		/* u = {} */
+	lua_pushcfunction(L, L__call);
+	lua_setfield(L, -2, "__call");		/* u.__call = L__call */
+	lua_setmetatable(L, -2);		/* setmetatable (t, u) */
+
+	luaL_newmetatable(L, LOGVIEW_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesLogview");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesLogview" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.logview..." */
+	lua_pushliteral(L, "curses.logview for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_LOGVIEW_C*/
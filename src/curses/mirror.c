@@ -0,0 +1,849 @@
+/* */
+
+/***
+ Screen mirroring.
+
+ A mirror follows what curses puts on the terminal, and writes each
+ change to a file descriptor as a compact binary delta: after every
+ @{curses.doupdate} (and @{curses.window:refresh}, @{curses.screen:present}
+ and @{curses.compositor:present}), the cells of the virtual screen
+ which differ from what was last sent are encoded with their position,
+ code point, attributes and color pair.  An auditing process decodes
+ the stream into a headless grid, without a terminal of its own:
+
+     -- the operator's side
+     local m = curses.mirror.start (sock)
+
+     -- the auditor's side
+     local d = curses.mirror.decoder ()
+     while true do
+       d:feed (sock:read ())
+       print (d:line (0))
+     end
+
+ Writes never block: while the reader has not taken the last frame,
+ frames are skipped, and the next one sent carries every change since,
+ so a slow reader catches up in one step.  The descriptor is best a
+ socket; a pipe should be set non-blocking.
+
+ The stream starts with the 4 bytes `LCM1`; then each frame is a
+ varint byte count and a payload of varints: lines, columns, cursor
+ line and column, a number of runs, and the runs.  A run is its line,
+ first column and number of cells, then tokens up to that number of
+ cells: 0 is followed by the attributes (`A_*` bits shifted right by
+ 16) and color pair of the cells after it, which start as 0 and 0; 1
+ is the right half of a wide character; 2 is followed by a combining
+ character for the next cell; 3 is followed by a count of repeats of
+ the last cell; and 4 or more is a cell with that code point plus 4.
+
+@module curses.mirror
+*/
+
+#ifndef LCURSES_MIRROR_C
+#define LCURSES_MIRROR_C 1
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "_helpers.c"
+#include "_dirty.c"
+#include "_width.c"
+#include "server.c"
+
+
+static const char *MIRROR_META = "curses:mirror";
+static const char *DECODER_META = "curses:mirrordecoder";
+
+#define MIRROR_MAGIC	"LCM1"
+#define MIRROR_GAP	3	/* unchanged cells sent to join two runs */
+
+/* cell tokens */
+#define MIRROR_PEN	0	/* attributes and pair of the cells that follow */
+#define MIRROR_TAIL	1	/* the right half of a wide character */
+#define MIRROR_COMB	2	/* a combining character for the next cell */
+#define MIRROR_REPEAT	3	/* the last cell, again a number of times */
+#define MIRROR_CHAR	4	/* plus the code point of a cell */
+
+typedef struct lc_mirror {
+	WINDOW *scr;		/* curscr of the mirrored screen */
+	int fd;
+	int nlines, ncols;	/* of the shadow */
+	cchar_t *shadow;	/* the screen as last sent */
+	int cy, cx;
+	lc_buf frame, out;	/* the frame being encoded, and the backlog */
+	size_t outpos;
+	int dead;
+	unsigned long frames, skipped;
+	struct lc_mirror *next;
+} lc_mirror;
+
+/* running mirrors, synced after each update of the terminal */
+static lc_mirror *mirrors = NULL;
+
+
+/* ========= *
+ * Encoding. *
+ * ========= */
+
+/* LEB128: 7 bits a byte, low bits first; returns the length */
+static int
+mr_putvarint(char *s, uint32_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80)
+	{
+		s[n++] = (char) (v | 0x80);
+		v >>= 7;
+	}
+	s[n++] = (char) v;
+	return n;
+}
+
+static void
+mr_varint(lc_buf *b, uint32_t v)
+{
+	char s[5];
+	buf_add(b, s, mr_putvarint(s, v));
+}
+
+static int
+mr_same(const cchar_t *a, const cchar_t *b)
+{
+	return memcmp(a, b, sizeof *a) == 0;
+}
+
+/* the code point of a cell, 0 in the right half of a wide character */
+static int
+mr_cellch(const cchar_t *c, int *wide)
+{
+	int tail = *wide;
+
+	*wide = !tail && lc_wcwidth(c->chars[0]) == 2;
+	return tail ? 0 : (int) c->chars[0];
+}
+
+static void
+mr_encode_run(lc_buf *b, const cchar_t *row, int y, int x0, int x1, int wide)
+{
+	attr_t attrs = A_NORMAL;
+	short pair = 0;
+	int x, last = -1, repeat = 0;
+
+	mr_varint(b, y);
+	mr_varint(b, x0);
+	mr_varint(b, x1 - x0);
+	for (x = x0; x < x1; x++)
+	{
+		wchar_t wch[CCHARW_MAX + 1];
+		attr_t a;
+		short p;
+		int ch = mr_cellch(&row[x], &wide);
+
+		if (ch != 0 && ch == last && mr_same(&row[x], &row[x - 1]))
+		{
+			repeat++;
+			continue;
+		}
+		if (repeat > 0)
+		{
+			mr_varint(b, MIRROR_REPEAT);
+			mr_varint(b, repeat);
+			repeat = 0;
+		}
+		getcchar(&row[x], wch, &a, &p, NULL);
+		a &= A_ATTRIBUTES & ~A_COLOR;
+		if (a != attrs || p != pair)
+		{
+			mr_varint(b, MIRROR_PEN);
+			mr_varint(b, a >> 16);
+			mr_varint(b, p);
+			attrs = a, pair = p;
+		}
+		if (ch != 0 && CCHARW_MAX > 1 && wch[0] && wch[1])
+		{
+			mr_varint(b, MIRROR_COMB);
+			mr_varint(b, wch[1]);
+		}
+		mr_varint(b, ch == 0 ? MIRROR_TAIL : MIRROR_CHAR + (uint32_t) ch);
+		last = ch;
+	}
+	if (repeat > 0)
+	{
+		mr_varint(b, MIRROR_REPEAT);
+		mr_varint(b, repeat);
+	}
+}
+
+/* write as much of the backlog as possible without blocking */
+static void
+mr_flush(lc_mirror *m)
+{
+	while (m->outpos < m->out.len)
+	{
+		ssize_t n = send(m->fd, m->out.s + m->outpos, m->out.len - m->outpos,
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == ENOTSOCK)
+			n = write(m->fd, m->out.s + m->outpos, m->out.len - m->outpos);
+		if (n > 0)
+			m->outpos += n;
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+		{
+			if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				m->dead = 1;
+			break;
+		}
+	}
+	if (m->outpos == m->out.len)
+		m->outpos = m->out.len = 0;
+}
+
+/* send what changed on the screen since the last frame */
+static void
+mr_sync(lc_mirror *m)
+{
+	int nlines, ncols, y, x, cy, cx, nruns = 0;
+	lc_buf *b = &m->frame;
+	char len[5];
+	size_t n;
+
+	if (m->dead || curscr == NULL || curscr != m->scr)
+		return;
+	mr_flush(m);
+	if (m->out.len > 0)
+	{
+		/* the reader is behind: what is not sent now is sent next */
+		m->skipped++;
+		return;
+	}
+	nlines = getmaxy(curscr);
+	ncols = getmaxx(curscr);
+	if (nlines != m->nlines || ncols != m->ncols)
+	{
+		cchar_t *shadow = calloc((size_t) nlines * ncols, sizeof *shadow);
+		if (!shadow)
+			return;
+		free(m->shadow);
+		m->shadow = shadow;	/* all cells differ from it */
+		m->nlines = nlines;
+		m->ncols = ncols;
+	}
+
+	b->len = 0;
+	for (y = 0; y < nlines; y++)
+	{
+		const cchar_t *row = curscr->_line[y].text;
+		cchar_t *old = m->shadow + (size_t) y * ncols;
+		int wide = 0, runwide = 0, start = -1, end = 0;
+
+		for (x = 0; x < ncols; x++)
+		{
+			int w = wide;
+			mr_cellch(&row[x], &wide);
+			if (mr_same(&row[x], &old[x]))
+				continue;
+			if (start >= 0 && x - end > MIRROR_GAP)
+			{
+				mr_encode_run(b, row, y, start, end, runwide);
+				nruns++;
+				start = -1;
+			}
+			if (start < 0)
+				start = x, runwide = w;
+			end = x + 1;
+			old[x] = row[x];
+		}
+		if (start >= 0)
+		{
+			/* cells of a joined gap are resent unchanged */
+			mr_encode_run(b, row, y, start, end, runwide);
+			nruns++;
+		}
+	}
+	getyx(curscr, cy, cx);
+	if (nruns == 0 && cy == m->cy && cx == m->cx)
+		return;
+	m->cy = cy;
+	m->cx = cx;
+
+	/* the header, then the runs encoded above */
+	n = b->len;
+	mr_varint(b, nlines);
+	mr_varint(b, ncols);
+	mr_varint(b, cy);
+	mr_varint(b, cx);
+	mr_varint(b, nruns);
+	if (buf_add(&m->out, len, mr_putvarint(len, (uint32_t) b->len)) < 0
+		|| buf_add(&m->out, b->s + n, b->len - n) < 0
+		|| buf_add(&m->out, b->s, n) < 0)
+	{
+		m->dead = 1;	/* the reader could not follow anymore */
+		return;
+	}
+	m->frames++;
+	mr_flush(m);
+}
+
+/* called after each update of the terminal */
+static void
+mr_sync_all(void)
+{
+	lc_mirror *m;
+
+	for (m = mirrors; m != NULL; m = m->next)
+		mr_sync(m);
+}
+
+
+/* ========= *
+ * Decoding. *
+ * ========= */
+
+typedef struct mr_cell {
+	int ch, comb;
+	attr_t attrs;
+	int pair;
+} mr_cell;
+
+typedef struct lc_mirrordecoder {
+	int nlines, ncols;
+	mr_cell *cells;
+	unsigned char *dirty;	/* rows changed since the last render */
+	int cy, cx;
+	lc_buf in;		/* an incomplete frame */
+	int magic;		/* the stream header was read */
+	unsigned long frames;
+	cchar_t *buf;
+	WINDOW *target;		/* last rendered to */
+} lc_mirrordecoder;
+
+/* read a varint from *p, before end; returns 0 if it is cut */
+static int
+mr_getvarint(const unsigned char **p, const unsigned char *end, uint32_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 35)
+	{
+		unsigned char c = *(*p)++;
+		*v |= (uint32_t) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return 0;
+}
+
+static int
+md_resize(lc_mirrordecoder *d, int nlines, int ncols)
+{
+	mr_cell *cells;
+	unsigned char *dirty;
+	cchar_t *buf;
+	size_t i, n = (size_t) nlines * ncols;
+
+	cells = malloc((n ? n : 1) * sizeof *cells);
+	dirty = malloc(nlines ? nlines : 1);
+	buf = malloc((ncols ? ncols : 1) * sizeof *buf);
+	if (!cells || !dirty || !buf)
+	{
+		free(cells);
+		free(dirty);
+		free(buf);
+		return 0;
+	}
+	for (i = 0; i < n; i++)
+	{
+		cells[i].ch = ' ';
+		cells[i].comb = 0;
+		cells[i].attrs = A_NORMAL;
+		cells[i].pair = 0;
+	}
+	memset(dirty, 1, nlines);
+	free(d->cells);
+	free(d->dirty);
+	free(d->buf);
+	d->cells = cells;
+	d->dirty = dirty;
+	d->buf = buf;
+	d->nlines = nlines;
+	d->ncols = ncols;
+	return 1;
+}
+
+/* apply the frame payload p..end; returns 0 if it is malformed */
+static int
+md_apply(lc_mirrordecoder *d, const unsigned char *p, const unsigned char *end)
+{
+	uint32_t nlines, ncols, cy, cx, nruns, r;
+
+	if (!mr_getvarint(&p, end, &nlines) || !mr_getvarint(&p, end, &ncols)
+		|| !mr_getvarint(&p, end, &cy) || !mr_getvarint(&p, end, &cx)
+		|| !mr_getvarint(&p, end, &nruns) || nlines > 0x7fff || ncols > 0x7fff)
+		return 0;
+	if ((int) nlines != d->nlines || (int) ncols != d->ncols)
+		if (!md_resize(d, nlines, ncols))
+			return 0;
+	d->cy = cy;
+	d->cx = cx;
+	for (r = 0; r < nruns; r++)
+	{
+		uint32_t y, x, n, i, v, comb = 0, a = 0, pair = 0;
+		mr_cell *row;
+
+		if (!mr_getvarint(&p, end, &y) || !mr_getvarint(&p, end, &x)
+			|| !mr_getvarint(&p, end, &n)
+			|| y >= nlines || x > ncols || n > ncols - x)
+			return 0;
+		d->dirty[y] = 1;
+		row = d->cells + (size_t) y * ncols + x;
+		for (i = 0; i < n;)
+		{
+			if (!mr_getvarint(&p, end, &v))
+				return 0;
+			switch (v)
+			{
+			case MIRROR_PEN:
+				if (!mr_getvarint(&p, end, &a) || !mr_getvarint(&p, end, &pair))
+					return 0;
+				break;
+			case MIRROR_COMB:
+				if (!mr_getvarint(&p, end, &comb))
+					return 0;
+				break;
+			case MIRROR_REPEAT:
+				if (!mr_getvarint(&p, end, &v) || i == 0 || v > n - i)
+					return 0;
+				for (; v > 0; v--, i++)
+					row[i] = row[i - 1];
+				break;
+			default:
+				row[i].ch = v == MIRROR_TAIL ? 0 : (int) (v - MIRROR_CHAR);
+				row[i].comb = comb;
+				row[i].attrs = (attr_t) a << 16;
+				row[i].pair = pair;
+				comb = 0;
+				i++;
+			}
+		}
+	}
+	d->frames++;
+	return 1;
+}
+
+
+/* ====== *
+ * Mirror. *
+ * ====== */
+
+static lc_mirror *
+checkmirror(lua_State *L, int narg)
+{
+	return (lc_mirror *) luaL_checkudata(L, narg, MIRROR_META);
+}
+
+
+/***
+Start mirroring the current screen.
+@function start
+@int fd file descriptor to write the stream to, such as a connected
+  socket; it is not closed by the mirror
+@treturn mirror the running mirror
+@usage
+  m = curses.mirror.start (fd)
+*/
+static int
+Mstart(lua_State *L)
+{
+	int fd = checkint(L, 1);
+	lc_mirror *m;
+
+	if (curscr == NULL)
+		return luaL_error(L, "curses is not initialized");
+	m = lua_newuserdata(L, sizeof *m);
+	memset(m, 0, sizeof *m);
+	m->scr = curscr;
+	m->fd = fd;
+	m->cy = m->cx = -1;
+	luaL_setmetatable(L, MIRROR_META);
+	buf_add(&m->out, MIRROR_MAGIC, 4);
+	m->next = mirrors;
+	mirrors = m;
+	mr_sync(m);
+	return 1;
+}
+
+
+/***
+Send the changes now.
+Only needed when the terminal was updated other than through lcurses,
+such as by @{curses.window:getch} refreshing its window.
+@function sync
+@treturn bool `false` once the reader has gone away
+*/
+static int
+Msync(lua_State *L)
+{
+	lc_mirror *m = checkmirror(L, 1);
+	mr_sync(m);
+	return pushboolresult(m->scr != NULL && !m->dead);
+}
+
+
+/***
+Frames sent and skipped.
+@function stats
+@treturn int frames sent
+@treturn int frames skipped while the reader was behind
+@treturn int bytes waiting to be written
+*/
+static int
+Mstats(lua_State *L)
+{
+	lc_mirror *m = checkmirror(L, 1);
+	lua_pushinteger(L, m->frames);
+	lua_pushinteger(L, m->skipped);
+	lua_pushinteger(L, m->out.len - m->outpos);
+	return 3;
+}
+
+
+/***
+Stop mirroring.
+@function stop
+*/
+static int
+Mstop(lua_State *L)
+{
+	lc_mirror *m = checkmirror(L, 1);
+	lc_mirror **p;
+
+	for (p = &mirrors; *p != NULL; p = &(*p)->next)
+		if (*p == m)
+		{
+			*p = m->next;
+			break;
+		}
+	free(m->shadow);
+	free(m->frame.s);
+	free(m->out.s);
+	memset(m, 0, sizeof *m);
+	m->dead = 1;
+	return 0;
+}
+
+
+/* ======== *
+ * Decoder. *
+ * ======== */
+
+static lc_mirrordecoder *
+checkdecoder(lua_State *L, int narg)
+{
+	return (lc_mirrordecoder *) luaL_checkudata(L, narg, DECODER_META);
+}
+
+
+/***
+Create a decoder of a mirror stream.
+@function decoder
+@treturn decoder a decoder, with an empty grid until the first frame
+*/
+static int
+Mdecoder(lua_State *L)
+{
+	lc_mirrordecoder *d = lua_newuserdata(L, sizeof *d);
+
+	memset(d, 0, sizeof *d);
+	luaL_setmetatable(L, DECODER_META);
+	return 1;
+}
+
+
+/***
+Apply bytes of the stream.
+They need not end on a frame; the rest is kept for the next call.
+@function feed
+@string data bytes read from the stream
+@treturn int number of frames applied
+*/
+static int
+Mfeed(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	size_t len;
+	const char *s = luaL_checklstring(L, 2, &len);
+	const unsigned char *p, *end;
+	unsigned long frames = d->frames;
+
+	if (buf_add(&d->in, s, len) < 0)
+		return luaL_error(L, "malloc failed");
+	p = (const unsigned char *) d->in.s;
+	end = p + d->in.len;
+	if (!d->magic)
+	{
+		if (end - p < 4)
+			return pushintresult(0);
+		if (memcmp(p, MIRROR_MAGIC, 4) != 0)
+			return luaL_error(L, "not a mirror stream");
+		p += 4;
+		d->magic = 1;
+	}
+	for (;;)
+	{
+		const unsigned char *q = p;
+		uint32_t n;
+		if (!mr_getvarint(&q, end, &n) || (size_t) (end - q) < n)
+			break;
+		if (!md_apply(d, q, q + n))
+			return luaL_error(L, "bad mirror frame");
+		p = q + n;
+	}
+	d->in.len = end - p;
+	memmove(d->in.s, p, d->in.len);
+	return pushintresult(d->frames - frames);
+}
+
+
+/***
+Size of the mirrored screen.
+@function size
+@treturn int number of lines
+@treturn int number of columns
+*/
+static int
+Msize(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	lua_pushinteger(L, d->nlines);
+	lua_pushinteger(L, d->ncols);
+	return 2;
+}
+
+
+/***
+Cursor position on the mirrored screen.
+@function cursor
+@treturn int line
+@treturn int column
+*/
+static int
+Mcursor(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	lua_pushinteger(L, d->cy);
+	lua_pushinteger(L, d->cx);
+	return 2;
+}
+
+
+/***
+Text of a line of the mirrored screen.
+@function line
+@int y line number, starting from 0
+@treturn string utf8 text of the line, without trailing blanks
+*/
+static int
+Mline(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	int y = checkint(L, 2);
+	luaL_Buffer b;
+	mr_cell *row;
+	int x, end;
+
+	luaL_argcheck(L, y >= 0 && y < d->nlines, 2, "bad line");
+	row = d->cells + (size_t) y * d->ncols;
+	for (end = d->ncols; end > 0 && (row[end - 1].ch == ' ' || row[end - 1].ch == 0)
+		&& !row[end - 1].comb; end--)
+		;
+	luaL_buffinit(L, &b);
+	for (x = 0; x < end; x++)
+	{
+		char buf[8];
+		int n = 0;
+		if (row[x].ch)
+			n = utf8_encode(buf, row[x].ch);
+		if (row[x].comb)
+			n += utf8_encode(buf + n, row[x].comb);
+		luaL_addlstring(&b, buf, n);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+
+/***
+A cell of the mirrored screen.
+@function cell
+@int y line, from 0
+@int x column, from 0
+@treturn string the character, empty in the right half of a wide one
+@treturn int attributes
+@treturn int color pair
+*/
+static int
+Mcell(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	int y = checkint(L, 2);
+	int x = checkint(L, 3);
+	mr_cell *c;
+	char buf[8];
+	int n = 0;
+
+	luaL_argcheck(L, y >= 0 && y < d->nlines, 2, "bad line");
+	luaL_argcheck(L, x >= 0 && x < d->ncols, 3, "bad column");
+	c = &d->cells[(size_t) y * d->ncols + x];
+	if (c->ch)
+		n = utf8_encode(buf, c->ch);
+	if (c->comb)
+		n += utf8_encode(buf + n, c->comb);
+	lua_pushlstring(L, buf, n);
+	lua_pushinteger(L, c->attrs);
+	lua_pushinteger(L, c->pair);
+	return 3;
+}
+
+
+/***
+Draw the mirrored screen into a window.
+Only lines changed since the last render into the same window are
+drawn.  Color pairs are used as they are, so the same pairs should be
+initialized on both sides.
+@function render
+@tparam curses.window win target window
+*/
+static int
+Mrender(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	WINDOW *w = checkwin(L, 2);
+	int nlines = getmaxy(w), ncols = getmaxx(w), y, x;
+
+	if (w != d->target)
+	{
+		d->target = w;
+		memset(d->dirty, 1, d->nlines);
+	}
+	if (ncols > d->ncols)
+		ncols = d->ncols;
+	for (y = 0; y < nlines && y < d->nlines; y++)
+	{
+		mr_cell *row = d->cells + (size_t) y * d->ncols;
+		int n = 0;
+
+		if (!d->dirty[y])
+			continue;
+		d->dirty[y] = 0;
+		for (x = 0; x < ncols; x++)
+		{
+			int ch = row[x].ch;
+			if (ch == 0)
+				continue;
+			/* a wide character cut by the right edge */
+			if (x + 1 < d->ncols && row[x + 1].ch == 0 && x + 1 >= ncols)
+				ch = ' ';
+			setcchar_(&d->buf[n], ch, row[x].attrs, row[x].pair);
+			if (row[x].comb && CCHARW_MAX > 2)
+			{
+				d->buf[n].chars[1] = row[x].comb;
+				d->buf[n].chars[2] = L'\0';
+			}
+			n++;
+		}
+		wmove(w, y, 0);
+		if (n > 0)
+			wadd_wchnstr(w, d->buf, n);
+	}
+	return 0;
+}
+
+
+/***
+Frames applied so far.
+@function frames
+@treturn int number of frames
+*/
+static int
+Mframes(lua_State *L)
+{
+	return pushintresult(checkdecoder(L, 1)->frames);
+}
+
+
+static int
+Mdecoder__gc(lua_State *L)
+{
+	lc_mirrordecoder *d = checkdecoder(L, 1);
+	free(d->cells);
+	free(d->dirty);
+	free(d->buf);
+	free(d->in.s);
+	memset(d, 0, sizeof *d);
+	return 0;
+}
+
+
+static const luaL_Reg curses_mirror_fns[] =
+{
+	LCURSES_FUNC( Mdecoder		),
+	LCURSES_FUNC( Mstart		),
+	{ NULL, NULL }
+};
+
+static const luaL_Reg curses_mirror_methods[] =
+{
+	LCURSES_FUNC( Mstats		),
+	LCURSES_FUNC( Mstop		),
+	LCURSES_FUNC( Msync		),
+	{"__gc",     Mstop		},
+	{ NULL, NULL }
+};
+
+static const luaL_Reg curses_mirrordecoder_methods[] =
+{
+	LCURSES_FUNC( Mcell		),
+	LCURSES_FUNC( Mcursor		),
+	LCURSES_FUNC( Mfeed		),
+	LCURSES_FUNC( Mframes		),
+	LCURSES_FUNC( Mline		),
+	LCURSES_FUNC( Mrender		),
+	LCURSES_FUNC( Msize		),
+	{"__gc",     Mdecoder__gc	},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_mirror(lua_State *L)
+{
+	luaL_newlib(L, curses_mirror_fns);
+
+	luaL_newmetatable(L, MIRROR_META);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesMirror");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesMirror" */
+	luaL_setfuncs(L, curses_mirror_methods, 0);
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, DECODER_META);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pushliteral(L, "CursesMirrorDecoder");
+	lua_setfield(L, -2, "_type");
+	luaL_setfuncs(L, curses_mirrordecoder_methods, 0);
+	lua_pop(L, 1);
+
+	/* t.version = "curses.mirror..." */
+	lua_pushliteral(L, "curses.mirror for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, -2, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_MIRROR_C*/
@@ -0,0 +1,427 @@
+/* */
+
+/***
+ Panels.
+
+ A panel puts a @{curses.window} in a stack, the way popups and dialogs
+ lie on top of each other.  @{update} refreshes the windows of the stack
+ from the bottom up, copying only what is not covered by a window above,
+ so a stack of windows costs one @{curses.doupdate} and no manual
+ touching and ordering of refreshes:
+
+     local dlg = curses.panel (curses.newwin (10, 40, 5, 20))
+     dlg:window ():box (0, 0)
+     curses.panel.update ()
+     curses.doupdate ()
+     ...
+     dlg:hide ()             -- what it covered is shown again
+     curses.panel.update ()
+     curses.doupdate ()
+
+ A window in a panel is moved with @{move}, not
+ @{curses.window:move_window}.  Closing the window closes its panel.
+
+@classmod curses.panel
+*/
+
+#ifndef LCURSES_PANEL_C
+#define LCURSES_PANEL_C 1
+
+#include <ncursesw/panel.h>
+
+#include "_helpers.c"
+
+
+static const char *PANEL_META = "curses:panel";
+static const char *PANEL_REGISTRY = "curses:panels";
+
+typedef struct lc_panel {
+	PANEL *pan;
+	WINDOW *std;			/* stdscr of the screen of the panel */
+	struct lc_panel *prev, *next;	/* all open panels */
+} lc_panel;
+
+static lc_panel *pn_all;
+
+
+static PANEL *
+checkpanel(lua_State *L, int narg)
+{
+	lc_panel *p = (lc_panel *) luaL_checkudata(L, narg, PANEL_META);
+	if (p->pan == NULL)
+		luaL_argerror(L, narg, "attempt to use closed panel");
+	return p->pan;
+}
+
+static void
+pn_unlink(lc_panel *p)
+{
+	if (p->prev)
+		p->prev->next = p->next;
+	else
+		pn_all = p->next;
+	if (p->next)
+		p->next->prev = p->prev;
+	p->next = p->prev = NULL;
+}
+
+/*
+** Free the panels of w, which is about to be closed: del_panel needs the
+** window, even for a hidden panel.
+*/
+static void
+pn_closewin(WINDOW *w)
+{
+	lc_panel *p = pn_all, *next;
+
+	for (; p != NULL; p = next)
+	{
+		next = p->next;
+		if (panel_window(p->pan) == w)
+		{
+			del_panel(p->pan);
+			p->pan = NULL;
+			pn_unlink(p);
+		}
+	}
+}
+
+/* free the panels of the screen of std, which is about to be deleted */
+static void
+pn_closescreen(WINDOW *std)
+{
+	lc_panel *p = pn_all, *next;
+
+	for (; p != NULL; p = next)
+	{
+		next = p->next;
+		if (p->std == std)
+		{
+			del_panel(p->pan);
+			p->pan = NULL;
+			pn_unlink(p);
+		}
+	}
+}
+
+/* push the table of panels by PANEL pointer, creating it if needed */
+static void
+pn_getregistry(lua_State *L)
+{
+	lua_pushstring(L, PANEL_REGISTRY);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (!lua_isnil(L, -1))
+		return;
+	lua_pop(L, 1);
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushliteral(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_pushstring(L, PANEL_REGISTRY);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+/* push the userdata of pan, or nil */
+static int
+pn_push(lua_State *L, PANEL *pan)
+{
+	pn_getregistry(L);
+	if (pan)
+		lua_rawgetp(L, -1, pan);
+	else
+		lua_pushnil(L);
+	lua_remove(L, -2);
+	return 1;
+}
+
+/* set the userdata of pan to the value on top, and pop it */
+static void
+pn_set(lua_State *L, PANEL *pan)
+{
+	pn_getregistry(L);
+	lua_insert(L, -2);
+	lua_rawsetp(L, -2, pan);
+	lua_pop(L, 1);
+}
+
+
+/***
+Put a window on top of the panel stack.
+@function __call
+@tparam curses.window win the window
+@treturn panel a new panel, shown
+@see new_panel(3x)
+@usage
+  popup = curses.panel (curses.newwin (5, 30, 10, 20))
+*/
+static int
+create_panel(lua_State *L, int narg)
+{
+	WINDOW *w = checkwin(L, narg);
+	lc_panel *p = lua_newuserdata(L, sizeof *p);
+
+	memset(p, 0, sizeof *p);
+	luaL_setmetatable(L, PANEL_META);
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, narg);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+	if ((p->pan = new_panel(w)) == NULL)
+		return luaL_error(L, "failed to create panel");
+	p->std = stdscr;
+	if ((p->next = pn_all) != NULL)
+		pn_all->prev = p;
+	pn_all = p;
+	lua_pushvalue(L, -1);
+	pn_set(L, p->pan);
+	return 1;
+}
+
+static int
+B__call(lua_State *L)
+{
+	return create_panel(L, 2);
+}
+
+
+/***
+Refresh the windows of the panel stack.
+The windows are copied to the virtual screen, but the terminal is only
+updated by @{curses.doupdate}.
+@function update
+@see update_panels(3x)
+*/
+static int
+Bupdate(lua_State *LCURSES_UNUSED(L))
+{
+	update_panels();
+	return 0;
+}
+
+
+/***
+Put the panel on top of the stack, showing it if hidden.
+@function top
+@treturn bool `true`, if successful
+@see top_panel(3x)
+*/
+static int
+Btop(lua_State *L)
+{
+	return pushokresult(top_panel(checkpanel(L, 1)));
+}
+
+
+/***
+Put the panel at the bottom of the stack, showing it if hidden.
+@function bottom
+@treturn bool `true`, if successful
+@see bottom_panel(3x)
+*/
+static int
+Bbottom(lua_State *L)
+{
+	return pushokresult(bottom_panel(checkpanel(L, 1)));
+}
+
+
+/***
+Take the panel out of the stack.
+@function hide
+@treturn bool `true`, if successful
+@see hide_panel(3x)
+*/
+static int
+Bhide(lua_State *L)
+{
+	return pushokresult(hide_panel(checkpanel(L, 1)));
+}
+
+
+/***
+Put a hidden panel back on top of the stack.
+@function show
+@treturn bool `true`, if successful
+@see show_panel(3x)
+*/
+static int
+Bshow(lua_State *L)
+{
+	return pushokresult(show_panel(checkpanel(L, 1)));
+}
+
+
+/***
+Whether the panel is hidden.
+@function hidden
+@treturn bool `true`, if the panel is not in the stack
+@see panel_hidden(3x)
+*/
+static int
+Bhidden(lua_State *L)
+{
+	return pushboolresult(panel_hidden(checkpanel(L, 1)) == TRUE);
+}
+
+
+/***
+Move the window of the panel.
+@function move
+@int y new top line
+@int x new left column
+@treturn bool `true`, if successful
+@see move_panel(3x)
+*/
+static int
+Bmove(lua_State *L)
+{
+	PANEL *pan = checkpanel(L, 1);
+	int y = checkint(L, 2);
+	int x = checkint(L, 3);
+	return pushokresult(move_panel(pan, y, x));
+}
+
+
+/***
+The window of the panel.
+@function window
+@treturn curses.window the window
+*/
+static int
+Bwindow(lua_State *L)
+{
+	checkpanel(L, 1);
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+	return 1;
+}
+
+
+/***
+Put another window in the panel, at the same place in the stack.
+@function replace
+@tparam curses.window win the new window
+@treturn bool `true`, if successful
+@see replace_panel(3x)
+*/
+static int
+Breplace(lua_State *L)
+{
+	PANEL *pan = checkpanel(L, 1);
+	WINDOW *w = checkwin(L, 2);
+
+	if (replace_panel(pan, w) == ERR)
+		return pushboolresult(0);
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	return pushboolresult(1);
+}
+
+
+/***
+The panel just above in the stack.
+@function above
+@treturn[1] panel the panel
+@return[2] nil if the panel is on top, or hidden
+@see panel_above(3x)
+*/
+static int
+Babove(lua_State *L)
+{
+	return pn_push(L, panel_above(checkpanel(L, 1)));
+}
+
+
+/***
+The panel just below in the stack.
+@function below
+@treturn[1] panel the panel
+@return[2] nil if the panel is at the bottom, or hidden
+@see panel_below(3x)
+*/
+static int
+Bbelow(lua_State *L)
+{
+	return pn_push(L, panel_below(checkpanel(L, 1)));
+}
+
+
+/***
+Take the panel out of the stack and free it.  The window is left open.
+@function close
+@see del_panel(3x)
+*/
+static int
+Bclose(lua_State *L)
+{
+	lc_panel *p = (lc_panel *) luaL_checkudata(L, 1, PANEL_META);
+
+	if (p->pan != NULL)
+	{
+		lua_pushnil(L);
+		pn_set(L, p->pan);
+		del_panel(p->pan);
+		p->pan = NULL;
+		pn_unlink(p);
+	}
+	return 0;
+}
+
+
+static const luaL_Reg curses_panel_fns[] =
+{
+	LCURSES_FUNC( Babove		),
+	LCURSES_FUNC( Bbelow		),
+	LCURSES_FUNC( Bbottom		),
+	LCURSES_FUNC( Bclose		),
+	LCURSES_FUNC( Bhidden		),
+	LCURSES_FUNC( Bhide		),
+	LCURSES_FUNC( Bmove		),
+	LCURSES_FUNC( Breplace		),
+	LCURSES_FUNC( Bshow		),
+	LCURSES_FUNC( Btop		),
+	LCURSES_FUNC( Bupdate		),
+	LCURSES_FUNC( Bwindow		),
+	{"__gc",     Bclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_panel(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_panel_fns);
+	t = lua_gettop(L);
+
+	lua_createtable(L, 0, 1);		/* u = {} */
+	lua_pushcfunction(L, B__call);
+	lua_setfield(L, -2, "__call");		/* u.__call = B__call */
+	lua_setmetatable(L, -2);		/* setmetatable (t, u) */
+
+	luaL_newmetatable(L, PANEL_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesPanel");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesPanel" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.panel..." */
+	lua_pushliteral(L, "curses.panel for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_PANEL_C*/
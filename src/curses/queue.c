@@ -0,0 +1,514 @@
+/* */
+
+/***
+ Draw command queues.
+
+ A queue carries draw commands from a producer, which must not call
+ curses itself, to the thread that owns the screen.  It is a lock-free
+ single-producer, single-consumer ring of commands encoded in C, so
+ neither side ever waits for the other: @{push} fails when the ring is
+ full, and @{apply} draws whatever was queued so far in one call.
+
+     -- UI thread
+     local q = curses.queue.new ()
+     q:bind (1, statuswin)
+     start_collector (q:handle ())
+     -- every frame
+     q:apply ()
+     curses.doupdate ()
+
+     -- collector, another Lua state on another thread
+     local q = require "curses".queue.attach (handle)
+     q:push (1, 0, 0, "load " .. load, curses.A_BOLD)
+
+ The same queue can be attached in many Lua states, but only one of
+ them may push, and only one of them may bind and apply.
+
+@classmod curses.queue
+*/
+
+#ifndef LCURSES_QUEUE_C
+#define LCURSES_QUEUE_C 1
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "_helpers.c"
+
+
+static const char *QUEUE_META = "curses:queue";
+
+/* commands */
+#define LCQ_TEXT	1
+#define LCQ_ERASE	2
+#define LCQ_CLRTOEOL	3
+#define LCQ_WRAP	0xffffffffU	/* rest of the ring is unused */
+
+typedef struct lcq_cmd {
+	uint32_t len;		/* of the record, header included */
+	uint32_t op;
+	int32_t id, y, x;
+	uint32_t attrs;
+	int32_t pair;
+	uint32_t textlen;
+	/* followed by the text */
+} lcq_cmd;
+
+#define LCQ_ALIGN(n)	(((n) + 7) & ~(size_t) 7)
+
+typedef struct lc_queue {
+	size_t head;		/* producer side, updated after a record */
+	char pad1[64 - sizeof(size_t)];
+	size_t tail;		/* consumer side, updated after a record */
+	char pad2[64 - sizeof(size_t)];
+	unsigned long dropped;
+	int refs;		/* guarded by queues_mu */
+	lua_Integer id;		/* handle, never reused */
+	struct lc_queue *next;	/* in queues */
+	size_t size;		/* a power of 2 */
+	char data[1];
+} lc_queue;
+
+
+/*
+** Live queues of the process, so that a handle from another Lua state
+** is only ever resolved to a queue which is still open somewhere.
+*/
+static lc_queue *queues = NULL;
+static lua_Integer queues_lastid = 0;
+static pthread_mutex_t queues_mu = PTHREAD_MUTEX_INITIALIZER;
+
+static lc_queue *
+queue_new(size_t size)
+{
+	lc_queue *q;
+	size_t n = 4096;
+
+	while (n < size)
+		n *= 2;
+	if (!(q = calloc(1, sizeof *q + n)))
+		return NULL;
+	q->size = n;
+	q->refs = 1;
+	pthread_mutex_lock(&queues_mu);
+	q->id = ++queues_lastid;
+	q->next = queues;
+	queues = q;
+	pthread_mutex_unlock(&queues_mu);
+	return q;
+}
+
+/* take another reference to the queue with this handle, or NULL */
+static lc_queue *
+queue_ref(lua_Integer id)
+{
+	lc_queue *q;
+
+	pthread_mutex_lock(&queues_mu);
+	for (q = queues; q && q->id != id; q = q->next)
+		;
+	if (q)
+		q->refs++;
+	pthread_mutex_unlock(&queues_mu);
+	return q;
+}
+
+static void
+queue_unref(lc_queue *q)
+{
+	lc_queue **pq;
+
+	pthread_mutex_lock(&queues_mu);
+	if (--q->refs > 0)
+		q = NULL;
+	else
+		for (pq = &queues; *pq; pq = &(*pq)->next)
+			if (*pq == q)
+			{
+				*pq = q->next;
+				break;
+			}
+	pthread_mutex_unlock(&queues_mu);
+	free(q);
+}
+
+/*
+** Append a record; returns 0, or -1 if the ring has no room for it.
+** Only the producer calls this.
+*/
+static int
+queue_push(lc_queue *q, const lcq_cmd *cmd, const char *text, size_t len)
+{
+	size_t need = LCQ_ALIGN(sizeof *cmd + len);
+	size_t head = q->head;
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	size_t off = head & (q->size - 1);
+	size_t skip = 0;
+	lcq_cmd *rec;
+
+	/* records do not wrap around; start over at the beginning instead */
+	if (off + need > q->size)
+		skip = q->size - off;
+	if (need > q->size / 2 || head + skip + need - tail > q->size)
+	{
+		__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	if (skip)
+	{
+		if (skip >= sizeof(uint32_t))
+			((lcq_cmd *) (q->data + off))->len = LCQ_WRAP;
+		head += skip;
+		off = 0;
+	}
+	rec = (lcq_cmd *) (q->data + off);
+	*rec = *cmd;
+	rec->len = need;
+	rec->textlen = len;
+	memcpy(rec + 1, text, len);
+	__atomic_store_n(&q->head, head + need, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+** The next record for the consumer, or NULL if there is none; it stays
+** valid until queue_pop.
+*/
+static const lcq_cmd *
+queue_peek(lc_queue *q)
+{
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	size_t tail = q->tail;
+
+	while (tail != head)
+	{
+		size_t off = tail & (q->size - 1);
+		const lcq_cmd *rec = (const lcq_cmd *) (q->data + off);
+		if (q->size - off >= sizeof(uint32_t) && rec->len != LCQ_WRAP)
+			return rec;
+		tail += q->size - off;
+		__atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void
+queue_pop(lc_queue *q, const lcq_cmd *rec)
+{
+	__atomic_store_n(&q->tail, q->tail + rec->len, __ATOMIC_RELEASE);
+}
+
+
+static lc_queue *
+checkqueue(lua_State *L, int narg)
+{
+	lc_queue **q = (lc_queue **) luaL_checkudata(L, narg, QUEUE_META);
+	if (*q == NULL)
+		luaL_argerror(L, narg, "attempt to use closed queue");
+	return *q;
+}
+
+/* wrap a reference to q in a new userdata, with a table of bindings */
+static void
+lc_newqueue(lua_State *L, lc_queue *q)
+{
+	lc_queue **p = lua_newuserdata(L, sizeof *p);
+	*p = q;
+	luaL_setmetatable(L, QUEUE_META);
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+}
+
+static int
+queue_pushcmd(lua_State *L, int op, int id, int y, int x, const char *s,
+	size_t len, attr_t attrs, int pair)
+{
+	lc_queue *q = checkqueue(L, 1);
+	lcq_cmd cmd;
+
+	cmd.op = op;
+	cmd.id = id;
+	cmd.y = y;
+	cmd.x = x;
+	cmd.attrs = attrs;
+	cmd.pair = pair;
+	return pushboolresult(queue_push(q, &cmd, s, len) == 0);
+}
+
+
+/***
+Create a queue.
+@function new
+@int[opt=1048576] size capacity in bytes; commands take 32 bytes plus
+  their text, rounded up to a multiple of 8
+@treturn queue a new queue
+*/
+static int
+Qnew(lua_State *L)
+{
+	lc_queue *q;
+	int size = optint(L, 1, 1 << 20);
+
+	luaL_argcheck(L, size > 0 && size <= (1 << 30), 1, "bad queue size");
+	if (!(q = queue_new(size)))
+		return luaL_error(L, "malloc failed");
+	lc_newqueue(L, q);
+	return 1;
+}
+
+
+/***
+A number standing for this queue, to pass to another Lua state.
+The queue stays alive as long as any Lua state has it open.
+@function handle
+@treturn int handle for @{attach}
+*/
+static int
+Qhandle(lua_State *L)
+{
+	return pushintresult(checkqueue(L, 1)->id);
+}
+
+
+/***
+Open a queue created in another Lua state of this process.
+@function attach
+@int handle result of @{handle}, while the queue is still open
+@treturn queue the same queue
+*/
+static int
+Qattach(lua_State *L)
+{
+	lc_queue *q = queue_ref(luaL_checkinteger(L, 1));
+
+	luaL_argcheck(L, q != NULL, 1, "bad queue handle");
+	lc_newqueue(L, q);
+	return 1;
+}
+
+
+/***
+Queue text to be drawn.
+Only the producer may call this.
+@function push
+@int id window id, see @{bind}
+@int y line
+@int x column
+@string str UTF-8 text
+@int[opt=curses.A_NORMAL] attrs attributes
+@int[opt=0] pair color pair
+@treturn bool `false` if the queue is full, and the command was dropped
+*/
+static int
+Qpush(lua_State *L)
+{
+	int id = checkint(L, 2);
+	int y = checkint(L, 3);
+	int x = checkint(L, 4);
+	size_t len;
+	const char *s = luaL_checklstring(L, 5, &len);
+	attr_t attrs = (attr_t) optint(L, 6, A_NORMAL);
+	int pair = optint(L, 7, 0);
+	return queue_pushcmd(L, LCQ_TEXT, id, y, x, s, len, attrs, pair);
+}
+
+
+/***
+Queue the erasing of a window.
+Only the producer may call this.
+@function erase
+@int id window id
+@treturn bool `false` if the queue is full
+@see curses.window:erase
+*/
+static int
+Qerase(lua_State *L)
+{
+	return queue_pushcmd(L, LCQ_ERASE, checkint(L, 2), 0, 0, "", 0, 0, 0);
+}
+
+
+/***
+Queue clearing a line of a window from a column to its end.
+Only the producer may call this.
+@function clrtoeol
+@int id window id
+@int y line
+@int x column
+@treturn bool `false` if the queue is full
+@see curses.window:clrtoeol
+*/
+static int
+Qclrtoeol(lua_State *L)
+{
+	return queue_pushcmd(L, LCQ_CLRTOEOL, checkint(L, 2), checkint(L, 3),
+		checkint(L, 4), "", 0, 0, 0);
+}
+
+
+/***
+Give a window an id for the commands of this queue.
+Bindings belong to the queue object they were made on, which should be
+the one of the consumer.
+@function bind
+@int id window id
+@tparam[opt] curses.window win the window, or `nil` to remove the id
+*/
+static int
+Qbind(lua_State *L)
+{
+	int id = checkint(L, 2);
+
+	checkqueue(L, 1);
+	if (!lua_isnoneornil(L, 3))
+		checkwin(L, 3);
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 3);
+	lua_rawseti(L, -2, id);
+	return 0;
+}
+
+
+/***
+Draw the queued commands.
+Commands for ids without a window are skipped, and the attributes of
+the windows are restored afterwards.  Call @{curses.doupdate} or
+refresh the windows to show the result.
+@function apply
+@int[opt] max apply at most this many commands
+@treturn int number of commands taken from the queue
+*/
+static int
+Qapply(lua_State *L)
+{
+	lc_queue *q = checkqueue(L, 1);
+	int max = optint(L, 2, -1);
+	const lcq_cmd *c;
+	int n = 0;
+	int lastid = 0;
+	WINDOW *w = NULL;
+
+	lua_getuservalue(L, 1);
+	while (n != max && (c = queue_peek(q)) != NULL)
+	{
+		if (w == NULL || c->id != lastid)
+		{
+			WINDOW **pw;
+			lua_rawgeti(L, -1, c->id);
+			pw = (WINDOW **) lua_touserdata(L, -1);
+			w = pw ? *pw : NULL;
+			lastid = c->id;
+			lua_pop(L, 1);
+		}
+		if (w != NULL)
+		{
+			attr_t oattrs;
+			short opair;
+
+			switch (c->op)
+			{
+			case LCQ_TEXT:
+				wattr_get(w, &oattrs, &opair, NULL);
+				wattr_set(w, c->attrs, c->pair, NULL);
+				if (wmove(w, c->y, c->x) == OK)
+					waddnstr(w, (const char *) (c + 1), c->textlen);
+				wattr_set(w, oattrs, opair, NULL);
+				break;
+			case LCQ_ERASE:
+				werase(w);
+				break;
+			case LCQ_CLRTOEOL:
+				if (wmove(w, c->y, c->x) == OK)
+					wclrtoeol(w);
+				break;
+			}
+		}
+		queue_pop(q, c);
+		n++;
+	}
+	return pushintresult(n);
+}
+
+
+/***
+State of the queue.
+@function stats
+@treturn int bytes waiting to be applied
+@treturn int commands dropped because the queue was full
+*/
+static int
+Qstats(lua_State *L)
+{
+	lc_queue *q = checkqueue(L, 1);
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	lua_pushinteger(L, head - tail);
+	lua_pushinteger(L, __atomic_load_n(&q->dropped, __ATOMIC_RELAXED));
+	return 2;
+}
+
+
+/***
+Close this queue object.
+The queue is freed when it is closed in every Lua state.
+@function close
+*/
+static int
+Qclose(lua_State *L)
+{
+	lc_queue **q = (lc_queue **) luaL_checkudata(L, 1, QUEUE_META);
+	if (*q)
+		queue_unref(*q);
+	*q = NULL;
+	return 0;
+}
+
+
+static const luaL_Reg curses_queue_fns[] =
+{
+	LCURSES_FUNC( Qapply		),
+	LCURSES_FUNC( Qattach		),
+	LCURSES_FUNC( Qbind		),
+	LCURSES_FUNC( Qclose		),
+	LCURSES_FUNC( Qclrtoeol		),
+	LCURSES_FUNC( Qerase		),
+	LCURSES_FUNC( Qhandle		),
+	LCURSES_FUNC( Qnew		),
+	LCURSES_FUNC( Qpush		),
+	LCURSES_FUNC( Qstats		),
+	{"__gc",     Qclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_queue(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_queue_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, QUEUE_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, mt, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesQueue");
+	lua_setfield(L, mt, "_type");		/* mt._type = "CursesQueue" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.queue..." */
+	lua_pushliteral(L, "curses.queue for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_QUEUE_C*/
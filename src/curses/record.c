@@ -0,0 +1,770 @@
+/* */
+
+/***
+ Session recording.
+
+ A recording keeps the bytes a screen sent to its terminal, and the
+ keystrokes it received, with the time of each, in the asciicast v2
+ format of asciinema: a JSON header line with the size of the terminal,
+ then one JSON array per event, `[seconds, "o", data]` for output, `"i"`
+ for input and `"r"` for a change of size.  A recording can be played
+ by asciinema, or replayed here into a @{curses.vterm}, without a
+ terminal, to reproduce a bug report or to time a rendering path
+ deterministically:
+
+     local screen = curses.newterm ("xterm-256color", fd, fd, true)
+     local rec = curses.record.start ("session.cast")
+     ...
+     rec:stop ()
+
+     local vt = curses.record.replay ("session.cast", {speed = 0})
+     print (vt:line (0))
+
+ The output of a threaded screen (see `curses.newterm`) passes through
+ its I/O thread, which writes the events, so the recording holds exactly
+ what reached the terminal.  Any other screen, such as the one of
+ @{curses.initscr}, is given such a thread for as long as it is
+ recorded: the descriptors curses writes to and reads from are pointed
+ at a pseudo-terminal, and get the real terminal back, with the modes
+ curses set meanwhile, when the recording stops.
+
+ JSON strings are text, so a byte which is not part of valid UTF-8 is
+ written as the lone surrogate U+DC80 to U+DCFF, as the surrogateescape
+ error handler of Python does.  @{replay} turns these back into the
+ original bytes, so a recording is byte-exact here; other players show
+ them as replacement characters.
+
+@module curses.record
+*/
+
+#ifndef LCURSES_RECORD_C
+#define LCURSES_RECORD_C 1
+
+#include <time.h>
+
+#include "_helpers.c"
+#include "screen.c"
+#include "server.c"
+#include "vterm.c"
+
+
+static const char *RECORDER_META = "curses:recorder";
+
+typedef struct lc_recorder {
+	FILE *fp;
+	lc_flusher *f;		/* NULL once stopped */
+	lc_flusher *tap;	/* put in front of a screen which is not threaded */
+	int tapfd[2];		/* the output and input descriptors of that screen */
+	struct timespec t0;
+	int nlines, ncols;
+	lc_buf tmp;
+	char part[2][4];	/* incomplete UTF-8 at the end of the last event */
+	int npart[2];
+	size_t events, bytes;
+	int err;		/* errno of a failed write */
+} lc_recorder;
+
+
+static double
+rec_since(const struct timespec *t0)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - t0->tv_sec) + (ts.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/*
+** Length of the UTF-8 sequence at s, 0 if it is not valid, or -1 if it
+** is cut short by the end of the n bytes.
+*/
+static int
+rec_seqlen(const unsigned char *s, size_t n)
+{
+	unsigned char c = s[0];
+	int len, i;
+
+	if (c >= 0xc2 && c <= 0xdf)
+		len = 2;
+	else if (c >= 0xe0 && c <= 0xef)
+		len = 3;
+	else if (c >= 0xf0 && c <= 0xf4)
+		len = 4;
+	else
+		return 0;
+	for (i = 1; i < len; i++)
+	{
+		if ((size_t) i >= n)
+			return -1;
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+	}
+	/* overlong forms, surrogates, and beyond U+10FFFF */
+	if ((c == 0xe0 && s[1] < 0xa0) || (c == 0xed && s[1] >= 0xa0)
+		|| (c == 0xf0 && s[1] < 0x90) || (c == 0xf4 && s[1] >= 0x90))
+		return 0;
+	return len;
+}
+
+/* write s as the contents of a JSON string */
+static void
+rec_string(FILE *fp, const char *str, size_t n)
+{
+	const unsigned char *s = (const unsigned char *) str;
+	size_t i = 0;
+
+	while (i < n)
+	{
+		unsigned char c = s[i];
+		int len;
+
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", fp);
+		else if (c == '\r')
+			fputs("\\r", fp);
+		else if (c == '\t')
+			fputs("\\t", fp);
+		else if (c < 0x20 || c == 0x7f)
+			fprintf(fp, "\\u%04x", c);
+		else if (c < 0x80)
+			putc(c, fp);
+		else if ((len = rec_seqlen(s + i, n - i)) > 0)
+		{
+			fwrite(s + i, 1, len, fp);
+			i += len;
+			continue;
+		}
+		else
+			fprintf(fp, "\\u%04x", 0xdc00 | c);
+		i++;
+	}
+}
+
+static void
+rec_write(lc_recorder *r, char kind, const char *s, size_t n)
+{
+	fprintf(r->fp, "[%.6f, \"%c\", \"", rec_since(&r->t0), kind);
+	rec_string(r->fp, s, n);
+	fputs("\"]\n", r->fp);
+	if (ferror(r->fp) && !r->err)
+		r->err = errno ? errno : EIO;
+	r->events++;
+}
+
+/*
+** Record n bytes of output or input of the screen of f, with f->mu held.
+** A UTF-8 sequence split between two reads is kept for the next event of
+** the same direction.
+*/
+static void
+rec_event(lc_flusher *f, int input, const char *s, size_t n)
+{
+	lc_recorder *r = f->rec;
+	struct winsize ws;
+	size_t keep = 0, k;
+
+	if (r->err)
+		return;
+	if (!input && ioctl(f->master, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0
+		&& (ws.ws_row != r->nlines || ws.ws_col != r->ncols))
+	{
+		char size[32];
+		r->nlines = ws.ws_row;
+		r->ncols = ws.ws_col;
+		sprintf(size, "%dx%d", r->ncols, r->nlines);
+		rec_write(r, 'r', size, strlen(size));
+	}
+
+	r->tmp.len = 0;
+	if (buf_add(&r->tmp, r->part[input], r->npart[input]) < 0
+		|| buf_add(&r->tmp, s, n) < 0)
+	{
+		r->err = ENOMEM;
+		return;
+	}
+	r->bytes += n;
+	for (k = 1; k <= 3 && k <= r->tmp.len; k++)
+	{
+		const unsigned char *p = (unsigned char *) r->tmp.s + r->tmp.len - k;
+		if ((*p & 0xc0) == 0x80)
+			continue;
+		if (rec_seqlen(p, k) < 0)
+			keep = k;
+		break;
+	}
+	memcpy(r->part[input], r->tmp.s + r->tmp.len - keep, keep);
+	r->npart[input] = keep;
+	if (r->tmp.len > keep)
+		rec_write(r, input ? 'i' : 'o', r->tmp.s, r->tmp.len - keep);
+}
+
+/* stop recording f, which is being closed, with its threads stopped */
+static void
+rec_detach(lc_recorder *r)
+{
+	r->f->rec = NULL;
+	r->f = NULL;
+}
+
+/*
+** Put a flusher between the screen with stdscr std, which is not
+** threaded, and its terminal on outfd and infd.
+*/
+static lc_flusher *
+rec_tap(lc_recorder *r, WINDOW *std, int outfd, int infd)
+{
+	lc_flusher *f;
+
+	fflush(stdout);
+	if (!(f = flusher_open(outfd, infd)))
+		return NULL;
+	if (dup2(f->slave, outfd) < 0
+		|| (infd != outfd && dup2(f->slave, infd) < 0))
+	{
+		int e = errno;
+		dup2(f->outfd, outfd);
+		flusher_close(f);
+		errno = e;
+		return NULL;
+	}
+	f->std = std;
+	flusher_catch_winch();
+	r->tap = f;
+	r->tapfd[0] = outfd;
+	r->tapfd[1] = infd;
+	return f;
+}
+
+/* give the screen its terminal back, which detaches r */
+static void
+rec_untap(lc_recorder *r)
+{
+	lc_flusher *f = r->tap;
+	struct termios t;
+
+	fflush(stdout);
+	/* flusher_close restores these, rather than those before the tap */
+	if (f->ttyfd >= 0 && tcgetattr(f->slave, &t) == 0)
+		f->saved = t;
+	dup2(f->outfd, r->tapfd[0]);
+	if (r->tapfd[1] != r->tapfd[0])
+		dup2(f->infd, r->tapfd[1]);
+	r->tap = NULL;
+	flusher_close(f);
+}
+
+/* the screen with stdscr std is being closed */
+static void
+rec_closescreen(WINDOW *std)
+{
+	lc_flusher *f;
+
+	pthread_mutex_lock(&flushers_mu);
+	for (f = flushers; f && !(f->std == std && f->rec && f->rec->tap == f);)
+		f = f->next;
+	pthread_mutex_unlock(&flushers_mu);
+	if (f)
+		rec_untap(f->rec);
+}
+
+
+static lc_recorder *
+checkrecorder(lua_State *L, int narg)
+{
+	return (lc_recorder *) luaL_checkudata(L, narg, RECORDER_META);
+}
+
+/* the flusher in front of the screen with stdscr std, or NULL */
+static lc_flusher *
+rec_flusher(WINDOW *std)
+{
+	lc_flusher *f;
+
+	pthread_mutex_lock(&flushers_mu);
+	for (f = flushers; f && f->std != std; f = f->next)
+		;
+	pthread_mutex_unlock(&flushers_mu);
+	return f;
+}
+
+
+/***
+Start recording a screen.
+Output already written by curses, such as the first frame, is not
+in the recording, so a recording is best started before the screen
+is first updated, or followed by a full redraw such as
+`curses.stdscr ():redrawwin ()`.
+@function start
+@string path file to write, replaced if it exists
+@tparam[opt] curses.screen screen the screen, by default the current
+  one; a screen which is neither threaded nor the one of
+  @{curses.initscr} must be given
+@treturn[1] recorder a recorder, stopped when collected
+@return[2] nil
+@treturn[2] string error message
+@usage
+  local rec = curses.record.start ("/tmp/bug.cast")
+*/
+static int
+Estart(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	const char *term;
+	int outfd, infd;
+	lc_recorder *r;
+	lc_flusher *f;
+	struct winsize ws;
+	WINDOW *std;
+
+	if (!lua_isnoneornil(L, 2))
+	{
+		lc_screen *s = checkscreen(L, 2);
+		SCREEN *old = set_term(s->sp);
+		term = termname();
+		std = stdscr;
+		if (old)
+			set_term(old);
+		outfd = fileno(s->ofp);
+		infd = fileno(s->ifp);
+	}
+	else
+	{
+		luaL_argcheck(L, stdscr != NULL, 2, "curses is not initialised");
+		term = termname();
+		std = stdscr;
+		outfd = fileno(stdout);
+		infd = fileno(stdin);
+	}
+	f = rec_flusher(std);
+	luaL_argcheck(L, !f || f->rec == NULL, 2, "screen is already recorded");
+	luaL_argcheck(L, f || !lua_isnoneornil(L, 2) || std == initscr_std, 2,
+		"the current screen should be given");
+
+	r = lua_newuserdata(L, sizeof *r);
+	memset(r, 0, sizeof *r);
+	luaL_setmetatable(L, RECORDER_META);
+	if (!(r->fp = fopen(path, "w")))
+		return pusherror(L, path);
+	if (!f && !(f = rec_tap(r, std, outfd, infd)))
+	{
+		int e = errno;
+		fclose(r->fp);
+		r->fp = NULL;
+		errno = e;
+		return pusherror(L, "record");
+	}
+	if (ioctl(f->master, TIOCGWINSZ, &ws) == 0)
+	{
+		r->nlines = ws.ws_row;
+		r->ncols = ws.ws_col;
+	}
+	/* a terminal which does not know its size, curses took terminfo's */
+	if (r->nlines <= 0 || r->ncols <= 0)
+	{
+		r->nlines = getmaxy(std);
+		r->ncols = getmaxx(std);
+	}
+	fprintf(r->fp, "{\"version\": 2, \"width\": %d, \"height\": %d, "
+		"\"timestamp\": %ld, \"env\": {\"TERM\": \"",
+		r->ncols, r->nlines, (long) time(NULL));
+	if (term)
+		rec_string(r->fp, term, strlen(term));
+	fputs("\"}}\n", r->fp);
+	fflush(r->fp);
+	clock_gettime(CLOCK_MONOTONIC, &r->t0);
+
+	pthread_mutex_lock(&f->mu);
+	r->f = f;
+	f->rec = r;
+	pthread_mutex_unlock(&f->mu);
+	return 1;
+}
+
+
+/***
+Stop recording, and close the file.
+Stopping again does nothing.
+@function stop
+@treturn[1] int number of events recorded
+@treturn[1] int number of bytes of output and input recorded
+@return[2] nil
+@treturn[2] string error message, if writing the file failed
+*/
+static int
+Estop(lua_State *L)
+{
+	lc_recorder *r = checkrecorder(L, 1);
+	int e;
+
+	if (r->fp == NULL)
+		return 0;
+	if (r->tap)
+		rec_untap(r);
+	else if (r->f)
+	{
+		pthread_mutex_lock(&r->f->mu);
+		r->f->rec = NULL;
+		pthread_mutex_unlock(&r->f->mu);
+		r->f = NULL;
+	}
+	e = r->err;
+	if (fclose(r->fp) != 0 && !e)
+		e = errno;
+	r->fp = NULL;
+	free(r->tmp.s);
+	r->tmp.s = NULL;
+	if (e)
+	{
+		errno = e;
+		return pusherror(L, "record");
+	}
+	lua_pushinteger(L, r->events);
+	lua_pushinteger(L, r->bytes);
+	return 2;
+}
+
+
+/* parse the JSON number at *p */
+static int
+rec_number(const char **p, double *d)
+{
+	char *end;
+
+	while (**p == ' ' || **p == '\t')
+		(*p)++;
+	*d = strtod(*p, &end);
+	if (end == *p)
+		return -1;
+	*p = end;
+	return 0;
+}
+
+static const char *
+rec_skip(const char *p, int c)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return *p == c ? p + 1 : NULL;
+}
+
+/* the four hex digits at s, stopping at any other character */
+static int
+rec_hex4(const char *s, unsigned long *cp)
+{
+	int i;
+
+	*cp = 0;
+	for (i = 0; i < 4; i++)
+	{
+		int c = s[i];
+		if (c >= '0' && c <= '9')
+			c -= '0';
+		else if (c >= 'a' && c <= 'f')
+			c -= 'a' - 10;
+		else if (c >= 'A' && c <= 'F')
+			c -= 'A' - 10;
+		else
+			return -1;
+		*cp = *cp << 4 | c;
+	}
+	return 0;
+}
+
+/* decode the JSON string at *p into b, replacing its contents */
+static int
+rec_unquote(const char **p, lc_buf *b)
+{
+	const char *s = rec_skip(*p, '"');
+
+	b->len = 0;
+	if (!s)
+		return -1;
+	while (*s != '"')
+	{
+		const char *from = s;
+		unsigned long cp, lo;
+
+		while (*s && *s != '"' && *s != '\\')
+			s++;
+		if (buf_add(b, from, s - from) < 0)
+			return -1;
+		if (*s != '\\')
+		{
+			if (!*s)
+				return -1;
+			continue;
+		}
+		switch (*++s)
+		{
+		case 'n': buf_addlit(b, "\n"); break;
+		case 'r': buf_addlit(b, "\r"); break;
+		case 't': buf_addlit(b, "\t"); break;
+		case 'b': buf_addlit(b, "\b"); break;
+		case 'f': buf_addlit(b, "\f"); break;
+		case '"': case '\\': case '/':
+			buf_add(b, s, 1);
+			break;
+		case 'u':
+			if (rec_hex4(s + 1, &cp) != 0)
+				return -1;
+			s += 4;
+			if (cp >= 0xd800 && cp < 0xdc00 && s[1] == '\\' && s[2] == 'u'
+				&& rec_hex4(s + 3, &lo) == 0
+				&& lo >= 0xdc00 && lo < 0xe000)
+			{
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				s += 6;
+			}
+			if (cp >= 0xdc80 && cp <= 0xdcff)
+			{
+				/* a byte which was not UTF-8, see rec_string */
+				char c = cp & 0xff;
+				buf_add(b, &c, 1);
+			}
+			else
+			{
+				char u[4];
+				buf_add(b, u, utf8_encode(u, cp));
+			}
+			break;
+		default:
+			return -1;
+		}
+		s++;
+	}
+	*p = s + 1;
+	return 0;
+}
+
+/* the integer after "key": in the header line h, or -1 */
+static long
+rec_header(const char *h, const char *key)
+{
+	const char *p = strstr(h, key);
+
+	if (!p || !(p = rec_skip(p + strlen(key), ':')))
+		return -1;
+	return strtol(p, NULL, 10);
+}
+
+static void
+rec_sleep(double t)
+{
+	struct timespec ts;
+
+	if (t <= 0)
+		return;
+	ts.tv_sec = (time_t) t;
+	ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+}
+
+/* state of replay, freed on errors raised by the step function */
+typedef struct rec_replay {
+	FILE *fp;
+	char *line;
+	size_t size;
+	lc_buf kind, data;
+} rec_replay;
+
+static void
+rec_replay_free(rec_replay *p)
+{
+	if (p->fp)
+		fclose(p->fp);
+	free(p->line);
+	free(p->kind.s);
+	free(p->data.s);
+	memset(p, 0, sizeof *p);
+}
+
+static int
+rec_replay_gc(lua_State *L)
+{
+	rec_replay_free((rec_replay *) lua_touserdata(L, 1));
+	return 0;
+}
+
+
+/***
+Replay a recording into a vterm.
+Output events are fed to the vterm at the pace they were recorded,
+scaled by *speed*; size changes resize it, and input events are
+skipped.  With a *speed* of 0 there are no pauses, which makes a
+replay a repeatable benchmark of the terminal side.
+@function replay
+@string path file written by @{start}, or by asciinema
+@tparam[opt] table opts options:
+
+ - `speed`: pace relative to the recording, default 1; 0 does not wait
+ - `idle`: longest pause in seconds, default no limit
+ - `vterm`: a @{curses.vterm} to feed, rather than a new one of the
+   size in the header
+ - `step`: function called after each output event with the vterm and
+   the time of the event; replay stops early if it returns `false`
+
+@treturn[1] curses.vterm the vterm, showing the end of the recording
+@treturn[1] int number of output events fed
+@treturn[1] number time of the last event in the recording
+@return[2] nil
+@treturn[2] string error message
+@usage
+  local vt, n, t = curses.record.replay ("bug.cast", {speed = 0})
+*/
+static int
+Ereplay(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	double speed = 1, idle = -1, t, last = 0, at = 0, elapsed;
+	int vt, step = 0, lineno = 1, n = 0;
+	struct timespec t0;
+	rec_replay *p;
+	vterm *v;
+
+	if (!lua_isnoneornil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		speed = optnumberfield(L, 2, "speed", 1);
+		idle = optnumberfield(L, 2, "idle", -1);
+		luaL_argcheck(L, speed >= 0, 2, "speed should >= 0");
+		lua_getfield(L, 2, "step");
+		if (!lua_isnil(L, -1))
+			step = lua_gettop(L);
+		else
+			lua_pop(L, 1);
+		lua_getfield(L, 2, "vterm");
+	}
+	else
+		lua_pushnil(L);
+	vt = lua_gettop(L);
+
+	p = lua_newuserdata(L, sizeof *p);
+	memset(p, 0, sizeof *p);
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, rec_replay_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_setmetatable(L, -2);
+	if (!(p->fp = fopen(path, "r")))
+		return pusherror(L, path);
+
+	if (getline(&p->line, &p->size, p->fp) < 0
+		|| rec_header(p->line, "\"version\"") != 2)
+	{
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: not an asciicast v2 recording", path);
+		return 2;
+	}
+	if (lua_isnil(L, vt))
+	{
+		long h = rec_header(p->line, "\"height\""),
+			w = rec_header(p->line, "\"width\"");
+		if (h <= 0 || w <= 0)
+		{
+			lua_pushnil(L);
+			lua_pushfstring(L, "%s: no size in header", path);
+			return 2;
+		}
+		newvterm(L, h, w);
+		lua_replace(L, vt);
+	}
+	v = checkvterm(L, vt);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (getline(&p->line, &p->size, p->fp) >= 0)
+	{
+		const char *s = p->line;
+
+		lineno++;
+		if (!(s = rec_skip(s, '[')))
+		{
+			/* blank lines are allowed, as in asciinema */
+			if (strspn(p->line, " \t\r\n") == strlen(p->line))
+				continue;
+			goto bad;
+		}
+		if (rec_number(&s, &t) != 0 || !(s = rec_skip(s, ','))
+			|| rec_unquote(&s, &p->kind) != 0 || !(s = rec_skip(s, ','))
+			|| rec_unquote(&s, &p->data) != 0 || !rec_skip(s, ']'))
+			goto bad;
+
+		at += idle >= 0 && t - last > idle ? idle : t - last;
+		last = t;
+		if (speed > 0 && (elapsed = rec_since(&t0)) < at / speed)
+			rec_sleep(at / speed - elapsed);
+
+		if (p->kind.len == 1 && p->kind.s[0] == 'o')
+		{
+			vt_feed(&v->parser, p->data.s, p->data.len);
+			n++;
+			if (step)
+			{
+				lua_pushvalue(L, step);
+				lua_pushvalue(L, vt);
+				lua_pushnumber(L, t);
+				lua_call(L, 2, 1);
+				if (lua_type(L, -1) == LUA_TBOOLEAN && !lua_toboolean(L, -1))
+					break;
+				lua_pop(L, 1);
+			}
+		}
+		else if (p->kind.len == 1 && p->kind.s[0] == 'r')
+		{
+			int w, h;
+			buf_add(&p->data, "", 1);
+			if (sscanf(p->data.s, "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+				vterm_resize(v, h, w);
+		}
+	}
+	rec_replay_free(p);
+
+	lua_pushvalue(L, vt);
+	lua_pushinteger(L, n);
+	lua_pushnumber(L, last);
+	return 3;
+
+bad:
+	lua_pushnil(L);
+	lua_pushfstring(L, "%s:%d: bad event", path, lineno);
+	return 2;
+}
+
+
+static const luaL_Reg curses_record_fns[] =
+{
+	LCURSES_FUNC( Ereplay		),
+	LCURSES_FUNC( Estart		),
+	{ NULL, NULL }
+};
+
+static const luaL_Reg curses_recorder_methods[] =
+{
+	LCURSES_FUNC( Estop		),
+	{"__gc",     Estop		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_record(lua_State *L)
+{
+	luaL_newlib(L, curses_record_fns);
+
+	luaL_newmetatable(L, RECORDER_META);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesRecorder");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesRecorder" */
+	luaL_setfuncs(L, curses_recorder_methods, 0);
+	lua_pop(L, 1);
+
+	/* t.version = "curses.record..." */
+	lua_pushliteral(L, "curses.record for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, -2, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_RECORD_C*/
@@ -0,0 +1,859 @@
+/* */
+
+/***
+ Curses terminal screens.
+
+ A screen is a terminal driven by curses, as created by
+ `curses.newterm`.  One process can drive several screens, for
+ example one per pty; curses functions and the @{curses.stdscr} window
+ apply to the current screen, which is selected with @{use} or
+ @{set_term}:
+
+     local screen = curses.newterm ("xterm", fd)
+     screen:use (function (stdscr)
+       stdscr:mvaddstr (0, 0, "hello")
+       stdscr:refresh ()
+     end)
+
+ A screen created with the *threaded* flag of `curses.newterm` hands
+ the writing of its output to a separate thread, so that a slow link
+ does not hold up the Lua thread; frames are then published with
+ @{present}, which skips frames while the terminal is still catching
+ up.
+
+@classmod curses.screen
+*/
+
+#ifndef LCURSES_SCREEN_C
+#define LCURSES_SCREEN_C 1
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#include "_helpers.c"
+
+
+static const char *SCREEN_META = "curses:screen";
+
+/*
+** A threaded screen runs on a pseudo-terminal, whose slave stands in
+** for the real terminal, so that ncurses still sets the modes of a tty
+** and curses input behaves as usual.  An I/O thread copies keystrokes
+** from the real terminal to the master, and drains whatever curses
+** writes into a backlog in memory; a writer thread sends the backlog
+** to the real terminal.  doupdate therefore never waits for a slow
+** link.
+*/
+typedef struct lc_flusher {
+	int master, slave;
+	int outfd, infd;	/* the real terminal */
+	int wake[2];		/* written to stop the I/O thread */
+	struct termios saved;	/* modes of the real terminal */
+	int ttyfd;		/* descriptor saved was read from, or -1 */
+	pthread_t io, writer;
+	pthread_mutex_t mu;
+	pthread_cond_t cond;
+	char *buf;		/* backlog */
+	size_t len, size;
+	size_t inflight;	/* bytes being written right now */
+	int done;		/* the I/O thread has finished */
+	int pending;		/* a frame was deferred; 2 once ready is signalled */
+	int ready[2];		/* readable while a deferred frame can be sent */
+	WINDOW *std;		/* stdscr of the screen */
+	struct lc_recorder *rec;	/* recording, or NULL */
+	struct lc_flusher *next;
+} lc_flusher;
+
+typedef struct lc_screen {
+	SCREEN *sp;
+	FILE *ofp, *ifp;
+	lc_flusher *flush;	/* NULL unless threaded */
+} lc_screen;
+
+
+/*
+** Threaded screens, for the SIGWINCH handler.  The handler may run on
+** any thread, so the list is only read with atomic loads, and
+** flusher_close waits for handlers still walking it before it frees an
+** unlinked flusher.  Changes to the list are serialized by flushers_mu.
+*/
+static lc_flusher *flushers = NULL;
+static int flushers_walking = 0;
+static pthread_mutex_t flushers_mu = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction flusher_oldwinch;
+static int flusher_winch_set = 0;
+
+static WINDOW *initscr_std = NULL;	/* stdscr of the screen of initscr */
+
+static void rec_event(lc_flusher *f, int input, const char *s, size_t n);	/* in record.c */
+static void rec_detach(struct lc_recorder *r);				/* in record.c */
+static void rec_closescreen(WINDOW *std);				/* in record.c */
+
+/*
+** Give the slaves the size of their real terminals before the handler
+** of ncurses, which reads the size from the slave, gets the signal.
+*/
+static void
+flusher_winch(int sig, siginfo_t *info, void *uctx)
+{
+	int e = errno;
+	lc_flusher *f;
+	struct winsize ws;
+
+	__atomic_add_fetch(&flushers_walking, 1, __ATOMIC_SEQ_CST);
+	for (f = __atomic_load_n(&flushers, __ATOMIC_SEQ_CST); f;
+			f = __atomic_load_n(&f->next, __ATOMIC_SEQ_CST))
+		if (ioctl(f->outfd, TIOCGWINSZ, &ws) == 0)
+			ioctl(f->master, TIOCSWINSZ, &ws);
+	__atomic_sub_fetch(&flushers_walking, 1, __ATOMIC_SEQ_CST);
+	errno = e;
+	if (flusher_oldwinch.sa_flags & SA_SIGINFO)
+		flusher_oldwinch.sa_sigaction(sig, info, uctx);
+	else if (flusher_oldwinch.sa_handler != SIG_DFL
+		&& flusher_oldwinch.sa_handler != SIG_IGN)
+		flusher_oldwinch.sa_handler(sig);
+}
+
+static void
+flusher_queue(lc_flusher *f, const char *s, size_t n)
+{
+	pthread_mutex_lock(&f->mu);
+	if (f->rec)
+		rec_event(f, 0, s, n);
+	if (f->len + n > f->size)
+	{
+		size_t size = f->size ? f->size : 4096;
+		char *buf;
+		while (size < f->len + n)
+			size *= 2;
+		if (!(buf = realloc(f->buf, size)))
+			goto out;	/* lose output rather than stall curses */
+		f->buf = buf;
+		f->size = size;
+	}
+	memcpy(f->buf + f->len, s, n);
+	f->len += n;
+	pthread_cond_broadcast(&f->cond);
+out:
+	pthread_mutex_unlock(&f->mu);
+}
+
+static void
+flusher_write(int fd, const char *s, size_t n)
+{
+	while (n > 0)
+	{
+		ssize_t r = write(fd, s, n);
+		if (r < 0)
+		{
+			struct pollfd p;
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return;
+			p.fd = fd;
+			p.events = POLLOUT;
+			poll(&p, 1, -1);
+			continue;
+		}
+		s += r;
+		n -= r;
+	}
+}
+
+/*
+** Pass keyboard input on to the slave.  The real terminal is raw, so
+** the interrupt characters the slave is set up for raise the signals
+** here, as the terminal would have done.
+*/
+static void
+flusher_input(lc_flusher *f, const char *s, size_t n)
+{
+	struct termios t;
+	size_t i, from = 0;
+
+	pthread_mutex_lock(&f->mu);
+	if (f->rec)
+		rec_event(f, 1, s, n);
+	pthread_mutex_unlock(&f->mu);
+
+	if (tcgetattr(f->slave, &t) == 0 && (t.c_lflag & ISIG))
+		for (i = 0; i < n; i++)
+		{
+			cc_t c = (unsigned char) s[i];
+			int sig = 0;
+			if (c == _POSIX_VDISABLE)
+				continue;
+			if (c == t.c_cc[VINTR])
+				sig = SIGINT;
+			else if (c == t.c_cc[VQUIT])
+				sig = SIGQUIT;
+			else if (c == t.c_cc[VSUSP])
+				sig = SIGTSTP;
+			if (sig)
+			{
+				flusher_write(f->master, s + from, i - from);
+				from = i + 1;
+				kill(0, sig);
+			}
+		}
+	flusher_write(f->master, s + from, n - from);
+}
+
+static void *
+flusher_io(void *arg)
+{
+	lc_flusher *f = arg;
+	struct pollfd p[3];
+	char buf[8192];
+	ssize_t n;
+
+	p[0].fd = f->master;
+	p[1].fd = f->infd;
+	p[2].fd = f->wake[0];
+	for (;;)
+	{
+		p[0].events = p[1].events = p[2].events = POLLIN;
+		if (poll(p, 3, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (p[2].revents)
+			break;
+		if (p[0].revents & (POLLIN | POLLHUP))
+			while ((n = read(f->master, buf, sizeof buf)) > 0)
+				flusher_queue(f, buf, n);
+		if (p[1].revents & POLLIN)
+		{
+			if ((n = read(f->infd, buf, sizeof buf)) > 0)
+				flusher_input(f, buf, n);
+			else if (n == 0)
+				p[1].fd = -1;
+		}
+		else if (p[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+			p[1].fd = -1;
+	}
+	/* whatever curses wrote last, such as endwin's */
+	while ((n = read(f->master, buf, sizeof buf)) > 0)
+		flusher_queue(f, buf, n);
+
+	pthread_mutex_lock(&f->mu);
+	f->done = 1;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->mu);
+	return NULL;
+}
+
+/*
+** The backlog was written: wake whoever waits to send a deferred frame.
+** Called with f->mu held.
+*/
+static void
+flusher_drained(lc_flusher *f)
+{
+	if (f->pending == 1)
+	{
+		f->pending = 2;
+		flusher_write(f->ready[1], "", 1);
+	}
+}
+
+static void *
+flusher_writer(void *arg)
+{
+	lc_flusher *f = arg;
+
+	pthread_mutex_lock(&f->mu);
+	for (;;)
+	{
+		char *buf;
+		size_t n;
+
+		while (f->len == 0 && !f->done)
+			pthread_cond_wait(&f->cond, &f->mu);
+		if (f->len == 0)
+			break;
+		buf = f->buf;
+		n = f->inflight = f->len;
+		f->buf = NULL;
+		f->len = f->size = 0;
+		pthread_mutex_unlock(&f->mu);
+
+		flusher_write(f->outfd, buf, n);
+		free(buf);
+
+		pthread_mutex_lock(&f->mu);
+		f->inflight = 0;
+		if (f->len == 0)
+			flusher_drained(f);
+	}
+	pthread_mutex_unlock(&f->mu);
+	return NULL;
+}
+
+/* bytes of output not written to the real terminal yet */
+static size_t
+flusher_backlog(lc_flusher *f)
+{
+	size_t n;
+	int unread = 0;
+
+	/* including what the I/O thread did not get to yet */
+	ioctl(f->master, FIONREAD, &unread);
+	pthread_mutex_lock(&f->mu);
+	n = f->len + f->inflight + (unread > 0 ? unread : 0);
+	pthread_mutex_unlock(&f->mu);
+	return n;
+}
+
+/* mark a frame as deferred until the backlog is written */
+static void
+flusher_defer(lc_flusher *f)
+{
+	int unread = 0;
+
+	ioctl(f->master, FIONREAD, &unread);
+	pthread_mutex_lock(&f->mu);
+	if (!f->pending)
+		f->pending = 1;
+	/* the writer may have finished since the backlog was looked at */
+	if (f->len == 0 && f->inflight == 0 && unread <= 0)
+		flusher_drained(f);
+	pthread_mutex_unlock(&f->mu);
+}
+
+/* the deferred frame, if any, was sent */
+static void
+flusher_sent(lc_flusher *f)
+{
+	char buf[16];
+
+	pthread_mutex_lock(&f->mu);
+	f->pending = 0;
+	while (read(f->ready[0], buf, sizeof buf) > 0)
+		;
+	pthread_mutex_unlock(&f->mu);
+}
+
+/*
+** Stop the threads once everything was written, and give the real
+** terminal its modes back.
+*/
+static void
+flusher_close(lc_flusher *f)
+{
+	lc_flusher **pf;
+	sigset_t set, old;
+
+	/* the handler must not interrupt this thread while it waits */
+	sigemptyset(&set);
+	sigaddset(&set, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	pthread_mutex_lock(&flushers_mu);
+	for (pf = &flushers; *pf; pf = &(*pf)->next)
+		if (*pf == f)
+		{
+			__atomic_store_n(pf, f->next, __ATOMIC_SEQ_CST);
+			break;
+		}
+	pthread_mutex_unlock(&flushers_mu);
+	/* handlers on other threads may still be looking at f */
+	while (__atomic_load_n(&flushers_walking, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	flusher_write(f->wake[1], "", 1);
+	pthread_join(f->io, NULL);
+	pthread_join(f->writer, NULL);
+	if (f->rec)
+		rec_detach(f->rec);
+
+	if (f->ttyfd >= 0)
+		tcsetattr(f->ttyfd, TCSADRAIN, &f->saved);
+	close(f->wake[0]);
+	close(f->wake[1]);
+	close(f->ready[0]);
+	close(f->ready[1]);
+	close(f->master);
+	close(f->slave);
+	close(f->outfd);
+	if (f->infd != f->outfd)
+		close(f->infd);
+	pthread_cond_destroy(&f->cond);
+	pthread_mutex_destroy(&f->mu);
+	free(f->buf);
+	free(f);
+}
+
+/*
+** Set up the pseudo-terminal for a threaded screen on outfd and infd,
+** and start its threads; returns NULL with errno set on failure.  The
+** slave gets the modes and size of the real terminal, which is put in
+** raw mode until flusher_close.
+*/
+static lc_flusher *
+flusher_open(int outfd, int infd)
+{
+	lc_flusher *f;
+	const char *name;
+	struct winsize ws;
+	sigset_t set, old;
+	int e;
+
+	if (!(f = calloc(1, sizeof *f)))
+		return NULL;
+	f->master = f->slave = f->outfd = f->infd = -1;
+	f->wake[0] = f->wake[1] = -1;
+	f->ready[0] = f->ready[1] = -1;
+	f->ttyfd = -1;
+
+	if ((f->outfd = dup(outfd)) < 0
+		|| (f->infd = infd == outfd ? f->outfd : dup(infd)) < 0
+		|| (f->master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+		|| grantpt(f->master) != 0 || unlockpt(f->master) != 0
+		|| !(name = ptsname(f->master))
+		|| (f->slave = open(name, O_RDWR | O_NOCTTY)) < 0
+		|| pipe(f->wake) != 0 || pipe(f->ready) != 0)
+		goto fail;
+	fcntl(f->master, F_SETFL, fcntl(f->master, F_GETFL) | O_NONBLOCK);
+	fcntl(f->ready[0], F_SETFL, fcntl(f->ready[0], F_GETFL) | O_NONBLOCK);
+	fcntl(f->ready[0], F_SETFD, FD_CLOEXEC);
+	fcntl(f->ready[1], F_SETFD, FD_CLOEXEC);
+
+	if (tcgetattr(infd, &f->saved) == 0)
+		f->ttyfd = f->infd;
+	else if (tcgetattr(outfd, &f->saved) == 0)
+		f->ttyfd = f->outfd;
+	if (f->ttyfd >= 0)
+	{
+		struct termios raw = f->saved;
+		tcsetattr(f->slave, TCSANOW, &f->saved);
+		/* what cfmakeraw does */
+		raw.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR
+			| ICRNL | IXON);
+		raw.c_oflag &= ~OPOST;
+		raw.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+		raw.c_cflag &= ~(CSIZE | PARENB);
+		raw.c_cflag |= CS8;
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(f->ttyfd, TCSADRAIN, &raw);
+	}
+	if (ioctl(outfd, TIOCGWINSZ, &ws) == 0)
+		ioctl(f->master, TIOCSWINSZ, &ws);
+
+	pthread_mutex_init(&f->mu, NULL);
+	pthread_cond_init(&f->cond, NULL);
+
+	/* signals are for the Lua thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old);
+	if ((e = pthread_create(&f->io, NULL, flusher_io, f)) == 0
+		&& (e = pthread_create(&f->writer, NULL, flusher_writer, f)) != 0)
+	{
+		flusher_write(f->wake[1], "", 1);
+		pthread_join(f->io, NULL);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (e != 0)
+	{
+		pthread_cond_destroy(&f->cond);
+		pthread_mutex_destroy(&f->mu);
+		errno = e;
+		goto fail;
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	pthread_mutex_lock(&flushers_mu);
+	f->next = flushers;
+	__atomic_store_n(&flushers, f, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&flushers_mu);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return f;
+
+fail:
+	e = errno;
+	if (f->ttyfd >= 0)
+		tcsetattr(f->ttyfd, TCSADRAIN, &f->saved);
+	if (f->wake[0] >= 0)
+		close(f->wake[0]), close(f->wake[1]);
+	if (f->ready[0] >= 0)
+		close(f->ready[0]), close(f->ready[1]);
+	if (f->slave >= 0)
+		close(f->slave);
+	if (f->master >= 0)
+		close(f->master);
+	if (f->infd >= 0 && f->infd != f->outfd)
+		close(f->infd);
+	if (f->outfd >= 0)
+		close(f->outfd);
+	free(f);
+	errno = e;
+	return NULL;
+}
+
+/*
+** Chain the SIGWINCH handler in front of the one ncurses installed
+** when the first threaded screen was created.
+*/
+static void
+flusher_catch_winch(void)
+{
+	struct sigaction sa;
+
+	if (flusher_winch_set || sigaction(SIGWINCH, NULL, &flusher_oldwinch) != 0)
+		return;
+	/* keep the flags, ncurses wants its reads interrupted */
+	sa = flusher_oldwinch;
+	sa.sa_sigaction = flusher_winch;
+	sa.sa_flags |= SA_SIGINFO;
+	if (sigaction(SIGWINCH, &sa, NULL) == 0)
+		flusher_winch_set = 1;
+}
+
+
+static lc_screen *
+checkscreen(lua_State *L, int narg)
+{
+	lc_screen *s = (lc_screen *) luaL_checkudata(L, narg, SCREEN_META);
+	if (s->sp == NULL)
+		luaL_argerror(L, narg, "attempt to use closed curses screen");
+	return s;
+}
+
+/*
+** set_term, but LINES and COLS follow the new screen too; ncurses keeps
+** them as plain globals, which are only assigned when a screen is
+** created or resized.
+*/
+static SCREEN *
+lc_set_term(SCREEN *sp)
+{
+	SCREEN *old = set_term(sp);
+	if (stdscr)
+	{
+		LINES = getmaxy(stdscr);
+		COLS = getmaxx(stdscr);
+	}
+	return old;
+}
+
+/* push the stdscr window object of the screen at narg */
+static void
+pushscreenstdscr(lua_State *L, int narg)
+{
+	lua_getuservalue(L, narg);
+	lua_rawgeti(L, -1, 1);
+	lua_remove(L, -2);
+}
+
+/*
+** Make the screen at narg current, including the stdscr registry slot;
+** returns the previously current screen.
+*/
+static SCREEN *
+setscreen(lua_State *L, int narg)
+{
+	SCREEN *old = lc_set_term(checkscreen(L, narg)->sp);
+	lua_pushstring(L, STDSCR_REGISTRY);
+	pushscreenstdscr(L, narg);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+	return old;
+}
+
+/*
+** Wrap the screen just created by newterm, which is current, in a new
+** userdata; the files and flusher are owned by the screen from now on.
+*/
+static void
+lc_newscreen(lua_State *L, SCREEN *sp, FILE *ofp, FILE *ifp, lc_flusher *flush)
+{
+	lc_screen *s = lua_newuserdata(L, sizeof *s);
+	s->sp = sp;
+	s->ofp = ofp;
+	s->ifp = ifp;
+	s->flush = flush;
+	if (flush)
+	{
+		flush->std = stdscr;
+		flusher_catch_winch();
+	}
+	luaL_setmetatable(L, SCREEN_META);
+
+	lua_createtable(L, 1, 0);
+	lc_newwin(L, stdscr);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
+}
+
+
+/***
+Call a function with this screen as the current screen.
+The previously current screen, and the window returned by
+@{curses.stdscr}, are restored afterwards, even if *fn* raises an
+error.
+@function use
+@func fn function called with the stdscr window of the screen,
+  followed by any extra arguments
+@param[opt] ... extra arguments for *fn*
+@return the results of *fn*
+@see use_screen(3x)
+*/
+static int
+Suse(lua_State *L)
+{
+	int n = lua_gettop(L), base, ok;
+	SCREEN *old;
+
+	checkscreen(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	lua_pushstring(L, STDSCR_REGISTRY);
+	lua_rawget(L, LUA_REGISTRYINDEX);	/* old stdscr, at n + 1 */
+	old = setscreen(L, 1);
+
+	base = lua_gettop(L);
+	lua_pushvalue(L, 2);
+	pushscreenstdscr(L, 1);
+	for (int i = 3; i <= n; i++)
+		lua_pushvalue(L, i);
+	ok = lua_pcall(L, n - 1, LUA_MULTRET, 0);
+
+	if (old)
+		lc_set_term(old);
+	lua_pushstring(L, STDSCR_REGISTRY);
+	lua_pushvalue(L, n + 1);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+
+	if (ok != 0)
+		return lua_error(L);
+	return lua_gettop(L) - base;
+}
+
+
+/***
+Make this screen the current screen.
+@function set_term
+@see set_term(3x)
+@see use
+*/
+static int
+Sset_term(lua_State *L)
+{
+	setscreen(L, 1);
+	return 0;
+}
+
+
+/***
+The main window of this screen.
+@function stdscr
+@treturn curses.window stdscr of the screen
+@see curses.stdscr
+*/
+static int
+Sstdscr(lua_State *L)
+{
+	checkscreen(L, 1);
+	pushscreenstdscr(L, 1);
+	return 1;
+}
+
+
+/***
+Restore the terminal of this screen and free it.
+If it was the current screen, there is no current screen afterwards.
+@function close
+@see delscreen(3x)
+*/
+static int
+Sclose(lua_State *L)
+{
+	lc_screen *s = (lc_screen *) luaL_checkudata(L, 1, SCREEN_META);
+	SCREEN *old;
+
+	if (s->sp == NULL)
+		return 0;
+
+	old = set_term(s->sp);
+	if (!isendwin())
+		endwin();
+	pn_closescreen(stdscr);
+	rec_closescreen(stdscr);
+	/* its windows, stdscr included, go away with the screen */
+	lc_closescreenwins(L);
+	if (old && old != s->sp)
+		lc_set_term(old);
+
+	pushscreenstdscr(L, 1);
+	lua_pushstring(L, STDSCR_REGISTRY);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (lua_rawequal(L, -1, -2))
+	{
+		lua_pushstring(L, STDSCR_REGISTRY);
+		lua_pushnil(L);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
+
+	/* endwin's output still has to reach the terminal */
+	if (s->flush)
+		flusher_close(s->flush);
+	s->flush = NULL;
+
+	delscreen(s->sp);
+	s->sp = NULL;
+	fclose(s->ofp);
+	if (s->ifp != s->ofp)
+		fclose(s->ifp);
+	return 0;
+}
+
+
+static int
+screen_doupdate(SCREEN *LCURSES_UNUSED(sp), void *LCURSES_UNUSED(data))
+{
+	int r = doupdate();
+	mr_sync_all();
+	return r;
+}
+
+
+/***
+Send the current frame of this screen to its terminal.
+This is @{curses.doupdate} for a screen which need not be current.
+On a threaded screen, if the writer thread is still busy with earlier
+output, the frame is only marked as pending and nothing is written:
+curses compares against what was last sent, so the next successful
+`present` brings the terminal up to date without sending the stale
+frames in between.  Once the backlog is written, @{ready_fd} becomes
+readable, so that an event loop knows to call `present` again.
+@function present
+@treturn bool `true` if the frame was sent, `false` if it was deferred
+@see doupdate(3x)
+@see use_screen(3x)
+@see backlog
+@see ready_fd
+*/
+static int
+Spresent(lua_State *L)
+{
+	lc_screen *s = checkscreen(L, 1);
+
+	if (s->flush && flusher_backlog(s->flush) > 0)
+	{
+		flusher_defer(s->flush);
+		return pushboolresult(0);
+	}
+	use_screen(s->sp, screen_doupdate, NULL);
+	if (s->flush)
+		flusher_sent(s->flush);
+	return pushboolresult(1);
+}
+
+
+/***
+Descriptor to wait on for a deferred frame.
+It becomes readable when @{present} deferred a frame and the writer
+thread has since written the backlog; the next successful `present`
+clears it.  Poll it together with the input of the program, e.g. with
+`posix.poll`, instead of presenting on a timer.
+@function ready_fd
+@treturn int file descriptor, or -1 unless the screen is threaded
+@see present
+*/
+static int
+Sready_fd(lua_State *L)
+{
+	lc_screen *s = checkscreen(L, 1);
+	return pushintresult(s->flush ? s->flush->ready[0] : -1);
+}
+
+
+/***
+Output of a threaded screen which has not been written yet.
+@function backlog
+@treturn int bytes waiting for the writer thread, 0 unless threaded
+@treturn bool whether a frame was deferred by @{present}
+*/
+static int
+Sbacklog(lua_State *L)
+{
+	lc_screen *s = checkscreen(L, 1);
+
+	lua_pushinteger(L, s->flush ? flusher_backlog(s->flush) : 0);
+	lua_pushboolean(L, s->flush && s->flush->pending);
+	return 2;
+}
+
+
+/***
+Unique string representation of a @{curses.screen}.
+@function __tostring
+@treturn string unique string representation of the screen object.
+*/
+static int
+S__tostring(lua_State *L)
+{
+	lc_screen *s = (lc_screen *) luaL_checkudata(L, 1, SCREEN_META);
+	if (s->sp == NULL)
+		lua_pushliteral(L, "curses screen (closed)");
+	else
+		lua_pushfstring(L, "curses screen (%p)", lua_touserdata(L, 1));
+	return 1;
+}
+
+
+static const luaL_Reg curses_screen_fns[] =
+{
+	LCURSES_FUNC( S__tostring	),
+	LCURSES_FUNC( Sbacklog		),
+	LCURSES_FUNC( Sclose		),
+	LCURSES_FUNC( Spresent		),
+	LCURSES_FUNC( Sready_fd		),
+	LCURSES_FUNC( Sset_term		),
+	LCURSES_FUNC( Sstdscr		),
+	LCURSES_FUNC( Suse		),
+	{"__gc",     Sclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_screen(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_screen_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, SCREEN_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, mt, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesScreen");
+	lua_setfield(L, mt, "_type");		/* mt._type = "CursesScreen" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.screen..." */
+	lua_pushliteral(L, "curses.screen for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_SCREEN_C*/
@@ -0,0 +1,902 @@
+/* */
+
+/***
+ Multi-client screen sharing.
+
+ A server holds one logical frame, a cell grid which is independent of
+ any terminal, and keeps any number of attached clients up to date with
+ it.  Clients are file descriptors, such as ptys or connected Unix
+ sockets, each with its own size and terminal type.  Every frame is
+ captured once; then each changed row is encoded into escape sequences
+ once per distinct client width and color depth, and the per-client
+ diffs are assembled and written on a pool of threads:
+
+     local server = curses.server.new (24, 80)
+     local id = server:attach (fd, 24, 80, "xterm-256color")
+     -- every frame
+     server:capture (stdscr)
+     server:present ()
+
+ Clients smaller than the frame see its top left corner.  Writes never
+ block: a client which cannot keep up skips frames, and catches up with
+ the newest one once its backlog is written.
+
+@classmod curses.server
+*/
+
+#ifndef LCURSES_SERVER_C
+#define LCURSES_SERVER_C 1
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "_helpers.c"
+#include "_ansi.c"
+#include "_grid.c"
+#include "_pool.c"
+#include "_width.c"
+
+
+static const char *SERVER_META = "curses:server";
+
+/* a growable byte buffer */
+typedef struct lc_buf {
+	char *s;
+	size_t len, cap;
+} lc_buf;
+
+static int
+buf_add(lc_buf *b, const char *s, size_t n)
+{
+	if (b->len + n > b->cap)
+	{
+		size_t cap = b->cap ? b->cap : 256;
+		char *ns;
+		while (cap < b->len + n)
+			cap *= 2;
+		if (!(ns = realloc(b->s, cap)))
+			return -1;
+		b->s = ns;
+		b->cap = cap;
+	}
+	memcpy(b->s + b->len, s, n);
+	b->len += n;
+	return 0;
+}
+
+#define buf_addlit(b, lit)	buf_add(b, lit, sizeof(lit) - 1)
+
+/* encoded rows, shared by the clients with the same width and depth */
+typedef struct srv_row {
+	uint64_t hash;
+	lc_buf enc;
+} srv_row;
+
+typedef struct srv_variant {
+	int width;		/* columns of the frame shown */
+	int pad;		/* clients are wider than the frame */
+	int depth;		/* number of colors */
+	int used;
+	srv_row *rows;		/* one per frame line */
+} srv_variant;
+
+typedef struct srv_client {
+	int fd;			/* -1 for a free slot */
+	int nlines, ncols, depth;
+	int variant;
+	uint64_t *sent;		/* hashes of the rows the client was sent */
+	int full;		/* clear and redraw everything */
+	int dead;		/* a write failed */
+	int cy, cx, cvis;	/* cursor the client was sent */
+	lc_buf out;		/* written up to outpos */
+	size_t outpos;
+	int updated;
+} srv_client;
+
+typedef struct lc_server {
+	lc_grid frame;
+	lc_pool pool;
+	int pooled;
+	srv_client *clients;
+	int nclients;
+	srv_variant *variants;
+	int nvariants;
+	int cy, cx, cvis;
+} lc_server;
+
+
+/* ============== *
+ * Row encoding.  *
+ * ============== */
+
+#define FNV_OFFSET	UINT64_C(14695981039346656037)
+#define FNV_PRIME	UINT64_C(1099511628211)
+
+static uint64_t
+fnv_int(uint64_t h, uint32_t v)
+{
+	int i;
+	for (i = 0; i < 4; i++, v >>= 8)
+		h = (h ^ (v & 0xff)) * FNV_PRIME;
+	return h;
+}
+
+static uint64_t
+srv_hash_row(const lc_cell *row, int width)
+{
+	uint64_t h = FNV_OFFSET;
+	int x;
+
+	for (x = 0; x < width; x++)
+	{
+		h = fnv_int(h, row[x].ch);
+		h = fnv_int(h, row[x].comb);
+		h = fnv_int(h, row[x].pen.attrs);
+		h = fnv_int(h, row[x].pen.fg);
+		h = fnv_int(h, row[x].pen.bg);
+	}
+	/* never 0, which marks rows a client has not been sent */
+	return h ? h : 1;
+}
+
+static int
+srv_is_blank(const lc_cell *c)
+{
+	return c->ch == ' ' && !c->comb && !c->pen.attrs
+		&& c->pen.fg == LC_COLOR_DEFAULT && c->pen.bg == LC_COLOR_DEFAULT;
+}
+
+/* append the SGR parameters for a pen color, for a terminal of depth colors */
+static void
+srv_color(lc_buf *b, int c, int depth, int bg)
+{
+	char num[32];
+
+	if (c == LC_COLOR_DEFAULT || depth < 8)
+		return;
+	if (c & LC_COLOR_RGB)
+	{
+		if (depth >= 0x1000000)
+		{
+			sprintf(num, ";%d8;2;%d;%d;%d", bg ? 4 : 3,
+				(c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+			buf_add(b, num, strlen(num));
+			return;
+		}
+		c = nearest_color(c & 0xffffff, depth >= 256 ? 256 : 16);
+	}
+	if (c >= 16 && depth < 256)
+		c = nearest_color(xterm_rgb(c), 16);
+	if (c >= 16)
+		sprintf(num, ";%d8;5;%d", bg ? 4 : 3, c);
+	else if (c >= 8 && depth >= 16)
+		sprintf(num, ";%d", (bg ? 100 : 90) + c - 8);
+	else if (c >= 8)
+		sprintf(num, ";%d%s", (bg ? 40 : 30) + c - 8, bg ? "" : ";1");
+	else
+		sprintf(num, ";%d", (bg ? 40 : 30) + c);
+	buf_add(b, num, strlen(num));
+}
+
+static void
+srv_sgr(lc_buf *b, const lc_pen *pen, int depth)
+{
+	attr_t a = pen->attrs;
+
+	buf_addlit(b, "\033[0");
+	if (a & A_BOLD)			buf_addlit(b, ";1");
+	if (a & A_DIM)			buf_addlit(b, ";2");
+	if (a & A_ITALIC & ~A_NORMAL)	buf_addlit(b, ";3");
+	if (a & A_UNDERLINE)		buf_addlit(b, ";4");
+	if (a & A_BLINK)		buf_addlit(b, ";5");
+	if (a & (A_REVERSE | A_STANDOUT))	buf_addlit(b, ";7");
+	if (a & A_INVIS)		buf_addlit(b, ";8");
+	srv_color(b, pen->fg, depth, 0);
+	srv_color(b, pen->bg, depth, 1);
+	buf_addlit(b, "m");
+}
+
+/*
+** Encode the first width cells of a frame row, leaving the terminal
+** with the default rendition.  The row is expected to start with the
+** cursor in its first column and the default rendition.
+*/
+static void
+srv_encode_row(lc_buf *b, const lc_cell *row, int ncols, const srv_variant *v)
+{
+	lc_pen cur;
+	int x, end;
+
+	b->len = 0;
+	pen_reset(&cur);
+	for (end = v->width; end > 0 && srv_is_blank(&row[end - 1]); end--)
+		;
+	for (x = 0; x < end; x++)
+	{
+		char u[8];
+		int n, ch = row[x].ch;
+
+		if (ch == 0)
+			continue;
+		/* a wide character cut by the right edge */
+		if (x + 1 == v->width && x + 1 < ncols && row[x + 1].ch == 0)
+			ch = ' ';
+		if (!pen_equal(&cur, &row[x].pen))
+		{
+			cur = row[x].pen;
+			srv_sgr(b, &cur, v->depth);
+		}
+		n = utf8_encode(u, ch);
+		if (row[x].comb && ch != ' ')
+			n += utf8_encode(u + n, row[x].comb);
+		buf_add(b, u, n);
+	}
+	if (cur.attrs || cur.fg != LC_COLOR_DEFAULT || cur.bg != LC_COLOR_DEFAULT)
+		buf_addlit(b, "\033[0m");
+	/* at the last column, EL would erase the character just written */
+	if (end < v->width || v->pad)
+		buf_addlit(b, "\033[K");
+}
+
+
+/* ============ *
+ * Present.     *
+ * ============ */
+
+static void
+srv_free_variant(srv_variant *v, int nlines)
+{
+	int y;
+	if (v->rows)
+		for (y = 0; y < nlines; y++)
+			free(v->rows[y].enc.s);
+	free(v->rows);
+	v->rows = NULL;
+}
+
+/* index of the variant for a client, creating it if need be */
+static int
+srv_variant_for(lc_server *s, const srv_client *c)
+{
+	int width = c->ncols < s->frame.ncols ? c->ncols : s->frame.ncols;
+	int pad = c->ncols > s->frame.ncols;
+	srv_variant *v;
+	int i;
+
+	for (i = 0; i < s->nvariants; i++)
+	{
+		v = &s->variants[i];
+		if (v->width == width && v->pad == pad && v->depth == c->depth)
+			return i;
+	}
+	v = realloc(s->variants, (s->nvariants + 1) * sizeof *v);
+	if (!v)
+		return -1;
+	s->variants = v;
+	v = &s->variants[s->nvariants];
+	v->width = width;
+	v->pad = pad;
+	v->depth = c->depth;
+	v->used = 0;
+	if (!(v->rows = calloc(s->frame.nlines, sizeof *v->rows)))
+		return -1;
+	return s->nvariants++;
+}
+
+/* job: bring row i % nlines of variant i / nlines up to date */
+static void
+srv_encode_job(void *ctx, int i)
+{
+	lc_server *s = ctx;
+	srv_variant *v = &s->variants[i / s->frame.nlines];
+	int y = i % s->frame.nlines;
+	const lc_cell *row = s->frame.rows[y];
+	uint64_t h;
+
+	if (!v->used)
+		return;
+	h = srv_hash_row(row, v->width);
+	if (h != v->rows[y].hash)
+	{
+		srv_encode_row(&v->rows[y].enc, row, s->frame.ncols, v);
+		v->rows[y].hash = h;
+	}
+}
+
+/* write as much of the client backlog as possible without blocking */
+static void
+srv_flush(srv_client *c)
+{
+	while (c->outpos < c->out.len)
+	{
+		ssize_t n = send(c->fd, c->out.s + c->outpos, c->out.len - c->outpos,
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == ENOTSOCK)
+			n = write(c->fd, c->out.s + c->outpos, c->out.len - c->outpos);
+		if (n > 0)
+			c->outpos += n;
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+		{
+			if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				c->dead = 1;
+			break;
+		}
+	}
+	if (c->outpos == c->out.len)
+		c->outpos = c->out.len = 0;
+}
+
+/* job: assemble and write the diff of client i */
+static void
+srv_client_job(void *ctx, int i)
+{
+	lc_server *s = ctx;
+	srv_client *c = &s->clients[i];
+	srv_variant *v;
+	char seq[32];
+	int y, nlines, rows = 0;
+
+	c->updated = 0;
+	if (c->fd < 0 || c->dead || c->variant < 0)
+		return;
+	/* the previous frame is still being written: skip this one */
+	if (c->out.len > 0)
+	{
+		srv_flush(c);
+		if (c->out.len > 0)
+			return;
+	}
+
+	v = &s->variants[c->variant];
+	nlines = c->nlines < s->frame.nlines ? c->nlines : s->frame.nlines;
+	if (c->full)
+	{
+		buf_addlit(&c->out, "\033[0m\033[H\033[2J");
+		memset(c->sent, 0, c->nlines * sizeof *c->sent);
+		c->full = 0;
+		c->cy = -1;
+	}
+	for (y = 0; y < nlines; y++)
+		if (c->sent[y] != v->rows[y].hash)
+		{
+			if (rows++ == 0)
+				buf_addlit(&c->out, "\033[?25l");
+			sprintf(seq, "\033[%dH", y + 1);
+			buf_add(&c->out, seq, strlen(seq));
+			buf_add(&c->out, v->rows[y].enc.s, v->rows[y].enc.len);
+			c->sent[y] = v->rows[y].hash;
+		}
+	if (rows > 0 || c->cy != s->cy || c->cx != s->cx || c->cvis != s->cvis)
+	{
+		int cy = s->cy < c->nlines ? s->cy : c->nlines - 1;
+		int cx = s->cx < c->ncols ? s->cx : c->ncols - 1;
+		sprintf(seq, "\033[%d;%dH", cy + 1, cx + 1);
+		buf_add(&c->out, seq, strlen(seq));
+		if (s->cvis && (rows > 0 || !c->cvis))
+			buf_addlit(&c->out, "\033[?25h");
+		else if (!s->cvis && c->cvis && rows == 0)
+			buf_addlit(&c->out, "\033[?25l");
+		c->cy = s->cy;
+		c->cx = s->cx;
+		c->cvis = s->cvis;
+	}
+	c->updated = c->out.len > 0;
+	srv_flush(c);
+}
+
+static int
+srv_present(lc_server *s)
+{
+	int i, n = 0;
+
+	for (i = 0; i < s->nvariants; i++)
+		s->variants[i].used = 0;
+	for (i = 0; i < s->nclients; i++)
+	{
+		srv_client *c = &s->clients[i];
+		if (c->fd < 0 || c->dead)
+			continue;
+		c->variant = srv_variant_for(s, c);
+		if (c->variant >= 0)
+			s->variants[c->variant].used = 1;
+	}
+	pool_run(&s->pool, srv_encode_job, s, s->nvariants * s->frame.nlines);
+	pool_run(&s->pool, srv_client_job, s, s->nclients);
+	for (i = 0; i < s->nclients; i++)
+		n += s->clients[i].updated;
+	return n;
+}
+
+static void
+srv_reset_variants(lc_server *s)
+{
+	int i;
+	for (i = 0; i < s->nvariants; i++)
+		srv_free_variant(&s->variants[i], s->frame.nlines);
+	free(s->variants);
+	s->variants = NULL;
+	s->nvariants = 0;
+}
+
+
+/* =========== *
+ * Capturing.  *
+ * =========== */
+
+/* copy a window into the frame, as far as they overlap */
+static void
+srv_capture_window(lc_server *s, WINDOW *w)
+{
+	int wlines = getmaxy(w), wcols = getmaxx(w);
+	int y, x, oy, ox, i, n;
+	cchar_t *buf = malloc((wcols + 1) * sizeof *buf);
+	struct { int pair, fg, bg; } pc[64];
+
+	if (!buf)
+		return;
+	for (i = 0; i < 64; i++)
+		pc[i].pair = -1;
+	getyx(w, oy, ox);
+	for (y = 0; y < s->frame.nlines; y++)
+	{
+		lc_cell *row = s->frame.rows[y];
+		n = 0;
+		if (y < wlines)
+		{
+			wmove(w, y, 0);
+			n = win_wchnstr(w, buf, wcols) == ERR ? 0 : wcols;
+		}
+		for (x = 0, i = 0; x < s->frame.ncols; i++)
+		{
+			lc_cell *c = &row[x];
+			attr_t attrs;
+			int pair, width;
+
+			if (i >= n || buf[i].chars[0] == L'\0')
+			{
+				for (; x < s->frame.ncols; x++)
+					grid_blank(&row[x], NULL);
+				break;
+			}
+			attrs = buf[i].attr;
+#if NCURSES_EXT_COLORS
+			pair = buf[i].ext_color ? buf[i].ext_color : (int) PAIR_NUMBER(attrs);
+#else
+			pair = PAIR_NUMBER(attrs);
+#endif
+			c->ch = buf[i].chars[0];
+			c->comb = CCHARW_MAX > 1 ? buf[i].chars[1] : 0;
+			if ((attrs & A_ALTCHARSET) && c->ch >= 0x5f && c->ch <= 0x7e)
+				c->ch = vterm_decgraphics[c->ch - 0x5f];
+			attrs &= ~A_ALTCHARSET;
+			if (pc[pair & 63].pair != pair)
+			{
+				lc_pen pen;
+				pen_from_attr(&pen, attrs, pair);
+				pc[pair & 63].pair = pair;
+				pc[pair & 63].fg = pen.fg;
+				pc[pair & 63].bg = pen.bg;
+			}
+			c->pen.attrs = attrs & (A_ATTRIBUTES & ~A_COLOR);
+			c->pen.fg = pc[pair & 63].fg;
+			c->pen.bg = pc[pair & 63].bg;
+			width = lc_wcwidth(c->ch);
+			x++;
+			if (width > 1 && x < s->frame.ncols)
+			{
+				row[x] = *c;
+				row[x].ch = 0;
+				row[x].comb = 0;
+				x++;
+			}
+		}
+	}
+	wmove(w, oy, ox);
+	free(buf);
+}
+
+/* copy the screen of a vterm into the frame, as far as they overlap */
+static void
+srv_capture_vterm(lc_server *s, const vterm *t)
+{
+	int y, x, n = t->ncols < s->frame.ncols ? t->ncols : s->frame.ncols;
+
+	for (y = 0; y < s->frame.nlines; y++)
+	{
+		lc_cell *row = s->frame.rows[y];
+		x = 0;
+		if (y < t->nlines)
+		{
+			memcpy(row, t->g->rows[y], n * sizeof *row);
+			x = n;
+			if (n < t->ncols && t->g->rows[y][n].ch == 0)
+				grid_blank(&row[n - 1], NULL);
+		}
+		for (; x < s->frame.ncols; x++)
+			grid_blank(&row[x], NULL);
+	}
+}
+
+
+/* ========== *
+ * Lua API.   *
+ * ========== */
+
+static lc_server *
+checkserver(lua_State *L, int narg)
+{
+	lc_server *s = (lc_server *) luaL_checkudata(L, narg, SERVER_META);
+	if (s->frame.rows == NULL)
+		luaL_argerror(L, narg, "attempt to use closed curses server");
+	return s;
+}
+
+static srv_client *
+checkclient(lua_State *L, lc_server *s, int narg)
+{
+	int id = checkint(L, narg);
+	luaL_argcheck(L, id > 0 && id <= s->nclients && s->clients[id - 1].fd >= 0,
+		narg, "bad client id");
+	return &s->clients[id - 1];
+}
+
+/* number of colors of a terminal type, per terminfo */
+static int
+term_depth(const char *term, int fd)
+{
+	TERMINAL *old = cur_term;
+	int err, depth = 8;
+
+	if (setupterm((char *) term, fd, &err) == OK)
+	{
+		depth = tigetnum("colors");
+		if (tigetflag("RGB") > 0 || tigetflag("Tc") > 0)
+			depth = 0x1000000;
+		if (cur_term != old)
+			del_curterm(cur_term);
+	}
+	set_curterm(old);
+	return depth < 0 ? 0 : depth;
+}
+
+
+/***
+Create a server.
+@function new
+@int lines number of lines of the frame
+@int cols number of columns of the frame
+@int[opt] nthreads number of threads encoding frames, by default one
+  per processor
+@treturn server a new server
+*/
+static int
+Rnew(lua_State *L)
+{
+	int nlines = checkint(L, 1);
+	int ncols = checkint(L, 2);
+	int nthreads = optint(L, 3, pool_ncpus());
+	lc_server *s;
+
+	luaL_argcheck(L, nlines > 0, 1, "lines should > 0");
+	luaL_argcheck(L, ncols > 0, 2, "cols should > 0");
+	s = lua_newuserdata(L, sizeof *s);
+	memset(s, 0, sizeof *s);
+	luaL_setmetatable(L, SERVER_META);
+	if (grid_init(&s->frame, nlines, ncols) != 0)
+		return luaL_error(L, "malloc failed");
+	s->pooled = pool_init(&s->pool, nthreads) == 0;
+	s->cvis = 1;
+	return 1;
+}
+
+
+/***
+Attach a client.
+The descriptor is switched to non-blocking mode; it is not closed by
+the server.  The client is sent a complete frame by the next @{present}.
+@function attach
+@int fd descriptor to write to, e.g. a pty or a connected socket
+@int lines number of lines of the client terminal
+@int cols number of columns of the client terminal
+@string[opt] termtype terminal type, to find out the number of colors;
+  `$TERM` if `nil`
+@treturn int client id
+@see detach
+*/
+static int
+Rattach(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	int fd = checkint(L, 2);
+	int nlines = checkint(L, 3);
+	int ncols = checkint(L, 4);
+	const char *term = optstring(L, 5, getenv("TERM"));
+	srv_client *c;
+	int i;
+
+	luaL_argcheck(L, nlines > 0, 3, "lines should > 0");
+	luaL_argcheck(L, ncols > 0, 4, "cols should > 0");
+
+	for (i = 0; i < s->nclients && s->clients[i].fd >= 0; i++)
+		;
+	if (i == s->nclients)
+	{
+		c = realloc(s->clients, (s->nclients + 1) * sizeof *c);
+		if (!c)
+			return luaL_error(L, "malloc failed");
+		s->clients = c;
+		s->nclients++;
+	}
+	c = &s->clients[i];
+	memset(c, 0, sizeof *c);
+	if (!(c->sent = calloc(nlines, sizeof *c->sent)))
+	{
+		c->fd = -1;
+		return luaL_error(L, "malloc failed");
+	}
+	c->fd = fd;
+	c->nlines = nlines;
+	c->ncols = ncols;
+	c->depth = term ? term_depth(term, fd) : 8;
+	c->variant = -1;
+	c->full = 1;
+	c->cy = -1;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	buf_addlit(&c->out, "\033[?1049h");
+	return pushintresult(i + 1);
+}
+
+
+/***
+Detach a client.
+The client terminal is asked to leave the alternate screen, if the
+descriptor still accepts output.
+@function detach
+@int id client id
+@see attach
+*/
+static int
+Rdetach(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	srv_client *c = checkclient(L, s, 2);
+
+	if (!c->dead)
+	{
+		c->out.len = c->outpos = 0;
+		buf_addlit(&c->out, "\033[0m\033[?25h\033[?1049l");
+		srv_flush(c);
+	}
+	free(c->sent);
+	free(c->out.s);
+	memset(c, 0, sizeof *c);
+	c->fd = -1;
+	return 0;
+}
+
+
+/***
+Change the size of a client terminal.
+The client is sent a complete frame by the next @{present}.
+@function resize_client
+@int id client id
+@int lines number of lines
+@int cols number of columns
+@treturn bool `true`, if successful
+*/
+static int
+Rresize_client(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	srv_client *c = checkclient(L, s, 2);
+	int nlines = checkint(L, 3);
+	int ncols = checkint(L, 4);
+	uint64_t *sent;
+
+	luaL_argcheck(L, nlines > 0, 3, "lines should > 0");
+	luaL_argcheck(L, ncols > 0, 4, "cols should > 0");
+	if (!(sent = realloc(c->sent, nlines * sizeof *sent)))
+		return pushboolresult(0);
+	c->sent = sent;
+	c->nlines = nlines;
+	c->ncols = ncols;
+	c->full = 1;
+	return pushboolresult(1);
+}
+
+
+/***
+Whether a client is still connected.
+A client whose descriptor failed, e.g. because the peer went away,
+should be detached.
+@function alive
+@int id client id
+@treturn bool `true`, unless writing to the client failed
+@treturn int number of bytes still waiting to be written
+*/
+static int
+Ralive(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	srv_client *c = checkclient(L, s, 2);
+	lua_pushboolean(L, !c->dead);
+	lua_pushinteger(L, (lua_Integer) (c->out.len - c->outpos));
+	return 2;
+}
+
+
+/***
+Copy a window or a vterm into the frame.
+Cells the source does not cover are blanked.
+@function capture
+@tparam curses.window|curses.vterm src source of the frame
+*/
+static int
+Rcapture(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	vterm *t = (vterm *) luaL_testudata(L, 2, VTERM_META);
+
+	if (t)
+		srv_capture_vterm(s, t);
+	else
+		srv_capture_window(s, checkwin(L, 2));
+	return 0;
+}
+
+
+/***
+Set the cursor position clients are left with.
+@function cursor
+@int y line
+@int x column
+@bool[opt=true] visible whether the cursor is shown
+*/
+static int
+Rcursor(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	int y = checkint(L, 2);
+	int x = checkint(L, 3);
+	s->cy = y < 0 ? 0 : y;
+	s->cx = x < 0 ? 0 : x;
+	s->cvis = optboolean(L, 4, 1);
+	return 0;
+}
+
+
+/***
+Send the changes since the previous frame to every client.
+@function present
+@treturn int number of clients which were sent anything
+*/
+static int
+Rpresent(lua_State *L)
+{
+	return pushintresult(srv_present(checkserver(L, 1)));
+}
+
+
+/***
+Change the size of the frame.
+All clients are sent a complete frame by the next @{present}.
+@function resize
+@int lines number of lines
+@int cols number of columns
+@treturn bool `true`, if successful
+*/
+static int
+Rresize(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	int nlines = checkint(L, 2);
+	int ncols = checkint(L, 3);
+	int i;
+
+	luaL_argcheck(L, nlines > 0, 2, "lines should > 0");
+	luaL_argcheck(L, ncols > 0, 3, "cols should > 0");
+	srv_reset_variants(s);
+	if (grid_resize(&s->frame, nlines, ncols) != 0)
+		return pushboolresult(0);
+	for (i = 0; i < s->nclients; i++)
+		s->clients[i].full = 1;
+	return pushboolresult(1);
+}
+
+
+/***
+Size of the frame.
+@function size
+@treturn int number of lines
+@treturn int number of columns
+*/
+static int
+Rsize(lua_State *L)
+{
+	lc_server *s = checkserver(L, 1);
+	lua_pushinteger(L, s->frame.nlines);
+	lua_pushinteger(L, s->frame.ncols);
+	return 2;
+}
+
+
+/***
+Free the server.
+Clients still attached are left as they are.
+@function close
+*/
+static int
+Rclose(lua_State *L)
+{
+	lc_server *s = (lc_server *) luaL_checkudata(L, 1, SERVER_META);
+	int i;
+
+	if (s->frame.rows == NULL)
+		return 0;
+	if (s->pooled)
+		pool_free(&s->pool);
+	srv_reset_variants(s);
+	for (i = 0; i < s->nclients; i++)
+	{
+		free(s->clients[i].sent);
+		free(s->clients[i].out.s);
+	}
+	free(s->clients);
+	s->clients = NULL;
+	s->nclients = 0;
+	grid_free(&s->frame);
+	return 0;
+}
+
+
+static const luaL_Reg curses_server_fns[] =
+{
+	LCURSES_FUNC( Ralive		),
+	LCURSES_FUNC( Rattach		),
+	LCURSES_FUNC( Rcapture		),
+	LCURSES_FUNC( Rclose		),
+	LCURSES_FUNC( Rcursor		),
+	LCURSES_FUNC( Rdetach		),
+	LCURSES_FUNC( Rnew		),
+	LCURSES_FUNC( Rpresent		),
+	LCURSES_FUNC( Rresize		),
+	LCURSES_FUNC( Rresize_client	),
+	LCURSES_FUNC( Rsize		),
+	{"__gc",     Rclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_server(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_server_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, SERVER_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, mt, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesServer");
+	lua_setfield(L, mt, "_type");		/* mt._type = "CursesServer" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.server..." */
+	lua_pushliteral(L, "curses.server for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_SERVER_C*/
@@ -0,0 +1,635 @@
+/* */
+
+/***
+ Virtual pads.
+
+ A vpad is shown like a pad, but holds only the rows near what was
+ shown lately.  Rows are materialized in tiles when a refresh first
+ needs them, from a Lua row provider or a table of rows, and the least
+ recently used tiles are dropped once more than a set number are
+ resident.  A million line log therefore costs about as much memory as
+ a screenful of it:
+
+     local vp = curses.vpad.new (#lines, 200, function (y)
+       return lines[y + 1]
+     end)
+     vp:prefresh (top, 0, 0, 0, curses.lines () - 1, curses.cols () - 1)
+
+ A provider returns the row as a UTF-8 string, a @{curses.chstr}, or
+ `nil` for a blank row.  Instead of a function, the provider can be a
+ table holding row *y* at index *y + 1*.
+
+@classmod curses.vpad
+*/
+
+#ifndef LCURSES_VPAD_C
+#define LCURSES_VPAD_C 1
+
+#include <limits.h>
+
+#include "_helpers.c"
+#include "_width.c"
+#include "chstr.c"
+
+
+static const char *VPAD_META = "curses:vpad";
+
+#define VPAD_TILE	64	/* rows per tile */
+
+typedef struct vpad_tile {
+	long first;		/* first row, or -1 for a free tile */
+	unsigned long used;	/* for the LRU */
+	cchar_t *cells;		/* VPAD_TILE rows of ncols cells */
+} vpad_tile;
+
+typedef struct lc_vpad {
+	long nlines;
+	int ncols;
+	vpad_tile *tiles;
+	int ntiles, maxtiles;
+	unsigned long clock;
+	unsigned long fetched;	/* rows asked from the provider */
+	int busy;		/* calling the provider */
+
+	WINDOW *view;		/* where the last refresh went */
+	int vy, vx, vlines, vcols;
+	long *shown;		/* row shown on each line of view */
+	int shownx;		/* and its first column */
+	cchar_t *buf;
+} lc_vpad;
+
+/* the right half of a wide character */
+#define VPAD_CONT(c)	((c)->chars[0] == L'\0')
+
+
+static lc_vpad *
+checkvpad(lua_State *L, int narg)
+{
+	lc_vpad *v = (lc_vpad *) luaL_checkudata(L, narg, VPAD_META);
+	if (v->tiles == NULL)
+		luaL_argerror(L, narg, "attempt to use closed vpad");
+	if (v->busy)
+		luaL_argerror(L, narg, "attempt to use vpad from its provider");
+	return v;
+}
+
+static void
+vpad_forget_view(lc_vpad *v)
+{
+	int i;
+	if (v->shown)
+		for (i = 0; i < v->vlines; i++)
+			v->shown[i] = -1;
+}
+
+/* drop the tiles holding rows first..last */
+static void
+vpad_drop(lc_vpad *v, long first, long last)
+{
+	int i;
+
+	for (i = 0; i < v->ntiles; i++)
+		if (v->tiles[i].first >= 0 && v->tiles[i].first <= last
+			&& v->tiles[i].first + VPAD_TILE > first)
+			v->tiles[i].first = -1;
+	vpad_forget_view(v);
+}
+
+/* put character ch of the given width at column x of row; returns new x */
+static int
+vpad_put(cchar_t *row, int ncols, int x, int ch, attr_t attrs, int pair,
+	int width)
+{
+	if (width == 0)
+	{
+		/* a combining character goes with the cell before */
+		int i = x - 1, k;
+		while (i > 0 && VPAD_CONT(&row[i]))
+			i--;
+		if (i >= 0)
+			for (k = 1; k < CCHARW_MAX; k++)
+				if (row[i].chars[k] == L'\0')
+				{
+					row[i].chars[k] = ch;
+					if (k + 1 < CCHARW_MAX)
+						row[i].chars[k + 1] = L'\0';
+					break;
+				}
+		return x;
+	}
+	if (x + width > ncols)
+		return ncols;
+	setcchar_(&row[x], ch, attrs, pair);
+	if (width > 1)
+	{
+		row[x + 1] = row[x];
+		row[x + 1].chars[0] = L'\0';
+	}
+	return x + width;
+}
+
+/*
+** Fill row from the provider result on top of the stack, and pop it;
+** returns -1 if it is neither a string, a chstr nor nil.
+*/
+static int
+vpad_row(lua_State *L, cchar_t *row, int ncols)
+{
+	int x = 0;
+	chstr **pcs;
+
+	for (; x < ncols; x++)
+		setcchar_(&row[x], ' ', A_NORMAL, 0);
+	x = 0;
+
+	if (lua_type(L, -1) == LUA_TSTRING)
+	{
+		size_t len;
+		const char *s = lua_tolstring(L, -1, &len), *end = s + len;
+		while (s < end && x < ncols)
+		{
+			int ch;
+			const char *next = utf8_decode(s, &ch);
+			if (next == NULL || next > end)
+				ch = 0xfffd, next = s + 1;
+			s = next;
+			if (ch == '\t')
+				x = (x / 8 + 1) * 8;
+			else if (ch >= 0x20 && ch != 0x7f)
+			{
+				int width = lc_wcwidth(ch);
+				if (width >= 0)
+					x = vpad_put(row, ncols, x, ch, A_NORMAL, 0,
+						width > 2 ? 2 : width);
+			}
+		}
+	}
+	else if ((pcs = (chstr **) luaL_testudata(L, -1, CHSTR_META)) && *pcs)
+	{
+		const chstr *cs = *pcs;
+		unsigned int i;
+		for (i = 0; i < cs->len && x < ncols; i++)
+		{
+			const cchar_t *c = &cs->str[i];
+			int width = lc_wcwidth(c->chars[0]);
+			if (width < 1)
+				continue;
+			if (width > 2)
+				width = 2;
+			if (x + width > ncols)
+				break;
+			row[x] = *c;
+			if (width > 1)
+			{
+				row[x + 1] = *c;
+				row[x + 1].chars[0] = L'\0';
+			}
+			x += width;
+		}
+	}
+	else if (!lua_isnil(L, -1))
+		return -1;
+	lua_pop(L, 1);
+	return 0;
+}
+
+/*
+** The cells of row y, materializing its tile if needed; the provider is
+** the uservalue of the vpad at narg.
+*/
+static const cchar_t *
+vpad_fetch(lua_State *L, int narg, lc_vpad *v, long y)
+{
+	long first = y - y % VPAD_TILE;
+	vpad_tile *t = NULL;
+	long r;
+	int i;
+
+	for (i = 0; i < v->ntiles; i++)
+		if (v->tiles[i].first == first)
+		{
+			t = &v->tiles[i];
+			goto found;
+		}
+
+	/* a free tile, a new one, or the least recently used */
+	for (i = 0; i < v->ntiles && v->tiles[i].first >= 0; i++)
+		;
+	if (i == v->ntiles && v->ntiles < v->maxtiles)
+	{
+		cchar_t *cells = malloc((size_t) VPAD_TILE * v->ncols * sizeof *cells);
+		if (!cells)
+			luaL_error(L, "malloc failed");
+		v->tiles[v->ntiles].cells = cells;
+		v->tiles[v->ntiles].first = -1;
+		v->ntiles++;
+	}
+	else if (i == v->ntiles)
+		for (i = 0; i < v->ntiles; i++)
+			if (t == NULL || v->tiles[i].used < t->used)
+				t = &v->tiles[i];
+	if (t == NULL)
+		t = &v->tiles[i];
+	t->first = -1;
+
+	lua_getuservalue(L, narg);
+	v->busy = 1;
+	for (r = 0; r < VPAD_TILE; r++)
+	{
+		cchar_t *row = t->cells + r * v->ncols;
+		if (first + r >= v->nlines)
+		{
+			lua_pushnil(L);
+			vpad_row(L, row, v->ncols);
+			continue;
+		}
+		if (lua_type(L, -1) == LUA_TFUNCTION)
+		{
+			lua_pushvalue(L, -1);
+			lua_pushinteger(L, first + r);
+			if (lua_pcall(L, 1, 1, 0) != 0)
+			{
+				v->busy = 0;
+				lua_error(L);
+			}
+		}
+		else
+			lua_rawgeti(L, -1, first + r + 1);
+		if (vpad_row(L, row, v->ncols) != 0)
+		{
+			v->busy = 0;
+			luaL_error(L, "vpad provider returned a %s", luaL_typename(L, -1));
+		}
+		v->fetched++;
+	}
+	v->busy = 0;
+	lua_pop(L, 1);
+	t->first = first;
+
+found:
+	t->used = ++v->clock;
+	return t->cells + (y - first) * v->ncols;
+}
+
+/* write columns x.. of a row into line wy of the view */
+static void
+vpad_show(lc_vpad *v, const cchar_t *row, int wy, int x)
+{
+	int n = 0, i;
+
+	for (i = x; i < v->ncols && i - x < v->vcols; i++)
+	{
+		const cchar_t *c = &row[i];
+		if (VPAD_CONT(c))
+		{
+			if (i == x)
+				setcchar_(&v->buf[n++], ' ', A_NORMAL, 0);
+			continue;
+		}
+		/* a wide character cut by the right edge */
+		if (i + 1 < v->ncols && VPAD_CONT(&row[i + 1]) && i + 1 - x >= v->vcols)
+			setcchar_(&v->buf[n], ' ', A_NORMAL, 0);
+		else
+			v->buf[n] = *c;
+		n++;
+	}
+	wmove(v->view, wy, 0);
+	if (n > 0)
+		wadd_wchnstr(v->view, v->buf, n);
+	if (i - x < v->vcols)
+	{
+		wmove(v->view, wy, i - x);
+		wclrtoeol(v->view);
+	}
+}
+
+/* make view cover the screen rectangle, which must be valid */
+static void
+vpad_setview(lua_State *L, lc_vpad *v, int sminrow, int smincol, int h, int w)
+{
+	long *shown;
+	cchar_t *buf;
+
+	if (v->view && v->vy == sminrow && v->vx == smincol && v->vlines == h
+		&& v->vcols == w)
+		return;
+	if (v->view)
+		delwin(v->view);
+	v->view = NULL;
+	shown = realloc(v->shown, h * sizeof *shown);
+	if (shown)
+		v->shown = shown;
+	buf = realloc(v->buf, w * sizeof *buf);
+	if (buf)
+		v->buf = buf;
+	if (!shown || !buf || !(v->view = newwin(h, w, sminrow, smincol)))
+		luaL_error(L, "cannot create the view of the vpad");
+	v->vy = sminrow;
+	v->vx = smincol;
+	v->vlines = h;
+	v->vcols = w;
+	vpad_forget_view(v);
+}
+
+static int
+vpad_refresh(lua_State *L, int update)
+{
+	lc_vpad *v = checkvpad(L, 1);
+	long pminrow = (long) luaL_checkinteger(L, 2);
+	int pmincol = checkint(L, 3);
+	int sminrow = checkint(L, 4);
+	int smincol = checkint(L, 5);
+	int smaxrow = checkint(L, 6);
+	int smaxcol = checkint(L, 7);
+	int h, w, i, need;
+
+	if (pminrow < 0)
+		pminrow = 0;
+	if (pmincol < 0)
+		pmincol = 0;
+	if (sminrow < 0)
+		sminrow = 0;
+	if (smincol < 0)
+		smincol = 0;
+	if (smaxrow >= LINES)
+		smaxrow = LINES - 1;
+	if (smaxcol >= COLS)
+		smaxcol = COLS - 1;
+	h = smaxrow - sminrow + 1;
+	w = smaxcol - smincol + 1;
+	if (h <= 0 || w <= 0)
+		return pushboolresult(0);
+	vpad_setview(L, v, sminrow, smincol, h, w);
+
+	/* enough tiles for the view, or it would evict its own rows */
+	need = h / VPAD_TILE + 2;
+	if (v->maxtiles < need)
+	{
+		vpad_tile *tiles = realloc(v->tiles, need * sizeof *tiles);
+		if (!tiles)
+			return luaL_error(L, "malloc failed");
+		v->tiles = tiles;
+		v->maxtiles = need;
+	}
+
+	for (i = 0; i < h; i++)
+	{
+		long y = pminrow + i;
+		if (v->shown[i] == y && v->shownx == pmincol)
+			continue;
+		if (y < v->nlines)
+			vpad_show(v, vpad_fetch(L, 1, v, y), i, pmincol);
+		else
+		{
+			wmove(v->view, i, 0);
+			wclrtoeol(v->view);
+		}
+		v->shown[i] = y;
+	}
+	v->shownx = pmincol;
+
+	if (update)
+		return pushokresult(wrefresh(v->view));
+	return pushokresult(wnoutrefresh(v->view));
+}
+
+
+/***
+Create a virtual pad.
+@function new
+@int lines number of rows, which may be very large
+@int cols number of columns
+@tparam function|table provider called with a row number from 0, and
+  returning the row; or a table of rows
+@int[opt=16] maxtiles number of tiles of 64 rows to keep, at least
+  what the largest view needs
+@treturn vpad a new vpad
+*/
+static int
+Anew(lua_State *L)
+{
+	lua_Integer nlines = luaL_checkinteger(L, 1);
+	int ncols = checkint(L, 2);
+	int maxtiles = optint(L, 4, 16);
+	lc_vpad *v;
+
+	luaL_argcheck(L, nlines >= 0, 1, "lines should >= 0");
+	luaL_argcheck(L, ncols > 0, 2, "cols should > 0");
+	luaL_argcheck(L, lua_type(L, 3) == LUA_TFUNCTION
+		|| lua_type(L, 3) == LUA_TTABLE, 3, "function or table expected");
+	luaL_argcheck(L, maxtiles > 0, 4, "maxtiles should > 0");
+
+	v = lua_newuserdata(L, sizeof *v);
+	memset(v, 0, sizeof *v);
+	luaL_setmetatable(L, VPAD_META);
+	v->nlines = nlines;
+	v->ncols = ncols;
+	v->maxtiles = maxtiles;
+	if (!(v->tiles = malloc(maxtiles * sizeof *v->tiles)))
+		return luaL_error(L, "malloc failed");
+	lua_pushvalue(L, 3);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+
+/***
+Show part of the vpad, like @{curses.window:pnoutrefresh}.
+Rows are taken from the provider when they are not resident; lines of
+the screen rectangle which still show the same row are left alone.
+@function pnoutrefresh
+@int st top row of the vpad to show
+@int sl left column of the vpad to show
+@int dt top row of rectangle
+@int dl left column of rectangle
+@int db bottom row of rectangle
+@int dr right column of rectangle
+@treturn bool `true`, if successful
+*/
+static int
+Apnoutrefresh(lua_State *L)
+{
+	return vpad_refresh(L, 0);
+}
+
+
+/***
+Show part of the vpad, like @{curses.window:prefresh}.
+@function prefresh
+@int st top row of the vpad to show
+@int sl left column of the vpad to show
+@int dt top row of rectangle
+@int dl left column of rectangle
+@int db bottom row of rectangle
+@int dr right column of rectangle
+@treturn bool `true`, if successful
+@see pnoutrefresh
+*/
+static int
+Aprefresh(lua_State *L)
+{
+	return vpad_refresh(L, 1);
+}
+
+
+/***
+Forget resident rows, because their contents changed.
+@function invalidate
+@int[opt=0] first first row
+@int[opt] last last row, by default the last row of the vpad
+*/
+static int
+Ainvalidate(lua_State *L)
+{
+	lc_vpad *v = checkvpad(L, 1);
+	long first = (long) luaL_optinteger(L, 2, 0);
+	long last = (long) luaL_optinteger(L, 3, LONG_MAX);
+	vpad_drop(v, first, last);
+	return 0;
+}
+
+
+/***
+Change the size of the vpad.
+Growing or shrinking the number of rows, as when a log grows, keeps the
+resident rows; changing the number of columns drops all of them.
+@function resize
+@int lines number of rows
+@int[opt] cols number of columns
+*/
+static int
+Aresize(lua_State *L)
+{
+	lc_vpad *v = checkvpad(L, 1);
+	lua_Integer nlines = luaL_checkinteger(L, 2);
+	int ncols = optint(L, 3, v->ncols);
+	int i;
+
+	luaL_argcheck(L, nlines >= 0, 2, "lines should >= 0");
+	luaL_argcheck(L, ncols > 0, 3, "cols should > 0");
+	if (ncols != v->ncols)
+	{
+		for (i = 0; i < v->ntiles; i++)
+			free(v->tiles[i].cells);
+		v->ntiles = 0;
+		v->ncols = ncols;
+		vpad_forget_view(v);
+	}
+	/* the tile at the old or new end is only partly filled */
+	else if (nlines != v->nlines)
+		vpad_drop(v, nlines < v->nlines ? nlines : v->nlines, LONG_MAX);
+	v->nlines = nlines;
+	return 0;
+}
+
+
+/***
+Size of the vpad.
+@function size
+@treturn int number of rows
+@treturn int number of columns
+*/
+static int
+Asize(lua_State *L)
+{
+	lc_vpad *v = checkvpad(L, 1);
+	lua_pushinteger(L, v->nlines);
+	lua_pushinteger(L, v->ncols);
+	return 2;
+}
+
+
+/***
+Memory used by the vpad.
+@function stats
+@treturn int number of resident rows
+@treturn int bytes of resident rows
+@treturn int rows asked from the provider so far
+*/
+static int
+Astats(lua_State *L)
+{
+	lc_vpad *v = checkvpad(L, 1);
+	int i, n = 0;
+
+	for (i = 0; i < v->ntiles; i++)
+		n += v->tiles[i].first >= 0;
+	lua_pushinteger(L, (lua_Integer) n * VPAD_TILE);
+	lua_pushinteger(L, (lua_Integer) v->ntiles * VPAD_TILE * v->ncols
+		* sizeof(cchar_t));
+	lua_pushinteger(L, v->fetched);
+	return 3;
+}
+
+
+/***
+Free the vpad.
+The screen rectangle keeps showing what it showed.
+@function close
+*/
+static int
+Aclose(lua_State *L)
+{
+	lc_vpad *v = (lc_vpad *) luaL_checkudata(L, 1, VPAD_META);
+	int i;
+
+	if (v->tiles == NULL)
+		return 0;
+	for (i = 0; i < v->ntiles; i++)
+		free(v->tiles[i].cells);
+	free(v->tiles);
+	v->tiles = NULL;
+	if (v->view)
+		delwin(v->view);
+	v->view = NULL;
+	free(v->shown);
+	free(v->buf);
+	return 0;
+}
+
+
+static const luaL_Reg curses_vpad_fns[] =
+{
+	LCURSES_FUNC( Aclose		),
+	LCURSES_FUNC( Ainvalidate	),
+	LCURSES_FUNC( Anew		),
+	LCURSES_FUNC( Apnoutrefresh	),
+	LCURSES_FUNC( Aprefresh		),
+	LCURSES_FUNC( Aresize		),
+	LCURSES_FUNC( Asize		),
+	LCURSES_FUNC( Astats		),
+	{"__gc",     Aclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_vpad(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_vpad_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, VPAD_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, mt, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesVpad");
+	lua_setfield(L, mt, "_type");		/* mt._type = "CursesVpad" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.vpad..." */
+	lua_pushliteral(L, "curses.vpad for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_VPAD_C*/
@@ -0,0 +1,1496 @@
+/* */
+
+/***
+ Terminal emulator panes.
+
+ A vterm runs a child process on a pseudo-terminal and interprets its
+ output with a VT100/xterm compatible state machine into a cell grid,
+ which is independent of the curses screen.  Rendering a pane copies
+ only the rows which changed since the previous render into a window,
+ so a UI can host tmux-like panes:
+
+     local pane = curses.vterm.spawn ("/bin/sh", 24, 80)
+     while pane:update () do
+       pane:render (win)
+       win:refresh ()
+     end
+
+ A vterm created with `curses.vterm.new` has no child process; text
+ written with @{feed} is interpreted as if the child had written it.
+
+@classmod curses.vterm
+*/
+
+#ifndef LCURSES_VTERM_C
+#define LCURSES_VTERM_C 1
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "_helpers.c"
+#include "_ansi.c"
+#include "_grid.c"
+#include "_width.c"
+
+
+static const char *VTERM_META = "curses:vterm";
+
+#define VTERM_READBUF	32768
+
+/* cursor state saved by DECSC, one copy per screen */
+typedef struct vterm_cursor {
+	int y, x;
+	lc_pen pen;
+	int origin;
+	char charset[2];
+	int gl;
+} vterm_cursor;
+
+typedef struct vterm {
+	lc_grid grid[2];	/* primary and alternate screen */
+	lc_grid *g;		/* the one being displayed */
+	int alt;
+	int nlines, ncols;
+	lc_vtparser parser;
+
+	int y, x;
+	int wrapnext;		/* the last column was written, wrap first */
+	lc_pen pen;
+	int top, bot;		/* scrolling region */
+	char charset[2];	/* G0 and G1, 'B' or '0' */
+	int gl;			/* which of them is invoked */
+	int lastch;		/* repeated by REP */
+	unsigned char *tabs;
+	vterm_cursor saved[2];
+
+	/* modes */
+	int autowrap, origin, insert, lnm, appcursor, show_cursor;
+
+	int fd;			/* pty master, -1 without a child */
+	pid_t pid;
+	int status;		/* exit status, once pid is reaped */
+	int eof;
+
+	/* last render target, to know when everything must be drawn */
+	WINDOW *target;
+	int tlines, tcols;
+	cchar_t *buf;
+
+	char title[LC_VT_MAXOSC + 1];
+} vterm;
+
+
+/* DEC special graphics for 0x5f..0x7e */
+static const unsigned short vterm_decgraphics[32] =
+{
+	0x0020, 0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0,
+	0x00b1, 0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+	0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+	0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7,
+};
+
+
+static void
+vterm_reply(vterm *t, const char *s)
+{
+	if (t->fd >= 0)
+		while (write(t->fd, s, strlen(s)) < 0 && errno == EINTR)
+			;
+}
+
+static void
+vterm_reset_tabs(vterm *t)
+{
+	int x;
+	for (x = 0; x < t->ncols; x++)
+		t->tabs[x] = x > 0 && x % 8 == 0;
+}
+
+static void
+vterm_reset(vterm *t)
+{
+	int i;
+
+	t->y = t->x = t->wrapnext = 0;
+	pen_reset(&t->pen);
+	t->top = 0;
+	t->bot = t->nlines - 1;
+	t->charset[0] = t->charset[1] = 'B';
+	t->gl = 0;
+	t->lastch = ' ';
+	t->autowrap = t->show_cursor = 1;
+	t->origin = t->insert = t->lnm = t->appcursor = 0;
+	for (i = 0; i < 2; i++)
+	{
+		memset(&t->saved[i], 0, sizeof t->saved[i]);
+		pen_reset(&t->saved[i].pen);
+		t->saved[i].charset[0] = t->saved[i].charset[1] = 'B';
+	}
+	vterm_reset_tabs(t);
+}
+
+static void
+vterm_free(vterm *t)
+{
+	grid_free(&t->grid[0]);
+	grid_free(&t->grid[1]);
+	free(t->tabs);
+	free(t->buf);
+	t->tabs = NULL;
+	t->buf = NULL;
+}
+
+
+/* =================== *
+ * Cursor and editing. *
+ * =================== */
+
+static void
+vterm_goto(vterm *t, int y, int x)
+{
+	int miny = 0, maxy = t->nlines - 1;
+
+	if (t->origin)
+	{
+		y += t->top;
+		miny = t->top;
+		maxy = t->bot;
+	}
+	t->y = y < miny ? miny : y > maxy ? maxy : y;
+	t->x = x < 0 ? 0 : x >= t->ncols ? t->ncols - 1 : x;
+	t->wrapnext = 0;
+}
+
+static void
+vterm_index(vterm *t)
+{
+	if (t->y == t->bot)
+		grid_scroll(t->g, t->top, t->bot, 1, &t->pen);
+	else if (t->y < t->nlines - 1)
+		t->y++;
+}
+
+static void
+vterm_reverse_index(vterm *t)
+{
+	if (t->y == t->top)
+		grid_scroll(t->g, t->top, t->bot, -1, &t->pen);
+	else if (t->y > 0)
+		t->y--;
+}
+
+/* shift the rest of the cursor row right (n > 0) or left (n < 0) */
+static void
+vterm_shift(vterm *t, int n)
+{
+	lc_cell *row = t->g->rows[t->y];
+	int i, x = t->x, k = n < 0 ? -n : n;
+
+	if (k > t->ncols - x)
+		k = t->ncols - x;
+	/* wide characters split by the shift are erased */
+	if (row[x].ch == 0 && x > 0)
+		grid_blank(&row[x - 1], &t->pen);
+	if (n > 0)
+	{
+		memmove(row + x + k, row + x, (t->ncols - x - k) * sizeof *row);
+		for (i = x; i < x + k; i++)
+			grid_blank(&row[i], &t->pen);
+		if (x + k < t->ncols && row[x + k].ch == 0)
+			grid_blank(&row[x + k], &t->pen);
+		if (lc_wcwidth(row[t->ncols - 1].ch) > 1)
+			grid_blank(&row[t->ncols - 1], &t->pen);
+	}
+	else
+	{
+		memmove(row + x, row + x + k, (t->ncols - x - k) * sizeof *row);
+		for (i = t->ncols - k; i < t->ncols; i++)
+			grid_blank(&row[i], &t->pen);
+		if (row[x].ch == 0)
+			grid_blank(&row[x], &t->pen);
+	}
+	t->g->dirty[t->y] = 1;
+}
+
+static void
+vterm_put(vterm *t, int ch, int width)
+{
+	lc_cell *row;
+	int x;
+
+	if (t->charset[t->gl] == '0' && ch >= 0x5f && ch <= 0x7e)
+		ch = vterm_decgraphics[ch - 0x5f];
+
+	if (width == 0)
+	{
+		/* combining character: attach it to the previous cell */
+		x = t->wrapnext ? t->x : t->x - 1;
+		row = t->g->rows[t->y];
+		if (x > 0 && row[x].ch == 0)
+			x--;
+		if (x >= 0 && !row[x].comb)
+		{
+			row[x].comb = ch;
+			t->g->dirty[t->y] = 1;
+		}
+		return;
+	}
+
+	if (t->wrapnext || (width > 1 && t->x + width > t->ncols && t->autowrap))
+	{
+		t->x = 0;
+		vterm_index(t);
+	}
+	t->wrapnext = 0;
+	if (t->x + width > t->ncols)
+		t->x = t->ncols - width;
+	if (t->x < 0)
+		return;
+	if (t->insert)
+		vterm_shift(t, width);
+
+	x = t->x;
+	row = t->g->rows[t->y];
+	/* overwriting half of a wide character erases the other half */
+	if (row[x].ch == 0 && x > 0)
+		grid_blank(&row[x - 1], &t->pen);
+	if (x + width < t->ncols && row[x + width].ch == 0)
+		grid_blank(&row[x + width], &t->pen);
+
+	row[x].ch = ch;
+	row[x].comb = 0;
+	row[x].pen = t->pen;
+	if (width > 1)
+	{
+		row[x + 1].ch = 0;
+		row[x + 1].comb = 0;
+		row[x + 1].pen = t->pen;
+	}
+	t->g->dirty[t->y] = 1;
+	t->lastch = ch;
+
+	t->x += width;
+	if (t->x >= t->ncols)
+	{
+		t->x = t->ncols - 1;
+		t->wrapnext = t->autowrap;
+	}
+}
+
+static void
+vterm_save_cursor(vterm *t)
+{
+	vterm_cursor *c = &t->saved[t->alt];
+	c->y = t->y;
+	c->x = t->x;
+	c->pen = t->pen;
+	c->origin = t->origin;
+	c->charset[0] = t->charset[0];
+	c->charset[1] = t->charset[1];
+	c->gl = t->gl;
+}
+
+static void
+vterm_restore_cursor(vterm *t)
+{
+	vterm_cursor *c = &t->saved[t->alt];
+	t->pen = c->pen;
+	t->origin = 0;
+	vterm_goto(t, c->y, c->x);
+	t->origin = c->origin;
+	t->charset[0] = c->charset[0];
+	t->charset[1] = c->charset[1];
+	t->gl = c->gl;
+}
+
+static void
+vterm_altscreen(vterm *t, int on)
+{
+	if (on == t->alt)
+		return;
+	t->alt = on;
+	t->g = &t->grid[on];
+	if (on)
+	{
+		int y;
+		for (y = 0; y < t->nlines; y++)
+			grid_erase(t->g, y, 0, t->ncols, &t->pen);
+	}
+	grid_touch(t->g, 0, t->nlines - 1);
+}
+
+/* erase in display, 0 below, 1 above, 2 all */
+static void
+vterm_erase_display(vterm *t, int mode)
+{
+	int y;
+
+	switch (mode)
+	{
+	case 0:
+		grid_erase(t->g, t->y, t->x, t->ncols, &t->pen);
+		for (y = t->y + 1; y < t->nlines; y++)
+			grid_erase(t->g, y, 0, t->ncols, &t->pen);
+		break;
+	case 1:
+		for (y = 0; y < t->y; y++)
+			grid_erase(t->g, y, 0, t->ncols, &t->pen);
+		grid_erase(t->g, t->y, 0, t->x + 1, &t->pen);
+		break;
+	case 2:
+	case 3:
+		for (y = 0; y < t->nlines; y++)
+			grid_erase(t->g, y, 0, t->ncols, &t->pen);
+		break;
+	}
+}
+
+static void
+vterm_set_mode(vterm *t, const lc_vtparser *p, int on)
+{
+	int i;
+
+	for (i = 0; i < (p->nparams ? p->nparams : 1); i++)
+	{
+		int m = p->params[i];
+		if (p->priv == '?')
+			switch (m)
+			{
+			case 1:		t->appcursor = on; break;
+			case 6:		t->origin = on; vterm_goto(t, 0, 0); break;
+			case 7:		t->autowrap = on; t->wrapnext = 0; break;
+			case 25:	t->show_cursor = on; break;
+			case 47:
+			case 1047:	vterm_altscreen(t, on); break;
+			case 1048:
+				if (on) vterm_save_cursor(t); else vterm_restore_cursor(t);
+				break;
+			case 1049:
+				if (on)
+				{
+					vterm_save_cursor(t);
+					vterm_altscreen(t, 1);
+					vterm_save_cursor(t);
+				}
+				else
+				{
+					vterm_altscreen(t, 0);
+					vterm_restore_cursor(t);
+				}
+				break;
+			}
+		else if (!p->priv)
+			switch (m)
+			{
+			case 4:		t->insert = on; break;
+			case 20:	t->lnm = on; break;
+			}
+	}
+}
+
+
+/* ================== *
+ * Parser callbacks.  *
+ * ================== */
+
+static void
+vterm_print(void *ud, const int *cps, size_t n)
+{
+	vterm *t = ud;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+	{
+		int width = lc_wcwidth(cps[i]);
+		if (width >= 0)
+			vterm_put(t, cps[i], width > 2 ? 2 : width);
+	}
+}
+
+static void
+vterm_execute(void *ud, int c)
+{
+	vterm *t = ud;
+
+	switch (c)
+	{
+	case '\b':
+		if (t->x > 0)
+			t->x--;
+		t->wrapnext = 0;
+		break;
+	case '\t':
+		while (t->x < t->ncols - 1 && !t->tabs[++t->x])
+			;
+		t->wrapnext = 0;
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		vterm_index(t);
+		if (t->lnm)
+			t->x = 0;
+		t->wrapnext = 0;
+		break;
+	case '\r':
+		t->x = 0;
+		t->wrapnext = 0;
+		break;
+	case 0x0e:	/* SO */
+		t->gl = 1;
+		break;
+	case 0x0f:	/* SI */
+		t->gl = 0;
+		break;
+	}
+}
+
+static void
+vterm_esc(void *ud, const lc_vtparser *p, int final)
+{
+	vterm *t = ud;
+
+	if (p->ninter == 1)
+	{
+		switch (p->inter[0])
+		{
+		case '(':
+		case ')':
+			t->charset[p->inter[0] == ')'] = final == '0' ? '0' : 'B';
+			break;
+		case '#':
+			if (final == '8')	/* DECALN */
+			{
+				int y, x;
+				for (y = 0; y < t->nlines; y++)
+					for (x = 0; x < t->ncols; x++)
+					{
+						lc_cell *c = &t->g->rows[y][x];
+						grid_blank(c, NULL);
+						c->ch = 'E';
+					}
+				grid_touch(t->g, 0, t->nlines - 1);
+				vterm_goto(t, 0, 0);
+			}
+			break;
+		}
+		return;
+	}
+	if (p->ninter)
+		return;
+
+	switch (final)
+	{
+	case '7':	vterm_save_cursor(t); break;
+	case '8':	vterm_restore_cursor(t); break;
+	case 'D':	vterm_index(t); t->wrapnext = 0; break;
+	case 'E':	t->x = 0; vterm_index(t); t->wrapnext = 0; break;
+	case 'M':	vterm_reverse_index(t); t->wrapnext = 0; break;
+	case 'H':	t->tabs[t->x] = 1; break;
+	case 'c':
+		vterm_altscreen(t, 0);
+		vterm_reset(t);
+		vterm_erase_display(t, 2);
+		break;
+	}
+}
+
+static void
+vterm_csi(void *ud, const lc_vtparser *p, int final)
+{
+	vterm *t = ud;
+	int n = vt_param(p, 0, 1);
+	int y, x;
+	char reply[32];
+
+	if (p->ninter)
+	{
+		/* DECSTR, soft reset */
+		if (p->inter[0] == '!' && final == 'p')
+		{
+			t->autowrap = t->show_cursor = 1;
+			t->origin = t->insert = t->appcursor = 0;
+			t->top = 0;
+			t->bot = t->nlines - 1;
+			pen_reset(&t->pen);
+		}
+		return;
+	}
+	if (p->priv && p->priv != '?' && final != 'c')
+		return;
+
+	switch (final)
+	{
+	case '@':	/* ICH */
+		vterm_shift(t, n);
+		break;
+	case 'A':	/* CUU */
+		y = t->y - n;
+		if (t->y >= t->top && y < t->top)
+			y = t->top;
+		t->y = y < 0 ? 0 : y;
+		t->wrapnext = 0;
+		break;
+	case 'B':	/* CUD */
+	case 'e':	/* VPR */
+		y = t->y + n;
+		if (t->y <= t->bot && y > t->bot)
+			y = t->bot;
+		t->y = y >= t->nlines ? t->nlines - 1 : y;
+		t->wrapnext = 0;
+		break;
+	case 'C':	/* CUF */
+	case 'a':	/* HPR */
+		x = t->x + n;
+		t->x = x >= t->ncols ? t->ncols - 1 : x;
+		t->wrapnext = 0;
+		break;
+	case 'D':	/* CUB */
+		x = t->x - n;
+		t->x = x < 0 ? 0 : x;
+		t->wrapnext = 0;
+		break;
+	case 'E':	/* CNL */
+	case 'F':	/* CPL */
+		y = final == 'E' ? t->y + n : t->y - n;
+		t->y = y < 0 ? 0 : y >= t->nlines ? t->nlines - 1 : y;
+		t->x = 0;
+		t->wrapnext = 0;
+		break;
+	case 'G':	/* CHA */
+	case '`':	/* HPA */
+		t->x = n > t->ncols ? t->ncols - 1 : n - 1;
+		t->wrapnext = 0;
+		break;
+	case 'H':	/* CUP */
+	case 'f':	/* HVP */
+		vterm_goto(t, n - 1, vt_param(p, 1, 1) - 1);
+		break;
+	case 'I':	/* CHT */
+		while (n-- > 0)
+			vterm_execute(t, '\t');
+		break;
+	case 'J':	/* ED */
+		vterm_erase_display(t, vt_param(p, 0, 0));
+		break;
+	case 'K':	/* EL */
+		switch (vt_param(p, 0, 0))
+		{
+		case 0:	grid_erase(t->g, t->y, t->x, t->ncols, &t->pen); break;
+		case 1:	grid_erase(t->g, t->y, 0, t->x + 1, &t->pen); break;
+		case 2:	grid_erase(t->g, t->y, 0, t->ncols, &t->pen); break;
+		}
+		break;
+	case 'L':	/* IL */
+	case 'M':	/* DL */
+		if (t->y >= t->top && t->y <= t->bot)
+		{
+			grid_scroll(t->g, t->y, t->bot, final == 'M' ? n : -n, &t->pen);
+			t->x = 0;
+			t->wrapnext = 0;
+		}
+		break;
+	case 'P':	/* DCH */
+		vterm_shift(t, -n);
+		break;
+	case 'S':	/* SU */
+		grid_scroll(t->g, t->top, t->bot, n, &t->pen);
+		break;
+	case 'T':	/* SD */
+		grid_scroll(t->g, t->top, t->bot, -n, &t->pen);
+		break;
+	case 'X':	/* ECH */
+		grid_erase(t->g, t->y, t->x, t->x + n, &t->pen);
+		break;
+	case 'Z':	/* CBT */
+		while (n-- > 0 && t->x > 0)
+			while (--t->x > 0 && !t->tabs[t->x])
+				;
+		t->wrapnext = 0;
+		break;
+	case 'b':	/* REP */
+		while (n-- > 0)
+			vterm_put(t, t->lastch, lc_wcwidth(t->lastch));
+		break;
+	case 'c':	/* DA */
+		if (p->priv == '>')
+			vterm_reply(t, "\033[>1;10;0c");
+		else if (!p->priv)
+			vterm_reply(t, "\033[?6c");
+		break;
+	case 'd':	/* VPA */
+		vterm_goto(t, n - 1, t->x);
+		break;
+	case 'g':	/* TBC */
+		if (vt_param(p, 0, 0) == 0)
+			t->tabs[t->x] = 0;
+		else if (vt_param(p, 0, 0) == 3)
+			memset(t->tabs, 0, t->ncols);
+		break;
+	case 'h':	/* SM */
+		vterm_set_mode(t, p, 1);
+		break;
+	case 'l':	/* RM */
+		vterm_set_mode(t, p, 0);
+		break;
+	case 'm':	/* SGR */
+		if (!p->priv)
+			sgr_apply(&t->pen, p);
+		break;
+	case 'n':	/* DSR */
+		if (vt_param(p, 0, 0) == 5)
+			vterm_reply(t, "\033[0n");
+		else if (vt_param(p, 0, 0) == 6)
+		{
+			sprintf(reply, "\033[%d;%dR",
+				t->y + 1 - (t->origin ? t->top : 0), t->x + 1);
+			vterm_reply(t, reply);
+		}
+		break;
+	case 'r':	/* DECSTBM */
+		if (!p->priv)
+		{
+			int top = vt_param(p, 0, 1) - 1;
+			int bot = vt_param(p, 1, t->nlines) - 1;
+			if (bot >= t->nlines)
+				bot = t->nlines - 1;
+			if (top < bot)
+			{
+				t->top = top;
+				t->bot = bot;
+				vterm_goto(t, 0, 0);
+			}
+		}
+		break;
+	case 's':	/* SCOSC */
+		if (!p->priv)
+			vterm_save_cursor(t);
+		break;
+	case 'u':	/* SCORC */
+		if (!p->priv)
+			vterm_restore_cursor(t);
+		break;
+	}
+}
+
+static void
+vterm_osc(void *ud, const char *s, size_t n)
+{
+	vterm *t = ud;
+
+	/* 0 and 2 set the window title */
+	if (n >= 2 && (s[0] == '0' || s[0] == '2') && s[1] == ';')
+	{
+		memcpy(t->title, s + 2, n - 2);
+		t->title[n - 2] = '\0';
+	}
+}
+
+static const lc_vtops vterm_ops = {
+	vterm_print, vterm_execute, vterm_esc, vterm_csi, vterm_osc
+};
+
+
+/* ================ *
+ * Pane management. *
+ * ================ */
+
+static int
+vterm_init(vterm *t, int nlines, int ncols)
+{
+	memset(t, 0, sizeof *t);
+	t->fd = -1;
+	t->pid = -1;
+	t->nlines = nlines;
+	t->ncols = ncols;
+	if (grid_init(&t->grid[0], nlines, ncols) != 0
+		|| grid_init(&t->grid[1], nlines, ncols) != 0
+		|| !(t->tabs = malloc(ncols)))
+		return vterm_free(t), -1;
+	t->g = &t->grid[0];
+	vt_init(&t->parser, &vterm_ops, t);
+	vterm_reset(t);
+	return 0;
+}
+
+static int
+vterm_resize(vterm *t, int nlines, int ncols)
+{
+	unsigned char *tabs;
+	lc_grid n[2];
+	int i;
+
+	/* allocate everything first, so that failing leaves t as it was */
+	if (grid_init(&n[0], nlines, ncols) != 0)
+		return -1;
+	if (grid_init(&n[1], nlines, ncols) != 0 || !(tabs = malloc(ncols)))
+	{
+		grid_free(&n[0]);
+		grid_free(&n[1]);
+		return -1;
+	}
+	free(t->tabs);
+	t->tabs = tabs;
+	/* keep the cursor row in sight by scrolling the rest up */
+	if (t->y >= nlines)
+	{
+		grid_scroll(t->g, 0, t->nlines - 1, t->y - nlines + 1, NULL);
+		t->y = nlines - 1;
+	}
+	for (i = 0; i < 2; i++)
+		grid_replace(&t->grid[i], &n[i]);
+	t->nlines = nlines;
+	t->ncols = ncols;
+	t->top = 0;
+	t->bot = nlines - 1;
+	if (t->x >= ncols)
+		t->x = ncols - 1;
+	t->wrapnext = 0;
+	for (i = 0; i < 2; i++)
+	{
+		if (t->saved[i].y >= nlines)
+			t->saved[i].y = nlines - 1;
+		if (t->saved[i].x >= ncols)
+			t->saved[i].x = ncols - 1;
+	}
+	vterm_reset_tabs(t);
+	t->target = NULL;
+	if (t->fd >= 0)
+	{
+		struct winsize ws;
+		memset(&ws, 0, sizeof ws);
+		ws.ws_row = nlines;
+		ws.ws_col = ncols;
+		ioctl(t->fd, TIOCSWINSZ, &ws);
+	}
+	return 0;
+}
+
+/*
+** Feed everything the child has written, up to limit bytes, through the
+** parser.  Returns the number of bytes read, or -1 once the child side
+** of the pty has been closed and all its output was consumed.
+*/
+static long
+vterm_read(vterm *t, long limit)
+{
+	char buf[VTERM_READBUF];
+	long total = 0;
+
+	if (t->fd < 0 || t->eof)
+		return -1;
+	while (total < limit)
+	{
+		ssize_t n = read(t->fd, buf, sizeof buf);
+		if (n > 0)
+		{
+			vt_feed(&t->parser, buf, n);
+			total += n;
+		}
+		else if (n == 0 || errno == EIO)
+		{
+			/* Linux reports EIO when the last slave fd is closed */
+			t->eof = 1;
+			break;
+		}
+		else if (errno != EINTR)
+			break;
+	}
+	return total == 0 && t->eof ? -1 : total;
+}
+
+static int
+vterm_reap(vterm *t, int options)
+{
+	int st;
+	pid_t r;
+
+	if (t->pid <= 0)
+		return 1;
+	while ((r = waitpid(t->pid, &st, options)) < 0 && errno == EINTR)
+		;
+	if (r == 0)
+		return 0;
+	if (r == t->pid)
+		t->status = WIFEXITED(st) ? WEXITSTATUS(st)
+			: WIFSIGNALED(st) ? 128 + WTERMSIG(st) : st;
+	t->pid = -1;
+	return 1;
+}
+
+static void
+vterm_close(vterm *t)
+{
+	if (t->fd >= 0)
+	{
+		close(t->fd);
+		t->fd = -1;
+	}
+	if (t->pid > 0 && !vterm_reap(t, WNOHANG))
+		kill(t->pid, SIGHUP);
+}
+
+static vterm *
+checkvterm(lua_State *L, int narg)
+{
+	vterm *t = (vterm *) luaL_checkudata(L, narg, VTERM_META);
+	luaL_argcheck(L, t != NULL && t->g != NULL, narg, "bad curses vterm");
+	return t;
+}
+
+static vterm *
+newvterm(lua_State *L, int nlines, int ncols)
+{
+	vterm *t;
+
+	luaL_argcheck(L, nlines > 0, 1, "nlines should > 0");
+	luaL_argcheck(L, ncols > 0, 2, "ncols should > 0");
+	t = lua_newuserdata(L, sizeof *t);
+	memset(t, 0, sizeof *t);
+	luaL_setmetatable(L, VTERM_META);
+	if (vterm_init(t, nlines, ncols) != 0)
+		luaL_error(L, "malloc failed");
+	return t;
+}
+
+
+/***
+Create a vterm without a child process.
+@function new
+@int lines number of lines
+@int cols number of columns
+@treturn vterm a new terminal emulator
+@see feed
+*/
+static int
+Vnew(lua_State *L)
+{
+	newvterm(L, checkint(L, 1), checkint(L, 2));
+	return 1;
+}
+
+
+/*
+** The child of fork() may only make async-signal-safe calls, so the
+** environment and the candidate paths for execve are built beforehand.
+** The strings are kept alive by a table left on the stack.
+*/
+extern char **environ;
+
+static const char **
+vt_envp(lua_State *L, const char *term)
+{
+	const char **envp;
+	int i, n;
+
+	for (n = 0; environ[n]; n++)
+		;
+	lua_createtable(L, 1, 1);
+	envp = lua_newuserdata(L, (n + 2) * sizeof *envp);
+	lua_setfield(L, -2, "envp");
+	for (i = n = 0; environ[i]; i++)
+		if (strncmp(environ[i], "TERM=", 5) != 0
+		 && strncmp(environ[i], "LINES=", 6) != 0
+		 && strncmp(environ[i], "COLUMNS=", 8) != 0)
+			envp[n++] = environ[i];
+	envp[n++] = lua_pushfstring(L, "TERM=%s", term);
+	lua_rawseti(L, -2, 1);
+	envp[n] = NULL;
+	return envp;
+}
+
+/* what execvp would try for file, in order */
+static const char **
+vt_paths(lua_State *L, const char *file)
+{
+	const char *path = getenv("PATH"), *p, *e;
+	const char **paths;
+	int n = 1;
+
+	if (!path)
+		path = "/bin:/usr/bin";
+	if (!strchr(file, '/'))
+		for (p = path; *p; p++)
+			n += *p == ':';
+	lua_createtable(L, n, 1);
+	paths = lua_newuserdata(L, (n + 1) * sizeof *paths);
+	lua_setfield(L, -2, "paths");
+	paths[0] = file;
+	paths[n] = NULL;
+	if (strchr(file, '/'))
+		return paths;
+	for (n = 0, p = path; ; p = e + 1)
+	{
+		if (!(e = strchr(p, ':')))
+			e = p + strlen(p);
+		/* an empty element means the current directory */
+		lua_pushlstring(L, e == p ? "." : p, e == p ? 1 : e - p);
+		paths[n] = lua_pushfstring(L, "%s/%s", lua_tostring(L, -1), file);
+		lua_rawseti(L, -3, ++n);
+		lua_pop(L, 1);
+		if (!*e)
+			break;
+	}
+	return paths;
+}
+
+
+/***
+Run a command on a new pseudo-terminal.
+A string *cmd* is run with `/bin/sh -c`, while a table is used as the
+argument vector as is.  The child runs in a new session with the pty
+as its controlling terminal, and `TERM` set to *term*.
+@function spawn
+@tparam string|table cmd command line, or argument vector
+@int lines number of lines
+@int cols number of columns
+@string[opt="xterm-256color"] term value for `TERM` in the child
+@treturn vterm a new terminal emulator, or `nil` plus an error message
+@usage
+  pane = curses.vterm.spawn ({"ls", "-l"}, 24, 80)
+*/
+static int
+Vspawn(lua_State *L)
+{
+	int nlines = checkint(L, 2);
+	int ncols = checkint(L, 3);
+	const char *term = optstring(L, 4, "xterm-256color");
+	const char **argv, **envp, **paths;
+	const char *slave;
+	struct winsize ws;
+	int i, n, fd;
+	pid_t pid;
+	vterm *t;
+
+	if (lua_type(L, 1) == LUA_TTABLE)
+	{
+		n = (int) lua_rawlen(L, 1);
+		luaL_argcheck(L, n > 0, 1, "empty argument vector");
+		argv = lua_newuserdata(L, (n + 1) * sizeof *argv);
+		for (i = 0; i < n; i++)
+		{
+			/* the strings stay referenced by the table */
+			lua_rawgeti(L, 1, i + 1);
+			luaL_argcheck(L, lua_type(L, -1) == LUA_TSTRING, 1,
+				"arguments should be strings");
+			argv[i] = lua_tostring(L, -1);
+			lua_pop(L, 1);
+		}
+		argv[n] = NULL;
+	}
+	else
+	{
+		argv = lua_newuserdata(L, 4 * sizeof *argv);
+		argv[0] = "/bin/sh";
+		argv[1] = "-c";
+		argv[2] = luaL_checkstring(L, 1);
+		argv[3] = NULL;
+	}
+	envp = vt_envp(L, term);
+	paths = vt_paths(L, argv[0]);
+
+	t = newvterm(L, nlines, ncols);
+
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+		return pusherror(L, "posix_openpt");
+	if (grantpt(fd) != 0 || unlockpt(fd) != 0 || !(slave = ptsname(fd)))
+	{
+		int e = errno;
+		close(fd);
+		errno = e;
+		return pusherror(L, "pty");
+	}
+	memset(&ws, 0, sizeof ws);
+	ws.ws_row = nlines;
+	ws.ws_col = ncols;
+
+	if ((pid = fork()) < 0)
+	{
+		int e = errno;
+		close(fd);
+		errno = e;
+		return pusherror(L, "fork");
+	}
+	if (pid == 0)
+	{
+		int s;
+
+		setsid();
+		if ((s = open(slave, O_RDWR)) < 0)
+			_exit(127);
+#ifdef TIOCSCTTY
+		ioctl(s, TIOCSCTTY, 0);
+#endif
+		ioctl(s, TIOCSWINSZ, &ws);
+		dup2(s, 0);
+		dup2(s, 1);
+		dup2(s, 2);
+		if (s > 2)
+			close(s);
+		close(fd);
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGTSTP, SIG_DFL);
+		signal(SIGWINCH, SIG_DFL);
+		for (i = 0; paths[i]; i++)
+			execve(paths[i], (char * const *) argv,
+				(char * const *) envp);
+		_exit(127);
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	t->fd = fd;
+	t->pid = pid;
+	return 1;
+}
+
+
+/***
+Interpret text as output of the child process.
+@function feed
+@string str bytes, usually containing escape sequences
+@see update
+*/
+static int
+Vfeed(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	size_t len;
+	const char *str = luaL_checklstring(L, 2, &len);
+	vt_feed(&t->parser, str, len);
+	return 0;
+}
+
+
+/***
+Read and interpret pending output of the child process.
+Never blocks; at most *limit* bytes are consumed per call, so that a
+child writing faster than the screen can be redrawn does not starve
+the rest of the UI.
+@function update
+@int[opt=1048576] limit maximum number of bytes to read
+@treturn int number of bytes read, or `nil` once the child has closed
+  the terminal and all of its output was read
+@see fd
+*/
+static int
+Vupdate(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	long limit = optint(L, 2, 1L << 20);
+	long n = vterm_read(t, limit);
+	if (n < 0)
+	{
+		vterm_reap(t, WNOHANG);
+		lua_pushnil(L);
+		return 1;
+	}
+	return pushintresult(n);
+}
+
+
+/***
+Copy the screen of the vterm into a window.
+Only rows which changed since the previous render are copied, unless
+the target window or its size changed, or *all* is true.  The cursor
+of *win* is left at the cursor position of the vterm.
+@function render
+@tparam curses.window win target window
+@bool[opt=false] all copy every row
+@treturn int number of rows copied
+*/
+static int
+Vrender(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	WINDOW *w = checkwin(L, 2);
+	int all = lua_toboolean(L, 3);
+	int y, n = 0, wlines = getmaxy(w);
+	lc_pencache cache = LC_PENCACHE_INIT;
+
+	if (t->target != w || t->tlines != wlines || t->tcols != getmaxx(w)
+		|| !t->buf)
+	{
+		cchar_t *buf = realloc(t->buf, t->ncols * sizeof *buf);
+		if (!buf)
+			return luaL_error(L, "malloc failed");
+		t->buf = buf;
+		t->target = w;
+		t->tlines = wlines;
+		t->tcols = getmaxx(w);
+		all = 1;
+	}
+
+	for (y = 0; y < t->nlines && y < wlines; y++)
+		if (all || t->g->dirty[y])
+		{
+			grid_render_row(t->g, y, w, y, 0, &cache, t->buf);
+			t->g->dirty[y] = 0;
+			n++;
+		}
+	if (all && t->nlines < wlines)
+	{
+		wmove(w, t->nlines, 0);
+		wclrtobot(w);
+	}
+	if (t->y < wlines && t->x < getmaxx(w))
+		wmove(w, t->y, t->x);
+	return pushintresult(n);
+}
+
+
+/*
+** Write everything to the pty.  While it is full, output of the child is
+** read and interpreted, so that a child which is blocked writing cannot
+** deadlock us.
+*/
+static int
+vterm_write(vterm *t, const char *str, size_t len)
+{
+	while (len > 0 && t->fd >= 0)
+	{
+		ssize_t n = write(t->fd, str, len);
+		if (n > 0)
+		{
+			str += n;
+			len -= n;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			struct pollfd pfd;
+			pfd.fd = t->fd;
+			pfd.events = POLLIN | POLLOUT;
+			if (poll(&pfd, 1, -1) > 0 && (pfd.revents & POLLIN)
+				&& vterm_read(t, VTERM_READBUF) < 0)
+				break;
+		}
+		else if (errno != EINTR)
+			break;
+	}
+	return len == 0;
+}
+
+
+/***
+Send input to the child process.
+@function send
+@string str bytes to write
+@treturn bool `true`, if successful
+@see send_key
+*/
+static int
+Vsend(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	size_t len;
+	const char *str = luaL_checklstring(L, 2, &len);
+	return pushboolresult(vterm_write(t, str, len));
+}
+
+
+/***
+Send a key, as returned by @{curses.window:getch}, to the child process.
+Function and cursor keys are translated into the escape sequences an
+xterm would send, honouring application cursor key mode; other keys are
+sent UTF-8 encoded.
+@function send_key
+@int key key code or character
+@treturn bool `true`, if successful
+@see send
+*/
+static int
+Vsend_key(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	int key = checkint(L, 2);
+	char buf[4];
+	const char *s = NULL;
+	size_t len = 0;
+
+	switch (key)
+	{
+	case KEY_UP:		s = t->appcursor ? "\033OA" : "\033[A"; break;
+	case KEY_DOWN:		s = t->appcursor ? "\033OB" : "\033[B"; break;
+	case KEY_RIGHT:		s = t->appcursor ? "\033OC" : "\033[C"; break;
+	case KEY_LEFT:		s = t->appcursor ? "\033OD" : "\033[D"; break;
+	case KEY_HOME:		s = t->appcursor ? "\033OH" : "\033[H"; break;
+	case KEY_END:		s = t->appcursor ? "\033OF" : "\033[F"; break;
+	case KEY_IC:		s = "\033[2~"; break;
+	case KEY_DC:		s = "\033[3~"; break;
+	case KEY_PPAGE:		s = "\033[5~"; break;
+	case KEY_NPAGE:		s = "\033[6~"; break;
+	case KEY_BTAB:		s = "\033[Z"; break;
+	case KEY_BACKSPACE:	s = "\177"; break;
+	case KEY_ENTER:		s = "\r"; break;
+	case KEY_F(1):		s = "\033OP"; break;
+	case KEY_F(2):		s = "\033OQ"; break;
+	case KEY_F(3):		s = "\033OR"; break;
+	case KEY_F(4):		s = "\033OS"; break;
+	case KEY_F(5):		s = "\033[15~"; break;
+	case KEY_F(6):		s = "\033[17~"; break;
+	case KEY_F(7):		s = "\033[18~"; break;
+	case KEY_F(8):		s = "\033[19~"; break;
+	case KEY_F(9):		s = "\033[20~"; break;
+	case KEY_F(10):		s = "\033[21~"; break;
+	case KEY_F(11):		s = "\033[23~"; break;
+	case KEY_F(12):		s = "\033[24~"; break;
+	default:
+		if (key < 0 || key > MAXUNICODE || (key >= 0xd800 && key < 0xe000))
+			return pushboolresult(0);
+		s = buf;
+		len = utf8_encode(buf, key);
+	}
+	if (s != buf)
+		len = strlen(s);
+	return pushboolresult(vterm_write(t, s, len));
+}
+
+
+/***
+Change the size of the terminal.
+The child is notified with `SIGWINCH`.
+@function resize
+@int lines number of lines
+@int cols number of columns
+@treturn bool `true`, if successful
+*/
+static int
+Vresize(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	int nlines = checkint(L, 2);
+	int ncols = checkint(L, 3);
+	luaL_argcheck(L, nlines > 0, 2, "nlines should > 0");
+	luaL_argcheck(L, ncols > 0, 3, "ncols should > 0");
+	return pushboolresult(vterm_resize(t, nlines, ncols) == 0);
+}
+
+
+/***
+Size of the terminal.
+@function size
+@treturn int number of lines
+@treturn int number of columns
+*/
+static int
+Vsize(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	lua_pushinteger(L, t->nlines);
+	lua_pushinteger(L, t->ncols);
+	return 2;
+}
+
+
+/***
+Cursor position of the terminal.
+@function cursor
+@treturn int line
+@treturn int column
+@treturn bool `true`, if the child wants the cursor visible
+*/
+static int
+Vcursor(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	lua_pushinteger(L, t->y);
+	lua_pushinteger(L, t->x);
+	lua_pushboolean(L, t->show_cursor);
+	return 3;
+}
+
+
+/***
+Text of one line of the terminal, without trailing blanks.
+@function line
+@int y line number, starting from 0
+@treturn string utf8 text of the line
+*/
+static int
+Vline(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	int y = checkint(L, 2);
+	luaL_Buffer b;
+	lc_cell *row;
+	int x, end;
+
+	luaL_argcheck(L, y >= 0 && y < t->nlines, 2, "bad line");
+	row = t->g->rows[y];
+	for (end = t->ncols; end > 0 && (row[end - 1].ch == ' ' || row[end - 1].ch == 0)
+		&& !row[end - 1].comb; end--)
+		;
+	luaL_buffinit(L, &b);
+	for (x = 0; x < end; x++)
+	{
+		char buf[8];
+		int n = 0;
+		if (row[x].ch)
+			n = utf8_encode(buf, row[x].ch);
+		if (row[x].comb)
+			n += utf8_encode(buf + n, row[x].comb);
+		luaL_addlstring(&b, buf, n);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+
+/***
+Title set by the child with an OSC 0 or OSC 2 sequence.
+@function title
+@treturn string title, empty if never set
+*/
+static int
+Vtitle(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	return pushstringresult(t->title);
+}
+
+
+/***
+File descriptor of the pty, to wait for output with `poll` or `select`.
+@function fd
+@treturn int file descriptor, or -1 without a child
+*/
+static int
+Vfd(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	return pushintresult(t->fd);
+}
+
+
+/***
+Process id of the child.
+@function pid
+@treturn int process id, or -1 without a child or once it was reaped
+*/
+static int
+Vpid(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	return pushintresult(t->pid);
+}
+
+
+/***
+Wait for the child process to exit.
+@function wait
+@bool[opt=false] nohang return immediately if the child is still running
+@treturn int exit status, 128 plus the signal number if killed by a
+  signal, or `nil` if still running
+*/
+static int
+Vwait(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	if (!vterm_reap(t, optboolean(L, 2, 0) ? WNOHANG : 0))
+		return 0;
+	return pushintresult(t->status);
+}
+
+
+/***
+Send a signal to the child process.
+@function kill
+@int[opt=SIGTERM] sig signal number
+@treturn bool `true`, if successful
+*/
+static int
+Vkill(lua_State *L)
+{
+	vterm *t = checkvterm(L, 1);
+	int sig = optint(L, 2, SIGTERM);
+	return pushboolresult(t->pid > 0 && kill(t->pid, sig) == 0);
+}
+
+
+/***
+Close the pty.
+The child receives `SIGHUP` if it is still running; its screen stays
+available.
+@function close
+*/
+static int
+Vclose(lua_State *L)
+{
+	vterm_close(checkvterm(L, 1));
+	return 0;
+}
+
+
+static int
+Vvterm_gc(lua_State *L)
+{
+	vterm *t = (vterm *) luaL_checkudata(L, 1, VTERM_META);
+	vterm_close(t);
+	vterm_free(t);
+	t->g = NULL;
+	return 0;
+}
+
+
+static const luaL_Reg curses_vterm_fns[] =
+{
+	LCURSES_FUNC( Vclose		),
+	LCURSES_FUNC( Vcursor		),
+	LCURSES_FUNC( Vfd		),
+	LCURSES_FUNC( Vfeed		),
+	LCURSES_FUNC( Vkill		),
+	LCURSES_FUNC( Vline		),
+	LCURSES_FUNC( Vnew		),
+	LCURSES_FUNC( Vpid		),
+	LCURSES_FUNC( Vrender		),
+	LCURSES_FUNC( Vresize		),
+	LCURSES_FUNC( Vsend		),
+	LCURSES_FUNC( Vsend_key		),
+	LCURSES_FUNC( Vsize		),
+	LCURSES_FUNC( Vspawn		),
+	LCURSES_FUNC( Vtitle		),
+	LCURSES_FUNC( Vupdate		),
+	LCURSES_FUNC( Vwait		),
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_vterm(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_vterm_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, VTERM_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, -2, "__index");		/* mt.__index = mt */
+
+	lua_pushcfunction(L, Vvterm_gc);
+	lua_setfield(L, -2, "__gc");		/* mt.__gc = Vvterm_gc */
+
+	lua_pushliteral(L, "CursesVterm");
+	lua_setfield(L, -2, "_type");		/* mt._type = "CursesVterm" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* t.version = "curses.vterm..." */
+	lua_pushliteral(L, "curses.vterm for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_VTERM_C*/
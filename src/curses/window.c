@@ -13,24 +13,122 @@
 */
 
 #include "_helpers.c"
+#include "_ansi.c"
+#include "_dirty.c"
+#include "_width.c"
 
 
 static const char *WINDOWMETA = "curses:window";
-
+static const char *STDSCR_REGISTRY = "curses:stdscr";
+static const char *WINDOW_REGISTRY = "curses:windows";
+static const char *SNAPSHOT_META = "curses:snapshot";
+
+/* the cells and cursor of a window, as window:snapshot copies them */
+typedef struct lc_snapshot {
+	int nlines, ncols;
+	int cury, curx;
+	cchar_t cells[];
+} lc_snapshot;
+
+static void pn_closewin(WINDOW *w);	/* in panel.c */
+static void pn_closescreen(WINDOW *std);	/* in panel.c */
+static void mr_sync_all(void);		/* in mirror.c */
+
+/*
+** The userdata of a window starts with the WINDOW pointer, so it can be
+** used as a WINDOW ** anywhere; what follows is state kept per window.
+** The parent of a subwindow is kept in the uservalue, which also keeps
+** it alive.
+*/
+typedef struct lc_window {
+	WINDOW *w;		/* NULL once closed */
+	WINDOW *scr;		/* curscr of the screen the window belongs to */
+} lc_window;
+
+/* push the table of window objects by WINDOW pointer, creating it if needed */
+static void
+lc_getwinregistry(lua_State *L)
+{
+	lua_pushstring(L, WINDOW_REGISTRY);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (!lua_isnil(L, -1))
+		return;
+	lua_pop(L, 1);
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushliteral(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_pushstring(L, WINDOW_REGISTRY);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+/*
+** Push the object of nw, the same one each time for as long as it is
+** referenced, so that collecting one of several objects of a window
+** cannot delete it under the others.
+*/
 static void
 lc_newwin(lua_State *L, WINDOW *nw)
 {
-	if (nw)
+	lc_window *lw;
+
+	if (nw == NULL)
+	{
+		lua_pushliteral(L, "failed to create window");
+		lua_error(L);
+	}
+	lc_getwinregistry(L);
+	lua_rawgetp(L, -1, nw);
+	lw = (lc_window *) lua_touserdata(L, -1);
+	if (lw == NULL || lw->w != nw)
 	{
-		WINDOW **w = lua_newuserdata(L, sizeof(WINDOW*));
+		lua_pop(L, 1);
+		lw = lua_newuserdata(L, sizeof *lw);
+		memset(lw, 0, sizeof *lw);
 		luaL_setmetatable(L, WINDOWMETA);
-		*w = nw;
+		lw->w = nw;
+		/* unlike stdscr, already set in ripoffline callbacks */
+		lw->scr = curscr;
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, -3, nw);
 	}
-	else
+	lua_remove(L, -2);
+}
+
+/*
+** delscreen frees every window of the current screen: mark their
+** objects closed, and forget them, so that a window which later gets
+** the same address has an object of its own.
+*/
+static void
+lc_closescreenwins(lua_State *L)
+{
+	lc_getwinregistry(L);
+	for (lua_pushnil(L); lua_next(L, -2) != 0; lua_pop(L, 1))
 	{
-		lua_pushliteral(L, "failed to create window");
-		lua_error(L);
+		lc_window *lw = (lc_window *) lua_touserdata(L, -1);
+		if (lw && lw->scr == curscr)
+		{
+			lw->w = NULL;
+			lua_pushvalue(L, -2);
+			lua_pushnil(L);
+			lua_rawset(L, -5);
+		}
 	}
+	lua_pop(L, 1);
+}
+
+/* push a new subwindow of the window at narg, which it keeps alive */
+static void
+lc_newsubwin(lua_State *L, int narg, WINDOW *nw)
+{
+	lc_newwin(L, nw);
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, narg);
+	lua_rawseti(L, -2, 1);
+	lua_setuservalue(L, -2);
 }
 
 
@@ -82,11 +180,24 @@ static int
 Wclose(lua_State *L)
 {
 	WINDOW **w = lc_getwin(L, 1);
-	if (*w != NULL && *w != stdscr)
+	int owner;
+
+	if (*w == NULL || *w == stdscr)
+		return 0;
+	/* a newer object may have taken over the window while this one
+	   was waiting to be collected */
+	lc_getwinregistry(L);
+	lua_rawgetp(L, -1, *w);
+	owner = lua_isnil(L, -1) || lua_rawequal(L, -1, 1);
+	lua_pop(L, 1);
+	if (owner)
 	{
+		lua_pushnil(L);
+		lua_rawsetp(L, -2, *w);
+		pn_closewin(*w);
 		delwin(*w);
-		*w = NULL;
 	}
+	*w = NULL;
 	return 0;
 }
 
@@ -129,7 +240,7 @@ Wsub(lua_State *L)
 	int begin_y = checkint(L, 4);
 	int begin_x = checkint(L, 5);
 
-	lc_newwin(L, subwin(orig, nlines, ncols, begin_y, begin_x));
+	lc_newsubwin(L, 1, subwin(orig, nlines, ncols, begin_y, begin_x));
 	return 1;
 }
 
@@ -154,7 +265,7 @@ Wderive(lua_State *L)
 	int begin_y = checkint(L, 4);
 	int begin_x = checkint(L, 5);
 
-	lc_newwin(L, derwin(orig, nlines, ncols, begin_y, begin_x));
+	lc_newsubwin(L, 1, derwin(orig, nlines, ncols, begin_y, begin_x));
 	return 1;
 }
 
@@ -177,6 +288,26 @@ Wmove_derived(lua_State *L)
 }
 
 
+/***
+The window this one was derived from.
+@function parent
+@treturn[1] window the parent window
+@return[2] nil if this is not a subwindow
+@see wgetparent(3x)
+@see derive
+*/
+static int
+Wparent(lua_State *L)
+{
+	WINDOW *p = wgetparent(checkwin(L, 1));
+
+	if (p == NULL)
+		return 0;
+	lc_newwin(L, p);
+	return 1;
+}
+
+
 /***
 Change the size of a window.
 @function resize
@@ -285,7 +416,9 @@ Refresh the window terminal display from the virtual screen.
 static int
 Wrefresh(lua_State *L)
 {
-	return pushokresult(wrefresh(checkwin(L, 1)));
+	int r = wrefresh(checkwin(L, 1));
+	mr_sync_all();
+	return pushokresult(r);
 }
 
 
@@ -433,6 +566,164 @@ Wis_linetouched(lua_State *L)
 }
 
 
+/***
+Which lines changed since the last refresh, all in one call.
+Consecutive changed lines make one run, given as its first line, its
+number of lines, and the first and last changed columns over them all.
+@function touched_lines
+@tparam[opt] table t table to fill, instead of a new one
+@treturn table `{y, n, first, last, ...}`, four numbers per run
+@treturn int number of runs
+@see touched_mask
+@usage
+  local t, n = win:touched_lines ()
+  for i = 1, 4 * n, 4 do
+    send (win, t[i], t[i + 1], t[i + 2], t[i + 3])
+  end
+*/
+static int
+Wtouched_lines(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+	int nlines = getmaxy(w), y = 0, k = 0, len;
+
+	if (lua_isnoneornil(L, 2))
+		lua_newtable(L);
+	else
+		luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	while (y < nlines)
+	{
+		int first, last, f, l, y0 = y;
+
+		if (!dirty_get(w, y++, &first, &last))
+			continue;
+		for (; y < nlines && dirty_get(w, y, &f, &l); y++)
+		{
+			if (f < first)
+				first = f;
+			if (l > last)
+				last = l;
+		}
+		lua_pushinteger(L, y0);
+		lua_rawseti(L, 2, ++k);
+		lua_pushinteger(L, y - y0);
+		lua_rawseti(L, 2, ++k);
+		lua_pushinteger(L, first);
+		lua_rawseti(L, 2, ++k);
+		lua_pushinteger(L, last);
+		lua_rawseti(L, 2, ++k);
+	}
+	/* what is left of an earlier call */
+	for (len = (int) lua_rawlen(L, 2); len > k; len--)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, 2, len);
+	}
+	lua_pushinteger(L, k / 4);
+	return 2;
+}
+
+
+/***
+Which lines changed since the last refresh, as a bit mask.
+@function touched_mask
+@treturn string a bit per line, from the low bit of the first byte;
+  set if the line changed
+@see touched_lines
+*/
+static int
+Wtouched_mask(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+	int nlines = getmaxy(w), y, first, last;
+	luaL_Buffer b;
+
+	luaL_buffinit(L, &b);
+	for (y = 0; y < nlines; y += 8)
+	{
+		int i, byte = 0;
+		for (i = 0; i < 8 && y + i < nlines; i++)
+			if (dirty_get(w, y + i, &first, &last))
+				byte |= 1 << i;
+		luaL_addchar(&b, byte);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+
+/***
+Copy the contents of the window, to put back later with @{restore}.
+The cells are copied line by line into a single block, so a snapshot
+costs one allocation and no Lua strings or tables.
+@function snapshot
+@return a snapshot of the cells and cursor of the window
+@see restore
+@usage
+  local under = stdscr:snapshot ()
+  show_dialog ()
+  stdscr:restore (under)
+  stdscr:refresh ()
+*/
+static int
+Wsnapshot(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+	int nlines = getmaxy(w), ncols = getmaxx(w), y;
+	lc_snapshot *s;
+
+	s = lua_newuserdata(L, sizeof *s + (size_t) nlines * ncols * sizeof(cchar_t));
+	luaL_setmetatable(L, SNAPSHOT_META);
+	s->nlines = nlines;
+	s->ncols = ncols;
+	getyx(w, s->cury, s->curx);
+	for (y = 0; y < nlines; y++)
+		memcpy(s->cells + (size_t) y * ncols, w->_line[y].text,
+			ncols * sizeof(cchar_t));
+	return 1;
+}
+
+
+/***
+Put back the contents of the window from a snapshot.
+Only the cells which differ from the snapshot are copied, and only
+their columns are marked as changed, so that restoring a screen after
+a dialog costs the refresh of what the dialog covered.
+@function restore
+@param snap snapshot made by @{snapshot} from a window of this size
+@treturn bool `true`, if successful, or `false` if the size of the
+  window changed since
+@see snapshot
+*/
+static int
+Wrestore(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+	lc_snapshot *s = (lc_snapshot *) luaL_checkudata(L, 2, SNAPSHOT_META);
+	int ncols = s->ncols, y;
+
+	if (getmaxy(w) != s->nlines || getmaxx(w) != ncols)
+		return pushboolresult(0);
+	for (y = 0; y < s->nlines; y++)
+	{
+		cchar_t *text = w->_line[y].text;
+		const cchar_t *from = s->cells + (size_t) y * ncols;
+		int first = 0, last = ncols - 1;
+
+		if (memcmp(text, from, ncols * sizeof(cchar_t)) == 0)
+			continue;
+		while (memcmp(text + first, from + first, sizeof(cchar_t)) == 0)
+			first++;
+		while (memcmp(text + last, from + last, sizeof(cchar_t)) == 0)
+			last--;
+		memcpy(text + first, from + first, (last - first + 1) * sizeof(cchar_t));
+		dirty_touch(w, y, first, last);
+	}
+	return pushokresult(wmove(w, s->cury, s->curx));
+}
+
+
 /***
 Has a window changed since the last refresh?
 @function is_wintouched
@@ -525,6 +816,39 @@ Wgetmaxyx(lua_State *L)
 }
 
 
+/***
+Fetch the cursor position, origin, size and parent offset at once.
+Layout code needing several of these for many windows saves a call per
+pair over @{getyx}, @{getbegyx}, @{getmaxyx} and @{getparyx}.
+@function geometry
+@treturn int cursor line
+@treturn int cursor column
+@treturn int top line, as for @{getbegyx}
+@treturn int left column
+@treturn int number of lines, as for @{getmaxyx}
+@treturn int number of columns
+@treturn int top line relative to the parent, or -1 if not a subwindow
+@treturn int left column relative to the parent, or -1
+@usage
+  local y, x, top, left, h, w = win:geometry ()
+*/
+static int
+Wgeometry(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+
+	lua_pushinteger(L, getcury(w));
+	lua_pushinteger(L, getcurx(w));
+	lua_pushinteger(L, getbegy(w));
+	lua_pushinteger(L, getbegx(w));
+	lua_pushinteger(L, getmaxy(w));
+	lua_pushinteger(L, getmaxx(w));
+	lua_pushinteger(L, getpary(w));
+	lua_pushinteger(L, getparx(w));
+	return 8;
+}
+
+
 /***
 Draw a border around a window.
 @function border
@@ -825,6 +1149,64 @@ Wmvaddchstr(lua_State *L)
 }
 
 
+/***
+Copy the columns of a @{curses.chstr} between *col* and *col* + *ncols*
+starting at the current cursor position.
+Finding the first column takes a binary search over the columns of
+*cs*, so panning a long line costs the same anywhere in the line.  Half
+a wide character at either edge is shown as a space.
+@function addchstr_cols
+@tparam curses.chstr cs
+@int col first column of *cs* to show, from 0
+@int[opt] ncols number of columns, up to the right of the window by
+  default
+@treturn bool `true`, if successful
+@see addchstr
+@see curses.chstr:col_to_index
+*/
+static int
+Waddchstr_cols(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+	chstr *cs = *checkchstr(L, 2);
+	int col = checkint(L, 3);
+	int room = getmaxx(w) - getcurx(w);
+	int ncols = optint(L, 4, room);
+	const unsigned int *cols;
+	unsigned int i, end;
+	cchar_t *buf;
+	int n = 0, x, r;
+
+	luaL_argcheck(L, col >= 0, 3, "col should >= 0");
+	if (ncols > room)
+		ncols = room;
+	if (ncols <= 0)
+		return pushokresult(OK);
+	cols = checkchstrcols(L, cs);
+	end = (unsigned int) col + ncols;
+	i = chstr_col_index(cs, cols, col);
+	/* the elements in between, and a space at either edge */
+	if (!(buf = malloc((chstr_col_index(cs, cols, end) - i + 2) * sizeof *buf)))
+		return luaL_error(L, "malloc failed");
+
+	/* a wide character cut by the left edge */
+	for (x = col; i < cs->len && cols[i] < (unsigned int) col && (unsigned int) x < cols[i + 1]; x++)
+		setcchar_(&buf[n++], ' ', cs->str[i].attr, 0);
+	if (x > col)
+		i++;
+	for (; i < cs->len && cols[i + 1] <= end; i++)
+		buf[n++] = cs->str[i];
+	/* and by the right edge */
+	if (i < cs->len && cols[i] < end)
+		for (x = cols[i]; (unsigned int) x < end; x++)
+			setcchar_(&buf[n++], ' ', cs->str[i].attr, 0);
+
+	r = n > 0 ? wadd_wchnstr(w, buf, n) : OK;
+	free(buf);
+	return pushokresult(r);
+}
+
+
 /***
 Copy a Lua string starting at the current cursor position.
 @function addstr
@@ -865,6 +1247,267 @@ Wmvaddstr(lua_State *L)
 }
 
 
+/* state of an addansi call, passed to the parser callbacks */
+typedef struct wansi {
+	WINDOW *w;
+	int y, x, maxy, maxx, top, bot;
+	cchar_t *run;		/* cells not yet copied to the window */
+	int runx, nrun;
+	lc_pen pen;
+	lc_pencache cache;
+	attr_t attrs;
+	int pair;
+	int clipped;
+} wansi;
+
+static void
+wansi_flush(wansi *a)
+{
+	if (a->nrun > 0)
+	{
+		wmove(a->w, a->y, a->runx);
+		wadd_wchnstr(a->w, a->run, a->nrun);
+		a->nrun = 0;
+	}
+}
+
+static void
+wansi_newline(wansi *a, int clear)
+{
+	wansi_flush(a);
+	if (clear && !a->clipped)
+	{
+		wmove(a->w, a->y, a->x);
+		wclrtoeol(a->w);
+	}
+	a->x = 0;
+	if (a->y == a->bot && is_scrollok(a->w))
+		wscrl(a->w, 1);
+	else if (a->y < a->maxy)
+		a->y++;
+	else
+		a->clipped = 1;
+}
+
+static void
+wansi_put(wansi *a, int ch, int width)
+{
+	if (a->x + width - 1 > a->maxx)
+		wansi_newline(a, 0);
+	if (a->clipped)
+		return;
+	if (a->nrun == 0)
+		a->runx = a->x;
+	setcchar_(&a->run[a->nrun++], ch, a->attrs, a->pair);
+	a->x += width;
+	if (a->x > a->maxx)
+		wansi_newline(a, 0);
+}
+
+static void
+wansi_print(void *ud, const int *cps, size_t n)
+{
+	wansi *a = ud;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+	{
+		int width = lc_wcwidth(cps[i]);
+		if (width > 0)
+			wansi_put(a, cps[i], width);
+		else if (width == 0 && a->nrun > 0)
+		{
+			/* combining character, attach it to the previous cell */
+			cchar_t *cc = &a->run[a->nrun - 1];
+			int k = 1;
+			while (k < CCHARW_MAX && cc->chars[k])
+				k++;
+			if (k < CCHARW_MAX)
+			{
+				cc->chars[k] = cps[i];
+				if (k + 1 < CCHARW_MAX)
+					cc->chars[k + 1] = L'\0';
+			}
+		}
+	}
+}
+
+static void
+wansi_execute(void *ud, int c)
+{
+	wansi *a = ud;
+
+	switch (c)
+	{
+	case '\n':
+		wansi_newline(a, 1);
+		break;
+	case '\r':
+		wansi_flush(a);
+		a->x = 0;
+		break;
+	case '\b':
+		wansi_flush(a);
+		if (a->x > 0)
+			a->x--;
+		break;
+	case '\t':
+		do
+			wansi_put(a, ' ', 1);
+		while (a->x % 8 && !a->clipped);
+		break;
+	}
+}
+
+static void
+wansi_esc(void *ud, const lc_vtparser *p, int final)
+{
+	(void) ud; (void) p; (void) final;
+}
+
+static void
+wansi_csi(void *ud, const lc_vtparser *p, int final)
+{
+	wansi *a = ud;
+
+	if (final == 'm' && !p->priv && !p->ninter)
+	{
+		sgr_apply(&a->pen, p);
+		a->attrs = pen_render(&a->pen, &a->cache, &a->pair);
+	}
+}
+
+static void
+wansi_skip_print(void *ud, const int *cps, size_t n)
+{
+	(void) ud; (void) cps; (void) n;
+}
+
+static void
+wansi_skip_execute(void *ud, int c)
+{
+	(void) ud; (void) c;
+}
+
+static const lc_vtops wansi_ops = {
+	wansi_print, wansi_execute, wansi_esc, wansi_csi, NULL
+};
+
+/* only tracks the pen, for text that would scroll out of sight anyway */
+static const lc_vtops wansi_skip_ops = {
+	wansi_skip_print, wansi_skip_execute, wansi_esc, wansi_csi, NULL
+};
+
+
+/***
+Write text containing ANSI escape sequences from the cursor position.
+SGR sequences change the window's current attributes and color pair,
+so the rendition carries over from one call to the next just as with
+@{attrset}.  16 color, 256 color and 24-bit color sequences are mapped
+onto the closest colors the terminal supports, allocating color pairs
+as needed.  Newlines, carriage returns, backspaces and tabs move the
+cursor as with @{addstr}; other escape sequences are dropped.
+
+When *str* ends in the middle of an escape sequence or UTF-8 character,
+the incomplete tail is returned so it can be prepended to the next chunk.
+@function addansi
+@string str utf8 string with embedded escape sequences
+@treturn bool `true`, if all of *str* fit in the window
+@treturn[opt] string incomplete trailing sequence, if any
+@see addstr
+@see curses.chstr.from_ansi
+@usage
+  local rest = ""
+  for chunk in pipe:lines ("L") do
+    local _, tail = win:addansi (rest .. chunk)
+    rest = tail or ""
+  end
+*/
+static int
+Waddansi(lua_State *L)
+{
+	WINDOW *w = checkwin(L, 1);
+	size_t len, done, skip = 0;
+	const char *str = luaL_checklstring(L, 2, &len);
+	attr_t attrs;
+	short spair;
+	int pair = 0;
+	wansi a;
+	lc_vtparser p;
+
+	memset(&a, 0, sizeof a);
+	a.w = w;
+	getyx(w, a.y, a.x);
+	getmaxyx(w, a.maxy, a.maxx);
+	a.maxy--;
+	a.maxx--;
+	if (wgetscrreg(w, &a.top, &a.bot) == ERR)
+		a.bot = a.maxy;
+
+	a.run = malloc(sizeof(cchar_t) * (a.maxx + 1));
+	if (!a.run)
+		return luaL_error(L, "malloc failed");
+
+	wattr_get(w, &attrs, &spair, &pair);
+	pen_from_attr(&a.pen, attrs, pair);
+	a.cache.fg = a.pen.fg;
+	a.cache.bg = a.pen.bg;
+	a.cache.pair = pair;
+	a.attrs = pen_render(&a.pen, &a.cache, &a.pair);
+
+	/*
+	** When the whole window scrolls, text followed by more newlines
+	** than the window has lines ends up out of sight: parse it for SGR
+	** state only, then render the tail into a blank window.  Otherwise
+	** scroll once up front to make room for all the new lines, rather
+	** than once per line.
+	*/
+	if (is_scrollok(w) && a.top == 0 && a.bot == a.maxy)
+	{
+		const char *s, *end = str + len;
+		size_t nl = 0;
+
+		for (s = str; (s = memchr(s, '\n', end - s)) != NULL; s++)
+			nl++;
+		if (nl > (size_t) a.maxy + 1)
+		{
+			for (nl -= a.maxy + 1, s = str; nl > 0; s++)
+				if (*s == '\n')
+					nl--;
+			skip = s - str;
+		}
+		else if (a.y + (int) nl > a.maxy)
+		{
+			wscrl(w, a.y + nl - a.maxy);
+			a.y = a.maxy - nl;
+		}
+	}
+
+	if (skip > 0)
+	{
+		vt_init(&p, &wansi_skip_ops, &a);
+		vt_feed(&p, str, skip);
+		werase(w);
+		a.y = a.x = 0;
+		p.ops = &wansi_ops;
+	}
+	else
+		vt_init(&p, &wansi_ops, &a);
+	done = skip + vt_feed(&p, str + skip, len - skip);
+
+	wansi_flush(&a);
+	wmove(w, a.y, a.x);
+	wattr_set(w, a.attrs, (short) a.pair, &a.pair);
+	free(a.run);
+
+	lua_pushboolean(L, !a.clipped);
+	if (done == len)
+		return 1;
+	lua_pushlstring(L, str + done, len - done);
+	return 2;
+}
+
+
 /***
 Set the background attributes for subsequently written characters.
 @function wbkgdset
@@ -1640,7 +2283,7 @@ Wsubpad(lua_State *L)
 	int begin_y = checkint(L, 4);
 	int begin_x = checkint(L, 5);
 
-	lc_newwin(L, subpad(orig, nlines, ncols, begin_y, begin_x));
+	lc_newsubwin(L, 1, subpad(orig, nlines, ncols, begin_y, begin_x));
 	return 1;
 }
 
@@ -1667,9 +2310,10 @@ Wprefresh(lua_State *L)
 	int smincol = checkint(L, 5);
 	int smaxrow = checkint(L, 6);
 	int smaxcol = checkint(L, 7);
+	int r = prefresh(p, pminrow, pmincol, sminrow, smincol, smaxrow, smaxcol);
 
-	return pushokresult(prefresh(p, pminrow, pmincol,
-		sminrow, smincol, smaxrow, smaxcol));
+	mr_sync_all();
+	return pushokresult(r);
 }
 
 
@@ -1795,8 +2439,10 @@ Wstandout(lua_State *L)
 static const luaL_Reg curses_window_fns[] =
 {
 	LCURSES_FUNC( W__tostring	),
+	LCURSES_FUNC( Waddansi		),
 	LCURSES_FUNC( Waddch		),
 	LCURSES_FUNC( Waddchstr		),
+	LCURSES_FUNC( Waddchstr_cols	),
 	LCURSES_FUNC( Waddstr		),
 	LCURSES_FUNC( Wattroff		),
 	LCURSES_FUNC( Wattron		),
@@ -1816,6 +2462,7 @@ static const luaL_Reg curses_window_fns[] =
 	LCURSES_FUNC( Wderive		),
 	LCURSES_FUNC( Wechoch		),
 	LCURSES_FUNC( Werase		),
+	LCURSES_FUNC( Wgeometry		),
 	LCURSES_FUNC( Wgetbegyx		),
 	LCURSES_FUNC( Wgetbkgd		),
 	LCURSES_FUNC( Wgetch		),
@@ -1856,6 +2503,7 @@ static const luaL_Reg curses_window_fns[] =
 	LCURSES_FUNC( Wnoutrefresh	),
 	LCURSES_FUNC( Woverlay		),
 	LCURSES_FUNC( Woverwrite	),
+	LCURSES_FUNC( Wparent		),
 	LCURSES_FUNC( Wpechochar	),
 	LCURSES_FUNC( Wpnoutrefresh	),
 	LCURSES_FUNC( Wprefresh		),
@@ -1863,8 +2511,10 @@ static const luaL_Reg curses_window_fns[] =
 	LCURSES_FUNC( Wredrawwin	),
 	LCURSES_FUNC( Wrefresh		),
 	LCURSES_FUNC( Wresize		),
+	LCURSES_FUNC( Wrestore		),
 	LCURSES_FUNC( Wscrl		),
 	LCURSES_FUNC( Wscrollok		),
+	LCURSES_FUNC( Wsnapshot		),
 	LCURSES_FUNC( Wstandend		),
 	LCURSES_FUNC( Wstandout		),
 	LCURSES_FUNC( Wsub		),
@@ -1874,6 +2524,8 @@ static const luaL_Reg curses_window_fns[] =
 	LCURSES_FUNC( Wsyncup		),
 	LCURSES_FUNC( Wtimeout		),
 	LCURSES_FUNC( Wtouch		),
+	LCURSES_FUNC( Wtouched_lines	),
+	LCURSES_FUNC( Wtouched_mask	),
 	LCURSES_FUNC( Wtouchline	),
 	LCURSES_FUNC( Wvline		),
 	LCURSES_FUNC( Wwbkgd		),
@@ -1913,6 +2565,11 @@ luaopen_curses_window(lua_State *L)
 
 	lua_pop(L, 1);				/* pop mt */
 
+	luaL_newmetatable(L, SNAPSHOT_META);
+	lua_pushliteral(L, "CursesSnapshot");
+	lua_setfield(L, -2, "_type");
+	lua_pop(L, 1);
+
 	/* t.version = "curses.window..." */
 	lua_pushliteral(L, "curses.window for " LUA_VERSION " / " PACKAGE_STRING);
 	lua_setfield(L, t, "version");
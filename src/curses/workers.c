@@ -0,0 +1,867 @@
+/* */
+
+/***
+ Rendering panes on worker threads.
+
+ A pane is an off-screen cell grid together with a render function,
+ which runs in a Lua state of its own.  @{render} runs the render
+ functions of many panes at the same time on a pool of threads, then
+ copies the rows of every grid that changed into its window and updates
+ the screen once:
+
+     local workers = curses.workers.new ()
+     local clock = workers:pane (10, 40, [[
+       return function (canvas, t)
+         canvas:clear ()
+         canvas:attrset (canvas.A_BOLD)
+         canvas:mvaddstr (0, 0, os.date ("%T", t))
+       end
+     ]])
+     -- every frame
+     workers:render { { clock, win1, os.time () }, { table, win2, rows } }
+
+ Render functions only see their canvas (see the @{curses.canvas}
+ section below) and the arguments given to @{render}; those are copied
+ into the state of the pane, so they can be nil, booleans, numbers,
+ strings or tables of these.  The state of a pane keeps its globals
+ from one frame to the next, and has the standard libraries loaded.
+
+@classmod curses.workers
+*/
+
+#ifndef LCURSES_WORKERS_C
+#define LCURSES_WORKERS_C 1
+
+#include "_helpers.c"
+#include "_ansi.c"
+#include "_grid.c"
+#include "_pool.c"
+#include "_width.c"
+
+
+static const char *WORKERS_META = "curses:workers";
+static const char *PANE_META = "curses:pane";
+static const char *CANVAS_META = "curses:canvas";
+
+#define WORKERS_MAXDEPTH	32
+
+/* what render functions draw with, a userdata in the state of the pane */
+typedef struct lc_canvas {
+	lc_grid *g;
+	int y, x;
+	lc_pen pen;
+} lc_canvas;
+
+typedef struct lc_pane {
+	lua_State *ws;		/* state the render function runs in */
+	int fn;			/* render function, a reference in ws */
+	int cref;		/* canvas, a reference in ws */
+	lc_canvas *canvas;
+	lc_grid grid;
+	int nargs;		/* arguments of the next run */
+	int status;		/* of the last run */
+	WINDOW *target;		/* window of the last blit */
+	int tlines, tcols;
+	cchar_t *buf;
+} lc_pane;
+
+typedef struct lc_workers {
+	lc_pool pool;
+	int pooled;
+} lc_workers;
+
+
+/* ========================== *
+ * Canvas, in the pane state. *
+ * ========================== */
+
+/***
+ Canvas, the first argument of render functions.
+ It has methods and attribute constants `A_NORMAL`, `A_BOLD`, `A_DIM`,
+ `A_ITALIC`, `A_UNDERLINE`, `A_BLINK`, `A_REVERSE` and `A_STANDOUT`.
+ Drawing is clipped to the grid of the pane; nothing wraps.
+@section curses.canvas
+*/
+
+static lc_canvas *
+checkcanvas(lua_State *L)
+{
+	return (lc_canvas *) luaL_checkudata(L, 1, CANVAS_META);
+}
+
+/* a color: -1 for the default, an index 0..255, or "#rrggbb" */
+static int
+checkpencolor(lua_State *L, int narg)
+{
+	if (lua_type(L, narg) == LUA_TSTRING)
+	{
+		const char *s = lua_tostring(L, narg);
+		char *end;
+		long rgb = strtol(s + 1, &end, 16);
+		luaL_argcheck(L, s[0] == '#' && end == s + 7 && *end == '\0', narg,
+			"bad color, expected \"#rrggbb\"");
+		return LC_COLOR_RGB | (int) rgb;
+	}
+	else
+	{
+		int c = checkint(L, narg);
+		luaL_argcheck(L, c >= -1 && c < 256, narg, "bad color index");
+		return c < 0 ? LC_COLOR_DEFAULT : c;
+	}
+}
+
+/* write s at the cursor; a newline goes to the start of the next line */
+static void
+canvas_addstr(lc_canvas *c, const char *s, size_t len)
+{
+	const char *end = s + len;
+	lc_grid *g = c->g;
+
+	while (s < end && c->y < g->nlines)
+	{
+		int ch, width;
+		const char *next = utf8_decode(s, &ch);
+
+		if (next == NULL || next > end)
+		{
+			ch = 0xfffd;
+			next = s + 1;
+		}
+		s = next;
+		if (ch == '\n')
+		{
+			c->y++;
+			c->x = 0;
+			continue;
+		}
+		if (ch < 0x20 || ch == 0x7f || c->x >= g->ncols)
+			continue;
+		width = lc_wcwidth(ch);
+		if (width < 0)
+			continue;
+		if (width > 2)
+			width = 2;
+		if (grid_put(g, c->y, c->x, ch, width, &c->pen) == c->x && width > 0)
+			c->x = g->ncols;	/* a wide character cut at the edge */
+		else
+			c->x += width;
+	}
+}
+
+static void
+canvas_move(lua_State *L, lc_canvas *c, int ny, int nx)
+{
+	luaL_argcheck(L, ny >= 0 && ny < c->g->nlines, 2, "line out of range");
+	luaL_argcheck(L, nx >= 0 && nx < c->g->ncols, 3, "column out of range");
+	c->y = ny;
+	c->x = nx;
+}
+
+
+/***
+Size of the canvas.
+@function size
+@treturn int number of lines
+@treturn int number of columns
+*/
+static int
+Gsize(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	lua_pushinteger(L, c->g->nlines);
+	lua_pushinteger(L, c->g->ncols);
+	return 2;
+}
+
+
+/***
+Blank the whole canvas, and move the cursor to the top left corner.
+The pen is left as it is.
+@function clear
+*/
+static int
+Gclear(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	int y;
+
+	for (y = 0; y < c->g->nlines; y++)
+		grid_erase(c->g, y, 0, c->g->ncols, NULL);
+	c->y = c->x = 0;
+	return 0;
+}
+
+
+/***
+Move the cursor.
+@function move
+@int y line
+@int x column
+*/
+static int
+Gmove(lua_State *L)
+{
+	canvas_move(L, checkcanvas(L), checkint(L, 2), checkint(L, 3));
+	return 0;
+}
+
+
+/***
+Position of the cursor.
+@function getyx
+@treturn int line
+@treturn int column
+*/
+static int
+Ggetyx(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	lua_pushinteger(L, c->y);
+	lua_pushinteger(L, c->x);
+	return 2;
+}
+
+
+/***
+Set the attributes of the pen.
+@function attrset
+@int attrs a combination of the `A_` constants of the canvas
+*/
+static int
+Gattrset(lua_State *L)
+{
+	checkcanvas(L)->pen.attrs = (attr_t) checkint(L, 2);
+	return 0;
+}
+
+
+/***
+Turn on attributes of the pen.
+@function attron
+@int attrs a combination of the `A_` constants of the canvas
+*/
+static int
+Gattron(lua_State *L)
+{
+	checkcanvas(L)->pen.attrs |= (attr_t) checkint(L, 2);
+	return 0;
+}
+
+
+/***
+Turn off attributes of the pen.
+@function attroff
+@int attrs a combination of the `A_` constants of the canvas
+*/
+static int
+Gattroff(lua_State *L)
+{
+	checkcanvas(L)->pen.attrs &= ~(attr_t) checkint(L, 2);
+	return 0;
+}
+
+
+/***
+Set the colors of the pen.
+Colors are -1 for the default color, a color index, or a `"#rrggbb"`
+string, which is shown as the nearest color the terminal has.
+@function color
+@tparam int|string fg foreground color
+@tparam[opt=-1] int|string bg background color
+*/
+static int
+Gcolor(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	int fg = checkpencolor(L, 2);
+	int bg = lua_isnoneornil(L, 3) ? LC_COLOR_DEFAULT : checkpencolor(L, 3);
+	c->pen.fg = fg;
+	c->pen.bg = bg;
+	return 0;
+}
+
+
+/***
+Write a UTF-8 string at the cursor with the pen.
+@function addstr
+@string str string to write
+*/
+static int
+Gaddstr(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	size_t len;
+	const char *s = luaL_checklstring(L, 2, &len);
+	canvas_addstr(c, s, len);
+	return 0;
+}
+
+
+/***
+Move the cursor, then write a UTF-8 string with the pen.
+@function mvaddstr
+@int y line
+@int x column
+@string str string to write
+*/
+static int
+Gmvaddstr(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	size_t len;
+	const char *s = luaL_checklstring(L, 4, &len);
+	canvas_move(L, c, checkint(L, 2), checkint(L, 3));
+	canvas_addstr(c, s, len);
+	return 0;
+}
+
+
+/***
+Fill a rectangle with a character, using the pen.
+The cursor does not move.
+@function fill
+@int y top line
+@int x left column
+@int h number of lines
+@int w number of columns
+@string[opt=" "] ch character to fill with
+*/
+static int
+Gfill(lua_State *L)
+{
+	lc_canvas *c = checkcanvas(L);
+	int y0 = checkint(L, 2), x0 = checkint(L, 3);
+	int y1 = y0 + checkint(L, 4), x1 = x0 + checkint(L, 5);
+	const char *s = optstring(L, 6, " ");
+	int ch = ' ', width = 1, y, x;
+
+	if (*s && utf8_decode(s, &ch) && ch >= 0x7f)
+		width = lc_wcwidth(ch);
+	if (ch < 0x20 || width < 1)
+		ch = ' ', width = 1;
+	if (width > 2)
+		width = 2;
+	if (y0 < 0)
+		y0 = 0;
+	if (x0 < 0)
+		x0 = 0;
+	if (y1 > c->g->nlines)
+		y1 = c->g->nlines;
+	if (x1 > c->g->ncols)
+		x1 = c->g->ncols;
+	for (y = y0; y < y1; y++)
+		for (x = x0; x + width <= x1; x += width)
+			grid_put(c->g, y, x, ch, width, &c->pen);
+	return 0;
+}
+
+
+static const luaL_Reg curses_canvas_fns[] =
+{
+	LCURSES_FUNC( Gaddstr		),
+	LCURSES_FUNC( Gattroff		),
+	LCURSES_FUNC( Gattron		),
+	LCURSES_FUNC( Gattrset		),
+	LCURSES_FUNC( Gclear		),
+	LCURSES_FUNC( Gcolor		),
+	LCURSES_FUNC( Gfill		),
+	LCURSES_FUNC( Ggetyx		),
+	LCURSES_FUNC( Gmove		),
+	LCURSES_FUNC( Gmvaddstr		),
+	LCURSES_FUNC( Gsize		),
+	{ NULL, NULL }
+};
+
+/* create the canvas of a pane in its state, referenced from the registry */
+static void
+newcanvas(lua_State *ws, lc_pane *p)
+{
+	lc_canvas *c = lua_newuserdata(ws, sizeof *c);
+	c->g = &p->grid;
+	c->y = c->x = 0;
+	pen_reset(&c->pen);
+
+	luaL_newmetatable(ws, CANVAS_META);
+	luaL_newlib(ws, curses_canvas_fns);
+#define CANVAS_ATTR(_a)	(lua_pushinteger(ws, _a), lua_setfield(ws, -2, #_a))
+	CANVAS_ATTR(A_NORMAL);
+	CANVAS_ATTR(A_BOLD);
+	CANVAS_ATTR(A_DIM);
+	CANVAS_ATTR(A_ITALIC);
+	CANVAS_ATTR(A_UNDERLINE);
+	CANVAS_ATTR(A_BLINK);
+	CANVAS_ATTR(A_REVERSE);
+	CANVAS_ATTR(A_STANDOUT);
+#undef CANVAS_ATTR
+	lua_setfield(ws, -2, "__index");
+	lua_setmetatable(ws, -2);
+
+	p->canvas = c;
+	p->cref = luaL_ref(ws, LUA_REGISTRYINDEX);
+}
+
+
+/* ======= *
+ * Panes.  *
+ * ======= */
+
+static lc_pane *
+checkpane(lua_State *L, int narg)
+{
+	lc_pane *p = (lc_pane *) luaL_checkudata(L, narg, PANE_META);
+	if (p->ws == NULL)
+		luaL_argerror(L, narg, "attempt to use closed pane");
+	return p;
+}
+
+/*
+** Copy the value at idx of from onto the stack of to; returns 0, or -1
+** if it holds something which cannot be copied, leaving the stack of
+** to for the caller to reset.
+*/
+static int
+xcopy(lua_State *from, int idx, lua_State *to, int depth)
+{
+	size_t len;
+	const char *s;
+
+	if (!lua_checkstack(to, 3))
+		return -1;
+	switch (lua_type(from, idx))
+	{
+	case LUA_TNIL:
+		lua_pushnil(to);
+		return 0;
+	case LUA_TBOOLEAN:
+		lua_pushboolean(to, lua_toboolean(from, idx));
+		return 0;
+	case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+		if (lua_isinteger(from, idx))
+		{
+			lua_pushinteger(to, lua_tointeger(from, idx));
+			return 0;
+		}
+#endif
+		lua_pushnumber(to, lua_tonumber(from, idx));
+		return 0;
+	case LUA_TSTRING:
+		s = lua_tolstring(from, idx, &len);
+		lua_pushlstring(to, s, len);
+		return 0;
+	case LUA_TTABLE:
+		if (depth >= WORKERS_MAXDEPTH || !lua_checkstack(from, 3))
+			return -1;
+		idx = lua_absindex(from, idx);
+		lua_newtable(to);
+		for (lua_pushnil(from); lua_next(from, idx) != 0; lua_pop(from, 1))
+		{
+			if (xcopy(from, -2, to, depth + 1) != 0
+				|| xcopy(from, -1, to, depth + 1) != 0)
+			{
+				lua_pop(from, 2);
+				return -1;
+			}
+			lua_rawset(to, -3);
+		}
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* job for the pool: run the render function of a pane */
+static void
+pane_job(void *ctx, int i)
+{
+	lc_pane *p = ((lc_pane **) ctx)[i];
+	p->status = lua_pcall(p->ws, p->nargs + 1, 0, 0);
+}
+
+/*
+** Copy the rows of the grid that changed into w; returns the number of
+** rows copied, or -1 when out of memory.
+*/
+static int
+pane_blit(lc_pane *p, WINDOW *w, int all)
+{
+	int y, n = 0, wlines = getmaxy(w);
+	lc_pencache cache = LC_PENCACHE_INIT;
+
+	if (p->target != w || p->tlines != wlines || p->tcols != getmaxx(w)
+		|| !p->buf)
+	{
+		cchar_t *buf = realloc(p->buf, p->grid.ncols * sizeof *buf);
+		if (!buf)
+			return -1;
+		p->buf = buf;
+		p->target = w;
+		p->tlines = wlines;
+		p->tcols = getmaxx(w);
+		all = 1;
+	}
+	for (y = 0; y < p->grid.nlines && y < wlines; y++)
+		if (all || p->grid.dirty[y])
+		{
+			grid_render_row(&p->grid, y, w, y, 0, &cache, p->buf);
+			p->grid.dirty[y] = 0;
+			n++;
+		}
+	if (all && p->grid.nlines < wlines)
+	{
+		wmove(w, p->grid.nlines, 0);
+		wclrtobot(w);
+	}
+	return n;
+}
+
+
+static void
+pane_free(lc_pane *p)
+{
+	if (p->ws)
+		lua_close(p->ws);
+	p->ws = NULL;
+	grid_free(&p->grid);
+	free(p->buf);
+	p->buf = NULL;
+}
+
+
+/***
+Copy the grid of the pane into a window.
+Only rows which changed since the previous blit are copied, unless the
+target window or its size changed, or *all* is true.  @{render} does
+this for every pane it runs.
+@function blit
+@tparam curses.window win target window
+@bool[opt=false] all copy every row
+@treturn int number of rows copied
+*/
+static int
+Nblit(lua_State *L)
+{
+	lc_pane *p = checkpane(L, 1);
+	int n = pane_blit(p, checkwin(L, 2), lua_toboolean(L, 3));
+	if (n < 0)
+		return luaL_error(L, "malloc failed");
+	return pushintresult(n);
+}
+
+
+/***
+Change the size of the grid of the pane, keeping its top left corner.
+@function resize
+@int lines number of lines
+@int cols number of columns
+*/
+static int
+Nresize(lua_State *L)
+{
+	lc_pane *p = checkpane(L, 1);
+	int nlines = checkint(L, 2);
+	int ncols = checkint(L, 3);
+
+	luaL_argcheck(L, nlines > 0, 2, "lines should > 0");
+	luaL_argcheck(L, ncols > 0, 3, "cols should > 0");
+	if (grid_resize(&p->grid, nlines, ncols) != 0)
+		return luaL_error(L, "malloc failed");
+	if (p->canvas->y >= nlines)
+		p->canvas->y = nlines - 1;
+	if (p->canvas->x > ncols)
+		p->canvas->x = ncols;
+	p->target = NULL;
+	return 0;
+}
+
+
+/***
+Size of the grid of the pane.
+@function size
+@treturn int number of lines
+@treturn int number of columns
+*/
+static int
+Nsize(lua_State *L)
+{
+	lc_pane *p = checkpane(L, 1);
+	lua_pushinteger(L, p->grid.nlines);
+	lua_pushinteger(L, p->grid.ncols);
+	return 2;
+}
+
+
+/***
+Close the Lua state of the pane and free its grid.
+@function close
+*/
+static int
+Nclose(lua_State *L)
+{
+	pane_free((lc_pane *) luaL_checkudata(L, 1, PANE_META));
+	return 0;
+}
+
+
+static const luaL_Reg curses_pane_fns[] =
+{
+	LCURSES_FUNC( Nblit		),
+	LCURSES_FUNC( Nclose		),
+	LCURSES_FUNC( Nresize		),
+	LCURSES_FUNC( Nsize		),
+	{"__gc",     Nclose		},
+	{ NULL, NULL }
+};
+
+
+/* ========= *
+ * Workers.  *
+ * ========= */
+
+static lc_workers *
+checkworkers(lua_State *L, int narg)
+{
+	lc_workers *k = (lc_workers *) luaL_checkudata(L, narg, WORKERS_META);
+	if (!k->pooled)
+		luaL_argerror(L, narg, "attempt to use closed workers");
+	return k;
+}
+
+
+/***
+Create a pool of worker threads.
+@function new
+@int[opt] nthreads number of threads, by default one per processor
+@treturn workers a new pool
+*/
+static int
+Knew(lua_State *L)
+{
+	int nthreads = optint(L, 1, pool_ncpus());
+	lc_workers *k;
+
+	luaL_argcheck(L, nthreads > 0, 1, "nthreads should > 0");
+	k = lua_newuserdata(L, sizeof *k);
+	k->pooled = 0;
+	luaL_setmetatable(L, WORKERS_META);
+	if (pool_init(&k->pool, nthreads) != 0)
+		return luaL_error(L, "cannot start worker threads");
+	k->pooled = 1;
+	return 1;
+}
+
+
+/***
+Create a pane.
+*chunk* is loaded into a new Lua state and run once; it must return
+the render function of the pane, which is called by @{render} with the
+canvas of the pane followed by the arguments of its job.
+@function pane
+@int lines number of lines of the grid
+@int cols number of columns of the grid
+@string chunk Lua source, or a chunk from `string.dump` of a function
+  without upvalues
+@string[opt="=pane"] chunkname name of the chunk in error messages
+@treturn pane a new pane
+*/
+static int
+Kpane(lua_State *L)
+{
+	int nlines = checkint(L, 2);
+	int ncols = checkint(L, 3);
+	size_t len;
+	const char *chunk = luaL_checklstring(L, 4, &len);
+	const char *name = optstring(L, 5, "=pane");
+	lc_pane *p;
+	lua_State *ws;
+
+	checkworkers(L, 1);
+	luaL_argcheck(L, nlines > 0, 2, "lines should > 0");
+	luaL_argcheck(L, ncols > 0, 3, "cols should > 0");
+
+	p = lua_newuserdata(L, sizeof *p);
+	memset(p, 0, sizeof *p);
+	luaL_setmetatable(L, PANE_META);
+	if (grid_init(&p->grid, nlines, ncols) != 0)
+		return luaL_error(L, "malloc failed");
+	if (!(ws = p->ws = luaL_newstate()))
+		return luaL_error(L, "cannot create Lua state");
+	luaL_openlibs(ws);
+	newcanvas(ws, p);
+
+	if (luaL_loadbuffer(ws, chunk, len, name) != 0
+		|| lua_pcall(ws, 0, 1, 0) != 0
+		|| (lua_type(ws, -1) != LUA_TFUNCTION
+			&& (lua_pushliteral(ws, "chunk did not return a function"), 1)))
+	{
+		lua_pushstring(L, lua_tostring(ws, -1));
+		pane_free(p);
+		return lua_error(L);
+	}
+	p->fn = luaL_ref(ws, LUA_REGISTRYINDEX);
+	return 1;
+}
+
+
+/***
+Run the render functions of panes in parallel and show the results.
+Every job is a table `{pane, win, ...}`: the render function of *pane*
+is called with its canvas and the remaining elements of the job.  Once
+all of them returned, the grids are copied into their windows on the
+calling thread, each window is marked for refresh with
+@{curses.window:noutrefresh}, and the screen is updated with a single
+@{curses.doupdate}.  A pane may appear only once.
+@function render
+@tparam table jobs list of jobs
+@treturn bool `true` if every render function succeeded
+@treturn[opt] table the error messages of failed jobs, by job index;
+  their windows are left as they were
+*/
+static int
+Krender(lua_State *L)
+{
+	lc_workers *k = checkworkers(L, 1);
+	int n, i, j, failed = 0;
+	lc_pane **panes;
+	WINDOW **wins;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	n = (int) lua_rawlen(L, 2);
+	panes = lua_newuserdata(L, n * (sizeof *panes + sizeof *wins) + 1);
+	wins = (WINDOW **) (panes + n);
+
+	for (i = 0; i < n; i++)
+	{
+		lc_pane *p;
+
+		lua_rawgeti(L, 2, i + 1);
+		if (lua_type(L, -1) != LUA_TTABLE)
+			return luaL_error(L, "job %d is not a table", i + 1);
+		lua_rawgeti(L, -1, 1);
+		p = (lc_pane *) luaL_testudata(L, -1, PANE_META);
+		if (!p || !p->ws)
+			return luaL_error(L, "job %d has no open pane", i + 1);
+		lua_rawgeti(L, -2, 2);
+		wins[i] = *(WINDOW **) luaL_checkudata(L, -1, WINDOWMETA);
+		if (!wins[i])
+			return luaL_error(L, "job %d has a closed window", i + 1);
+		for (j = 0; j < i; j++)
+			if (panes[j] == p)
+				return luaL_error(L, "pane of job %d is used twice", i + 1);
+		panes[i] = p;
+		lua_pop(L, 2);
+
+		/* render function, canvas, arguments */
+		lua_settop(p->ws, 0);
+		lua_rawgeti(p->ws, LUA_REGISTRYINDEX, p->fn);
+		lua_rawgeti(p->ws, LUA_REGISTRYINDEX, p->cref);
+		p->nargs = (int) lua_rawlen(L, -1) - 2;
+		if (p->nargs < 0)
+			p->nargs = 0;
+		for (j = 0; j < p->nargs; j++)
+		{
+			lua_rawgeti(L, -1, j + 3);
+			if (xcopy(L, -1, p->ws, 0) != 0)
+			{
+				lua_settop(p->ws, 0);
+				return luaL_error(L, "argument %d of job %d cannot be copied",
+					j + 1, i + 1);
+			}
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	pool_run(&k->pool, pane_job, panes, n);
+
+	for (i = 0; i < n; i++)
+		if (panes[i]->status != 0)
+		{
+			if (!failed++)
+				lua_newtable(L);
+			lua_pushstring(L, lua_tostring(panes[i]->ws, -1));
+			lua_rawseti(L, -2, i + 1);
+			lua_settop(panes[i]->ws, 0);
+		}
+		else
+		{
+			if (pane_blit(panes[i], wins[i], 0) < 0)
+				return luaL_error(L, "malloc failed");
+			wnoutrefresh(wins[i]);
+		}
+	doupdate();
+	mr_sync_all();
+
+	lua_pushboolean(L, !failed);
+	if (failed)
+		lua_insert(L, -2);
+	return failed ? 2 : 1;
+}
+
+
+/***
+Stop the worker threads.
+Panes stay usable with other pools.
+@function close
+*/
+static int
+Kclose(lua_State *L)
+{
+	lc_workers *k = (lc_workers *) luaL_checkudata(L, 1, WORKERS_META);
+	if (k->pooled)
+		pool_free(&k->pool);
+	k->pooled = 0;
+	return 0;
+}
+
+
+static const luaL_Reg curses_workers_fns[] =
+{
+	LCURSES_FUNC( Kclose		),
+	LCURSES_FUNC( Knew		),
+	LCURSES_FUNC( Kpane		),
+	LCURSES_FUNC( Krender		),
+	{"__gc",     Kclose		},
+	{ NULL, NULL }
+};
+
+
+LUALIB_API int
+luaopen_curses_workers(lua_State *L)
+{
+	int t, mt;
+
+	luaL_newlib(L, curses_workers_fns);
+	t = lua_gettop(L);
+
+	luaL_newmetatable(L, WORKERS_META);
+	mt = lua_gettop(L);
+
+	lua_pushvalue(L, mt);
+	lua_setfield(L, mt, "__index");		/* mt.__index = mt */
+	lua_pushliteral(L, "CursesWorkers");
+	lua_setfield(L, mt, "_type");		/* mt._type = "CursesWorkers" */
+
+	/* for k,v in pairs(t) do mt[k]=v end */
+	for (lua_pushnil(L); lua_next(L, t) != 0;)
+		lua_setfield(L, mt, lua_tostring(L, -2));
+
+	lua_pop(L, 1);				/* pop mt */
+
+	/* panes have a metatable of their own */
+	luaL_newmetatable(L, PANE_META);
+	luaL_setfuncs(L, curses_pane_fns, 0);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pushliteral(L, "CursesPane");
+	lua_setfield(L, -2, "_type");
+	lua_pop(L, 1);
+
+	/* t.version = "curses.workers..." */
+	lua_pushliteral(L, "curses.workers for " LUA_VERSION " / " PACKAGE_STRING);
+	lua_setfield(L, t, "version");
+
+	return 1;
+}
+
+#endif /*!LCURSES_WORKERS_C*/
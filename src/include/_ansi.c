@@ -0,0 +1,673 @@
+/*
+ * ANSI/ECMA-48 escape sequence parsing for lcurses.
+ *
+ * A table-driven parser in the style of Paul Williams' DEC-compatible
+ * state machine, plus an SGR interpreter that tracks a terminal
+ * independent "pen" and maps it onto curses attributes and color pairs.
+ */
+
+#ifndef LCURSES__ANSI_C
+#define LCURSES__ANSI_C 1
+
+#include <pthread.h>
+
+#include "_helpers.c"
+
+
+/* ================= *
+ * Escape sequences. *
+ * ================= */
+
+#define LC_VT_MAXPARAMS		32
+#define LC_VT_MAXINTER		2
+#define LC_VT_MAXOSC		256
+#define LC_VT_PRINTBUF		256
+
+/* parser states */
+enum {
+	VT_GROUND, VT_ESCAPE, VT_ESC_INTER, VT_CSI_ENTRY, VT_CSI_PARAM,
+	VT_CSI_INTER, VT_CSI_IGNORE, VT_OSC, VT_STRING, VT_NSTATES
+};
+
+/* byte classes */
+enum {
+	VC_C0, VC_BEL, VC_CANSUB, VC_ESC, VC_INTER, VC_DIGIT, VC_SEP,
+	VC_PRIV, VC_LBRACKET, VC_RBRACKET, VC_DCS, VC_STRSTART, VC_FINAL,
+	VC_DEL, VC_HIGH, VC_NCLASSES
+};
+
+/* actions */
+enum {
+	VA_NONE, VA_PRINT, VA_EXECUTE, VA_CLEAR, VA_COLLECT, VA_PARAM,
+	VA_ESC_DISPATCH, VA_CSI_DISPATCH, VA_OSC_START, VA_OSC_PUT,
+	VA_OSC_END, VA_OSC_END_ESC
+};
+
+#define VT_(a, s)	((unsigned char)(((a) << 4) | (s)))
+#define VT_ACTION(t)	((t) >> 4)
+#define VT_STATE(t)	((t) & 0x0f)
+
+static unsigned char vt_class[256];
+static pthread_once_t vt_class_once = PTHREAD_ONCE_INIT;
+
+/* transition table, indexed by [state][byte class] */
+static const unsigned char vt_table[VT_NSTATES][VC_NCLASSES] =
+{
+	/* VT_GROUND */
+	{ VT_(VA_EXECUTE, VT_GROUND), VT_(VA_EXECUTE, VT_GROUND),
+	  VT_(VA_EXECUTE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_PRINT, VT_GROUND), VT_(VA_PRINT, VT_GROUND),
+	  VT_(VA_PRINT, VT_GROUND), VT_(VA_PRINT, VT_GROUND),
+	  VT_(VA_PRINT, VT_GROUND), VT_(VA_PRINT, VT_GROUND),
+	  VT_(VA_PRINT, VT_GROUND), VT_(VA_PRINT, VT_GROUND),
+	  VT_(VA_PRINT, VT_GROUND), VT_(VA_NONE, VT_GROUND),
+	  VT_(VA_PRINT, VT_GROUND) },
+	/* VT_ESCAPE */
+	{ VT_(VA_EXECUTE, VT_ESCAPE), VT_(VA_EXECUTE, VT_ESCAPE),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_COLLECT, VT_ESC_INTER), VT_(VA_ESC_DISPATCH, VT_GROUND),
+	  VT_(VA_ESC_DISPATCH, VT_GROUND), VT_(VA_ESC_DISPATCH, VT_GROUND),
+	  VT_(VA_CLEAR, VT_CSI_ENTRY), VT_(VA_OSC_START, VT_OSC),
+	  VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_STRING),
+	  VT_(VA_ESC_DISPATCH, VT_GROUND), VT_(VA_NONE, VT_ESCAPE),
+	  VT_(VA_NONE, VT_GROUND) },
+	/* VT_ESC_INTER */
+	{ VT_(VA_EXECUTE, VT_ESC_INTER), VT_(VA_EXECUTE, VT_ESC_INTER),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_COLLECT, VT_ESC_INTER), VT_(VA_ESC_DISPATCH, VT_GROUND),
+	  VT_(VA_ESC_DISPATCH, VT_GROUND), VT_(VA_ESC_DISPATCH, VT_GROUND),
+	  VT_(VA_ESC_DISPATCH, VT_GROUND), VT_(VA_ESC_DISPATCH, VT_GROUND),
+	  VT_(VA_ESC_DISPATCH, VT_GROUND), VT_(VA_ESC_DISPATCH, VT_GROUND),
+	  VT_(VA_ESC_DISPATCH, VT_GROUND), VT_(VA_NONE, VT_ESC_INTER),
+	  VT_(VA_NONE, VT_GROUND) },
+	/* VT_CSI_ENTRY */
+	{ VT_(VA_EXECUTE, VT_CSI_ENTRY), VT_(VA_EXECUTE, VT_CSI_ENTRY),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_COLLECT, VT_CSI_INTER), VT_(VA_PARAM, VT_CSI_PARAM),
+	  VT_(VA_PARAM, VT_CSI_PARAM), VT_(VA_COLLECT, VT_CSI_PARAM),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_CSI_DISPATCH, VT_GROUND),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_CSI_DISPATCH, VT_GROUND),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_NONE, VT_CSI_ENTRY),
+	  VT_(VA_NONE, VT_CSI_IGNORE) },
+	/* VT_CSI_PARAM */
+	{ VT_(VA_EXECUTE, VT_CSI_PARAM), VT_(VA_EXECUTE, VT_CSI_PARAM),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_COLLECT, VT_CSI_INTER), VT_(VA_PARAM, VT_CSI_PARAM),
+	  VT_(VA_PARAM, VT_CSI_PARAM), VT_(VA_NONE, VT_CSI_IGNORE),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_CSI_DISPATCH, VT_GROUND),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_CSI_DISPATCH, VT_GROUND),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_NONE, VT_CSI_PARAM),
+	  VT_(VA_NONE, VT_CSI_IGNORE) },
+	/* VT_CSI_INTER */
+	{ VT_(VA_EXECUTE, VT_CSI_INTER), VT_(VA_EXECUTE, VT_CSI_INTER),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_COLLECT, VT_CSI_INTER), VT_(VA_NONE, VT_CSI_IGNORE),
+	  VT_(VA_NONE, VT_CSI_IGNORE), VT_(VA_NONE, VT_CSI_IGNORE),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_CSI_DISPATCH, VT_GROUND),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_CSI_DISPATCH, VT_GROUND),
+	  VT_(VA_CSI_DISPATCH, VT_GROUND), VT_(VA_NONE, VT_CSI_INTER),
+	  VT_(VA_NONE, VT_CSI_IGNORE) },
+	/* VT_CSI_IGNORE */
+	{ VT_(VA_EXECUTE, VT_CSI_IGNORE), VT_(VA_EXECUTE, VT_CSI_IGNORE),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_NONE, VT_CSI_IGNORE), VT_(VA_NONE, VT_CSI_IGNORE),
+	  VT_(VA_NONE, VT_CSI_IGNORE), VT_(VA_NONE, VT_CSI_IGNORE),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_NONE, VT_GROUND),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_NONE, VT_GROUND),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_NONE, VT_CSI_IGNORE),
+	  VT_(VA_NONE, VT_CSI_IGNORE) },
+	/* VT_OSC */
+	{ VT_(VA_NONE, VT_OSC), VT_(VA_OSC_END, VT_GROUND),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_OSC_END_ESC, VT_ESCAPE),
+	  VT_(VA_OSC_PUT, VT_OSC), VT_(VA_OSC_PUT, VT_OSC),
+	  VT_(VA_OSC_PUT, VT_OSC), VT_(VA_OSC_PUT, VT_OSC),
+	  VT_(VA_OSC_PUT, VT_OSC), VT_(VA_OSC_PUT, VT_OSC),
+	  VT_(VA_OSC_PUT, VT_OSC), VT_(VA_OSC_PUT, VT_OSC),
+	  VT_(VA_OSC_PUT, VT_OSC), VT_(VA_NONE, VT_OSC),
+	  VT_(VA_OSC_PUT, VT_OSC) },
+	/* VT_STRING: DCS, SOS, PM and APC payloads are swallowed */
+	{ VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_GROUND),
+	  VT_(VA_NONE, VT_GROUND), VT_(VA_CLEAR, VT_ESCAPE),
+	  VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_STRING),
+	  VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_STRING),
+	  VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_STRING),
+	  VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_STRING),
+	  VT_(VA_NONE, VT_STRING), VT_(VA_NONE, VT_STRING),
+	  VT_(VA_NONE, VT_STRING) },
+};
+
+static void
+vt_init_classes(void)
+{
+	int c;
+
+	for (c = 0x00; c < 0x20; c++)	vt_class[c] = VC_C0;
+	for (c = 0x20; c < 0x30; c++)	vt_class[c] = VC_INTER;
+	for (c = 0x30; c < 0x3a; c++)	vt_class[c] = VC_DIGIT;
+	for (c = 0x3c; c < 0x40; c++)	vt_class[c] = VC_PRIV;
+	for (c = 0x40; c < 0x7f; c++)	vt_class[c] = VC_FINAL;
+	for (c = 0x80; c < 0x100; c++)	vt_class[c] = VC_HIGH;
+	vt_class[0x07] = VC_BEL;
+	vt_class[0x18] = vt_class[0x1a] = VC_CANSUB;
+	vt_class[':'] = vt_class[';'] = VC_SEP;
+	vt_class['['] = VC_LBRACKET;
+	vt_class[']'] = VC_RBRACKET;
+	vt_class['P'] = VC_DCS;
+	vt_class['X'] = vt_class['^'] = vt_class['_'] = VC_STRSTART;
+	vt_class[0x7f] = VC_DEL;
+	vt_class[0x1b] = VC_ESC;
+}
+
+
+struct lc_vtparser;
+
+typedef struct lc_vtops {
+	/* a run of decoded code points in the ground state */
+	void (*print)(void *ud, const int *cps, size_t n);
+	/* a C0 control character */
+	void (*execute)(void *ud, int c);
+	void (*esc)(void *ud, const struct lc_vtparser *p, int final);
+	void (*csi)(void *ud, const struct lc_vtparser *p, int final);
+	/* optional, operating system command payload */
+	void (*osc)(void *ud, const char *s, size_t n);
+} lc_vtops;
+
+typedef struct lc_vtparser {
+	int state;
+	int nparams;
+	int params[LC_VT_MAXPARAMS];
+	/* bit i set when params[i] is a ':' separated sub-parameter */
+	unsigned int subparams;
+	int ninter;
+	char inter[LC_VT_MAXINTER];
+	char priv;
+	/* partially decoded UTF-8 sequence */
+	int cp, need;
+	size_t nosc;
+	char osc[LC_VT_MAXOSC];
+	const lc_vtops *ops;
+	void *ud;
+} lc_vtparser;
+
+
+static void
+vt_init(lc_vtparser *p, const lc_vtops *ops, void *ud)
+{
+	/* parsers are set up on worker threads too */
+	pthread_once(&vt_class_once, vt_init_classes);
+	memset(p, 0, sizeof *p);
+	p->state = VT_GROUND;
+	p->ops = ops;
+	p->ud = ud;
+}
+
+static void
+vt_clear(lc_vtparser *p)
+{
+	p->nparams = 0;
+	p->params[0] = 0;
+	p->subparams = 0;
+	p->ninter = 0;
+	p->priv = 0;
+}
+
+/* number of the leading parameter, or def if it was omitted or zero */
+static int
+vt_param(const lc_vtparser *p, int i, int def)
+{
+	if (i >= p->nparams || p->params[i] == 0)
+		return def;
+	return p->params[i];
+}
+
+
+/*
+** Feed n bytes through the parser.  Returns the offset of the first byte
+** of a sequence left incomplete at the end of the buffer, or n when the
+** buffer ended in the ground state; the parser itself remembers the
+** partial state, so streaming callers may ignore the result.
+*/
+static size_t
+vt_feed(lc_vtparser *p, const char *str, size_t n)
+{
+	const unsigned char *s = (const unsigned char *) str;
+	const unsigned char *end = s + n;
+	const unsigned char *seq = s;	/* start of the incomplete tail */
+	int buf[LC_VT_PRINTBUF];
+	size_t nbuf = 0;
+
+#define VT_FLUSH() LCURSES_STMT_BEG {				\
+		if (nbuf) p->ops->print(p->ud, buf, nbuf);	\
+		nbuf = 0;					\
+	} LCURSES_STMT_END
+
+	while (s < end)
+	{
+		unsigned int c = *s;
+
+		/* fast path: printable text and UTF-8 in the ground state */
+		if (p->state == VT_GROUND && (c >= 0x20 && c != 0x7f))
+		{
+			if (p->need == 0)
+			{
+				if (c < 0x80)
+				{
+					buf[nbuf++] = c;
+				}
+				else if (c >= 0xc2 && c <= 0xf4)
+				{
+					seq = s;
+					p->need = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+					p->cp = c & (0x3f >> p->need);
+				}
+				else
+					buf[nbuf++] = 0xfffd;
+			}
+			/* overlong forms: E0 takes A0 and up next, F0 takes 90 */
+			else if ((c & 0xc0) == 0x80
+				&& !(p->cp == 0 && c < (p->need == 3 ? 0x90 : 0xa0)))
+			{
+				p->cp = (p->cp << 6) | (c & 0x3f);
+				if (--p->need == 0)
+				{
+					if (p->cp > MAXUNICODE || (p->cp >= 0xd800 && p->cp < 0xe000))
+						p->cp = 0xfffd;
+					buf[nbuf++] = p->cp;
+				}
+			}
+			else
+			{
+				/* truncated or overlong: replace and reprocess c */
+				p->need = 0;
+				buf[nbuf++] = 0xfffd;
+				if (nbuf == LC_VT_PRINTBUF) VT_FLUSH();
+				continue;
+			}
+			s++;
+			if (nbuf == LC_VT_PRINTBUF) VT_FLUSH();
+			continue;
+		}
+
+		if (p->need)
+		{
+			p->need = 0;
+			buf[nbuf++] = 0xfffd;
+		}
+		VT_FLUSH();
+
+		{
+			unsigned char t = vt_table[p->state][vt_class[c]];
+			if (p->state == VT_GROUND && VT_STATE(t) != VT_GROUND)
+				seq = s;
+
+			switch (VT_ACTION(t))
+			{
+			case VA_EXECUTE:
+				p->ops->execute(p->ud, c);
+				break;
+			case VA_CLEAR:
+				vt_clear(p);
+				break;
+			case VA_COLLECT:
+				if (vt_class[c] == VC_PRIV)
+					p->priv = c;
+				else if (p->ninter < LC_VT_MAXINTER)
+					p->inter[p->ninter++] = c;
+				break;
+			case VA_PARAM:
+				if (p->nparams == 0)
+					p->nparams = 1;
+				if (vt_class[c] == VC_SEP)
+				{
+					if (p->nparams < LC_VT_MAXPARAMS)
+					{
+						if (c == ':')
+							p->subparams |= 1u << p->nparams;
+						p->params[p->nparams++] = 0;
+					}
+				}
+				else if (p->params[p->nparams - 1] < 100000)
+					p->params[p->nparams - 1] =
+						p->params[p->nparams - 1] * 10 + (c - '0');
+				break;
+			case VA_ESC_DISPATCH:
+				p->ops->esc(p->ud, p, c);
+				break;
+			case VA_CSI_DISPATCH:
+				p->ops->csi(p->ud, p, c);
+				break;
+			case VA_OSC_START:
+				p->nosc = 0;
+				break;
+			case VA_OSC_PUT:
+				if (p->nosc < LC_VT_MAXOSC)
+					p->osc[p->nosc++] = c;
+				break;
+			case VA_OSC_END:
+			case VA_OSC_END_ESC:
+				if (p->ops->osc)
+					p->ops->osc(p->ud, p->osc, p->nosc);
+				if (VT_ACTION(t) == VA_OSC_END_ESC)
+					vt_clear(p);
+				break;
+			}
+			p->state = VT_STATE(t);
+		}
+		s++;
+	}
+	VT_FLUSH();
+#undef VT_FLUSH
+
+	if (p->state == VT_GROUND && p->need == 0)
+		return n;
+	return (size_t) ((const char *) seq - str);
+}
+
+
+/* ================ *
+ * SGR and the pen. *
+ * ================ */
+
+/* pen colors: LC_COLOR_DEFAULT, an indexed color 0..255, or 24-bit RGB */
+#define LC_COLOR_DEFAULT	(-1)
+#define LC_COLOR_RGB		0x1000000
+#define LC_RGB(r, g, b)		(LC_COLOR_RGB | ((r) << 16) | ((g) << 8) | (b))
+
+#ifndef A_ITALIC
+#  define A_ITALIC	A_NORMAL
+#endif
+
+typedef struct lc_pen {
+	attr_t attrs;
+	int fg, bg;
+} lc_pen;
+
+static void
+pen_reset(lc_pen *pen)
+{
+	pen->attrs = A_NORMAL;
+	pen->fg = pen->bg = LC_COLOR_DEFAULT;
+}
+
+/* attribute changes for SGR 0..29, indexed by parameter */
+static const struct { attr_t on, off; } sgr_attrs[30] =
+{
+	/*  0 */ { 0, 0 },
+	/*  1 */ { A_BOLD, 0 },
+	/*  2 */ { A_DIM, 0 },
+	/*  3 */ { A_ITALIC, 0 },
+	/*  4 */ { A_UNDERLINE, 0 },
+	/*  5 */ { A_BLINK, 0 },
+	/*  6 */ { A_BLINK, 0 },
+	/*  7 */ { A_REVERSE, 0 },
+	/*  8 */ { A_INVIS, 0 },
+	/*  9 */ { 0, 0 },
+	/* 10 */ { 0, 0 },
+	/* 11 */ { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	/* 15 */ { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	/* 20 */ { 0, 0 },
+	/* 21 */ { A_UNDERLINE, 0 },
+	/* 22 */ { 0, A_BOLD | A_DIM },
+	/* 23 */ { 0, A_ITALIC },
+	/* 24 */ { 0, A_UNDERLINE },
+	/* 25 */ { 0, A_BLINK },
+	/* 26 */ { 0, 0 },
+	/* 27 */ { 0, A_REVERSE },
+	/* 28 */ { 0, A_INVIS },
+	/* 29 */ { 0, 0 },
+};
+
+/*
+** Parse an extended color (38/48/58) starting at params[i], which holds
+** the 38; returns the index of the last parameter consumed.
+*/
+static int
+sgr_extcolor(const lc_vtparser *p, int i, int *color)
+{
+	const int *a = p->params;
+	int n = p->nparams;
+	int sub = (p->subparams >> (i + 1)) & 1;
+
+	if (i + 1 >= n)
+		return i;
+	if (sub)
+	{
+		/* 38:5:n, 38:2:r:g:b or 38:2:cs:r:g:b */
+		int last = i + 1;
+		while (last + 1 < n && ((p->subparams >> (last + 1)) & 1))
+			last++;
+		if (a[i + 1] == 5 && last >= i + 2)
+			*color = a[i + 2] & 0xff;
+		else if (a[i + 1] == 2 && last >= i + 4)
+		{
+			int k = last - 2;
+			*color = LC_RGB(a[k] & 0xff, a[k + 1] & 0xff, a[k + 2] & 0xff);
+		}
+		return last;
+	}
+	if (a[i + 1] == 5 && i + 2 < n)
+	{
+		*color = a[i + 2] & 0xff;
+		return i + 2;
+	}
+	if (a[i + 1] == 2 && i + 4 < n)
+	{
+		*color = LC_RGB(a[i + 2] & 0xff, a[i + 3] & 0xff, a[i + 4] & 0xff);
+		return i + 4;
+	}
+	return i + 1;
+}
+
+/* apply the parameters of a CSI ... m sequence to the pen */
+static void
+sgr_apply(lc_pen *pen, const lc_vtparser *p)
+{
+	int i, n = p->nparams ? p->nparams : 1;
+
+	for (i = 0; i < n; i++)
+	{
+		int a = p->params[i];
+
+		/* stray sub-parameters, e.g. the style in 4:3 */
+		if (i > 0 && ((p->subparams >> i) & 1))
+		{
+			if (p->params[i - 1] == 4 && a == 0)
+				pen->attrs &= ~A_UNDERLINE;
+			continue;
+		}
+
+		if (a == 0)
+			pen_reset(pen);
+		else if (a < 30)
+			pen->attrs = (pen->attrs & ~sgr_attrs[a].off) | sgr_attrs[a].on;
+		else if (a <= 37)
+			pen->fg = a - 30;
+		else if (a == 38)
+			i = sgr_extcolor(p, i, &pen->fg);
+		else if (a == 39)
+			pen->fg = LC_COLOR_DEFAULT;
+		else if (a <= 47)
+			pen->bg = a - 40;
+		else if (a == 48)
+			i = sgr_extcolor(p, i, &pen->bg);
+		else if (a == 49)
+			pen->bg = LC_COLOR_DEFAULT;
+		else if (a == 58)
+		{
+			int ignored;
+			i = sgr_extcolor(p, i, &ignored);
+		}
+		else if (a >= 90 && a <= 97)
+			pen->fg = a - 90 + 8;
+		else if (a >= 100 && a <= 107)
+			pen->bg = a - 100 + 8;
+	}
+}
+
+
+/* RGB value of an xterm 256 color palette entry */
+static int
+xterm_rgb(int c)
+{
+	static const unsigned char base[16][3] = {
+		{0,0,0}, {205,0,0}, {0,205,0}, {205,205,0},
+		{0,0,238}, {205,0,205}, {0,205,205}, {229,229,229},
+		{127,127,127}, {255,0,0}, {0,255,0}, {255,255,0},
+		{92,92,255}, {255,0,255}, {0,255,255}, {255,255,255},
+	};
+	static const unsigned char ramp[6] = {0, 95, 135, 175, 215, 255};
+
+	if (c < 16)
+		return (base[c][0] << 16) | (base[c][1] << 8) | base[c][2];
+	if (c < 232)
+	{
+		c -= 16;
+		return (ramp[c / 36] << 16) | (ramp[(c / 6) % 6] << 8) | ramp[c % 6];
+	}
+	c = 8 + (c - 232) * 10;
+	return (c << 16) | (c << 8) | c;
+}
+
+/* nearest of the first ncolors palette entries to an RGB value */
+static int
+nearest_color(int rgb, int ncolors)
+{
+	int r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+	int i, best = 0, bestd = INT_MAX;
+
+	if (ncolors >= 256)
+	{
+		/* closest cube entry and closest grey, no search needed */
+		static const unsigned char ramp[6] = {0, 95, 135, 175, 215, 255};
+		int ri = r < 48 ? 0 : r < 115 ? 1 : (r - 35) / 40;
+		int gi = g < 48 ? 0 : g < 115 ? 1 : (g - 35) / 40;
+		int bi = b < 48 ? 0 : b < 115 ? 1 : (b - 35) / 40;
+		int avg = (r + g + b) / 3;
+		int gr = avg > 238 ? 23 : avg < 8 ? 0 : (avg - 3) / 10;
+		int gv = 8 + gr * 10;
+		int dc = (ramp[ri] - r) * (ramp[ri] - r) + (ramp[gi] - g) * (ramp[gi] - g)
+			+ (ramp[bi] - b) * (ramp[bi] - b);
+		int dg = (gv - r) * (gv - r) + (gv - g) * (gv - g) + (gv - b) * (gv - b);
+		return dg < dc ? 232 + gr : 16 + 36 * ri + 6 * gi + bi;
+	}
+
+	for (i = 0; i < ncolors && i < 16; i++)
+	{
+		int c = xterm_rgb(i);
+		int dr = ((c >> 16) & 0xff) - r;
+		int dg = ((c >> 8) & 0xff) - g;
+		int db = (c & 0xff) - b;
+		int d = dr * dr + dg * dg + db * db;
+		if (d < bestd)
+		{
+			bestd = d;
+			best = i;
+		}
+	}
+	return best;
+}
+
+/*
+** Map a pen color onto a color number the terminal supports.  Bright
+** colors on 8 color terminals become their dark variant, with *bright
+** set so the caller can substitute A_BOLD for foregrounds.
+*/
+static int
+pen_color(int c, int *bright)
+{
+	int ncolors = COLORS;
+
+	*bright = 0;
+	if (c == LC_COLOR_DEFAULT)
+		return c;
+	if (c & LC_COLOR_RGB)
+	{
+		c &= 0xffffff;
+		if (ncolors >= 0x1000000)
+			return c;
+		return nearest_color(c, ncolors);
+	}
+	if (c < ncolors)
+		return c;
+	if (c >= 16)
+		c = nearest_color(xterm_rgb(c), ncolors < 16 ? 16 : ncolors);
+	if (c >= 8 && ncolors < 16)
+	{
+		*bright = 1;
+		c -= 8;
+	}
+	return c < ncolors ? c : 0;
+}
+
+/* Cache of the last pen color pair resolved by pen_render. */
+typedef struct lc_pencache {
+	int fg, bg;
+	int pair;
+	attr_t bold;
+} lc_pencache;
+
+#define LC_PENCACHE_INIT	{ LC_COLOR_DEFAULT - 1, LC_COLOR_DEFAULT - 1, 0, 0 }
+
+/*
+** Resolve a pen to curses attributes and a color pair number for the
+** current screen, allocating pairs on demand.
+*/
+static attr_t
+pen_render(const lc_pen *pen, lc_pencache *cache, int *pair)
+{
+	if (pen->fg != cache->fg || pen->bg != cache->bg)
+	{
+		cache->fg = pen->fg;
+		cache->bg = pen->bg;
+		cache->pair = 0;
+		cache->bold = 0;
+
+		if (COLOR_PAIRS > 0 && (pen->fg != LC_COLOR_DEFAULT || pen->bg != LC_COLOR_DEFAULT))
+		{
+			int fbright, bbright;
+			int f = pen_color(pen->fg, &fbright);
+			int b = pen_color(pen->bg, &bbright);
+			int p;
+
+			if (fbright)
+				cache->bold = A_BOLD;
+#if NCURSES_EXT_FUNCS >= 20180127
+			p = alloc_pair(f, b);
+			/* without use_default_colors, -1 is not a valid color */
+			if (p < 0)
+				p = alloc_pair(f < 0 ? COLOR_WHITE : f, b < 0 ? COLOR_BLACK : b);
+#else
+			p = 0;
+			if (f >= 0 && b >= 0 && f < 8 && b < 8 && COLOR_PAIRS > 64)
+				p = 1 + f + 8 * b, init_pair(p, f, b);
+#endif
+			cache->pair = p < 0 ? 0 : p;
+		}
+	}
+	*pair = cache->pair;
+	return pen->attrs | cache->bold;
+}
+
+/* Reconstruct a pen from a curses rendition. */
+static void
+pen_from_attr(lc_pen *pen, attr_t attrs, int pair)
+{
+	pen_reset(pen);
+	pen->attrs = attrs & (A_ATTRIBUTES & ~A_COLOR);
+	if (pair > 0)
+	{
+#if NCURSES_EXT_FUNCS >= 20180127
+		int f, b;
+		if (extended_pair_content(pair, &f, &b) == OK)
+#else
+		short f, b;
+		if (pair_content(pair, &f, &b) == OK)
+#endif
+		{
+			pen->fg = f;
+			pen->bg = b;
+		}
+	}
+}
+
+#endif /*LCURSES__ANSI_C*/
@@ -0,0 +1,56 @@
+/*
+ * Changed cells of curses windows for lcurses.
+ *
+ * For each line of a window, ncurses keeps the first and last column
+ * changed since the window was last copied to the virtual screen, and
+ * wnoutrefresh copies only that range.  touchline can only mark whole
+ * lines, so these helpers read and widen the range directly; struct
+ * ldat is private to ncurses, and is declared here as in its
+ * curses.priv.h, where it has not changed since ncurses 5.
+ */
+
+#ifndef LCURSES__DIRTY_C
+#define LCURSES__DIRTY_C 1
+
+#include "_helpers.c"
+
+
+struct ldat {
+	cchar_t *text;
+	NCURSES_SIZE_T firstchar;	/* _NOCHANGE if the line did not change */
+	NCURSES_SIZE_T lastchar;
+	NCURSES_SIZE_T oldindex;
+};
+
+
+/* the changed columns of line y of w; returns 0 if it did not change */
+static int
+dirty_get(WINDOW *w, int y, int *first, int *last)
+{
+	struct ldat *l = &w->_line[y];
+
+	if (l->firstchar == _NOCHANGE)
+		return 0;
+	*first = l->firstchar;
+	*last = l->lastchar;
+	return 1;
+}
+
+/* mark columns first..last of line y of w as changed */
+static void
+dirty_touch(WINDOW *w, int y, int first, int last)
+{
+	struct ldat *l = &w->_line[y];
+
+	/* a wide character cut by the range is copied whole */
+	if (first > 0)
+		first--;
+	if (last < getmaxx(w) - 1)
+		last++;
+	if (l->firstchar == _NOCHANGE || l->firstchar > first)
+		l->firstchar = first;
+	if (l->lastchar == _NOCHANGE || l->lastchar < last)
+		l->lastchar = last;
+}
+
+#endif /*!LCURSES__DIRTY_C*/
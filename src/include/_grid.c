@@ -0,0 +1,288 @@
+/*
+ * Terminal independent cell grids for lcurses.
+ *
+ * A grid holds characters together with an lc_pen rendition, so it can
+ * be filled without a curses screen and rendered onto any window later.
+ * Rows are kept as an array of pointers so that scrolling a region only
+ * rotates pointers, and every row has a dirty flag so that rendering
+ * can skip rows which did not change since the last time.
+ */
+
+#ifndef LCURSES__GRID_C
+#define LCURSES__GRID_C 1
+
+#include "_helpers.c"
+#include "_ansi.c"
+
+
+typedef struct lc_cell {
+	int ch;			/* 0 in the right half of a wide character */
+	int comb;		/* a combining character, or 0 */
+	lc_pen pen;
+} lc_cell;
+
+typedef struct lc_grid {
+	int nlines, ncols;
+	lc_cell **rows;
+	unsigned char *dirty;
+} lc_grid;
+
+
+static int
+pen_equal(const lc_pen *a, const lc_pen *b)
+{
+	return a->attrs == b->attrs && a->fg == b->fg && a->bg == b->bg;
+}
+
+/* a blank cell takes only the background color of the pen (BCE) */
+static void
+grid_blank(lc_cell *c, const lc_pen *pen)
+{
+	c->ch = ' ';
+	c->comb = 0;
+	c->pen.attrs = A_NORMAL;
+	c->pen.fg = LC_COLOR_DEFAULT;
+	c->pen.bg = pen ? pen->bg : LC_COLOR_DEFAULT;
+}
+
+static void
+grid_free(lc_grid *g)
+{
+	int y;
+
+	if (g->rows)
+		for (y = 0; y < g->nlines; y++)
+			free(g->rows[y]);
+	free(g->rows);
+	free(g->dirty);
+	g->rows = NULL;
+	g->dirty = NULL;
+	g->nlines = g->ncols = 0;
+}
+
+/* allocate a blank grid; returns 0, or -1 when out of memory */
+static int
+grid_init(lc_grid *g, int nlines, int ncols)
+{
+	int y, x;
+
+	g->nlines = nlines;
+	g->ncols = ncols;
+	g->rows = calloc(nlines, sizeof *g->rows);
+	g->dirty = malloc(nlines);
+	if (!g->rows || !g->dirty)
+		return grid_free(g), -1;
+	memset(g->dirty, 1, nlines);
+	for (y = 0; y < nlines; y++)
+	{
+		if (!(g->rows[y] = malloc(ncols * sizeof(lc_cell))))
+			return grid_free(g), -1;
+		for (x = 0; x < ncols; x++)
+			grid_blank(&g->rows[y][x], NULL);
+	}
+	return 0;
+}
+
+/*
+** Replace g by the blank grid n, of another size, keeping the top left
+** corner of the contents of g.
+*/
+static void
+grid_replace(lc_grid *g, lc_grid *n)
+{
+	int y, ncols = n->ncols;
+
+	for (y = 0; y < n->nlines && y < g->nlines; y++)
+		memcpy(n->rows[y], g->rows[y],
+			(ncols < g->ncols ? ncols : g->ncols) * sizeof(lc_cell));
+	/* do not leave half of a wide character at the right edge */
+	for (y = 0; y < n->nlines; y++)
+		if (ncols < g->ncols && y < g->nlines && g->rows[y][ncols].ch == 0)
+			grid_blank(&n->rows[y][ncols - 1], NULL);
+	grid_free(g);
+	*g = *n;
+}
+
+/*
+** Change the size of a grid, keeping the top left corner of its
+** contents; returns 0, or -1 when out of memory.
+*/
+static int
+grid_resize(lc_grid *g, int nlines, int ncols)
+{
+	lc_grid n;
+
+	if (grid_init(&n, nlines, ncols) != 0)
+		return -1;
+	grid_replace(g, &n);
+	return 0;
+}
+
+static void
+grid_touch(lc_grid *g, int y0, int y1)
+{
+	if (y0 <= y1)
+		memset(g->dirty + y0, 1, y1 - y0 + 1);
+}
+
+/* erase columns x0 up to but not including x1 of row y */
+static void
+grid_erase(lc_grid *g, int y, int x0, int x1, const lc_pen *pen)
+{
+	lc_cell *row = g->rows[y];
+
+	if (x1 > g->ncols)
+		x1 = g->ncols;
+	if (x0 >= x1)
+		return;
+	/* erasing half of a wide character erases all of it */
+	if (x0 > 0 && row[x0].ch == 0)
+		x0--;
+	if (x1 < g->ncols && row[x1].ch == 0)
+		x1++;
+	for (; x0 < x1; x0++)
+		grid_blank(&row[x0], pen);
+	g->dirty[y] = 1;
+}
+
+/*
+** Scroll rows top..bot up by n lines, or down when n is negative,
+** blanking the rows scrolled in.
+*/
+static void
+grid_scroll(lc_grid *g, int top, int bot, int n, const lc_pen *pen)
+{
+	int h = bot - top + 1;
+	int k, y;
+
+	if (h <= 0 || n == 0)
+		return;
+	k = n < 0 ? -n : n;
+	if (k > h)
+		k = h;
+	if (k < h)
+	{
+		/* rotate the row pointers, the k rows leaving come back in */
+		lc_cell *save[64], **tmp = save;
+		if (k > 64 && !(tmp = malloc(k * sizeof *tmp)))
+		{
+			k = h;		/* no memory: just blank the region */
+			goto blank;
+		}
+		if (n > 0)
+		{
+			memcpy(tmp, g->rows + top, k * sizeof *tmp);
+			memmove(g->rows + top, g->rows + top + k, (h - k) * sizeof *tmp);
+			memcpy(g->rows + bot - k + 1, tmp, k * sizeof *tmp);
+		}
+		else
+		{
+			memcpy(tmp, g->rows + bot - k + 1, k * sizeof *tmp);
+			memmove(g->rows + top + k, g->rows + top, (h - k) * sizeof *tmp);
+			memcpy(g->rows + top, tmp, k * sizeof *tmp);
+		}
+		if (tmp != save)
+			free(tmp);
+	}
+blank:
+	for (y = 0; y < k; y++)
+		grid_erase(g, n > 0 ? bot - y : top + y, 0, g->ncols, pen);
+	grid_touch(g, top, bot);
+}
+
+/*
+** Write character ch, of the given width, at row y and column x with
+** pen; width 0 attaches a combining character to the cell before x.
+** Returns the column after the character, or x if it did not fit.
+*/
+static int
+grid_put(lc_grid *g, int y, int x, int ch, int width, const lc_pen *pen)
+{
+	lc_cell *row = g->rows[y];
+
+	if (width == 0)
+	{
+		int c = x - 1;
+		if (c > 0 && c < g->ncols && row[c].ch == 0)
+			c--;
+		if (c >= 0 && c < g->ncols && !row[c].comb)
+		{
+			row[c].comb = ch;
+			g->dirty[y] = 1;
+		}
+		return x;
+	}
+	if (x < 0 || x + width > g->ncols)
+		return x;
+	/* overwriting half of a wide character erases the other half */
+	if (x > 0 && row[x].ch == 0)
+		grid_blank(&row[x - 1], pen);
+	if (x + width < g->ncols && row[x + width].ch == 0)
+		grid_blank(&row[x + width], pen);
+	row[x].ch = ch;
+	row[x].comb = 0;
+	row[x].pen = *pen;
+	if (width > 1)
+	{
+		row[x + 1].ch = 0;
+		row[x + 1].comb = 0;
+		row[x + 1].pen = *pen;
+	}
+	g->dirty[y] = 1;
+	return x + width;
+}
+
+
+/*
+** Copy row y of a grid into row wy of a window, starting at column wx,
+** converting cells with pen_render.  buf must have room for one cchar_t
+** per grid column.
+*/
+static void
+grid_render_row(const lc_grid *g, int y, WINDOW *w, int wy, int wx,
+	lc_pencache *cache, cchar_t *buf)
+{
+	const lc_cell *row = g->rows[y];
+	const lc_pen *last = NULL;
+	attr_t attrs = A_NORMAL;
+	int pair = 0;
+	int x, n = 0, width = getmaxx(w) - wx;
+
+	if (width > g->ncols)
+		width = g->ncols;
+	for (x = 0; x < width; x++)
+	{
+		const lc_cell *c = &row[x];
+		int ch = c->ch;
+
+		if (ch == 0)
+			continue;
+		/* a wide character cut by the right edge */
+		if (x + 1 < g->ncols && row[x + 1].ch == 0 && x + 1 >= width)
+			ch = ' ';
+		if (!last || !pen_equal(last, &c->pen))
+		{
+			last = &c->pen;
+			attrs = pen_render(last, cache, &pair);
+		}
+		setcchar_(&buf[n], ch, attrs, pair);
+		if (c->comb && CCHARW_MAX > 2)
+		{
+			buf[n].chars[1] = c->comb;
+			buf[n].chars[2] = L'\0';
+		}
+		n++;
+	}
+	if (n > 0)
+	{
+		wmove(w, wy, wx);
+		wadd_wchnstr(w, buf, n);
+	}
+	if (wx + width < getmaxx(w))
+	{
+		wmove(w, wy, wx + width);
+		wclrtoeol(w);
+	}
+}
+
+#endif /*LCURSES__GRID_C*/
@@ -13,6 +13,13 @@
 #ifndef LCURSES__HELPERS_C
 #define LCURSES__HELPERS_C 1
 
+/*
+** POSIX.1-2008 declarations, which -std=c99 hides: getline,
+** clock_gettime, posix_openpt and friends, and pthreads.
+*/
+#ifndef _XOPEN_SOURCE
+#  define _XOPEN_SOURCE 700
+#endif
 
 #include <errno.h>
 #include <grp.h>
@@ -278,10 +285,10 @@ checkintfield(lua_State *L, int index, const char *k)
 	return r;
 }
 
-static int
+static lua_Number
 checknumberfield(lua_State *L, int index, const char *k)
 {
-	int r;
+	lua_Number r;
 	checkfieldtype(L, index, k, LUA_TNUMBER, "number");
 	r = lua_tonumber(L, -1);
 	lua_pop(L, 1);
@@ -310,11 +317,23 @@ optintfield(lua_State *L, int index, const char *k, int def)
 	return checkintfield(L, index, k);
 }
 
+static lua_Number
+optnumberfield(lua_State *L, int index, const char *k, lua_Number def)
+{
+	int got_type;
+	lua_getfield(L, index, k);
+	got_type = lua_type(L, -1);
+	lua_pop(L, 1);
+	if (got_type == LUA_TNONE || got_type == LUA_TNIL)
+		return def;
+	return checknumberfield(L, index, k);
+}
+
 static const char *
 optstringfield(lua_State *L, int index, const char *k, const char *def)
 {
-	const char *r;
 	int got_type;
+	lua_getfield(L, index, k);
 	got_type = lua_type(L, -1);
 	lua_pop(L, 1);
 	if (got_type == LUA_TNONE || got_type == LUA_TNIL)
@@ -400,4 +419,49 @@ static const char *utf8_decode (const char *o, int *val) {
   return (const char *)s + 1;  /* +1 to include first byte */
 }
 
+/*
+** Encode one code point as UTF-8 into buf, which must have room for 4
+** bytes; returns the number of bytes written.
+*/
+static int utf8_encode (char *buf, unsigned int c) {
+  if (c < 0x80) {
+    buf[0] = c;
+    return 1;
+  }
+  if (c < 0x800) {
+    buf[0] = 0xC0 | (c >> 6);
+    buf[1] = 0x80 | (c & 0x3F);
+    return 2;
+  }
+  if (c < 0x10000) {
+    buf[0] = 0xE0 | (c >> 12);
+    buf[1] = 0x80 | ((c >> 6) & 0x3F);
+    buf[2] = 0x80 | (c & 0x3F);
+    return 3;
+  }
+  buf[0] = 0xF0 | (c >> 18);
+  buf[1] = 0x80 | ((c >> 12) & 0x3F);
+  buf[2] = 0x80 | ((c >> 6) & 0x3F);
+  buf[3] = 0x80 | (c & 0x3F);
+  return 4;
+}
+
+/*
+** Store a single code point and its rendition in a cchar_t.  A positive
+** pair overrides any color bits in attrs; pair numbers above 255 only
+** fit in the extended color field.
+*/
+static void
+setcchar_(cchar_t *cc, int ch, attr_t attrs, int pair)
+{
+	if (pair > 0)
+		attrs = (attrs & ~A_COLOR) | COLOR_PAIR(pair > 255 ? 255 : pair);
+	cc->attr = attrs;
+	cc->chars[0] = ch;
+	cc->chars[1] = L'\0';
+#if NCURSES_EXT_COLORS
+	cc->ext_color = pair > 0 ? pair : 0;
+#endif
+}
+
 #endif /*LCURSES__HELPERS_C*/
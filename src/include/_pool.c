@@ -0,0 +1,150 @@
+/*
+ * A minimal fork/join thread pool for lcurses.
+ *
+ * pool_run hands out the indices 0..n-1 of a job to the worker threads
+ * and to the calling thread, and returns once every index was done.
+ * Jobs never call back into Lua, so the Lua state stays single threaded.
+ */
+
+#ifndef LCURSES__POOL_C
+#define LCURSES__POOL_C 1
+
+#include <pthread.h>
+
+#include "_helpers.c"
+
+
+#define LC_POOL_MAXTHREADS	64
+
+typedef void (*lc_pooljob)(void *ctx, int i);
+
+typedef struct lc_pool {
+	pthread_mutex_t mu;
+	pthread_cond_t work, done;
+	pthread_t threads[LC_POOL_MAXTHREADS];
+	int nthreads;
+	/* the current job */
+	lc_pooljob job;
+	void *ctx;
+	int next, n, running;
+	unsigned int gen;
+	int quit;
+} lc_pool;
+
+
+/* number of processors online, at least 1 */
+static int
+pool_ncpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return n > LC_POOL_MAXTHREADS ? LC_POOL_MAXTHREADS : (int) n;
+#endif
+	return 1;
+}
+
+/* take indices of the current job until none are left; mu is held */
+static void
+pool_drain(lc_pool *p)
+{
+	while (p->next < p->n)
+	{
+		int i = p->next++;
+		p->running++;
+		pthread_mutex_unlock(&p->mu);
+		p->job(p->ctx, i);
+		pthread_mutex_lock(&p->mu);
+		if (--p->running == 0 && p->next >= p->n)
+			pthread_cond_broadcast(&p->done);
+	}
+}
+
+static void *
+pool_worker(void *arg)
+{
+	lc_pool *p = arg;
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&p->mu);
+	for (;;)
+	{
+		while (!p->quit && p->gen == seen)
+			pthread_cond_wait(&p->work, &p->mu);
+		if (p->quit)
+			break;
+		seen = p->gen;
+		pool_drain(p);
+	}
+	pthread_mutex_unlock(&p->mu);
+	return NULL;
+}
+
+/*
+** Start nthreads - 1 workers, the caller of pool_run being the last
+** one; returns 0, or -1 if not even the mutexes could be set up.
+*/
+static int
+pool_init(lc_pool *p, int nthreads)
+{
+	int i;
+
+	memset(p, 0, sizeof *p);
+	if (pthread_mutex_init(&p->mu, NULL) != 0)
+		return -1;
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	if (nthreads > LC_POOL_MAXTHREADS)
+		nthreads = LC_POOL_MAXTHREADS;
+	for (i = 0; i < nthreads - 1; i++)
+	{
+		if (pthread_create(&p->threads[i], NULL, pool_worker, p) != 0)
+			break;
+		p->nthreads++;
+	}
+	return 0;
+}
+
+static void
+pool_run(lc_pool *p, lc_pooljob job, void *ctx, int n)
+{
+	if (n <= 0)
+		return;
+	if (p->nthreads == 0 || n == 1)
+	{
+		int i;
+		for (i = 0; i < n; i++)
+			job(ctx, i);
+		return;
+	}
+	pthread_mutex_lock(&p->mu);
+	p->job = job;
+	p->ctx = ctx;
+	p->next = 0;
+	p->n = n;
+	p->gen++;
+	pthread_cond_broadcast(&p->work);
+	pool_drain(p);
+	while (p->running > 0)
+		pthread_cond_wait(&p->done, &p->mu);
+	pthread_mutex_unlock(&p->mu);
+}
+
+static void
+pool_free(lc_pool *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->mu);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->mu);
+	for (i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+	p->nthreads = 0;
+	pthread_cond_destroy(&p->work);
+	pthread_cond_destroy(&p->done);
+	pthread_mutex_destroy(&p->mu);
+}
+
+#endif /*LCURSES__POOL_C*/
@@ -17,6 +17,800 @@ local function printf (fmt, ...)
   return print (string.format (fmt, ...))
 end
 
+
+-- Headless checks, run with `lua test.lua check`.  Those needing a
+-- terminal run curses on a pty from luaposix, and are skipped without it.
+
+local checks = {}
+
+local function check (name, fn)
+  checks[#checks + 1] = { name = name, fn = fn }
+end
+
+local function run_checks ()
+  local failed = 0
+  for _, c in ipairs (checks) do
+    local ok, err = pcall (c.fn)
+    if ok and err == "skip" then
+      printf ("%-36s skipped", c.name)
+    elseif ok then
+      printf ("%-36s ok", c.name)
+    else
+      printf ("%-36s FAILED: %s", c.name, tostring (err))
+      failed = failed + 1
+    end
+  end
+  return failed == 0
+end
+
+
+check ("ansi: bold and dim together", function ()
+  local cs = chstr.from_ansi ("\27[1;2mx\27[22my")
+  local _, a = cs:get (1)
+  assert (a & curses.A_BOLD ~= 0 and a & curses.A_DIM ~= 0)
+  _, a = cs:get (2)
+  assert (a & (curses.A_BOLD | curses.A_DIM) == 0)
+end)
+
+check ("ansi: overlong UTF-8 is replaced", function ()
+  local function shown (s)
+    local vt = curses.vterm.new (2, 10)
+    vt:feed (s)
+    return vt:line (0):match "^(.-) *$"
+  end
+  assert (shown "x\224\129\129y" == "x\u{fffd}\u{fffd}\u{fffd}y")
+  assert (shown "\240\129\129\129" == ("\u{fffd}"):rep (4))
+  assert (shown "\224\160\128\240\144\128\128" == "\u{800}\u{10000}")
+  local cs = chstr.from_ansi "\224\129\129"
+  assert (cs:len () == 3 and cs:get (1) == 0xfffd)
+end)
+
+check ("width: wide, combining, unassigned", function ()
+  assert (curses.width ("this is a test, 中文.") == 21)
+  assert (curses.width ("e\u{301}") == 1)          -- combining acute
+  assert (curses.width ("\u{ff21}\u{1f600}") == 4) -- fullwidth A, emoji
+  assert (curses.width ("\u{378}\u{1fbfa}") == 2)  -- unassigned
+  assert (curses.width ("a\tb\255") == 2)
+end)
+
+check ("truncate: whole characters, ellipsis", function ()
+  assert (curses.truncate ("abc", 5) == "abc")
+  local s, w = curses.truncate ("中文字", 5)
+  assert (s == "中文" and w == 4)
+  s, w = curses.truncate ("中文字", 5, "…")
+  assert (s == "中文…" and w == 5)
+  s, w = curses.truncate ("abcdef", 4, "...")
+  assert (s == "a..." and w == 4)
+  assert (curses.truncate ("abc", 0, "…") == "")
+end)
+
+check ("vterm: /bin/sh on a pty", function ()
+  local vt = assert (curses.vterm.spawn ("printf 'hi\\n'; echo $TERM", 4, 20, "dumb"))
+  repeat until not vt:update ()
+  assert (vt:wait () == 0)
+  assert (vt:line (0):match "^hi *$")
+  assert (vt:line (1):match "^dumb *$")
+  local ok, err = curses.vterm.spawn ({"/nonexistent"}, 4, 20)
+  assert (ok and ok:wait () == 127, err)
+  -- the cursor, below "dumb", stays in sight
+  assert (vt:resize (2, 10))
+  assert (select (2, vt:size ()) == 10 and vt:line (0):match "^dumb *$")
+end)
+
+check ("server: only changed rows are sent", function ()
+  local ok, socket = pcall (require, "posix.sys.socket")
+  if not ok then return "skip" end
+  local unistd, poll = require "posix.unistd", require "posix.poll"
+  local a, b = socket.socketpair (socket.AF_UNIX, socket.SOCK_STREAM, 0)
+  local server = curses.server.new (4, 20)
+  local function frame ()
+    server:present ()
+    local out = {}
+    while poll.rpoll (b, 200) > 0 do
+      out[#out + 1] = unistd.read (b, 65536)
+    end
+    local rows = {}
+    for y in table.concat (out):gmatch "\27%[(%d+)H" do
+      rows[#rows + 1] = tonumber (y)
+    end
+    return table.concat (rows, ",")
+  end
+  local vt = curses.vterm.new (4, 20)
+  server:attach (a, 4, 20, "dumb")
+  vt:feed "one\r\ntwo\r\nthree"
+  server:capture (vt)
+  assert (frame () == "1,2,3,4")
+  vt:feed "\27[3;1Hthird"
+  server:capture (vt)
+  assert (frame () == "3")
+  server:capture (vt)
+  assert (frame () == "")
+  server:close ()
+  unistd.close (a)
+  unistd.close (b)
+end)
+
+check ("queue: handles of live queues only", function ()
+  local q = curses.queue.new ()
+  local h = q:handle ()
+  local p = curses.queue.attach (h)
+  assert (p:push (1, 0, 0, "x") and q:stats () == p:stats ())
+  assert (not pcall (curses.queue.attach, h + 1))
+  assert (not pcall (curses.queue.attach, 0))
+  q:close ()
+  assert (curses.queue.attach (h)):close ()
+  p:close ()
+  assert (not pcall (curses.queue.attach, h))
+end)
+
+-- a pseudo-terminal pair from luaposix, or nil
+local function openpty ()
+  local ok, stdlib = pcall (require, "posix.stdlib")
+  if not ok then return nil end
+  local fcntl = require "posix.fcntl"
+  local master = stdlib.openpt (fcntl.O_RDWR | fcntl.O_NOCTTY)
+  assert (stdlib.grantpt (master) and stdlib.unlockpt (master))
+  return master, fcntl.open (stdlib.ptsname (master), fcntl.O_RDWR | fcntl.O_NOCTTY)
+end
+
+check ("record: a screen which is not threaded", function ()
+  local master, slave = openpty ()
+  if not master then return "skip" end
+  local unistd = require "posix.unistd"
+  local path = os.tmpname ()
+  local sc = assert (curses.newterm ("xterm", slave, slave))
+  local rec = assert (curses.record.start (path, sc))
+  local win = sc:stdscr ()
+  win:mvaddstr (0, 0, "tapped")
+  win:noutrefresh ()
+  sc:present ()
+  assert (rec:stop () > 0)
+  win:mvaddstr (1, 0, "not recorded")
+  win:noutrefresh ()
+  sc:present ()
+  local vt = assert (curses.record.replay (path, { speed = 0 }))
+  assert (vt:line (0):match "^tapped" and vt:line (1):match "^ *$")
+  -- closing the screen stops the recording
+  rec = assert (curses.record.start (path, sc))
+  sc:close ()
+  assert (rec:stop ())
+  unistd.close (slave)
+  unistd.close (master)
+  os.remove (path)
+end)
+
+check ("record: replay escapes", function ()
+  local path = os.tmpname ()
+  local function replay (event)
+    local f = assert (io.open (path, "w"))
+    f:write ('{"version": 2, "width": 10, "height": 2}\n', event, "\n")
+    f:close ()
+    local vt = curses.vterm.new (2, 10)
+    local ok, err = curses.record.replay (path, { speed = 0, vterm = vt })
+    return ok and vt:line (0), err
+  end
+  assert (replay '[0.5, "o", "a\\u00e9\\ud83d\\ude00"]':match "^a\u{e9}\u{1f600}")
+  -- bytes which are not UTF-8 come back as they were, one U+FFFD each
+  assert (replay '[0.5, "o", "b\\udcff\\udc80c"]':match "^b\u{fffd}\u{fffd}c")
+  assert (not replay '[0.5, "o", "\\u12"]')
+  assert (not replay '[0.5, "o", "\\u12')
+  local ok, err = pcall (curses.record.replay, path, { speed = "fast" })
+  assert (not ok and err:match "speed")
+  os.remove (path)
+end)
+
+check ("frame: persist and restore stdscr", function ()
+  local master, slave = openpty ()
+  if not master then return "skip" end
+  local unistd = require "posix.unistd"
+  local path = os.tmpname ()
+  local sc = assert (curses.newterm ("xterm", slave, slave))
+  local win = sc:stdscr ()
+  win:mvaddstr (2, 3, "saved frame")
+  assert (curses.persist_frame (path))
+  win:erase ()
+  win:move (0, 0)
+  assert (curses.restore_frame (path))
+  assert (win:mvwinnstr (2, 0, 14) == "   saved frame")
+  assert (win:getyx () == 2)
+  sc:close ()
+  -- another terminal type
+  sc = assert (curses.newterm ("vt100", slave, slave))
+  assert (not curses.restore_frame (path))
+  sc:close ()
+  unistd.close (slave)
+  unistd.close (master)
+  os.remove (path)
+end)
+
+check ("window: one object per window", function ()
+  local master, slave = openpty ()
+  if not master then return "skip" end
+  local unistd = require "posix.unistd"
+  local sc = assert (curses.newterm ("xterm", slave, slave))
+  assert (curses.stdscr () == sc:stdscr ())
+  local w = curses.newwin (4, 10, 1, 1)
+  local sub = w:sub (2, 5, 2, 2)
+  assert (sub:parent () == w and w:parent () == nil)
+  local derived = w:derive (1, 1, 0, 0)
+  assert (derived:parent () == w)
+  sc:close ()
+  -- every window of a closed screen is closed with it
+  for _, x in ipairs { w, sub, derived } do
+    assert (tostring (x) == "curses window (closed)")
+    assert (not pcall (x.getmaxyx, x))
+  end
+  w:close ()
+  unistd.close (slave)
+  unistd.close (master)
+end)
+
+check ("newterm: screens and set_term", function ()
+  local m1, s1 = openpty ()
+  if not m1 then return "skip" end
+  local m2, s2 = openpty ()
+  local unistd = require "posix.unistd"
+  local a = assert (curses.newterm ("xterm", s1, s1))
+  assert (curses.stdscr () == a:stdscr ())
+  local b = assert (curses.newterm ("vt100", s2, s2))
+  assert (curses.stdscr () == b:stdscr () and a:stdscr () ~= b:stdscr ())
+  assert (a:use (function (w, x) return w == curses.stdscr () and x end, 1) == 1)
+  assert (curses.stdscr () == b:stdscr ())
+  local ok, err = pcall (a.use, a, function () error "boom" end)
+  assert (not ok and err:match "boom" and curses.stdscr () == b:stdscr ())
+  a:set_term ()
+  assert (curses.stdscr () == a:stdscr ())
+  a:close ()
+  b:close ()
+  assert (tostring (a) == "curses screen (closed)")
+  assert (not pcall (a.stdscr, a))
+  for _, fd in ipairs { s1, m1, s2, m2 } do unistd.close (fd) end
+end)
+
+-- run fn with a screen on a pty as the current one, or skip; fn gets
+-- the screen, and a function returning a vterm showing its output
+local function with_screen (fn)
+  local master, slave = openpty ()
+  if not master then return "skip" end
+  local unistd, poll = require "posix.unistd", require "posix.poll"
+  local sc = assert (curses.newterm ("xterm", slave, slave))
+  local vt = curses.vterm.new (curses.lines (), curses.cols ())
+  local function terminal ()
+    while poll.rpoll (master, 0) > 0 do
+      vt:feed (assert (unistd.read (master, 65536)))
+    end
+    return vt
+  end
+  local ok, err = pcall (fn, sc, terminal)
+  sc:close ()
+  unistd.close (slave)
+  unistd.close (master)
+  assert (ok, err)
+end
+
+check ("workers: panes rendered on threads", function ()
+  return with_screen (function ()
+    local w = curses.workers.new (2)
+    local chunk = [[
+      return function (c, label)
+        if label == "bad" then error "boom" end
+        c:clear ()
+        c:mvaddstr (0, 0, label .. " 中文")
+      end
+    ]]
+    local panes, wins, jobs = {}, {}, {}
+    for i = 1, 4 do
+      panes[i] = w:pane (2, 12, chunk, "=p" .. i)
+      wins[i] = curses.newwin (2, 12, i * 2, 0)
+      jobs[i] = { panes[i], wins[i], "pane" .. i }
+    end
+    assert (w:render (jobs))
+    for i = 1, 4 do
+      assert (wins[i]:mvwinnstr (0, 0, 12) == "pane" .. i .. " 中文")
+    end
+    local ok, errs = w:render { { panes[1], wins[1], "bad" }, jobs[2] }
+    assert (not ok and errs[1]:match "boom" and not errs[2])
+    assert (not pcall (w.render, w, { { panes[1], wins[1], print } }))
+    w:close ()
+  end)
+end)
+
+check ("vpad: rows asked for lazily", function ()
+  return with_screen (function (_, terminal)
+    local asked = 0
+    local vp = curses.vpad.new (1000000, 40, function (y)
+      asked = asked + 1
+      return ("row %d"):format (y)
+    end)
+    assert (vp:prefresh (500000, 0, 0, 0, 9, 39))
+    local vt = terminal ()
+    assert (vt:line (0):match "^row 500000 *$" and vt:line (9):match "^row 500009 *$")
+    assert (asked < 1000 and select (3, vp:stats ()) == asked)
+    local before = asked
+    assert (vp:prefresh (500001, 0, 0, 0, 9, 39))
+    assert (asked == before and terminal ():line (0):match "^row 500001 *$")
+    -- past the end, the rectangle is cleared
+    assert (vp:prefresh (999995, 0, 0, 0, 9, 39))
+    vt = terminal ()
+    assert (vt:line (4):match "^row 999999 *$" and vt:line (5):match "^ *$")
+    vp:close ()
+  end)
+end)
+
+check ("fileview: index, lines, render", function ()
+  return with_screen (function (_, terminal)
+    local path = os.tmpname ()
+    local f = assert (io.open (path, "w"))
+    for i = 0, 9999 do f:write ("line ", i, "\n") end
+    f:write ("tab\tctl\1 中文")
+    f:close ()
+    local fv = assert (curses.fileview.open (path))
+    assert (fv:wait ())
+    assert (fv:lines () == 10001 and fv:size () == 98905)
+    assert (fv:line (0) == "line 0" and fv:line (9999) == "line 9999")
+    assert (fv:line (10000) == "tab\tctl\1 中文" and fv:line (10001) == nil)
+    assert (fv:offset (1) == 7)
+    local win = curses.stdscr ()
+    assert (fv:render (win, 9999) == 2)
+    win:refresh ()
+    local vt = terminal ()
+    assert (vt:line (0):match "^line 9999 *$")
+    assert (vt:line (1):match "^tab     ctl%^A 中文 *$")
+    assert (vt:line (2):match "^ *$")
+    fv:close ()
+    assert (not pcall (fv.lines, fv))
+    os.remove (path)
+    assert (not curses.fileview.open (path))
+  end)
+end)
+
+check ("fileview: truncated while following", function ()
+  return with_screen (function (_, terminal)
+    local path = os.tmpname ()
+    local function rewrite (line, n)
+      local f = assert (io.open (path, "w"))
+      f:write ((line .. "\n"):rep (n))
+      f:close ()
+    end
+    local fv
+    -- until the follow thread has seen n lines
+    local function settle (n)
+      for _ = 1, 250 do
+        if fv:wait () and fv:lines () == n then return true end
+        curses.napms (20)
+      end
+    end
+    rewrite (("a"):rep (99), 1000)
+    fv = assert (curses.fileview.open (path))
+    fv:follow (true)
+    assert (settle (1000))
+    -- rotated: lines past the new end are never read
+    rewrite ("short", 1)
+    local win = curses.stdscr ()
+    assert (fv:render (win, 900) == 0 and fv:line (900) == nil)
+    assert (settle (1) and fv:line (0) == "short")
+    fv:render (win, 0)
+    win:refresh ()
+    assert (terminal ():line (0):match "^short *$")
+    -- truncated and written past the old size between two polls
+    rewrite (("a"):rep (99), 1000)
+    assert (settle (1000))
+    rewrite (("b"):rep (29), 5000)
+    assert (fv:line (0) ~= ("a"):rep (99))
+    assert (settle (5000) and fv:line (4999) == ("b"):rep (29))
+    fv:close ()
+    os.remove (path)
+  end)
+end)
+
+check ("logview: ring, scrolling, pinning", function ()
+  return with_screen (function (_, terminal)
+    local win = curses.newwin (4, 20, 2, 0)
+    local log = curses.logview (win, 6)
+    assert (log:append "one\ntwo\n" == 2)
+    win:refresh ()
+    local vt = terminal ()
+    assert (vt:line (2):match "^one *$" and vt:line (3):match "^two *$")
+    for i = 3, 8 do log:append ("line " .. i) end
+    assert (log:lines () == 6 and log:line (1) == "line 3" and log:line (-1) == "line 8")
+    win:refresh ()
+    vt = terminal ()
+    assert (vt:line (2):match "^line 5" and vt:line (5):match "^line 8")
+    -- scrolled back, new lines only move the view off evicted lines
+    assert (log:scroll (2) == 2)
+    win:refresh ()
+    assert (terminal ():line (2):match "^line 3")
+    log:append "line 9"
+    assert (log:offset () == 2)
+    win:refresh ()
+    vt = terminal ()
+    assert (vt:line (2):match "^line 4" and vt:line (5):match "^line 7")
+    assert (log:scroll (100) == 2)
+    log:bottom ()
+    log:append "line 10"
+    assert (log:offset () == 0)
+    win:refresh ()
+    assert (terminal ():line (5):match "^line 10")
+    log:clear ()
+    assert (log:lines () == 0 and log:line (1) == nil)
+    log:close ()
+    assert (not pcall (log.append, log, "x"))
+  end)
+end)
+
+check ("listview: only visible rows are fetched", function ()
+  return with_screen (function (_, terminal)
+    local win = curses.newwin (5, 20, 0, 0)
+    local lv = curses.listview (win, 1000000, function (i) return "item " .. i end)
+    assert (lv:selected () == 1 and lv:fetched () == 5)
+    win:refresh ()
+    assert (terminal ():line (4):match "^item 5 *$")
+    -- the view follows the selection, fetching only the new rows
+    assert (lv:move (5) == 6 and lv:top () == 2 and lv:fetched () == 6)
+    assert (lv:select (500000) == 500000 and lv:fetched () < 20)
+    win:refresh ()
+    local vt = terminal ()
+    local found
+    for y = 0, 4 do found = found or vt:line (y):match "^item 500000 *$" end
+    assert (found)
+    assert (lv:select (2000000) == 1000000 and lv:move (-2000000) == 1)
+    lv:set_count (0)
+    assert (lv:selected () == nil and lv:move (1) == nil)
+    lv:close ()
+  end)
+end)
+
+check ("chstr: columns of wide characters", function ()
+  local cs = chstr "hi,世界"
+  local got = {}
+  for col = 0, 7 do
+    local i, start = cs:col_to_index (col)
+    got[#got + 1] = tostring (i) .. ":" .. tostring (start)
+  end
+  assert (table.concat (got, " ") == "1:0 2:1 3:2 4:3 4:3 5:5 5:5 nil:nil")
+  for i, col in ipairs {0, 1, 2, 3, 5, 7} do assert (cs:index_to_col (i) == col) end
+  assert (cs:width () == 7)
+  -- the index follows changes to the chstr
+  cs:set_str (1, "中")
+  assert (cs:width () == 8 and cs:index_to_col (6) == 8)
+end)
+
+check ("chstr: addchstr_cols pans by column", function ()
+  return with_screen (function (_, terminal)
+    local big = chstr (("ab中文c"):rep (20000))
+    local w = curses.stdscr ()
+    local function show (col, ncols)
+      w:move (0, 0)
+      w:clrtoeol ()
+      w:move (0, 0)
+      assert (w:addchstr_cols (big, col, ncols))
+      w:refresh ()
+      return terminal ():line (0):match "^(.-) *$"
+    end
+    assert (show (0, 10) == "ab中文cab")
+    -- half a wide character at either edge is a space
+    assert (show (3, 4) == " 文c")
+    assert (show (1, 4) == "b中")
+    assert (show (7 * 10000 + 1, 9) == "b中文cab")
+    -- the window clips ncols
+    w:move (1, 76)
+    assert (w:addchstr_cols (big, 0))
+    w:refresh ()
+    assert (terminal ():line (1):match "ab中 *$")
+  end)
+end)
+
+local function wrapped (text, width, opts)
+  local doc = curses.layout.wrap (text, width, opts)
+  local t = {}
+  for i = 1, doc:lines () do t[i] = text:sub (doc:line (i)) end
+  return table.concat (t, "|")
+end
+
+check ("layout: greedy and balanced wrap", function ()
+  assert (wrapped ("the quick brown fox jumps over the lazy dog", 10)
+          == "the quick|brown fox|jumps over|the lazy|dog")
+  assert (wrapped ("supercalifragilistic word", 8) == "supercal|ifragili|stic|word")
+  assert (wrapped ("中文中文中文 abc中文", 5) == "中文|中文|中文|abc中|文")
+  assert (wrapped ("", 5) == "")
+  assert (wrapped ("aaa bb cc ddddd", 6) == "aaa bb|cc|ddddd")
+  assert (wrapped ("aaa bb cc ddddd", 6, {mode = "balanced"}) == "aaa|bb cc|ddddd")
+  assert (not pcall (curses.layout.wrap, "x", 1, {mode = "nope"}))
+end)
+
+check ("layout: draw into a window", function ()
+  return with_screen (function (_, terminal)
+    local w = curses.stdscr ():derive (5, 20, 2, 10)
+    local doc = curses.layout.wrap ("one two three four five six seven eight nine ten", 20)
+    doc:draw (w, 1)
+    w:refresh ()
+    local vt = terminal ()
+    assert (vt:line (2):match "^ +one two three four *$")
+    assert (vt:line (4):match "^ +nine ten *$")
+    -- drawn as wrapped: combining marks, tabs and controls
+    doc = curses.layout.wrap ("cafe\u{301} x\n\ta\1\na\tb c d", 12)
+    assert (doc:lines () == 4)
+    assert (doc:draw (w, 1) == 4)
+    w:refresh ()
+    vt = terminal ()
+    assert (vt:line (2):match "^ +cafe\u{301} x *$")
+    assert (vt:line (3):match "^ +        a%^A *$")
+    assert (vt:line (4):match "^ +a       b c *$")
+    assert (vt:line (5):match "^ +d *$")
+  end)
+end)
+
+check ("layout: the cache is bounded by text size", function ()
+  local text = "cached text"
+  assert (curses.layout.wrap (text, 4) == curses.layout.wrap (text, 4))
+  -- a text over the limit is not kept once the caller drops it
+  local weak = setmetatable ({}, {__mode = "v"})
+  weak[1] = curses.layout.wrap (("word "):rep (14 << 20), 80)
+  assert (weak[1]:lines () > 0)
+  collectgarbage ()
+  collectgarbage ()
+  assert (weak[1] == nil)
+end)
+
+check ("layout: threaded layout equals serial", function ()
+  -- a few parts of a megabyte each, with ragged paragraphs
+  local words, seed = {}, 7
+  for i = 1, 400000 do
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    words[i] = ("abcdefgh中"):sub (1, 1 + seed % 11)
+      .. (seed % 53 == 0 and "\n" or seed % 97 == 0 and "\n\n" or " ")
+  end
+  local big = table.concat (words)
+  local function offsets (doc)
+    local starts, ends = doc:offsets ()
+    return table.concat (starts, ",") .. "|" .. table.concat (ends, ",")
+  end
+  local function forget ()
+    for i = 1, 20 do curses.layout.wrap ("forget " .. i, 1) end
+  end
+  return with_screen (function ()
+    for _, mode in ipairs {"greedy", "balanced"} do
+      for _, width in ipairs {7, 40} do
+        forget ()
+        local doc = curses.layout.wrap (big, width, {mode = mode, threads = 4, at = #big // 2})
+        -- the part holding at can be shown as soon as wrap returns
+        local top, n = doc:view (curses.newwin (5, width, 0, 0), #big // 2)
+        assert (top <= #big // 2 and n == 5)
+        local threaded = offsets (doc)
+        assert (doc:ready ())
+        forget ()
+        assert (offsets (curses.layout.wrap (big, width, {mode = mode, threads = 1})) == threaded)
+      end
+    end
+  end)
+end)
+
+check ("panel: stacking order", function ()
+  return with_screen (function (_, terminal)
+    local P = curses.panel
+    local base = curses.newwin (10, 40, 0, 0)
+    for y = 0, 9 do base:mvaddstr (y, 0, ("b"):rep (40)) end
+    local pop = curses.newwin (3, 10, 2, 5)
+    pop:mvaddstr (1, 1, "POPUP")
+    local pa, pb = P (base), P (pop)
+    local function row (y)
+      P.update ()
+      curses.doupdate ()
+      return terminal ():line (y):sub (1, 20)
+    end
+    assert (row (3) == "bbbbb POPUP    bbbbb")
+    assert (pb:below () == pa and pa:above () == pb and pb:above () == nil)
+    assert (pb:window () == pop)
+    pb:move (5, 10)
+    assert (row (3) == ("b"):rep (20) and row (6) == "bbbbbbbbbb POPUP    ")
+    pb:hide ()
+    assert (pb:hidden () and row (6) == ("b"):rep (20))
+    pb:show ()
+    pa:top ()
+    assert (row (6) == ("b"):rep (20))
+    pa:bottom ()
+    assert (row (6) == "bbbbbbbbbb POPUP    ")
+    -- a closed panel is taken out of the stack, and raises on use
+    pb:close ()
+    assert (pa:above () == nil)
+    assert (row (6) == ("b"):rep (20))
+    assert (not pcall (pb.top, pb))
+    pa:close ()
+  end)
+end)
+
+check ("compositor: damage and stacking", function ()
+  return with_screen (function (_, terminal)
+    local base = curses.stdscr ()
+    for y = 0, 9 do base:mvaddstr (y, 0, string.char (97 + y):rep (30)) end
+    local comp = curses.compositor ()
+    comp:add (base, 0)
+    local pop = curses.newwin (2, 10, 3, 5)
+    pop:mvaddstr (0, 0, "POPUP")
+    comp:add (pop)
+    local function row (y) return terminal ():line (y):sub (1, 20) end
+    assert (comp:present () == 2)
+    assert (row (3) == "dddddPOPUP     ddddd" and row (4) == "eeeee          eeeee")
+    -- what a move uncovers is drawn again by the window below
+    comp:move (pop, 4, 8)
+    comp:present ()
+    assert (row (3) == ("d"):rep (20) and row (4) == "eeeeeeeePOPUP     ee")
+    -- a change under a window does not show through it
+    base:mvaddstr (4, 0, ("Z"):rep (30))
+    comp:present ()
+    assert (row (4) == "ZZZZZZZZPOPUP     ZZ")
+    comp:hide (pop)
+    assert (comp:present () == 1 and row (4) == ("Z"):rep (20))
+    comp:hide (pop, false)
+    comp:present ()
+    assert (row (4) == "ZZZZZZZZPOPUP     ZZ")
+    -- closed windows are dropped, and what they covered is redrawn
+    pop:close ()
+    assert (comp:present () == 1 and comp:windows () == 1)
+    assert (row (4) == ("Z"):rep (20))
+    comp:close ()
+  end)
+end)
+
+check ("window: touched lines and mask", function ()
+  return with_screen (function ()
+    local w = curses.newwin (20, 40, 0, 0)
+    w:noutrefresh ()
+    local t, n = w:touched_lines ()
+    assert (n == 0 and #t == 0 and w:touched_mask () == "\0\0\0")
+    w:mvaddstr (2, 5, "abc")
+    w:mvaddstr (3, 1, "de")
+    w:mvaddstr (10, 7, "f")
+    t, n = w:touched_lines (t)
+    assert (n == 2 and table.concat (t, ",") == "2,2,1,7,10,1,7,7")
+    assert (w:touched_mask () == "\12\4\0")
+    -- a reused table loses what is left of the earlier runs
+    w:noutrefresh ()
+    w:mvaddstr (19, 0, "g")
+    t, n = w:touched_lines (t)
+    assert (n == 1 and table.concat (t, ",") == "19,1,0,0")
+    assert (w:touched_mask () == "\0\0\8")
+    w:close ()
+  end)
+end)
+
+check ("mirror: decoder follows the encoder", function ()
+  local ok, socket = pcall (require, "posix.sys.socket")
+  if not ok then return "skip" end
+  local unistd, poll = require "posix.unistd", require "posix.poll"
+  return with_screen (function (_, terminal)
+    local a, b = socket.socketpair (socket.AF_UNIX, socket.SOCK_STREAM, 0)
+    local s = curses.stdscr ()
+    local m = curses.mirror.start (a)
+    local d = curses.mirror.decoder ()
+    local function received ()
+      local out = {}
+      while poll.rpoll (b, 0) > 0 do out[#out + 1] = unistd.read (b, 65536) end
+      return table.concat (out)
+    end
+    d:feed (received ())
+    assert (select (2, d:size ()) == 80)
+    for y = 0, 23 do s:mvaddstr (y, 0, ("row %02d "):format (y) .. ("x"):rep (60)) end
+    s:attron (curses.A_BOLD)
+    s:mvaddstr (3, 10, "BOLD中文e\u{301}")
+    s:attroff (curses.A_BOLD)
+    s:refresh ()
+    d:feed (received ())
+    local vt = terminal ()
+    for y = 0, 23 do assert (d:line (y) == vt:line (y):match "^(.-) *$", y) end
+    local ch, attrs = d:cell (3, 10)
+    assert (ch == "B" and attrs & curses.A_BOLD ~= 0)
+    assert (d:cell (3, 15) == "" and d:cell (3, 18) == "e\u{301}")
+    assert (select (2, d:cell (3, 19)) & curses.A_BOLD == 0)
+    -- a small change is a small frame, and may arrive a byte at a time
+    s:mvaddstr (11, 0, "partial")
+    s:refresh ()
+    local frame = received ()
+    assert (#frame < 100)
+    for i = 1, #frame do d:feed (frame:sub (i, i)) end
+    assert (d:line (11) == "partial" .. ("x"):rep (60))
+    assert (d:cursor () == 11)
+    m:stop ()
+    unistd.close (a)
+    unistd.close (b)
+  end)
+end)
+
+check ("window: snapshot and restore", function ()
+  return with_screen (function (_, terminal)
+    local w = curses.stdscr ()
+    for y = 0, 23 do w:mvaddstr (y, 0, ("row %02d 中文 "):format (y) .. ("x"):rep (60)) end
+    w:move (3, 4)
+    w:refresh ()
+    local before = {}
+    local vt = terminal ()
+    for y = 0, 23 do before[y] = vt:line (y) end
+    local snap = w:snapshot ()
+    for y = 5, 10 do w:mvaddstr (y, 20, ("#"):rep (30)) end
+    w:mvaddstr (12, 7, "Z")
+    w:refresh ()
+    assert (w:restore (snap))
+    -- only the changed lines are touched again, a column wider each side
+    local t, n = w:touched_lines ()
+    assert (n == 2 and table.concat (t, ",") == "5,6,19,50,12,1,6,8")
+    local y, x = w:getyx ()
+    assert (y == 3 and x == 4)
+    w:refresh ()
+    vt = terminal ()
+    for y = 0, 23 do assert (vt:line (y) == before[y], y) end
+    -- a window of another size
+    local small = curses.newwin (5, 10, 0, 0)
+    assert (small:restore (snap) == false)
+    assert (not pcall (w.restore, w, {}))
+    small:close ()
+  end)
+end)
+
+check ("constants: fixed ones once, ACS_ of the current screen", function ()
+  local master, slave = openpty ()
+  if not master then return "skip" end
+  local unistd = require "posix.unistd"
+  local key, bold = curses.KEY_F1, curses.A_BOLD
+  assert (key and bold and curses.ACS_NOPE == nil and curses[1] == nil)
+  -- screens come and go without touching the fixed constants
+  for _ = 1, 50 do assert (curses.newterm ("xterm", slave, slave)):close () end
+  assert (curses.KEY_F1 == key and curses.A_BOLD == bold)
+  assert (curses.ACS_HLINE == nil)
+  local sc = assert (curses.newterm ("xterm", slave, slave))
+  assert (curses.ACS_HLINE == curses.A_ALTCHARSET | ("q"):byte ())
+  assert (curses.ACS_ULCORNER == curses.A_ALTCHARSET | ("l"):byte ())
+  assert (curses.ACS_NOPE == nil)
+  sc:close ()
+  assert (curses.ACS_HLINE == nil)
+  unistd.close (slave)
+  unistd.close (master)
+end)
+
+check ("window: geometry in one call", function ()
+  return with_screen (function ()
+    local w = curses.newwin (10, 30, 2, 4)
+    w:move (3, 7)
+    assert (table.concat ({w:geometry ()}, ",") == "3,7,2,4,10,30,-1,-1")
+    local sub = w:sub (4, 8, 5, 10)
+    sub:move (1, 2)
+    assert (table.concat ({sub:geometry ()}, ",") == "1,2,5,10,4,8,3,6")
+    local py, px = select (7, sub:geometry ())
+    assert (py == sub:getparyx () and px == select (2, sub:getparyx ()))
+    sub:close ()
+    w:close ()
+  end)
+end)
+
+check ("screen: ready_fd wakes deferred frame", function ()
+  local master, slave = openpty ()
+  if not master then return "skip" end
+  local unistd, poll = require "posix.unistd", require "posix.poll"
+  local sc = assert (curses.newterm ("xterm", slave, slave, true))
+  local win = sc:stdscr ()
+  -- nobody reads the master, so the writer thread falls behind
+  local deferred = false
+  for f = 1, 2000 do
+    for y = 0, curses.lines () - 1 do
+      win:mvaddstr (y, 0, string.rep (string.char (65 + (f + y) % 26), 20))
+    end
+    win:noutrefresh ()
+    if not sc:present () then deferred = true break end
+  end
+  assert (deferred and select (2, sc:backlog ()))
+  local ready = sc:ready_fd ()
+  assert (poll.rpoll (ready, 0) == 0)
+  for _ = 1, 100 do
+    while poll.rpoll (master, 20) > 0 do unistd.read (master, 65536) end
+    if poll.rpoll (ready, 0) > 0 then break end
+  end
+  assert (poll.rpoll (ready, 0) > 0)
+  assert (sc:present ())
+  assert (poll.rpoll (ready, 0) == 0 and not select (2, sc:backlog ()))
+  sc:close ()
+  unistd.close (slave)
+  unistd.close (master)
+end)
+
 local msg = {
   'hello, world',
   'this is a test, 中文.',
@@ -72,7 +866,9 @@ local function main ()
   curses.endwin ()
 end
 
-if not arg[1] then
+if arg[1] == "check" then
+  os.exit (run_checks () and 0 or 1)
+elseif not arg[1] then
   xpcall(main, function (err)
     if not curses.isendwin() then
       curses.endwin ()